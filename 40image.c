@@ -16,43 +16,254 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <math.h>
 #include "compress40.h"
 #include "compress.h"
 #include "decompress.h"
+#include "serve40.h"
+#include "stats40.h"
+
+#define DEFAULT_WORKERS 4
+#define DEFAULT_TILE_SIZE 256
+#define PYRAMID_LEVELS 2
+
+/*
+ * How 40image -c should write its output when asked for more than plain
+ * compress40 does: the tile size (0 for the flat format), the tile coding,
+ * the block size, the codeword profile, the colour space, the file name
+ * prefix of the smaller pyramid levels (NULL for none), whether to print
+ * quantization stats as JSON on stderr, and whether to only estimate the
+ * result instead of compressing
+ */
+struct compress_options {
+        unsigned tile_size;
+        unsigned coding;
+        unsigned block_size;
+        unsigned profile;
+        unsigned color;
+        const char *pyramid;
+        bool quant_stats;
+        bool estimate;
+};
+typedef struct compress_options compress_options;
 
 static void (*compress_or_decompress)(FILE *input) = compress40;
+/* what each stage cost, with --stats (NULL without) */
+static Codec40_run_stats *run_stats = NULL;
+static void compress40_options(FILE *fp, const compress_options *options);
+static void estimate40_options(FILE *fp, const compress_options *options);
+static void write_compressed(UArray2_T comp_avg_int_array, FILE *output,
+                                        const compress_options *options);
+static void require_whole_blocks(Pnm_ppm original, unsigned block_size);
 
 int main(int argc, char *argv[])
 {
         int i;
+        const char *socket_path = NULL;
+        unsigned workers = DEFAULT_WORKERS;
+        unsigned cache_size = 0;
+        bool region = false;
+        unsigned region_x = 0, region_y = 0, region_w = 0, region_h = 0;
+        unsigned preview_scale = 0;
+        const char *compare_path = NULL;
+        bool stats = false;
+        compress_options options = {
+                .tile_size = 0, .coding = COMP40_CODING_RAW,
+                .block_size = COMP40_DEFAULT_BLOCK_SIZE,
+                .profile = PROFILE40_STANDARD,
+                .color = COMP40_COLOR_YPBPR, .pyramid = NULL,
+                .quant_stats = false, .estimate = false
+        };
 
         for (i = 1; i < argc; i++) {
                 if (strcmp(argv[i], "-c") == 0) {
                         compress_or_decompress = compress40;
                 } else if (strcmp(argv[i], "-d") == 0) {
                         compress_or_decompress = decompress40;
+                } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+                        socket_path = argv[++i];
+                } else if (strcmp(argv[i], "--workers") == 0 &&
+                                                        i + 1 < argc) {
+                        workers = strtoul(argv[++i], NULL, 10);
+                } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+                        cache_size = strtoul(argv[++i], NULL, 10);
+                } else if (strcmp(argv[i], "--tile") == 0 && i + 1 < argc) {
+                        /* checked before narrowing, so 2^32 + 2 isn't 2 */
+                        char *end;
+                        unsigned long tile = strtoul(argv[++i], &end, 10);
+                        if (*end != '\0' || tile == 0 || tile % 2 != 0 ||
+                                        tile > COMP40_MAX_TILE_SIZE) {
+                                fprintf(stderr, "%s: --tile must be a positive "
+                                        "even number of pixels, at most "
+                                        "%d\n", argv[0], COMP40_MAX_TILE_SIZE);
+                                exit(1);
+                        }
+                        options.tile_size = tile;
+                } else if (strcmp(argv[i], "--entropy") == 0) {
+                        options.coding = COMP40_CODING_RANS;
+                } else if (strcmp(argv[i], "--predict") == 0) {
+                        options.coding = COMP40_CODING_RANS_MED;
+                } else if (strcmp(argv[i], "--rle") == 0) {
+                        options.coding = COMP40_CODING_RLE;
+                } else if (strcmp(argv[i], "--block") == 0 && i + 1 < argc) {
+                        options.block_size = strtoul(argv[++i], NULL, 10);
+                        if (!comp40_valid_block_size(options.block_size)) {
+                                fprintf(stderr, "%s: --block takes 2, 4 or "
+                                                        "8\n", argv[0]);
+                                exit(1);
+                        }
+                } else if (strcmp(argv[i], "--profile") == 0 &&
+                                                        i + 1 < argc) {
+                        options.profile = strtoul(argv[++i], NULL, 10);
+                        if (profile40_get(options.profile) == NULL) {
+                                fprintf(stderr, "%s: --profile takes 0 "
+                                        "(standard) or 1 (fine)\n", argv[0]);
+                                exit(1);
+                        }
+                } else if (strcmp(argv[i], "--ycocg") == 0) {
+                        options.color = COMP40_COLOR_YCOCG;
+                } else if (strcmp(argv[i], "--gray") == 0) {
+                        options.color = COMP40_COLOR_GRAY;
+                } else if (strcmp(argv[i], "--quant-stats") == 0) {
+                        options.quant_stats = true;
+                } else if (strcmp(argv[i], "--estimate") == 0) {
+                        options.estimate = true;
+                } else if (strcmp(argv[i], "--stats") == 0) {
+                        stats = true;
+                } else if (strcmp(argv[i], "--pyramid") == 0 &&
+                                                        i + 1 < argc) {
+                        options.pyramid = argv[++i];
+                } else if (strcmp(argv[i], "--preview") == 0 &&
+                                                        i + 1 < argc) {
+                        preview_scale = strtoul(argv[++i], NULL, 10);
+                        if (!valid_preview_scale(preview_scale,
+                                                COMP40_DEFAULT_BLOCK_SIZE)) {
+                                fprintf(stderr, "%s: --preview takes 2, 4 or "
+                                                        "8\n", argv[0]);
+                                exit(1);
+                        }
+                } else if (strcmp(argv[i], "--compare") == 0 &&
+                                                        i + 1 < argc) {
+                        compare_path = argv[++i];
+                } else if (strcmp(argv[i], "--region") == 0 && i + 1 < argc) {
+                        region = sscanf(argv[++i], "%u,%u,%u,%u", &region_x,
+                                        &region_y, &region_w, &region_h) == 4;
+                        if (!region) {
+                                fprintf(stderr, "%s: --region takes "
+                                        "x,y,width,height\n", argv[0]);
+                                exit(1);
+                        }
                 } else if (*argv[i] == '-') {
                         fprintf(stderr, "%s: unknown option '%s'\n",
                                 argv[0], argv[i]);
                         exit(1);
                 } else if (argc - i > 2) {
                         fprintf(stderr, "Usage: %s -d [filename]\n"
-                                "       %s -c [filename]\n",
-                                argv[0], argv[0]);
+                                "       %s -c [--tile n] [--block 2|4|8] "
+                                "[--entropy | --predict | --rle]\n"
+                                "                [--profile 0|1] "
+                                "[--ycocg | --gray] [--pyramid prefix] "
+                                "[--quant-stats]\n"
+                                "                [--estimate] [filename]\n"
+                                "       %s -d --region x,y,w,h [filename]\n"
+                                "       %s -d --preview 2|4|8 [filename]\n"
+                                "       %s --compare original.ppm "
+                                "[filename]\n"
+                                "       %s --serve socket [--workers n] "
+                                "[--cache n]\n"
+                                "       (any but --serve can also take "
+                                "--stats)\n",
+                                argv[0], argv[0], argv[0], argv[0], argv[0],
+                                                                argv[0]);
                         exit(1);
                 } else {
                         break;
                 }
         }
         assert(argc - i <= 1);    /* at most one file on command line */
+        if (options.tile_size % options.block_size != 0) {
+                fprintf(stderr, "%s: --tile must be a multiple of the block "
+                                                        "size\n", argv[0]);
+                exit(1);
+        }
+        if (options.profile != PROFILE40_STANDARD &&
+                                (options.coding == COMP40_CODING_RANS ||
+                                options.coding == COMP40_CODING_RANS_MED)) {
+                fprintf(stderr, "%s: --entropy and --predict only work with "
+                                        "--profile 0\n", argv[0]);
+                exit(1);
+        }
+
+        if (socket_path != NULL) {
+                if (workers == 0) {
+                        fprintf(stderr, "%s: --workers must be positive\n",
+                                                                argv[0]);
+                        exit(1);
+                }
+                serve40(socket_path, workers, cache_size);
+                return EXIT_FAILURE;    /* serve40 only returns on error */
+        }
         
+        FILE *fp = stdin;
         if (i < argc) {
-                FILE *fp = fopen(argv[i], "r");
+                fp = fopen(argv[i], "r");
                 assert(fp != NULL);
+        }
+        if (stats) {
+                NEW(run_stats);
+                stats40_start(run_stats);
+        }
+        if (compare_path != NULL) {
+                FILE *original_fp = fopen(compare_path, "rb");
+                if (original_fp == NULL) {
+                        perror(compare_path);
+                        exit(EXIT_FAILURE);
+                }
+                decompress40_compare(fp, original_fp);
+                fclose(original_fp);
+        } else if (preview_scale != 0) {
+                decompress40_preview(fp, preview_scale);
+        } else if (region) {
+                decompress40_region(fp, region_x, region_y, region_w,
+                                                                region_h);
+        } else if (compress_or_decompress == compress40 &&
+                   (options.tile_size != 0 ||
+                    options.coding != COMP40_CODING_RAW ||
+                    options.block_size != COMP40_DEFAULT_BLOCK_SIZE ||
+                    options.profile != PROFILE40_STANDARD ||
+                    options.color != COMP40_COLOR_YPBPR ||
+                    options.pyramid != NULL || options.quant_stats ||
+                    options.estimate)) {
+                /* entropy coding, prediction and runs are per tile, and
+                 * only format 3 can say the block size, profile or colour
+                 * space, so they imply tiling */
+                if (options.tile_size == 0 &&
+                    (options.coding != COMP40_CODING_RAW ||
+                     options.block_size != COMP40_DEFAULT_BLOCK_SIZE ||
+                     options.profile != PROFILE40_STANDARD ||
+                     options.color != COMP40_COLOR_YPBPR)) {
+                        options.tile_size = DEFAULT_TILE_SIZE;
+                }
+                if (options.estimate) {
+                        estimate40_options(fp, &options);
+                } else {
+                        compress40_options(fp, &options);
+                }
+        } else {
                 compress_or_decompress(fp);
+        }
+        if (fp != stdin) {
                 fclose(fp);
-        } else {
-                compress_or_decompress(stdin);
+        }
+        if (run_stats != NULL) {
+                size_t len = Codec40_run_stats_json(run_stats, NULL, 0);
+                char *json = ALLOC(len + 1);
+                Codec40_run_stats_json(run_stats, json, len + 1);
+                fprintf(stderr, "%s\n", json);
+                FREE(json);
+                FREE(run_stats);
         }
 
         return EXIT_SUCCESS; 
@@ -60,24 +271,326 @@ int main(int argc, char *argv[])
 
 void compress40(FILE *fp) {
         Pnm_ppm original = ppm_to_rgb_int(fp);
+        stats40_stage(run_stats, "ppm_to_rgb_int");
+        require_whole_blocks(original, COMP40_DEFAULT_BLOCK_SIZE);
         UArray2_T rgb_float_array = rgb_int_to_rgb_float(original);
-        UArray2b_T comp_video_array =
-                                rgb_float_to_component_video(rgb_float_array);
-        UArray2_T comp_avg_float_array =
-                        comp_video_floats_to_comp_avg_float(comp_video_array);
+        stats40_stage(run_stats, "rgb_int_to_rgb_float");
+        UArray2b_T comp_video_array = rgb_float_to_component_video(
+                                rgb_float_array, COMP40_DEFAULT_BLOCK_SIZE);
+        stats40_stage(run_stats, "rgb_float_to_component_video");
+        UArray2_T comp_avg_float_array = comp_video_floats_to_comp_avg_float(
+                                                comp_video_array, NULL);
+        stats40_stage(run_stats, "comp_video_floats_to_comp_avg_float");
         UArray2_T comp_avg_int_array =
-                        comp_avg_floats_to_comp_avg_ints(comp_avg_float_array);
+                        comp_avg_floats_to_comp_avg_ints(comp_avg_float_array,
+                                PROFILE40_STANDARD, COMP40_COLOR_YPBPR, NULL);
+        stats40_stage(run_stats, "comp_avg_floats_to_comp_avg_ints");
         comp_avg_ints_to_out(comp_avg_int_array);
+        fflush(stdout);
+        stats40_stage(run_stats, "comp_avg_ints_to_out");
+}
+
+/*
+ * Same as compress40, but writes the tiled format if options->tile_size is
+ * set, with blocks of options->block_size pixels, codewords laid out by
+ * options->profile and luma and chroma in the options->color colour space,
+ * and with options->pyramid also writes smaller renditions (half and quarter
+ * size, whatever the block size) to <pyramid>.1.c40 and <pyramid>.2.c40.
+ * Each level is a 2x2 box filter of the component video pixels of the one
+ * above it, so the source is only read once. A
+ * tiled image whose pixels are all gray (a PGM, or a PPM with red, green and
+ * blue equal) is compressed luma only, whatever options->color says. With
+ * options->quant_stats, what quantizing did to the full size image is printed
+ * as JSON on stderr.
+ */
+static void compress40_options(FILE *fp, const compress_options *options) {
+        Pnm_ppm original = ppm_to_rgb_int(fp);
+        stats40_stage(run_stats, "ppm_to_rgb_int");
+        require_whole_blocks(original, options->block_size);
+        compress_options detected = *options;
+        if (detected.tile_size != 0 && rgb_int_is_gray(original)) {
+                detected.color = COMP40_COLOR_GRAY;
+        }
+        stats40_stage(run_stats, "rgb_int_is_gray");
+        options = &detected;
+        Codec40_quant_stats *stats = NULL;
+        if (options->quant_stats) {
+                NEW(stats);
+                init_quant_stats(stats, options->profile);
+        }
+        UArray2b_T comp_video_array = rgb_int_to_component_video(original,
+                                        options->block_size, options->color);
+        stats40_stage(run_stats, "rgb_int_to_component_video");
+
+        for (unsigned level = 0; comp_video_array != NULL; level++) {
+                Codec40_quant_stats *level_stats = level == 0 ? stats : NULL;
+                UArray2b_T next_array = NULL;
+                if (options->pyramid != NULL && level < PYRAMID_LEVELS) {
+                        next_array = comp_video_floats_to_next_level(
+                                                        comp_video_array);
+                        stats40_stage(run_stats,
+                                        "comp_video_floats_to_next_level");
+                }
+                UArray2_T comp_avg_float_array =
+                        comp_video_floats_to_comp_avg_float(comp_video_array,
+                                                                level_stats);
+                stats40_stage(run_stats, "comp_video_floats_to_comp_avg_float");
+                comp_video_array = next_array;
+                UArray2_T comp_avg_int_array =
+                        comp_avg_floats_to_comp_avg_ints(comp_avg_float_array,
+                                        options->profile, options->color,
+                                                                level_stats);
+                stats40_stage(run_stats, "comp_avg_floats_to_comp_avg_ints");
+                if (level == 0) {
+                        write_compressed(comp_avg_int_array, stdout, options);
+                        continue;
+                }
+
+                char name[FILENAME_MAX];
+                snprintf(name, sizeof(name), "%s.%u.c40", options->pyramid,
+                                                                        level);
+                FILE *output = fopen(name, "wb");
+                if (output == NULL) {
+                        perror(name);
+                        exit(EXIT_FAILURE);
+                }
+                write_compressed(comp_avg_int_array, output, options);
+                fclose(output);
+        }
+
+        if (stats != NULL) {
+                size_t len = Codec40_quant_stats_json(stats, NULL, 0);
+                char *json = ALLOC(len + 1);
+                Codec40_quant_stats_json(stats, json, len + 1);
+                fprintf(stderr, "%s\n", json);
+                FREE(json);
+                FREE(stats);
+        }
+}
+
+/*
+ * Instead of compressing, predict the RMS error ppmdiff would report between
+ * the image and its decompressed form, and the size of the file options asks
+ * for, from a sample of the image's blocks (see rgb_int_to_estimate). Both
+ * are printed with their 95% confidence intervals. The colour space is
+ * chosen the same way compress40_options chooses it.
+ */
+static void estimate40_options(FILE *fp, const compress_options *options) {
+        Pnm_ppm original = ppm_to_rgb_int(fp);
+        stats40_stage(run_stats, "ppm_to_rgb_int");
+        require_whole_blocks(original, options->block_size);
+        comp40_header format = {
+                .version = options->tile_size == 0 ? COMP40_FLAT :
+                                                        COMP40_TILED,
+                .tile_size = options->tile_size,
+                .block_size = options->block_size,
+                .profile = options->profile,
+                .color = options->color
+        };
+        if (options->tile_size != 0 && rgb_int_is_gray(original)) {
+                format.color = COMP40_COLOR_GRAY;
+        }
+        comp40_estimate estimate = rgb_int_to_estimate(original, &format,
+                                                        options->coding);
+        Pnm_ppmfree(&original);
+        stats40_stage(run_stats, "rgb_int_to_estimate");
+
+        printf("blocks %" PRIu64 "  sampled %" PRIu64 "\n", estimate.blocks,
+                                                        estimate.samples);
+        printf("rms    %f%%  (95%% interval %f%% to %f%%)\n",
+                        estimate.rms * 100, estimate.rms_low * 100,
+                        estimate.rms_high * 100);
+        printf("size   %.0f bytes  (95%% interval %.0f to %.0f)\n",
+                        estimate.size, estimate.size_low, estimate.size_high);
+}
+
+/*
+ * Exit with an error, rather than failing an assertion in the first stage, if
+ * the image is smaller than one block across or down: there would be nothing
+ * to compress.
+ */
+static void require_whole_blocks(Pnm_ppm original, unsigned block_size) {
+        if (original->width < block_size || original->height < block_size) {
+                fprintf(stderr, "40image: a %ux%u image has no whole %ux%u "
+                        "blocks\n", original->width, original->height,
+                        block_size, block_size);
+                exit(EXIT_FAILURE);
+        }
+}
+
+/*
+ * Write one compressed image in the format options asks for.
+ */
+static void write_compressed(UArray2_T comp_avg_int_array, FILE *output,
+                                        const compress_options *options) {
+        if (options->tile_size == 0) {
+                comp_avg_ints_to_file(comp_avg_int_array, output);
+                fflush(output);
+                stats40_stage(run_stats, "comp_avg_ints_to_file");
+        } else {
+                comp40_header format = {
+                        .version = COMP40_TILED,
+                        .tile_size = options->tile_size,
+                        .block_size = options->block_size,
+                        .profile = options->profile,
+                        .color = options->color
+                };
+                comp_avg_ints_to_tiled_out(comp_avg_int_array, output, &format,
+                                                        options->coding);
+                fflush(output);
+                stats40_stage(run_stats, "comp_avg_ints_to_tiled_out");
+        }
 }
 
 void decompress40(FILE *fp) {
-        UArray2_T comp_avg_int_array = word_to_comp_avg_ints(fp);
+        comp40_header header;
+        Codec40_status status;
+        UArray2_T comp_avg_int_array = word_to_comp_avg_ints(fp, &header,
+                                                                &status);
+        if (comp_avg_int_array == NULL) {
+                fprintf(stderr, "40image: %s\n", Codec40_strerror(status));
+                exit(EXIT_FAILURE);
+        }
+        stats40_stage(run_stats, "word_to_comp_avg_ints");
+        UArray2_T comp_avg_float_array =
+                        comp_avg_ints_to_comp_avg_floats(comp_avg_int_array,
+                                        header.profile, header.color);
+        stats40_stage(run_stats, "comp_avg_ints_to_comp_avg_floats");
+        Pnm_ppm output = comp_avg_float_to_rgb_int(comp_avg_float_array,
+                                        header.block_size, header.color);
+        stats40_stage(run_stats, "comp_avg_float_to_rgb_int");
+        rgb_int_to_pnm(output, header.color);
+        fflush(stdout);
+        stats40_stage(run_stats, "rgb_int_to_pnm");
+}
+
+/*
+ * Decode only the pixels in the given rectangle. The rectangle is clipped to
+ * the image, and only the codewords under it are read from the file.
+ */
+void decompress40_region(FILE *fp, unsigned x, unsigned y, unsigned w,
+                                                                unsigned h) {
+        comp40_header header;
+        Codec40_status status = read_comp40_header_file(fp, &header);
+        if (status != CODEC40_OK) {
+                fprintf(stderr, "40image: %s\n", Codec40_strerror(status));
+                exit(EXIT_FAILURE);
+        }
+        /* a partial block at the right or bottom edge isn't stored */
+        unsigned width = header.width - header.width % header.block_size;
+        unsigned height = header.height - header.height % header.block_size;
+        if (x >= width || y >= height || w == 0 || h == 0) {
+                fprintf(stderr, "40image: region is outside the %ux%u image\n",
+                                                                width, height);
+                exit(EXIT_FAILURE);
+        }
+        w = (w > width - x) ? width - x : w;
+        h = (h > height - y) ? height - y : h;
+
+        UArray2_T comp_avg_int_array =
+                region_to_comp_avg_ints(fp, &header, x, y, w, h, &status);
+        if (comp_avg_int_array == NULL) {
+                fprintf(stderr, "40image: %s%s\n", Codec40_strerror(status),
+                        status == CODEC40_ETRUNCATED ? " (or the input can't "
+                        "be read at an offset - a pipe?)" : "");
+                exit(EXIT_FAILURE);
+        }
+        stats40_stage(run_stats, "region_to_comp_avg_ints");
         UArray2_T comp_avg_float_array =
-                        comp_avg_ints_to_comp_avg_floats(comp_avg_int_array);
-        UArray2b_T comp_video_array =
-                comp_avg_float_to_comp_video_floats(comp_avg_float_array);
-        UArray2_T rgb_float_array =
-                                component_video_to_rgb_float(comp_video_array);
-        Pnm_ppm output = rgb_float_to_rgb_int(rgb_float_array);
-        rgb_int_to_ppm(output);
-}
\ No newline at end of file
+                        comp_avg_ints_to_comp_avg_floats(comp_avg_int_array,
+                                        header.profile, header.color);
+        stats40_stage(run_stats, "comp_avg_ints_to_comp_avg_floats");
+        Pnm_ppm output = crop_rgb_int(comp_avg_float_to_rgb_int(
+                        comp_avg_float_array, header.block_size, header.color),
+                                        header.block_size, x, y, w, h);
+        stats40_stage(run_stats, "comp_avg_float_to_rgb_int");
+        rgb_int_to_pnm(output, header.color);
+        fflush(stdout);
+        stats40_stage(run_stats, "rgb_int_to_pnm");
+}
+
+/*
+ * Decode a preview 1/scale the size of the image, from just the a, Pb and Pr
+ * of each block.
+ */
+void decompress40_preview(FILE *fp, unsigned scale) {
+        comp40_header header;
+        Codec40_status status;
+        UArray2_T comp_avg_int_array = word_to_comp_avg_ints(fp, &header,
+                                                                &status);
+        if (comp_avg_int_array == NULL) {
+                fprintf(stderr, "40image: %s\n", Codec40_strerror(status));
+                exit(EXIT_FAILURE);
+        }
+        if (!valid_preview_scale(scale, header.block_size)) {
+                fprintf(stderr, "40image: the image has %ux%u blocks, so "
+                        "--preview must be at least %u\n", header.block_size,
+                        header.block_size, header.block_size);
+                exit(EXIT_FAILURE);
+        }
+        stats40_stage(run_stats, "word_to_comp_avg_ints");
+        Pnm_ppm output = comp_avg_ints_to_preview(comp_avg_int_array, &header,
+                                                                        scale);
+        stats40_stage(run_stats, "comp_avg_ints_to_preview");
+        rgb_int_to_pnm(output, header.color);
+        fflush(stdout);
+        stats40_stage(run_stats, "rgb_int_to_pnm");
+}
+
+/*
+ * Measure a compressed image against its original in one pass: the codewords
+ * are decoded a block at a time and compared with the original's pixels as
+ * they come out, with no decoded image, PPM or ppmdiff in between. Prints the
+ * RMS error (as a percentage of 255, the number ppmdiff prints), the PSNR and
+ * the largest error of each channel and of all three together.
+ */
+void decompress40_compare(FILE *fp, FILE *original_fp) {
+        comp40_header header;
+        Codec40_status status;
+        UArray2_T comp_avg_int_array = word_to_comp_avg_ints(fp, &header,
+                                                                &status);
+        if (comp_avg_int_array == NULL) {
+                fprintf(stderr, "40image: %s\n", Codec40_strerror(status));
+                exit(EXIT_FAILURE);
+        }
+        stats40_stage(run_stats, "word_to_comp_avg_ints");
+        Pnm_ppm original = ppm_to_rgb_int(original_fp);
+        stats40_stage(run_stats, "ppm_to_rgb_int");
+        /* a partial block at the right or bottom edge isn't stored */
+        unsigned block_size = header.block_size;
+        if (original->width - original->width % block_size !=
+                        UArray2_width(comp_avg_int_array) * block_size ||
+            original->height - original->height % block_size !=
+                        UArray2_height(comp_avg_int_array) * block_size) {
+                fprintf(stderr, "40image: the original is %ux%u but the "
+                        "compressed image is %ux%u\n", original->width,
+                        original->height, header.width, header.height);
+                exit(EXIT_FAILURE);
+        }
+
+        comp40_error error = comp_avg_ints_to_error(comp_avg_int_array,
+                                                        &header, original);
+        Pnm_ppmfree(&original);
+        stats40_stage(run_stats, "comp_avg_ints_to_error");
+
+        const char *names[] = {"red", "green", "blue", "all"};
+        double all_squares = 0;
+        unsigned all_max = 0;
+        for (int c = 0; c < 4; c++) {
+                double squares = c < 3 ? error.sum_squares[c] : all_squares;
+                unsigned max = c < 3 ? error.max_diff[c] : all_max;
+                double samples = (double) error.pixels * (c < 3 ? 1 : 3);
+                double rms = sqrt(squares / samples) / 255;
+                if (rms == 0) {
+                        printf("%-6s rms %f%%  psnr inf dB  max %u\n",
+                                                names[c], 0.0, max);
+                } else {
+                        printf("%-6s rms %f%%  psnr %.2f dB  max %u\n",
+                                names[c], rms * 100, -20 * log10(rms), max);
+                }
+                if (c < 3) {
+                        all_squares += squares;
+                        all_max = max > all_max ? max : all_max;
+                }
+        }
+}
@@ -0,0 +1,68 @@
+/**************************************************************
+ *
+ *                     alloc40.c
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  Wrappers for the Mem interface that count every
+ *               allocation and free for stats40.c before passing
+ *               it on. Linking with ALLOC40_WRAP from the
+ *               Makefile (ld --wrap) sends every call to Mem_*
+ *               from outside the Mem implementation here,
+ *               including the ones UArray_new makes for
+ *               UArray2_new and each block of UArray2b_new.
+ *               Without it nothing calls these functions and
+ *               this file isn't linked in from libcodec40.a.
+ *
+ **************************************************************/
+
+#include "mem.h"
+#include "stats40.h"
+
+/* The Mem functions these wrap, as renamed by ld --wrap */
+void *__real_Mem_alloc(long nbytes, const char *file, int line);
+void *__real_Mem_calloc(long count, long nbytes, const char *file, int line);
+void __real_Mem_free(void *ptr, const char *file, int line);
+void *__real_Mem_resize(void *ptr, long nbytes, const char *file, int line);
+
+void *__wrap_Mem_alloc(long nbytes, const char *file, int line);
+void *__wrap_Mem_calloc(long count, long nbytes, const char *file, int line);
+void __wrap_Mem_free(void *ptr, const char *file, int line);
+void *__wrap_Mem_resize(void *ptr, long nbytes, const char *file, int line);
+
+/*
+ * Name: __wrap_Mem_alloc, __wrap_Mem_calloc, __wrap_Mem_free,
+ *       __wrap_Mem_resize
+ * Purpose: count a call to the Mem interface and make it
+ * Parameters: as for the Mem function
+ * Returns: as for the Mem function
+ * Notes: a resize counts as an allocation of its new size. Freeing NULL
+ *        isn't counted
+ */
+void *__wrap_Mem_alloc(long nbytes, const char *file, int line)
+{
+        stats40_count_alloc(nbytes);
+        return __real_Mem_alloc(nbytes, file, line);
+}
+
+void *__wrap_Mem_calloc(long count, long nbytes, const char *file, int line)
+{
+        stats40_count_alloc(count * nbytes);
+        return __real_Mem_calloc(count, nbytes, file, line);
+}
+
+void __wrap_Mem_free(void *ptr, const char *file, int line)
+{
+        if (ptr != NULL) {
+                stats40_count_free();
+        }
+        __real_Mem_free(ptr, file, line);
+}
+
+void *__wrap_Mem_resize(void *ptr, long nbytes, const char *file, int line)
+{
+        stats40_count_alloc(nbytes);
+        return __real_Mem_resize(ptr, nbytes, file, line);
+}
@@ -0,0 +1,720 @@
+/**************************************************************
+ *
+ *                     bench40.c
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  Throughput benchmark for the codec, run by
+ *               "make bench". It runs each image of the synthetic
+ *               corpus in corpus40.c through compress.c and
+ *               decompress.c a stage at a time, and prints the
+ *               best time of each stage, and of compressing and
+ *               decompressing end to end, as JSON: seconds,
+ *               megapixels per second and bytes per second. The
+ *               corpus is run three times (--rounds), seconds
+ *               apart, so a slow spell on the machine doesn't
+ *               cost any stage its best time, and in each round
+ *               every image runs over and over for at least
+ *               0.2 seconds (--min-time), so tiny images are
+ *               timed over many runs.
+ *
+ *               Two pipelines are timed for every image: "flat",
+ *               the stages compress40 and decompress40 run, and
+ *               "rans", 256 pixel tiles with entropy coding.
+ *               The corpus is the same on every run, so a run
+ *               can be compared with a stored one: with
+ *               --baseline file each result also gets the
+ *               baseline's throughput and the relative change.
+ *               A result is a regression, and makes the exit
+ *               status nonzero, only if its best time over all
+ *               the rounds (so every round) is slower than the
+ *               baseline by more than the tolerance plus the
+ *               stage's own noise: how much slower the slowest
+ *               round's best time was than the fastest, up to
+ *               the tolerance again. An image whose stages look
+ *               like a regression is run for another --rounds
+ *               rounds, up to twice, in case a slow spell
+ *               outlasted the rounds. Stages that take under a
+ *               millisecond are not checked, since timer noise
+ *               swamps them.
+ *
+ *               Throughput is machine dependent, so a baseline is
+ *               only good on the machine that made it. None is
+ *               committed: "make bench-baseline" writes one, and
+ *               "make bench" compares against it if it is there.
+ *
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include "compress.h"
+#include "decompress.h"
+#include "corpus40.h"
+
+#define MAX_STAGES 16
+#define MAX_BASELINE 1024
+#define MAX_NAME 64
+#define DEFAULT_ROUNDS 3
+#define DEFAULT_REPS 1
+#define DEFAULT_MIN_SECONDS 0.2
+#define MIN_CHECKED_SECONDS 0.001
+#define DEFAULT_TOLERANCE 0.25
+#define CONFIRM_PASSES 2
+#define BENCH_TILE_SIZE 256
+/*
+ * Name: stage_time
+ * Contains: one timed stage of a pipeline - its name, how many bytes it
+ *           handled (what it reads, or what it writes for the stages that
+ *           write files), and how long it took in seconds
+ */
+struct stage_time {
+        const char *stage;
+        uint64_t bytes;
+        double seconds;
+};
+typedef struct stage_time stage_time;
+
+/*
+ * Name: pipeline_result
+ * Contains: the best time of each stage of one pipeline on one image so far,
+ *           the slowest of the rounds' own best times for each stage, how
+ *           many stages there are, and how many times it has run
+ */
+struct pipeline_result {
+        stage_time best[MAX_STAGES];
+        double slowest[MAX_STAGES];
+        unsigned count, reps;
+};
+typedef struct pipeline_result pipeline_result;
+
+/*
+ * Name: baseline_result
+ * Contains: one result read back from a baseline file - the image, pipeline
+ *           and stage it is for, and its megapixels per second
+ */
+struct baseline_result {
+        char name[MAX_NAME], pipeline[MAX_NAME], stage[MAX_NAME];
+        double mp_per_s;
+};
+typedef struct baseline_result baseline_result;
+
+/* Helper functions */
+bool pipeline_regressed(const pipeline_result *result,
+                const corpus40_image *image, const char *pipeline,
+                const baseline_result *baseline, unsigned baseline_count,
+                double tolerance);
+bool stage_regressed(const pipeline_result *result, unsigned stage,
+                uint64_t pixels, const baseline_result *old, double tolerance,
+                double *change, double *noise);
+void time_pipeline(const unsigned char *ppm, size_t ppm_length,
+                unsigned pipeline, unsigned min_reps, double min_seconds,
+                pipeline_result *result);
+unsigned time_flat(const unsigned char *ppm, size_t ppm_length,
+                                                        stage_time *stages);
+unsigned time_rans(const unsigned char *ppm, size_t ppm_length,
+                                                        stage_time *stages);
+unsigned time_decompress(unsigned char *compressed, size_t compressed_length,
+                                        stage_time *stages, unsigned count);
+unsigned lap(stage_time *stages, unsigned count, const char *stage,
+                                        uint64_t bytes, double *start);
+unsigned add_total(stage_time *stages, unsigned count, const char *stage,
+                                        unsigned first, uint64_t bytes);
+double now(void);
+unsigned read_baseline(const char *path, baseline_result *results);
+bool json_string(const char *line, const char *key, char *out, size_t cap);
+bool json_number(const char *line, const char *key, double *out);
+const baseline_result *find_baseline(const baseline_result *results,
+                unsigned count, const char *name, const char *pipeline,
+                const char *stage);
+
+int main(int argc, char *argv[])
+{
+        unsigned rounds = DEFAULT_ROUNDS;
+        unsigned min_reps = DEFAULT_REPS;
+        double min_seconds = DEFAULT_MIN_SECONDS;
+        double tolerance = DEFAULT_TOLERANCE;
+        const char *baseline_path = NULL;
+        for (int i = 1; i < argc; i++) {
+                if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) {
+                        rounds = strtoul(argv[++i], NULL, 10);
+                } else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc) {
+                        min_reps = strtoul(argv[++i], NULL, 10);
+                } else if (strcmp(argv[i], "--min-time") == 0 &&
+                                                        i + 1 < argc) {
+                        min_seconds = strtod(argv[++i], NULL);
+                } else if (strcmp(argv[i], "--tolerance") == 0 &&
+                                                        i + 1 < argc) {
+                        tolerance = strtod(argv[++i], NULL);
+                } else if (strcmp(argv[i], "--baseline") == 0 &&
+                                                        i + 1 < argc) {
+                        baseline_path = argv[++i];
+                } else {
+                        fprintf(stderr, "usage: %s [--rounds n] [--reps n] "
+                                "[--min-time seconds] [--tolerance fraction] "
+                                "[--baseline file]\n", argv[0]);
+                        return EXIT_FAILURE;
+                }
+        }
+        rounds = rounds == 0 ? 1 : rounds;
+        min_reps = min_reps == 0 ? 1 : min_reps;
+
+        baseline_result *baseline = NULL;
+        unsigned baseline_count = 0;
+        if (baseline_path != NULL) {
+                baseline = ALLOC(MAX_BASELINE * sizeof(*baseline));
+                baseline_count = read_baseline(baseline_path, baseline);
+        }
+
+        /*
+         * the decoder writes its image to standard output, so the report
+         * gets its own copy of standard output and the decoder gets /dev/null
+         */
+        fflush(stdout);
+        FILE *report = fdopen(dup(fileno(stdout)), "w");
+        assert(report != NULL);
+        FILE *null = freopen("/dev/null", "w", stdout);
+        assert(null != NULL);
+
+        fprintf(report, "{\n  \"benchmark\": \"bench40\",\n");
+        fprintf(report, "  \"baseline\": %s%s%s,\n", baseline ? "\"" : "",
+                        baseline ? baseline_path : "null",
+                        baseline ? "\"" : "");
+        fprintf(report, "  \"results\": [\n");
+
+        /* each image's pipelines keep their best times across the rounds */
+        unsigned cases = corpus40_count();
+        unsigned char **ppms = ALLOC(cases * sizeof(*ppms));
+        size_t *ppm_lengths = ALLOC(cases * sizeof(*ppm_lengths));
+        pipeline_result *results = CALLOC(cases * 2, sizeof(*results));
+        for (unsigned c = 0; c < cases; c++) {
+                ppms[c] = corpus40_ppm(corpus40_get(c), &ppm_lengths[c]);
+        }
+        for (unsigned round = 0; round < rounds; round++) {
+                for (unsigned c = 0; c < cases; c++) {
+                        for (unsigned p = 0; p < 2; p++) {
+                                time_pipeline(ppms[c], ppm_lengths[c], p,
+                                        min_reps, min_seconds,
+                                        &results[c * 2 + p]);
+                        }
+                }
+        }
+
+        /*
+         * a slow spell can outlast every round, so anything that looks like
+         * a regression is run again, and only counts if it is slow again
+         */
+        for (unsigned pass = 0; baseline != NULL && pass < CONFIRM_PASSES;
+                                                                pass++) {
+                bool rerun = false;
+                for (unsigned c = 0; c < cases * 2; c++) {
+                        const corpus40_image *image = corpus40_get(c / 2);
+                        if (!pipeline_regressed(&results[c], image,
+                                        c % 2 == 0 ? "flat" : "rans",
+                                        baseline, baseline_count, tolerance)) {
+                                continue;
+                        }
+                        for (unsigned round = 0; round < rounds; round++) {
+                                time_pipeline(ppms[c / 2], ppm_lengths[c / 2],
+                                        c % 2, min_reps, min_seconds,
+                                        &results[c]);
+                        }
+                        rerun = true;
+                }
+                if (!rerun) {
+                        break;
+                }
+        }
+
+        unsigned regressions = 0;
+        bool first_result = true;
+        for (unsigned c = 0; c < cases; c++) {
+                const corpus40_image *image = corpus40_get(c);
+                uint64_t pixels = (uint64_t) image->width * image->height;
+                for (unsigned p = 0; p < 2; p++) {
+                        const char *pipeline = p == 0 ? "flat" : "rans";
+                        const stage_time *best = results[c * 2 + p].best;
+                        unsigned count = results[c * 2 + p].count;
+                        unsigned reps = results[c * 2 + p].reps;
+                        for (unsigned s = 0; s < count; s++) {
+                                double seconds = best[s].seconds > 0 ?
+                                                best[s].seconds : 1e-9;
+                                double mp_per_s = pixels / seconds / 1e6;
+                                fprintf(report, "%s    {\"case\": \"%s\", "
+                                        "\"width\": %u, \"height\": %u, "
+                                        "\"pipeline\": \"%s\", "
+                                        "\"stage\": \"%s\", \"reps\": %u, "
+                                        "\"seconds\": %.9f, "
+                                        "\"mp_per_s\": %.3f, "
+                                        "\"bytes_per_s\": %.0f",
+                                        first_result ? "" : ",\n",
+                                        image->name, image->width,
+                                        image->height, pipeline,
+                                        best[s].stage, reps, best[s].seconds,
+                                        mp_per_s, best[s].bytes / seconds);
+                                first_result = false;
+                                const baseline_result *old = find_baseline(
+                                        baseline, baseline_count, image->name,
+                                        pipeline, best[s].stage);
+                                if (old != NULL && old->mp_per_s > 0) {
+                                        double change, noise;
+                                        bool checked = best[s].seconds >=
+                                                        MIN_CHECKED_SECONDS;
+                                        bool regressed = stage_regressed(
+                                                &results[c * 2 + p], s,
+                                                pixels, old, tolerance,
+                                                &change, &noise);
+                                        regressions += regressed;
+                                        fprintf(report, ", "
+                                                "\"baseline_mp_per_s\": %.3f, "
+                                                "\"change\": %.4f, "
+                                                "\"noise\": %.4f, "
+                                                "\"checked\": %s, "
+                                                "\"regressed\": %s",
+                                                old->mp_per_s, change, noise,
+                                                checked ? "true" : "false",
+                                                regressed ? "true" : "false");
+                                }
+                                fprintf(report, "}");
+                        }
+                }
+                FREE(ppms[c]);
+        }
+        FREE(results);
+        FREE(ppm_lengths);
+        FREE(ppms);
+        fprintf(report, "\n  ],\n  \"tolerance\": %.4f,\n", tolerance);
+        fprintf(report, "  \"regressions\": %u\n}\n", regressions);
+        fclose(report);
+        if (baseline != NULL) {
+                FREE(baseline);
+        }
+        return regressions > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*
+ * Name: pipeline_regressed
+ * Purpose: check whether any stage of one pipeline on one image regressed
+ * Parameters: the pipeline's results, the image, the pipeline's name, the
+ *             baseline results and how many there are, and the tolerance
+ * Returns: true if some stage regressed (see stage_regressed)
+ * Notes: none
+ */
+bool pipeline_regressed(const pipeline_result *result,
+                const corpus40_image *image, const char *pipeline,
+                const baseline_result *baseline, unsigned baseline_count,
+                double tolerance)
+{
+        uint64_t pixels = (uint64_t) image->width * image->height;
+        for (unsigned s = 0; s < result->count; s++) {
+                const baseline_result *old = find_baseline(baseline,
+                                baseline_count, image->name, pipeline,
+                                result->best[s].stage);
+                double change, noise;
+                if (old != NULL && old->mp_per_s > 0 && stage_regressed(
+                                result, s, pixels, old, tolerance, &change,
+                                &noise)) {
+                        return true;
+                }
+        }
+        return false;
+}
+
+/*
+ * Name: stage_regressed
+ * Purpose: compare one stage's best time with the baseline
+ * Parameters: the pipeline's results, which stage, the image's pixels, the
+ *             stage's baseline result, the tolerance, and where to store the
+ *             relative change in throughput and the stage's noise
+ * Returns: true if the stage is checked and slower than the baseline by more
+ *          than the tolerance plus its noise
+ * Notes: old must have a positive mp_per_s. The noise is how much slower the
+ *        slowest round's best time was than the fastest, so a stage whose
+ *        rounds disagree gets that much more slack, but never more than the
+ *        tolerance again, so one very slow round can't hide a regression
+ */
+bool stage_regressed(const pipeline_result *result, unsigned stage,
+                uint64_t pixels, const baseline_result *old, double tolerance,
+                double *change, double *noise)
+{
+        double seconds = result->best[stage].seconds > 0 ?
+                                result->best[stage].seconds : 1e-9;
+        *change = pixels / seconds / 1e6 / old->mp_per_s - 1;
+        *noise = result->slowest[stage] / seconds - 1;
+        double slack = *noise < tolerance ? *noise : tolerance;
+        return result->best[stage].seconds >= MIN_CHECKED_SECONDS &&
+                                                *change < -(tolerance + slack);
+}
+
+/*
+ * Name: time_pipeline
+ * Purpose: run one pipeline on one image for a round of the benchmark,
+ *          keeping the best time of each stage
+ * Parameters: the image as a PPM file in memory and its length, the pipeline
+ *             (0 for flat, 1 for rans), how many times to run it at least,
+ *             how many seconds to keep running it at least, and the results
+ *             of the rounds so far
+ * Returns: none
+ * Notes: results starts zeroed, before the first round. How far apart the
+ *        rounds' best times are is how noisy the stage is on this machine
+ */
+void time_pipeline(const unsigned char *ppm, size_t ppm_length,
+                unsigned pipeline, unsigned min_reps, double min_seconds,
+                pipeline_result *result)
+{
+        stage_time stages[MAX_STAGES];
+        double round_best[MAX_STAGES];
+        double started = now();
+        for (unsigned rep = 0; rep < min_reps ||
+                                now() - started < min_seconds; rep++) {
+                unsigned count = pipeline == 0 ?
+                                time_flat(ppm, ppm_length, stages) :
+                                time_rans(ppm, ppm_length, stages);
+                for (unsigned s = 0; s < count; s++) {
+                        if (result->reps == 0 || stages[s].seconds <
+                                                result->best[s].seconds) {
+                                result->best[s] = stages[s];
+                        }
+                        if (rep == 0 || stages[s].seconds < round_best[s]) {
+                                round_best[s] = stages[s].seconds;
+                        }
+                }
+                result->count = count;
+                result->reps++;
+        }
+        for (unsigned s = 0; s < result->count; s++) {
+                if (round_best[s] > result->slowest[s]) {
+                        result->slowest[s] = round_best[s];
+                }
+        }
+}
+
+/*
+ * Name: time_flat
+ * Purpose: time compress40's stages, then decompress40's, on one image
+ * Parameters: the image as a PPM file in memory and its length, where to
+ *             store the stage times
+ * Returns: the number of stage times stored
+ * Notes: the compressed image is written to memory, and "compress" and
+ *        "decompress" are the sums of their stages
+ */
+unsigned time_flat(const unsigned char *ppm, size_t ppm_length,
+                                                        stage_time *stages)
+{
+        FILE *input = fmemopen((void *) ppm, ppm_length, "rb");
+        assert(input != NULL);
+        unsigned count = 0;
+        double start = now();
+
+        Pnm_ppm original = ppm_to_rgb_int(input);
+        count = lap(stages, count, "ppm_to_rgb_int", ppm_length, &start);
+        uint64_t pixels = (uint64_t) original->width * original->height;
+        uint64_t blocks = (uint64_t) (original->width / 2) *
+                                                (original->height / 2);
+
+        UArray2_T rgb_float_array = rgb_int_to_rgb_float(original);
+        count = lap(stages, count, "rgb_int_to_rgb_float",
+                        pixels * sizeof(struct Pnm_rgb), &start);
+        UArray2b_T comp_video_array = rgb_float_to_component_video(
+                                rgb_float_array, COMP40_DEFAULT_BLOCK_SIZE);
+        count = lap(stages, count, "rgb_float_to_component_video",
+                        blocks * 4 * sizeof(rgb_floats), &start);
+        UArray2_T comp_avg_float_array = comp_video_floats_to_comp_avg_float(
+                                                comp_video_array, NULL);
+        count = lap(stages, count, "comp_video_floats_to_comp_avg_float",
+                        blocks * 4 * sizeof(comp_video_floats), &start);
+        UArray2_T comp_avg_int_array =
+                        comp_avg_floats_to_comp_avg_ints(comp_avg_float_array,
+                                PROFILE40_STANDARD, COMP40_COLOR_YPBPR, NULL);
+        count = lap(stages, count, "comp_avg_floats_to_comp_avg_ints",
+                        blocks * sizeof(comp_avg_floats), &start);
+
+        char *compressed = NULL;
+        size_t compressed_length = 0;
+        FILE *output = open_memstream(&compressed, &compressed_length);
+        assert(output != NULL);
+        comp_avg_ints_to_file(comp_avg_int_array, output);
+        fclose(output);
+        count = lap(stages, count, "comp_avg_ints_to_file", compressed_length,
+                                                                        &start);
+        count = add_total(stages, count, "compress", 0, ppm_length);
+        fclose(input);
+
+        return time_decompress((unsigned char *) compressed, compressed_length,
+                                                                stages, count);
+}
+
+/*
+ * Name: time_rans
+ * Purpose: time the stages of a tiled, entropy coded compress, then of
+ *          decompressing it, on one image
+ * Parameters: the image as a PPM file in memory and its length, where to
+ *             store the stage times
+ * Returns: the number of stage times stored
+ * Notes: as for time_flat
+ */
+unsigned time_rans(const unsigned char *ppm, size_t ppm_length,
+                                                        stage_time *stages)
+{
+        FILE *input = fmemopen((void *) ppm, ppm_length, "rb");
+        assert(input != NULL);
+        unsigned count = 0;
+        double start = now();
+
+        Pnm_ppm original = ppm_to_rgb_int(input);
+        count = lap(stages, count, "ppm_to_rgb_int", ppm_length, &start);
+        uint64_t pixels = (uint64_t) original->width * original->height;
+        uint64_t blocks = (uint64_t) (original->width / 2) *
+                                                (original->height / 2);
+
+        UArray2b_T comp_video_array = rgb_int_to_component_video(original,
+                        COMP40_DEFAULT_BLOCK_SIZE, COMP40_COLOR_YPBPR);
+        count = lap(stages, count, "rgb_int_to_component_video",
+                        pixels * sizeof(struct Pnm_rgb), &start);
+        UArray2_T comp_avg_float_array = comp_video_floats_to_comp_avg_float(
+                                                comp_video_array, NULL);
+        count = lap(stages, count, "comp_video_floats_to_comp_avg_float",
+                        blocks * 4 * sizeof(comp_video_floats), &start);
+        UArray2_T comp_avg_int_array =
+                        comp_avg_floats_to_comp_avg_ints(comp_avg_float_array,
+                                PROFILE40_STANDARD, COMP40_COLOR_YPBPR, NULL);
+        count = lap(stages, count, "comp_avg_floats_to_comp_avg_ints",
+                        blocks * sizeof(comp_avg_floats), &start);
+
+        char *compressed = NULL;
+        size_t compressed_length = 0;
+        FILE *output = open_memstream(&compressed, &compressed_length);
+        assert(output != NULL);
+        comp40_header format = {
+                .version = COMP40_TILED, .tile_size = BENCH_TILE_SIZE,
+                .block_size = COMP40_DEFAULT_BLOCK_SIZE,
+                .profile = PROFILE40_STANDARD, .color = COMP40_COLOR_YPBPR
+        };
+        comp_avg_ints_to_tiled_out(comp_avg_int_array, output, &format,
+                                                        COMP40_CODING_RANS);
+        fclose(output);
+        count = lap(stages, count, "comp_avg_ints_to_tiled_out",
+                                                compressed_length, &start);
+        count = add_total(stages, count, "compress", 0, ppm_length);
+        fclose(input);
+
+        return time_decompress((unsigned char *) compressed, compressed_length,
+                                                                stages, count);
+}
+
+/*
+ * Name: time_decompress
+ * Purpose: time decompress40's stages on a compressed image
+ * Parameters: the compressed image and its length, the stage times so far and
+ *             how many there are
+ * Returns: the number of stage times stored
+ * Notes: frees compressed. The decoded image goes to standard output
+ */
+unsigned time_decompress(unsigned char *compressed, size_t compressed_length,
+                                        stage_time *stages, unsigned count)
+{
+        FILE *input = fmemopen(compressed, compressed_length, "rb");
+        assert(input != NULL);
+        unsigned first = count;
+        double start = now();
+
+        comp40_header header;
+        Codec40_status status;
+        UArray2_T comp_avg_int_array = word_to_comp_avg_ints(input, &header,
+                                                                &status);
+        assert(comp_avg_int_array != NULL);
+        count = lap(stages, count, "word_to_comp_avg_ints", compressed_length,
+                                                                        &start);
+        uint64_t blocks = (uint64_t) UArray2_width(comp_avg_int_array) *
+                                        UArray2_height(comp_avg_int_array);
+        uint64_t pixels = blocks * header.block_size * header.block_size;
+
+        UArray2_T comp_avg_float_array =
+                        comp_avg_ints_to_comp_avg_floats(comp_avg_int_array,
+                                        header.profile, header.color);
+        count = lap(stages, count, "comp_avg_ints_to_comp_avg_floats",
+                        blocks * sizeof(comp_avg_ints), &start);
+        Pnm_ppm output = comp_avg_float_to_rgb_int(comp_avg_float_array,
+                                        header.block_size, header.color);
+        count = lap(stages, count, "comp_avg_float_to_rgb_int",
+                        blocks * sizeof(comp_avg_floats), &start);
+        rgb_int_to_pnm(output, header.color);
+        fflush(stdout);
+        count = lap(stages, count, "rgb_int_to_pnm", pixels * 3, &start);
+        count = add_total(stages, count, "decompress", first,
+                                                        compressed_length);
+
+        fclose(input);
+        free(compressed);
+        return count;
+}
+
+/*
+ * Name: lap
+ * Purpose: store the time of the stage that just finished and start the next
+ * Parameters: the stage times and how many there are, the stage's name and
+ *             the bytes it handled, and when it started (moved to now)
+ * Returns: the new number of stage times
+ * Notes: none
+ */
+unsigned lap(stage_time *stages, unsigned count, const char *stage,
+                                        uint64_t bytes, double *start)
+{
+        assert(count < MAX_STAGES);
+        double end = now();
+        stages[count] = (stage_time) {.stage = stage, .bytes = bytes,
+                                                .seconds = end - *start};
+        *start = end;
+        return count + 1;
+}
+
+/*
+ * Name: add_total
+ * Purpose: store the sum of a run of stage times as a stage of its own
+ * Parameters: the stage times and how many there are, the name of the total,
+ *             the first stage to add up (the rest up to count are added), and
+ *             the bytes the whole run handled
+ * Returns: the new number of stage times
+ * Notes: none
+ */
+unsigned add_total(stage_time *stages, unsigned count, const char *stage,
+                                        unsigned first, uint64_t bytes)
+{
+        assert(count < MAX_STAGES);
+        double seconds = 0;
+        for (unsigned s = first; s < count; s++) {
+                seconds += stages[s].seconds;
+        }
+        stages[count] = (stage_time) {.stage = stage, .bytes = bytes,
+                                                        .seconds = seconds};
+        return count + 1;
+}
+
+/*
+ * Name: now
+ * Purpose: read the monotonic clock
+ * Parameters: none
+ * Returns: the time in seconds
+ * Notes: none
+ */
+double now(void)
+{
+        struct timespec time;
+        clock_gettime(CLOCK_MONOTONIC, &time);
+        return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+/*
+ * Name: read_baseline
+ * Purpose: read the results of an earlier run
+ * Parameters: the path of its JSON report, where to store the results (room
+ *             for MAX_BASELINE)
+ * Returns: the number of results read
+ * Notes: exits if the file can't be opened. Only reads reports written by
+ *        this program, which put each result on a line of its own
+ */
+unsigned read_baseline(const char *path, baseline_result *results)
+{
+        FILE *input = fopen(path, "r");
+        if (input == NULL) {
+                perror(path);
+                exit(EXIT_FAILURE);
+        }
+        char line[1024];
+        unsigned count = 0;
+        while (count < MAX_BASELINE && fgets(line, sizeof(line), input)) {
+                baseline_result *result = &results[count];
+                if (json_string(line, "case", result->name, MAX_NAME) &&
+                    json_string(line, "pipeline", result->pipeline,
+                                                                MAX_NAME) &&
+                    json_string(line, "stage", result->stage, MAX_NAME) &&
+                    json_number(line, "mp_per_s", &result->mp_per_s)) {
+                        count++;
+                }
+        }
+        fclose(input);
+        return count;
+}
+
+/*
+ * Name: json_string
+ * Purpose: find a string member on one line of a report
+ * Parameters: the line, the member's name, where to copy its value and the
+ *             room there
+ * Returns: true if the member was found and its value fit
+ * Notes: values with escapes aren't understood, and this program never
+ *        writes any
+ */
+bool json_string(const char *line, const char *key, char *out, size_t cap)
+{
+        char pattern[MAX_NAME + 8];
+        snprintf(pattern, sizeof(pattern), "\"%s\": \"", key);
+        const char *value = strstr(line, pattern);
+        if (value == NULL) {
+                return false;
+        }
+        value += strlen(pattern);
+        const char *end = strchr(value, '"');
+        if (end == NULL || (size_t) (end - value) >= cap) {
+                return false;
+        }
+        memcpy(out, value, end - value);
+        out[end - value] = '\0';
+        return true;
+}
+
+/*
+ * Name: json_number
+ * Purpose: find a number member on one line of a report
+ * Parameters: the line, the member's name, where to store its value
+ * Returns: true if the member was found
+ * Notes: the name is matched with its opening quote, so "mp_per_s" doesn't
+ *        match "baseline_mp_per_s"
+ */
+bool json_number(const char *line, const char *key, double *out)
+{
+        char pattern[MAX_NAME + 8];
+        snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+        const char *value = strstr(line, pattern);
+        return value != NULL &&
+                        sscanf(value + strlen(pattern), "%lf", out) == 1;
+}
+
+/*
+ * Name: find_baseline
+ * Purpose: look up the baseline result for one stage
+ * Parameters: the baseline results and how many there are, and the image,
+ *             pipeline and stage to look for
+ * Returns: the result, or NULL if the baseline doesn't have it
+ * Notes: none
+ */
+const baseline_result *find_baseline(const baseline_result *results,
+                unsigned count, const char *name, const char *pipeline,
+                const char *stage)
+{
+        for (unsigned i = 0; i < count; i++) {
+                if (strcmp(results[i].name, name) == 0 &&
+                    strcmp(results[i].pipeline, pipeline) == 0 &&
+                    strcmp(results[i].stage, stage) == 0) {
+                        return &results[i];
+                }
+        }
+        return NULL;
+}
+
+#undef MAX_STAGES
+#undef MAX_BASELINE
+#undef MAX_NAME
+#undef DEFAULT_ROUNDS
+#undef DEFAULT_REPS
+#undef DEFAULT_MIN_SECONDS
+#undef MIN_CHECKED_SECONDS
+#undef DEFAULT_TOLERANCE
+#undef CONFIRM_PASSES
+#undef BENCH_TILE_SIZE
@@ -12,6 +12,7 @@
  **************************************************************/
 
 #include "bitpack.h"
+#include "bitpack_checked.h"
 #include "assert.h"
 
 Except_T Bitpack_Overflow = { "Overflow packing bits" };
@@ -24,11 +25,15 @@ Except_T Bitpack_Overflow = { "Overflow packing bits" };
  * can fit into a certain amount of bits
  * Parameters: The number and the proposed width
  * Returns: True if it fits and false if not
- * Notes: none
+ * Notes: every number fits in 64 bits (shifting a uint64_t by 64 is undefined,
+ *        so that width is handled on its own)
  */
 bool Bitpack_fitsu(uint64_t n, unsigned width)
 {
         assert(width <= 64);
+        if (width == WORD_LENGTH) {
+                return true;
+        }
 
         /*
          * if the number can fit in the width, then there will be no 1s after
@@ -44,14 +49,15 @@ bool Bitpack_fitsu(uint64_t n, unsigned width)
  * can fit into a certain amount of bits
  * Parameters: The number and the proposed width
  * Returns: True if it fits and false if not
- * Notes: none
+ * Notes: nothing fits in 0 bits, not even 0, since a signed field needs a
+ *        sign bit
  */
 bool Bitpack_fitss(int64_t n, unsigned width)
 {
         assert(width <= 64);
 
-        /* 0 is an edge case */
-        if (n == 0) {
+        /* 0 is an edge case, and a width of 0 would shift by -1 below */
+        if (n == 0 || width == 0) {
                 return width >= 1;
         }
 
@@ -120,14 +126,15 @@ int64_t Bitpack_gets(uint64_t word, unsigned width, unsigned lsb)
         }
         
         /*
-         * store unsigned word returned by Bitpack_getu as signed word. Shift
-         * word such that the leftmost bit in the desired field is also the
-         * leftmost bit of the word. Then shift it back to where it was. When
+         * Shift the unsigned word returned by Bitpack_getu such that the
+         * leftmost bit in the desired field is also the leftmost bit of the
+         * word, and store it as a signed word (left shifting a negative
+         * signed word is undefined). Then shift it back to where it was. When
          * it shifts back, it will either pull 1s or 0s along with it depending
          * on what the leftmost bit was
          */
-        int64_t extraction = Bitpack_getu(word, width, lsb);
-        extraction = extraction << (WORD_LENGTH - width);
+        uint64_t field = Bitpack_getu(word, width, lsb);
+        int64_t extraction = field << (WORD_LENGTH - width);
         extraction = extraction >> (WORD_LENGTH - width);
 
         return extraction;
@@ -148,9 +155,56 @@ uint64_t Bitpack_newu(uint64_t word, unsigned width, unsigned lsb,
                                                                 uint64_t value)
 {
         assert(width + lsb <= 64);
-        if (!Bitpack_fitsu(value, width)) {
+        if (!Bitpack_newu_checked(word, width, lsb, value, &word)) {
+                RAISE(Bitpack_Overflow);
+        }
+        return word;
+}
+
+
+/*
+ * Name: Bitpack_news
+ * Purpose: Insert a signed number into an existing codeword
+ * Parameters: The codeword, the width in bits of the number to insert,
+ * the least significant bit location of the number to insert, and the value.
+ * Returns: The new codeword with the new value inserted
+ * Notes: It is a CRE for the width and lsb being to large for the codeword.
+          The Bitpack_Overflow exception will be raised if the proposed value
+          doesn't fit in the proposed width. 
+ */
+uint64_t Bitpack_news(uint64_t word, unsigned width, unsigned lsb,
+                                                                int64_t value)
+{
+        assert(width + lsb <= 64);
+        if (!Bitpack_news_checked(word, width, lsb, value, &word)) {
                 RAISE(Bitpack_Overflow);
         }
+        return word;
+}
+
+
+/*
+ * Name: Bitpack_newu_checked
+ * Purpose: Insert an unsigned number into an existing codeword without
+ *          raising an exception
+ * Parameters: The codeword, the width in bits of the number to insert,
+ * the least significant bit location of the number to insert, the value, and
+ * where to store the new codeword.
+ * Returns: true if the value was inserted, false if the value doesn't fit in
+ *          the proposed width or the field doesn't fit in the codeword
+ * Notes: result must not be NULL, and is left alone when false is returned.
+ *        A field of width 0 holds only 0, and leaves the word as it was
+ */
+bool Bitpack_newu_checked(uint64_t word, unsigned width, unsigned lsb,
+                                        uint64_t value, uint64_t *result)
+{
+        if (width + lsb > 64 || !Bitpack_fitsu(value, width)) {
+                return false;
+        }
+        if (width == 0) {
+                *result = word;
+                return true;
+        }
 
         /*
          * get all the bits in the word except 0s for all of the bits in the
@@ -166,31 +220,32 @@ uint64_t Bitpack_newu(uint64_t word, unsigned width, unsigned lsb,
         word = word & mask;
         word = word | value;
 
-        return word;
+        *result = word;
+        return true;
 }
 
 
 /*
- * Name: Bitpack_news
- * Purpose: Insert a signed number into an existing codeword
+ * Name: Bitpack_news_checked
+ * Purpose: Insert a signed number into an existing codeword without raising
+ *          an exception
  * Parameters: The codeword, the width in bits of the number to insert,
- * the least significant bit location of the number to insert, and the value.
- * Returns: The new codeword with the new value inserted
- * Notes: It is a CRE for the width and lsb being to large for the codeword.
-          The Bitpack_Overflow exception will be raised if the proposed value
-          doesn't fit in the proposed width. 
+ * the least significant bit location of the number to insert, the value, and
+ * where to store the new codeword.
+ * Returns: true if the value was inserted, false if the value doesn't fit in
+ *          the proposed width or the field doesn't fit in the codeword
+ * Notes: result must not be NULL, and is left alone when false is returned
  */
-uint64_t Bitpack_news(uint64_t word, unsigned width, unsigned lsb,
-                                                                int64_t value)
+bool Bitpack_news_checked(uint64_t word, unsigned width, unsigned lsb,
+                                        int64_t value, uint64_t *result)
 {
-        assert(width + lsb <= 64);
-        if (!Bitpack_fitss(value, width)) {
-                RAISE(Bitpack_Overflow);
+        if (width + lsb > 64 || !Bitpack_fitss(value, width)) {
+                return false;
         }
 
         /* knock off any leading 1s and treat value as an unsigned value */
-        uint64_t real_val = value << (WORD_LENGTH - width);
+        uint64_t real_val = (uint64_t) value << (WORD_LENGTH - width);
         real_val = real_val >> (WORD_LENGTH - width);
 
-        return Bitpack_newu(word, width, lsb, real_val);
+        return Bitpack_newu_checked(word, width, lsb, real_val, result);
 }
@@ -0,0 +1,362 @@
+/**************************************************************
+ *
+ *                     bitpack_bench.c
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  Microbenchmark for bitpack.c, run by "make
+ *               bench-bitpack". It times Bitpack_fitsu, fitss,
+ *               getu, gets, newu and news, and the _checked
+ *               versions of newu and news, on fields of several
+ *               widths and LSBs, and the pack and unpack kernels
+ *               of each codeword profile, which do all six fields
+ *               of a codeword in one call. It prints the best
+ *               time of each as JSON, in nanoseconds per call.
+ *
+ *               Each call gets a different word and value from a
+ *               seeded table, and every value fits its field, so
+ *               the times are of the common path and not of
+ *               raising Bitpack_Overflow. bitpack_test checks the
+ *               results of the same functions.
+ *
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "bitpack.h"
+#include "bitpack_checked.h"
+#include "profile40.h"
+#include "mem.h"
+#include "assert.h"
+
+#define DEFAULT_REPS 5
+#define INPUTS 4096
+#define TARGET_SECONDS 0.01
+#define SEED UINT64_C(0xb17bec4)
+
+#define OP_FITSU 0
+#define OP_FITSS 1
+#define OP_GETU 2
+#define OP_GETS 3
+#define OP_NEWU 4
+#define OP_NEWS 5
+#define OP_NEWU_CHECKED 6
+#define OP_NEWS_CHECKED 7
+#define OP_PACK 8
+#define OP_UNPACK 9
+
+/*
+ * Name: bench_op
+ * Contains: one function to time - its name, which of the OP_ values it is,
+ *           and whether it takes an lsb (the fits functions only take a width,
+ *           and the profile kernels neither)
+ */
+struct bench_op {
+        const char *name;
+        unsigned op;
+        bool takes_lsb;
+};
+typedef struct bench_op bench_op;
+
+static const bench_op field_ops[] = {
+        {"Bitpack_fitsu", OP_FITSU, false},
+        {"Bitpack_fitss", OP_FITSS, false},
+        {"Bitpack_getu", OP_GETU, true},
+        {"Bitpack_gets", OP_GETS, true},
+        {"Bitpack_newu", OP_NEWU, true},
+        {"Bitpack_news", OP_NEWS, true},
+        {"Bitpack_newu_checked", OP_NEWU_CHECKED, true},
+        {"Bitpack_news_checked", OP_NEWS_CHECKED, true}
+};
+
+/*
+ * The fields timed: 6 is the standard profile's a, b, c and d, 12 the fine
+ * profile's chroma, and 63 and 64 the widest. Each width is timed at every
+ * lsb it fits at
+ */
+static const unsigned widths[] = {1, 6, 12, 32, 63, 64};
+static const unsigned lsbs[] = {0, 26, 63};
+
+/*
+ * Name: bench_inputs
+ * Contains: the table of inputs each call takes one entry of - codewords,
+ *           unsigned and signed values that fit the field being timed, and
+ *           the quantized values of blocks that fit the profile being timed
+ */
+struct bench_inputs {
+        uint64_t words[INPUTS];
+        uint64_t values[INPUTS];
+        int64_t svalues[INPUTS];
+        comp_avg_ints ints[INPUTS];
+};
+typedef struct bench_inputs bench_inputs;
+
+/* Helper functions */
+static inline uint64_t next_random(uint64_t *state);
+void fill_values(bench_inputs *inputs, unsigned width, uint64_t *random);
+double time_op(unsigned op, const bench_inputs *inputs, unsigned width,
+                                unsigned lsb, const profile40 *profile,
+                                unsigned reps);
+uint64_t run_op(unsigned op, const bench_inputs *inputs, unsigned width,
+                unsigned lsb, const profile40 *profile, unsigned passes);
+void print_result(bool *first, const char *name, const char *profile,
+                                int width, int lsb, double ns_per_op);
+double now(void);
+
+int main(int argc, char *argv[])
+{
+        unsigned reps = DEFAULT_REPS;
+        for (int i = 1; i < argc; i++) {
+                if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc) {
+                        reps = strtoul(argv[++i], NULL, 10);
+                } else {
+                        fprintf(stderr, "usage: %s [--reps n]\n", argv[0]);
+                        return EXIT_FAILURE;
+                }
+        }
+        reps = reps == 0 ? 1 : reps;
+
+        bench_inputs *inputs;
+        NEW(inputs);
+        uint64_t random = SEED;
+        for (unsigned i = 0; i < INPUTS; i++) {
+                inputs->words[i] = next_random(&random);
+        }
+
+        printf("{\n  \"benchmark\": \"bitpack_bench\",\n");
+        printf("  \"reps\": %u,\n  \"results\": [\n", reps);
+        bool first = true;
+        unsigned ops = sizeof(field_ops) / sizeof(field_ops[0]);
+        for (unsigned w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+                fill_values(inputs, widths[w], &random);
+                for (unsigned o = 0; o < ops; o++) {
+                        const bench_op *op = &field_ops[o];
+                        for (unsigned l = 0; l < sizeof(lsbs) /
+                                                sizeof(lsbs[0]); l++) {
+                                if (widths[w] + lsbs[l] > 64 ||
+                                                (!op->takes_lsb && l > 0)) {
+                                        continue;
+                                }
+                                double ns = time_op(op->op, inputs, widths[w],
+                                                        lsbs[l], NULL, reps);
+                                print_result(&first, op->name, NULL,
+                                                widths[w], op->takes_lsb ?
+                                                (int) lsbs[l] : -1, ns);
+                        }
+                }
+        }
+
+        const profile40 *profile;
+        for (unsigned id = 0; (profile = profile40_get(id)) != NULL; id++) {
+                for (unsigned i = 0; i < INPUTS; i++) {
+                        profile->unpack(profile, inputs->words[i],
+                                                        &inputs->ints[i]);
+                }
+                print_result(&first, "pack", profile->name, -1, -1,
+                        time_op(OP_PACK, inputs, 0, 0, profile, reps));
+                print_result(&first, "unpack", profile->name, -1, -1,
+                        time_op(OP_UNPACK, inputs, 0, 0, profile, reps));
+        }
+        printf("\n  ]\n}\n");
+
+        FREE(inputs);
+        return EXIT_SUCCESS;
+}
+
+/*
+ * Name: next_random
+ * Purpose: step a splitmix64 generator
+ * Parameters: the generator's state
+ * Returns: the next 64 random bits
+ * Notes: none
+ */
+static inline uint64_t next_random(uint64_t *state)
+{
+        uint64_t z = (*state += UINT64_C(0x9e3779b97f4a7c15));
+        z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+        z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+        return z ^ (z >> 31);
+}
+
+/*
+ * Name: fill_values
+ * Purpose: make the values to put in fields of one width
+ * Parameters: the inputs, the width, the generator's state
+ * Returns: none
+ * Notes: the unsigned values are the width's low bits of a random word, and
+ *        the signed ones the same bits sign extended, so every one fits
+ */
+void fill_values(bench_inputs *inputs, unsigned width, uint64_t *random)
+{
+        for (unsigned i = 0; i < INPUTS; i++) {
+                uint64_t bits = next_random(random) >> (64 - width);
+                inputs->values[i] = bits;
+                inputs->svalues[i] = Bitpack_gets(bits, width, 0);
+        }
+}
+
+/*
+ * Name: time_op
+ * Purpose: find how long one call of a function takes
+ * Parameters: which of the OP_ functions, the inputs, the width and lsb of
+ *             the field (for the Bitpack functions), the profile (for pack
+ *             and unpack), how many times to time it
+ * Returns: the best time of a call, in nanoseconds
+ * Notes: the number of passes over the inputs is doubled until one timing
+ *        takes TARGET_SECONDS, so the clock's resolution doesn't matter
+ */
+double time_op(unsigned op, const bench_inputs *inputs, unsigned width,
+                                unsigned lsb, const profile40 *profile,
+                                unsigned reps)
+{
+        /* keeps the compiler from dropping the calls, whose results are xored
+         * into it */
+        static volatile uint64_t sink;
+
+        unsigned passes = 1;
+        double start = now();
+        sink ^= run_op(op, inputs, width, lsb, profile, passes);
+        while (now() - start < TARGET_SECONDS) {
+                passes *= 2;
+                start = now();
+                sink ^= run_op(op, inputs, width, lsb, profile, passes);
+        }
+
+        double best = 0;
+        for (unsigned rep = 0; rep < reps; rep++) {
+                start = now();
+                sink ^= run_op(op, inputs, width, lsb, profile, passes);
+                double seconds = now() - start;
+                if (rep == 0 || seconds < best) {
+                        best = seconds;
+                }
+        }
+        return best * 1e9 / ((double) passes * INPUTS);
+}
+
+/*
+ * Name: run_op
+ * Purpose: call a function on every input, a number of times over
+ * Parameters: which of the OP_ functions, the inputs, the width and lsb of
+ *             the field, the profile, the number of passes over the inputs
+ * Returns: every result xored together
+ * Notes: each call's word comes from the last call's result as well as the
+ *        table, so calls can't be moved out of the loop
+ */
+uint64_t run_op(unsigned op, const bench_inputs *inputs, unsigned width,
+                unsigned lsb, const profile40 *profile, unsigned passes)
+{
+        uint64_t acc = 0;
+        uint64_t word;
+        comp_avg_ints ints;
+        for (unsigned pass = 0; pass < passes; pass++) {
+                for (unsigned i = 0; i < INPUTS; i++) {
+                        uint64_t in = inputs->words[i] ^ (acc & 1);
+                        switch (op) {
+                        case OP_FITSU:
+                                acc ^= Bitpack_fitsu(in, width);
+                                break;
+                        case OP_FITSS:
+                                acc ^= Bitpack_fitss(in, width);
+                                break;
+                        case OP_GETU:
+                                acc ^= Bitpack_getu(in, width, lsb);
+                                break;
+                        case OP_GETS:
+                                acc ^= Bitpack_gets(in, width, lsb);
+                                break;
+                        case OP_NEWU:
+                                acc ^= Bitpack_newu(in, width, lsb,
+                                                        inputs->values[i]);
+                                break;
+                        case OP_NEWS:
+                                acc ^= Bitpack_news(in, width, lsb,
+                                                        inputs->svalues[i]);
+                                break;
+                        case OP_NEWU_CHECKED:
+                                Bitpack_newu_checked(in, width, lsb,
+                                                inputs->values[i], &word);
+                                acc ^= word;
+                                break;
+                        case OP_NEWS_CHECKED:
+                                Bitpack_news_checked(in, width, lsb,
+                                                inputs->svalues[i], &word);
+                                acc ^= word;
+                                break;
+                        case OP_PACK:
+                                profile->pack(profile, &inputs->ints[i],
+                                                                        &word);
+                                acc ^= word;
+                                break;
+                        case OP_UNPACK:
+                                profile->unpack(profile, in, &ints);
+                                acc ^= ints.a ^ ints.b ^ ints.reddiff_avg;
+                                break;
+                        default:
+                                assert(0);
+                        }
+                }
+        }
+        return acc;
+}
+
+/*
+ * Name: print_result
+ * Purpose: print one result as a line of the JSON report
+ * Parameters: whether it is the first result (cleared once printed), the
+ *             function's name, the profile's name (NULL for the Bitpack
+ *             functions), the width and lsb of the field (-1 for none), and
+ *             the time of one call
+ * Returns: none
+ * Notes: none
+ */
+void print_result(bool *first, const char *name, const char *profile,
+                                int width, int lsb, double ns_per_op)
+{
+        printf("%s    {\"function\": \"%s\"", *first ? "" : ",\n", name);
+        if (profile != NULL) {
+                printf(", \"profile\": \"%s\"", profile);
+        }
+        if (width >= 0) {
+                printf(", \"width\": %d", width);
+        }
+        if (lsb >= 0) {
+                printf(", \"lsb\": %d", lsb);
+        }
+        printf(", \"ns_per_op\": %.3f}", ns_per_op);
+        *first = false;
+}
+
+/*
+ * Name: now
+ * Purpose: read the monotonic clock
+ * Parameters: none
+ * Returns: the time in seconds
+ * Notes: none
+ */
+double now(void)
+{
+        struct timespec time;
+        clock_gettime(CLOCK_MONOTONIC, &time);
+        return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+#undef DEFAULT_REPS
+#undef INPUTS
+#undef TARGET_SECONDS
+#undef SEED
+#undef OP_FITSU
+#undef OP_FITSS
+#undef OP_GETU
+#undef OP_GETS
+#undef OP_NEWU
+#undef OP_NEWS
+#undef OP_NEWU_CHECKED
+#undef OP_NEWS_CHECKED
+#undef OP_PACK
+#undef OP_UNPACK
@@ -0,0 +1,29 @@
+/**************************************************************
+ *
+ *                     bitpack_checked.h
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  Interface for versions of Bitpack_newu and
+ *               Bitpack_news that report a value that does not
+ *               fit by returning false instead of raising
+ *               Bitpack_Overflow. CII exceptions go through one
+ *               process wide handler stack, so these are the
+ *               ones to use from more than one thread.
+ *
+ **************************************************************/
+
+#ifndef BITPACK_CHECKED_INCLUDED
+#define BITPACK_CHECKED_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+
+bool Bitpack_newu_checked(uint64_t word, unsigned width, unsigned lsb,
+                                        uint64_t value, uint64_t *result);
+bool Bitpack_news_checked(uint64_t word, unsigned width, unsigned lsb,
+                                        int64_t value, uint64_t *result);
+
+#endif
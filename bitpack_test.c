@@ -1,12 +1,42 @@
 #include "bitpack.h"
+#include "bitpack_checked.h"
+#include "profile40.h"
+#include "except.h"
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "assert.h"
 
-int main() {
+#define DEFAULT_CASES 1000000
+#define SEED UINT64_C(0xb17ac4)
+
+/* Helper functions */
+static inline uint64_t next_random(uint64_t *state);
+uint64_t random_value(uint64_t *state, unsigned width);
+bool ref_fitsu(uint64_t n, unsigned width);
+bool ref_fitss(int64_t n, unsigned width);
+uint64_t ref_getu(uint64_t word, unsigned width, unsigned lsb);
+int64_t ref_gets(uint64_t word, unsigned width, unsigned lsb);
+uint64_t ref_newu(uint64_t word, unsigned width, unsigned lsb,
+                                                        uint64_t value);
+void check_field(uint64_t word, unsigned width, unsigned lsb, uint64_t value);
+void check_profile(const profile40 *profile, uint64_t word,
+                                                const comp_avg_ints *ints);
+void random_ints(uint64_t *state, const profile40 *profile,
+                                                        comp_avg_ints *ints);
+
+/*
+ * The fixed cases first, then a differential fuzz of everything that packs
+ * bits: bitpack.c against a bit at a time reference, the raising functions
+ * against the _checked ones, and each profile's pack and unpack kernels
+ * against Bitpack fields. Every width and lsb is tried with the words and
+ * values at the edges of its field, then "bitpack_test [cases [seed]]"
+ * random cases (1000000 by default).
+ */
+int main(int argc, char *argv[]) {
         uint64_t word = 1238478491; 
         unsigned width = 34;
-        unsigned width2 = 55;
+        unsigned width2 = 15;
         unsigned lsb = 13;
         unsigned lsb2 = 49;
         uint64_t u_num = 62946;
@@ -15,6 +45,13 @@ int main() {
         assert(Bitpack_getu(Bitpack_newu(word, width, lsb, u_num), width, lsb) == u_num);
         assert(Bitpack_gets(Bitpack_news(word, width, lsb, s_num), width, lsb) == s_num);
 
+        uint64_t checked;
+        assert(Bitpack_newu_checked(word, width, lsb, u_num, &checked) && checked == Bitpack_newu(word, width, lsb, u_num));
+        assert(Bitpack_news_checked(word, width, lsb, -s_num, &checked) && checked == Bitpack_news(word, width, lsb, -s_num));
+        assert(!Bitpack_newu_checked(word, 4, lsb, 16, &checked));
+        assert(!Bitpack_news_checked(word, 4, lsb, 8, &checked));
+        assert(!Bitpack_newu_checked(word, width, 40, u_num, &checked));
+
         assert(Bitpack_getu(Bitpack_newu(word, width, lsb, u_num), width2, lsb2) == Bitpack_getu(word, width2, lsb2));
         assert(Bitpack_gets(Bitpack_news(word, width, lsb, s_num), width2, lsb2) == Bitpack_gets(word, width2, lsb2));
         
@@ -49,5 +86,269 @@ int main() {
         // uint64_t new1 = Bitpack_news(word, width, lsb, field1);
         // new1 = Bitpack_getu(new1, width, lsb);
         // printf("Original: %ld\nNew: %ld\n", original1, new1);
+
+        unsigned long cases = argc > 1 ? strtoul(argv[1], NULL, 10) :
+                                                                DEFAULT_CASES;
+        uint64_t random = argc > 2 ? strtoull(argv[2], NULL, 0) : SEED;
+
+        /* every field, with the words and values at its edges */
+        const uint64_t edge_words[] = {0, ~UINT64_C(0), UINT64_C(1) << 63, 1,
+                        UINT64_C(0xaaaaaaaaaaaaaaaa),
+                        UINT64_C(0x5555555555555555)};
+        unsigned long checked_fields = 0;
+        for (unsigned w = 0; w <= 64; w++) {
+                uint64_t top = w == 0 ? 0 : UINT64_C(1) << (w - 1);
+                uint64_t max = w == 64 ? ~UINT64_C(0) : (top << 1) - 1;
+                const uint64_t edge_values[] = {0, 1, max, max + 1, top - 1,
+                                top, -top, -top - 1, ~UINT64_C(0),
+                                UINT64_C(1) << 63, (UINT64_C(1) << 63) - 1};
+                for (unsigned l = 0; w + l <= 64; l++) {
+                        for (unsigned i = 0; i < sizeof(edge_words) /
+                                                sizeof(edge_words[0]); i++) {
+                                for (unsigned j = 0; j < sizeof(edge_values) /
+                                                sizeof(edge_values[0]); j++) {
+                                        check_field(edge_words[i], w, l,
+                                                        edge_values[j]);
+                                        checked_fields++;
+                                }
+                        }
+                }
+        }
+
+        for (unsigned long n = 0; n < cases; n++) {
+                unsigned w = next_random(&random) % 65;
+                unsigned l = next_random(&random) % (65 - w);
+                check_field(next_random(&random), w, l,
+                                                random_value(&random, w));
+                checked_fields++;
+
+                const profile40 *profile;
+                for (unsigned id = 0; (profile = profile40_get(id)) != NULL;
+                                                                id++) {
+                        comp_avg_ints ints;
+                        random_ints(&random, profile, &ints);
+                        check_profile(profile, next_random(&random), &ints);
+                }
+        }
+
+        printf("bitpack_test: ok (%lu fields)\n", checked_fields);
         return 0;
-}
\ No newline at end of file
+}
+
+/*
+ * Name: next_random
+ * Purpose: step a splitmix64 generator
+ * Parameters: the generator's state
+ * Returns: the next 64 random bits
+ * Notes: none
+ */
+static inline uint64_t next_random(uint64_t *state)
+{
+        uint64_t z = (*state += UINT64_C(0x9e3779b97f4a7c15));
+        z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+        z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+        return z ^ (z >> 31);
+}
+
+/*
+ * Name: random_value
+ * Purpose: make a value to put in a field
+ * Parameters: the generator's state, the width of the field
+ * Returns: the value
+ * Notes: half are random 64 bit values, which mostly don't fit, and half are
+ *        random values a bit either side of the field's width, which fit
+ *        about half the time, signed or unsigned
+ */
+uint64_t random_value(uint64_t *state, unsigned width)
+{
+        uint64_t value = next_random(state);
+        if (value & 1) {
+                return value;
+        }
+        unsigned bits = width + next_random(state) % 3;
+        bits = bits > 64 ? 64 : bits;
+        value = bits == 0 ? 0 : value >> (64 - bits);
+        return next_random(state) & 1 ? value : -value;
+}
+
+/*
+ * Name: ref_fitsu, ref_fitss, ref_getu, ref_gets, ref_newu
+ * Purpose: the reference versions of the Bitpack functions, which go a bit at
+ *          a time
+ * Parameters: as for the Bitpack function
+ * Returns: as for the Bitpack function
+ * Notes: ref_newu doesn't check that the value fits; its bits above the width
+ *        are ignored
+ */
+bool ref_fitsu(uint64_t n, unsigned width)
+{
+        for (unsigned i = width; i < 64; i++) {
+                if ((n >> i) & 1) {
+                        return false;
+                }
+        }
+        return true;
+}
+
+bool ref_fitss(int64_t n, unsigned width)
+{
+        if (width == 0) {
+                return false;
+        }
+        uint64_t sign = (uint64_t) n >> 63;
+        for (unsigned i = width - 1; i < 64; i++) {
+                if ((((uint64_t) n >> i) & 1) != sign) {
+                        return false;
+                }
+        }
+        return true;
+}
+
+uint64_t ref_getu(uint64_t word, unsigned width, unsigned lsb)
+{
+        uint64_t value = 0;
+        for (unsigned i = 0; i < width; i++) {
+                value |= ((word >> (lsb + i)) & 1) << i;
+        }
+        return value;
+}
+
+int64_t ref_gets(uint64_t word, unsigned width, unsigned lsb)
+{
+        uint64_t value = ref_getu(word, width, lsb);
+        if (width > 0 && (value >> (width - 1)) & 1) {
+                for (unsigned i = width; i < 64; i++) {
+                        value |= UINT64_C(1) << i;
+                }
+        }
+        return (int64_t) value;
+}
+
+uint64_t ref_newu(uint64_t word, unsigned width, unsigned lsb, uint64_t value)
+{
+        for (unsigned i = 0; i < width; i++) {
+                word &= ~(UINT64_C(1) << (lsb + i));
+                word |= ((value >> i) & 1) << (lsb + i);
+        }
+        return word;
+}
+
+/*
+ * Name: check_field
+ * Purpose: check every Bitpack function on one field against the reference
+ * Parameters: the word, the width and lsb of the field, the value to put in
+ *             it (also tried as a signed value)
+ * Returns: none
+ * Notes: width + lsb must be at most 64. Bitpack_newu and Bitpack_news must
+ *        raise Bitpack_Overflow exactly when the _checked versions return
+ *        false, and give the same word when they don't
+ */
+void check_field(uint64_t word, unsigned width, unsigned lsb, uint64_t value)
+{
+        int64_t svalue = (int64_t) value;
+        bool fitsu = ref_fitsu(value, width);
+        bool fitss = ref_fitss(svalue, width);
+        assert(Bitpack_fitsu(value, width) == fitsu);
+        assert(Bitpack_fitss(svalue, width) == fitss);
+        assert(Bitpack_getu(word, width, lsb) == ref_getu(word, width, lsb));
+        assert(Bitpack_gets(word, width, lsb) == ref_gets(word, width, lsb));
+
+        uint64_t checked = word;
+        assert(Bitpack_newu_checked(word, width, lsb, value, &checked) ==
+                                                                        fitsu);
+        assert(checked == (fitsu ? ref_newu(word, width, lsb, value) : word));
+        volatile bool raised = false;
+        uint64_t packed = word;
+        TRY
+                packed = Bitpack_newu(word, width, lsb, value);
+        EXCEPT(Bitpack_Overflow)
+                raised = true;
+        END_TRY;
+        assert(raised == !fitsu && packed == checked);
+        if (fitsu) {
+                assert(Bitpack_getu(packed, width, lsb) == value);
+        }
+
+        checked = word;
+        assert(Bitpack_news_checked(word, width, lsb, svalue, &checked) ==
+                                                                        fitss);
+        assert(checked == (fitss ? ref_newu(word, width, lsb, value) : word));
+        raised = false;
+        packed = word;
+        TRY
+                packed = Bitpack_news(word, width, lsb, svalue);
+        EXCEPT(Bitpack_Overflow)
+                raised = true;
+        END_TRY;
+        assert(raised == !fitss && packed == checked);
+        if (fitss) {
+                assert(Bitpack_gets(packed, width, lsb) == svalue);
+        }
+}
+
+/*
+ * Name: check_profile
+ * Purpose: check a profile's pack and unpack kernels against Bitpack fields
+ * Parameters: the profile, a codeword to unpack, values to pack
+ * Returns: none
+ * Notes: the fields are a, b, c, d, Pb, Pr from the most significant end down
+ *        to bit 0. Bits of the codeword above the fields are ignored
+ */
+void check_profile(const profile40 *profile, uint64_t word,
+                                                const comp_avg_ints *ints)
+{
+        unsigned wa = profile->width_a, wbcd = profile->width_bcd;
+        unsigned wc = profile->width_chroma;
+        unsigned lsb_d = 2 * wc, lsb_c = lsb_d + wbcd, lsb_b = lsb_c + wbcd;
+        unsigned lsb_a = lsb_b + wbcd;
+
+        comp_avg_ints unpacked;
+        profile->unpack(profile, word, &unpacked);
+        assert(unpacked.reddiff_avg == Bitpack_getu(word, wc, 0));
+        assert(unpacked.bluediff_avg == Bitpack_getu(word, wc, wc));
+        assert(unpacked.d == Bitpack_gets(word, wbcd, lsb_d));
+        assert(unpacked.c == Bitpack_gets(word, wbcd, lsb_c));
+        assert(unpacked.b == Bitpack_gets(word, wbcd, lsb_b));
+        assert(unpacked.a == Bitpack_getu(word, wa, lsb_a));
+        uint64_t repacked;
+        assert(profile->pack(profile, &unpacked, &repacked));
+        assert(repacked == Bitpack_getu(word, lsb_a + wa, 0));
+
+        uint64_t expected = 0;
+        bool fits = Bitpack_newu_checked(expected, wc, 0, ints->reddiff_avg,
+                                                                &expected) &&
+                Bitpack_newu_checked(expected, wc, wc, ints->bluediff_avg,
+                                                                &expected) &&
+                Bitpack_news_checked(expected, wbcd, lsb_d, ints->d,
+                                                                &expected) &&
+                Bitpack_news_checked(expected, wbcd, lsb_c, ints->c,
+                                                                &expected) &&
+                Bitpack_news_checked(expected, wbcd, lsb_b, ints->b,
+                                                                &expected) &&
+                Bitpack_newu_checked(expected, wa, lsb_a, ints->a, &expected);
+        uint64_t packed = word;
+        assert(profile->pack(profile, ints, &packed) == fits);
+        assert(packed == (fits ? expected : word));
+}
+
+/*
+ * Name: random_ints
+ * Purpose: make the quantized values of a block to pack
+ * Parameters: the generator's state, the profile, where to store the values
+ * Returns: none
+ * Notes: each value is made by random_value for the width of its field, so
+ *        most blocks have a value that doesn't fit
+ */
+void random_ints(uint64_t *state, const profile40 *profile,
+                                                        comp_avg_ints *ints)
+{
+        ints->reddiff_avg = random_value(state, profile->width_chroma);
+        ints->bluediff_avg = random_value(state, profile->width_chroma);
+        ints->a = random_value(state, profile->width_a);
+        ints->b = random_value(state, profile->width_bcd);
+        ints->c = random_value(state, profile->width_bcd);
+        ints->d = random_value(state, profile->width_bcd);
+}
+
+#undef DEFAULT_CASES
+#undef SEED
@@ -0,0 +1,499 @@
+/**************************************************************
+ *
+ *                     codec40.c
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  Implementation of the in-memory codec. Runs the
+ *               same pipeline stages as 40image, only with
+ *               buffer versions of the first and last stage.
+ *               Arguments are checked here, before any stage
+ *               runs, so that none of the assertions in the
+ *               stages can fire on bad input.
+ *
+ **************************************************************/
+
+#include <limits.h>
+#include <stdarg.h>
+#include "codec40.h"
+#include "compress.h"
+#include "decompress.h"
+#include "stats40.h"
+
+#define BLOCKSIZE 2
+#define RGB8_SIZE 3
+
+/* Helper functions */
+static void json_append(char *out, size_t out_cap, size_t *len,
+                                                const char *format, ...);
+static void stage_json_append(char *out, size_t out_cap, size_t *len,
+                const char *separator, const Codec40_stage_stats *stage);
+
+/*
+ * Name: Codec40_strerror
+ * Purpose: describe a status code
+ * Parameters: the status code
+ * Returns: a string describing it (never NULL)
+ * Notes: the strings are constants, so this is safe from any thread
+ */
+const char *Codec40_strerror(Codec40_status status)
+{
+        switch (status) {
+        case CODEC40_OK:
+                return "success";
+        case CODEC40_EINVAL:
+                return "invalid argument";
+        case CODEC40_ENOSPC:
+                return "output buffer too small";
+        case CODEC40_EFORMAT:
+                return "not a compressed image";
+        case CODEC40_ETRUNCATED:
+                return "compressed image is truncated";
+        case CODEC40_EOVERFLOW:
+                return "value does not fit in its codeword field";
+        case CODEC40_ECHECKSUM:
+                return "tile checksum mismatch";
+        }
+        return "unknown error";
+}
+
+/*
+ * Name: Codec40_compressed_size
+ * Purpose: find how big a buffer Codec40_compress needs
+ * Parameters: the width and height of the image to be compressed
+ * Returns: the exact number of bytes the compressed image takes
+ * Notes: odd dimensions are trimmed by one, like 40image -c does
+ */
+size_t Codec40_compressed_size(unsigned width, unsigned height)
+{
+        return compressed_size(width, height);
+}
+
+/*
+ * Name: Codec40_compress
+ * Purpose: compress an image held in memory into a caller supplied buffer
+ * Parameters: the rgb triples of the image, its width and height, the buffer
+ *             to write the compressed image to and its capacity in bytes,
+ *             where to store the number of bytes written
+ * Returns: CODEC40_OK, CODEC40_EINVAL if a pointer is NULL or a dimension is
+ *          below 2 or above INT_MAX, CODEC40_ENOSPC if out_cap is smaller than
+ *          Codec40_compressed_size, CODEC40_EOVERFLOW if a codeword could not
+ *          be packed
+ * Notes: *out_len is only set when CODEC40_OK is returned
+ */
+Codec40_status Codec40_compress(const unsigned char *rgb, unsigned width,
+                                unsigned height, unsigned char *out,
+                                size_t out_cap, size_t *out_len)
+{
+        return Codec40_compress_stats(rgb, width, height, out, out_cap,
+                                                        out_len, NULL);
+}
+
+/*
+ * Name: Codec40_compress_stats
+ * Purpose: compress an image held in memory, and report what quantizing did
+ *          to each codeword field
+ * Parameters: the same as Codec40_compress, and the stats to fill in (NULL
+ *             for none, which makes this Codec40_compress)
+ * Returns: the same as Codec40_compress
+ * Notes: stats is filled in as the blocks are quantized, so it costs one
+ *        unquantize per block and no second pass. It is only complete when
+ *        CODEC40_OK is returned
+ */
+Codec40_status Codec40_compress_stats(const unsigned char *rgb,
+                        unsigned width, unsigned height, unsigned char *out,
+                        size_t out_cap, size_t *out_len,
+                        Codec40_quant_stats *stats)
+{
+        return Codec40_compress_timed(rgb, width, height, out, out_cap,
+                                                        out_len, stats, NULL);
+}
+
+/*
+ * Name: Codec40_compress_timed
+ * Purpose: compress an image held in memory, and report what each stage of
+ *          the pipeline cost
+ * Parameters: the same as Codec40_compress_stats, and the run stats to fill
+ *             in (NULL for none, which makes this Codec40_compress_stats)
+ * Returns: the same as Codec40_compress
+ * Notes: run is only complete when CODEC40_OK is returned. Its stages are
+ *        rgb8_to_rgb_int, then the compress.c stages up to
+ *        comp_avg_ints_to_buffer
+ */
+Codec40_status Codec40_compress_timed(const unsigned char *rgb,
+                        unsigned width, unsigned height, unsigned char *out,
+                        size_t out_cap, size_t *out_len,
+                        Codec40_quant_stats *stats, Codec40_run_stats *run)
+{
+        if (rgb == NULL || out == NULL || out_len == NULL ||
+            width < BLOCKSIZE || height < BLOCKSIZE ||
+            width > INT_MAX || height > INT_MAX) {
+                return CODEC40_EINVAL;
+        }
+        if (out_cap < Codec40_compressed_size(width, height)) {
+                return CODEC40_ENOSPC;
+        }
+
+        if (stats != NULL) {
+                init_quant_stats(stats, PROFILE40_STANDARD);
+        }
+        stats40_start(run);
+        Pnm_ppm original = rgb8_to_rgb_int(rgb, width, height);
+        stats40_stage(run, "rgb8_to_rgb_int");
+        UArray2_T rgb_float_array = rgb_int_to_rgb_float(original);
+        stats40_stage(run, "rgb_int_to_rgb_float");
+        UArray2b_T comp_video_array = rgb_float_to_component_video(
+                                                rgb_float_array, BLOCKSIZE);
+        stats40_stage(run, "rgb_float_to_component_video");
+        UArray2_T comp_avg_float_array = comp_video_floats_to_comp_avg_float(
+                                                comp_video_array, stats);
+        stats40_stage(run, "comp_video_floats_to_comp_avg_float");
+        UArray2_T comp_avg_int_array =
+                        comp_avg_floats_to_comp_avg_ints(comp_avg_float_array,
+                                PROFILE40_STANDARD, COMP40_COLOR_YPBPR, stats);
+        stats40_stage(run, "comp_avg_floats_to_comp_avg_ints");
+        bool packed = comp_avg_ints_to_buffer(comp_avg_int_array, out,
+                                                        out_cap, out_len);
+        stats40_stage(run, "comp_avg_ints_to_buffer");
+        return packed ? CODEC40_OK : CODEC40_EOVERFLOW;
+}
+
+/*
+ * Name: Codec40_image_size
+ * Purpose: get the dimensions of a compressed image without decoding it
+ * Parameters: the compressed image and its length in bytes, pointers to where
+ *             the width and height should be stored
+ * Returns: CODEC40_OK, CODEC40_EINVAL if a pointer is NULL, CODEC40_EFORMAT if
+ *          in doesn't start with a valid header for an image of at least one
+ *          block, CODEC40_ETRUNCATED if in is too short to hold every codeword
+ *          (format 2) or the tile index (format 3)
+ * Notes: *width and *height are only set when CODEC40_OK is returned
+ */
+Codec40_status Codec40_image_size(const unsigned char *in, size_t in_len,
+                                        unsigned *width, unsigned *height)
+{
+        if (in == NULL || width == NULL || height == NULL) {
+                return CODEC40_EINVAL;
+        }
+
+        comp40_header header;
+        Codec40_status status = parse_comp40_header(in, in_len, &header);
+        if (status != CODEC40_OK) {
+                return status;
+        }
+        size_t body_size = header.version == COMP40_TILED ?
+                comp40_index_size(&header) :
+                (size_t) (header.width / header.block_size) *
+                        (header.height / header.block_size) *
+                        profile40_get(header.profile)->word_bytes;
+        if (in_len - header.length < body_size) {
+                return CODEC40_ETRUNCATED;
+        }
+
+        *width = header.width - header.width % header.block_size;
+        *height = header.height - header.height % header.block_size;
+        return CODEC40_OK;
+}
+
+/*
+ * Name: Codec40_decompressed_size
+ * Purpose: find how big a buffer Codec40_decompress needs
+ * Parameters: the compressed image and its length in bytes, where to store the
+ *             number of bytes of rgb triples the image decompresses to
+ * Returns: the same status codes as Codec40_image_size
+ * Notes: *size is only set when CODEC40_OK is returned
+ */
+Codec40_status Codec40_decompressed_size(const unsigned char *in,
+                                                size_t in_len, size_t *size)
+{
+        if (size == NULL) {
+                return CODEC40_EINVAL;
+        }
+
+        unsigned width, height;
+        Codec40_status status = Codec40_image_size(in, in_len, &width, &height);
+        if (status == CODEC40_OK) {
+                *size = (size_t) width * (size_t) height * RGB8_SIZE;
+        }
+        return status;
+}
+
+/*
+ * Name: Codec40_decompress
+ * Purpose: decompress an image held in memory into a caller supplied buffer
+ * Parameters: the compressed image and its length in bytes, the buffer to
+ *             write the rgb triples to and its capacity in bytes, where to
+ *             store the number of bytes written
+ * Returns: the same status codes as Codec40_image_size, CODEC40_ENOSPC if
+ *          rgb_cap is smaller than Codec40_decompressed_size, or for a tiled
+ *          image CODEC40_ECHECKSUM if a tile is corrupt (or CODEC40_ETRUNCATED
+ *          if it is missing)
+ * Notes: *rgb_len is only set when CODEC40_OK is returned
+ */
+Codec40_status Codec40_decompress(const unsigned char *in, size_t in_len,
+                                        unsigned char *rgb, size_t rgb_cap,
+                                        size_t *rgb_len)
+{
+        return Codec40_decompress_timed(in, in_len, rgb, rgb_cap, rgb_len,
+                                                                        NULL);
+}
+
+/*
+ * Name: Codec40_decompress_timed
+ * Purpose: decompress an image held in memory, and report what each stage of
+ *          the pipeline cost
+ * Parameters: the same as Codec40_decompress, and the run stats to fill in
+ *             (NULL for none, which makes this Codec40_decompress)
+ * Returns: the same as Codec40_decompress
+ * Notes: run is only complete when CODEC40_OK is returned. Its stages are
+ *        buffer_to_comp_avg_ints, then the decompress.c stages up to
+ *        rgb_int_to_rgb8
+ */
+Codec40_status Codec40_decompress_timed(const unsigned char *in,
+                        size_t in_len, unsigned char *rgb, size_t rgb_cap,
+                        size_t *rgb_len, Codec40_run_stats *run)
+{
+        if (rgb == NULL || rgb_len == NULL) {
+                return CODEC40_EINVAL;
+        }
+
+        size_t size;
+        Codec40_status status = Codec40_decompressed_size(in, in_len, &size);
+        if (status != CODEC40_OK) {
+                return status;
+        }
+        if (rgb_cap < size) {
+                return CODEC40_ENOSPC;
+        }
+
+        comp40_header header;
+        stats40_start(run);
+        UArray2_T comp_avg_int_array = buffer_to_comp_avg_ints(in, in_len,
+                                                        &header, &status);
+        stats40_stage(run, "buffer_to_comp_avg_ints");
+        if (comp_avg_int_array == NULL) {
+                return status;
+        }
+        UArray2_T comp_avg_float_array =
+                        comp_avg_ints_to_comp_avg_floats(comp_avg_int_array,
+                                        header.profile, header.color);
+        stats40_stage(run, "comp_avg_ints_to_comp_avg_floats");
+        Pnm_ppm output = comp_avg_float_to_rgb_int(comp_avg_float_array,
+                                        header.block_size, header.color);
+        stats40_stage(run, "comp_avg_float_to_rgb_int");
+        rgb_int_to_rgb8(output, rgb);
+        stats40_stage(run, "rgb_int_to_rgb8");
+        *rgb_len = size;
+        return CODEC40_OK;
+}
+
+/*
+ * Name: Codec40_preview_size
+ * Purpose: get the dimensions of a compressed image's preview without decoding
+ *          it
+ * Parameters: the compressed image and its length in bytes, the scale (2, 4 or
+ *             8), pointers to where the width and height should be stored
+ * Returns: the same status codes as Codec40_image_size, or CODEC40_EINVAL if
+ *          the scale is not supported or smaller than the image's blocks
+ * Notes: *width and *height are only set when CODEC40_OK is returned
+ */
+Codec40_status Codec40_preview_size(const unsigned char *in, size_t in_len,
+                        unsigned scale, unsigned *width, unsigned *height)
+{
+        unsigned image_width, image_height;
+        Codec40_status status = Codec40_image_size(in, in_len, &image_width,
+                                                                &image_height);
+        if (status != CODEC40_OK) {
+                return status;
+        }
+
+        /* Codec40_image_size has already checked the header */
+        comp40_header header;
+        parse_comp40_header(in, in_len, &header);
+        if (!valid_preview_scale(scale, header.block_size)) {
+                return CODEC40_EINVAL;
+        }
+        *width = preview_size(image_width, header.block_size, scale);
+        *height = preview_size(image_height, header.block_size, scale);
+        return CODEC40_OK;
+}
+
+/*
+ * Name: Codec40_decompress_preview
+ * Purpose: decode a downscaled version of a compressed image into a caller
+ *          supplied buffer, from the a, Pb and Pr of its blocks only
+ * Parameters: the compressed image and its length in bytes, the scale (2, 4 or
+ *             8), the buffer to write the rgb triples to and its capacity in
+ *             bytes, where to store the number of bytes written
+ * Returns: the same status codes as Codec40_decompress, or CODEC40_EINVAL if
+ *          the scale is not supported or smaller than the image's blocks
+ * Notes: *rgb_len is only set when CODEC40_OK is returned. The buffer needs
+ *        room for the Codec40_preview_size width times height rgb triples
+ */
+Codec40_status Codec40_decompress_preview(const unsigned char *in,
+                        size_t in_len, unsigned scale, unsigned char *rgb,
+                        size_t rgb_cap, size_t *rgb_len)
+{
+        if (rgb == NULL || rgb_len == NULL) {
+                return CODEC40_EINVAL;
+        }
+
+        unsigned width, height;
+        Codec40_status status = Codec40_preview_size(in, in_len, scale,
+                                                        &width, &height);
+        if (status != CODEC40_OK) {
+                return status;
+        }
+        size_t size = (size_t) width * (size_t) height * RGB8_SIZE;
+        if (rgb_cap < size) {
+                return CODEC40_ENOSPC;
+        }
+
+        comp40_header header;
+        UArray2_T comp_avg_int_array = buffer_to_comp_avg_ints(in, in_len,
+                                                        &header, &status);
+        if (comp_avg_int_array == NULL) {
+                return status;
+        }
+        rgb_int_to_rgb8(comp_avg_ints_to_preview(comp_avg_int_array, &header,
+                                                                scale), rgb);
+        *rgb_len = size;
+        return CODEC40_OK;
+}
+
+
+/*
+ * Name: Codec40_quant_stats_json
+ * Purpose: write quantization stats as JSON
+ * Parameters: the stats, the buffer to write to and its capacity in bytes
+ * Returns: the length of the JSON, '\0' not included, whether or not it fit
+ * Notes: stats must not be NULL; out may be NULL if out_cap is 0. Works like
+ *        snprintf: the output is cut short (but always terminated) when it
+ *        doesn't fit, so call once with no buffer to size it. Each field
+ *        lists its clamp counts, squared error and mean squared error per
+ *        block, and its histogram as an object from each quantized value
+ *        used to its count
+ */
+size_t Codec40_quant_stats_json(const Codec40_quant_stats *stats, char *out,
+                                                        size_t out_cap)
+{
+        static const char *names[CODEC40_FIELDS] = {
+                "a", "b", "c", "d", "pb", "pr"
+        };
+        size_t len = 0;
+        if (out_cap > 0) {
+                out[0] = '\0';
+        }
+        json_append(out, out_cap, &len, "{\"profile\": %u, \"blocks\": %llu, "
+                        "\"fields\": [", stats->profile,
+                        (unsigned long long) stats->blocks);
+        for (unsigned field = 0; field < CODEC40_FIELDS; field++) {
+                double mse = stats->blocks == 0 ? 0 :
+                                stats->squared_error[field] / stats->blocks;
+                json_append(out, out_cap, &len, "%s{\"name\": \"%s\", "
+                        "\"transform_clamps\": %llu, "
+                        "\"quantize_clamps\": %llu, "
+                        "\"squared_error\": %.9g, \"mse\": %.9g, "
+                        "\"histogram\": {", field == 0 ? "" : ", ",
+                        names[field],
+                        (unsigned long long) stats->transform_clamps[field],
+                        (unsigned long long) stats->quantize_clamps[field],
+                        stats->squared_error[field], mse);
+                bool first = true;
+                for (unsigned bin = 0; bin < stats->bins[field] &&
+                                        bin < CODEC40_MAX_BINS; bin++) {
+                        if (stats->histogram[field][bin] == 0) {
+                                continue;
+                        }
+                        json_append(out, out_cap, &len, "%s\"%lld\": %llu",
+                                first ? "" : ", ",
+                                (long long) (stats->first_value[field] + bin),
+                                (unsigned long long)
+                                        stats->histogram[field][bin]);
+                        first = false;
+                }
+                json_append(out, out_cap, &len, "}}");
+        }
+        json_append(out, out_cap, &len, "]}");
+        return len;
+}
+
+/*
+ * Name: Codec40_run_stats_json
+ * Purpose: write run stats as JSON
+ * Parameters: the stats, the buffer to write to and its capacity in bytes
+ * Returns: the length of the JSON, '\0' not included, whether or not it fit
+ * Notes: run must not be NULL; out may be NULL if out_cap is 0. Works like
+ *        Codec40_quant_stats_json. Lists each stage in the order it first ran
+ *        and then the total, with the same fields for each
+ */
+size_t Codec40_run_stats_json(const Codec40_run_stats *run, char *out,
+                                                        size_t out_cap)
+{
+        size_t len = 0;
+        if (out_cap > 0) {
+                out[0] = '\0';
+        }
+        json_append(out, out_cap, &len, "{\"stages\": [");
+        for (unsigned i = 0; i < run->stages; i++) {
+                stage_json_append(out, out_cap, &len, i == 0 ? "" : ", ",
+                                                        &run->stage[i]);
+        }
+
+        /* closed outside the loop, so a run with no stages is still JSON */
+        stage_json_append(out, out_cap, &len, "], \"total\": ", &run->total);
+        json_append(out, out_cap, &len, "}");
+        return len;
+}
+
+/*
+ * Name: stage_json_append
+ * Purpose: append one stage's statistics as a JSON object
+ * Parameters: the buffer and its capacity, the length written so far (moved
+ *             past the new text), the text to put before the object, and the
+ *             stage
+ * Returns: none
+ * Notes: see json_append
+ */
+static void stage_json_append(char *out, size_t out_cap, size_t *len,
+                const char *separator, const Codec40_stage_stats *stage)
+{
+        json_append(out, out_cap, len, "%s{\"name\": \"%s\", "
+                "\"wall_seconds\": %.6f, \"cpu_seconds\": %.6f, "
+                "\"allocations\": %llu, \"frees\": %llu, "
+                "\"bytes_allocated\": %llu, \"peak_rss_bytes\": %llu}",
+                separator, stage->name, stage->wall_seconds,
+                stage->cpu_seconds,
+                (unsigned long long) stage->allocations,
+                (unsigned long long) stage->frees,
+                (unsigned long long) stage->bytes_allocated,
+                (unsigned long long) stage->peak_rss_bytes);
+}
+
+/*
+ * Name: json_append
+ * Purpose: append formatted text to a buffer that may be too small
+ * Parameters: the buffer and its capacity, the length written so far (moved
+ *             past the new text), a printf format and its arguments
+ * Returns: none
+ * Notes: *len keeps counting past out_cap, so it ends up as the length the
+ *        whole text needs
+ */
+static void json_append(char *out, size_t out_cap, size_t *len,
+                                                const char *format, ...)
+{
+        va_list args;
+        va_start(args, format);
+        size_t room = *len < out_cap ? out_cap - *len : 0;
+        int written = vsnprintf(room > 0 ? out + *len : NULL, room, format,
+                                                                        args);
+        va_end(args);
+        if (written > 0) {
+                *len += written;
+        }
+}
+
+#undef BLOCKSIZE
+#undef RGB8_SIZE
@@ -0,0 +1,157 @@
+/**************************************************************
+ *
+ *                     codec40.h
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  Interface for compressing and decompressing
+ *               images held in memory. Unlike compress40 and
+ *               decompress40, nothing is read from a file or
+ *               written to standard output, so the codec can be
+ *               linked into another program (libcodec40).
+ *
+ *               Images are 8-bit rgb triples stored row major
+ *               with no padding between rows. Compressed data
+ *               is byte for byte what 40image -c writes, and
+ *               tiled images (40image -c --tile) decompress too.
+ *
+ *               Every function reports bad input through a
+ *               Codec40_status instead of an assertion or a CII
+ *               exception, and none of them keep state between
+ *               calls, so they can be called from many threads
+ *               at once. Running out of memory is still fatal.
+ *
+ *               Codec40_compress_stats also fills in a
+ *               Codec40_quant_stats: what the encoder did to
+ *               each codeword field, collected as the blocks go
+ *               by, so an image that needs a finer profile shows
+ *               up without decoding and diffing it.
+ *
+ *               Codec40_compress_timed and Codec40_decompress_timed
+ *               also fill in a Codec40_run_stats: the wall and CPU
+ *               time, allocations and peak resident set size of
+ *               each pipeline stage, so a slow job can be pinned
+ *               on I/O, allocation or arithmetic without a
+ *               profiler. CPU time, allocations and RSS are the
+ *               whole process's, so they include any other calls
+ *               running at the same time.
+ *
+ **************************************************************/
+
+#ifndef CODEC40_INCLUDED
+#define CODEC40_INCLUDED
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum Codec40_status {
+        CODEC40_OK = 0,
+        CODEC40_EINVAL,         /* NULL pointer or image too small/large */
+        CODEC40_ENOSPC,         /* output buffer smaller than needed */
+        CODEC40_EFORMAT,        /* input doesn't start with a COMP40 header */
+        CODEC40_ETRUNCATED,     /* input ends before the last codeword */
+        CODEC40_EOVERFLOW,      /* a value didn't fit in its codeword field */
+        CODEC40_ECHECKSUM       /* a tile's bytes don't match its CRC32C */
+} Codec40_status;
+
+/* codeword fields, in order: a, b, c, d, Pb, Pr */
+#define CODEC40_FIELDS 6
+
+/* histogram bins for the widest field of any profile (12 bits) */
+#define CODEC40_MAX_BINS 4096
+
+/*
+ * What quantizing did to each codeword field of an image. transform_clamps
+ * counts blocks whose a left [0, 1] or whose b, c or d left [-0.3, 0.3] before
+ * quantizing; quantize_clamps counts blocks whose scaled a, b, c or d didn't
+ * fit its field. squared_error adds up, over the blocks, the squared clamping
+ * error plus the squared difference between the clamped value and what the
+ * decoder will unquantize it to. histogram[f][i] counts the blocks quantized
+ * to first_value[f] + i, for the bins[f] values the field can hold. Grayscale
+ * images leave Pb and Pr empty
+ */
+typedef struct Codec40_quant_stats {
+        unsigned profile;
+        uint64_t blocks;
+        uint64_t transform_clamps[CODEC40_FIELDS];
+        uint64_t quantize_clamps[CODEC40_FIELDS];
+        double squared_error[CODEC40_FIELDS];
+        int64_t first_value[CODEC40_FIELDS];
+        unsigned bins[CODEC40_FIELDS];
+        uint64_t histogram[CODEC40_FIELDS][CODEC40_MAX_BINS];
+} Codec40_quant_stats;
+
+/* more stages than any pipeline has */
+#define CODEC40_MAX_STAGES 8
+
+/*
+ * What one stage of a pipeline cost: its name (a compress.c or decompress.c
+ * function), the wall clock and process CPU seconds it took, how many times
+ * it allocated (Mem_alloc, Mem_calloc or Mem_resize) and freed memory, the
+ * bytes it asked for, and the process's peak resident set size when it
+ * finished. The counts are 0 unless the program was linked with the Mem
+ * wrappers in alloc40.c
+ */
+typedef struct Codec40_stage_stats {
+        const char *name;
+        double wall_seconds;
+        double cpu_seconds;
+        uint64_t allocations;
+        uint64_t frees;
+        uint64_t bytes_allocated;
+        uint64_t peak_rss_bytes;
+} Codec40_stage_stats;
+
+/*
+ * What each stage of one compress or decompress cost, in the order the stages
+ * first ran (a stage run more than once, like the levels of a pyramid, adds
+ * up), and the run's total. mark holds the clocks and counters as they were
+ * when the stage being run started
+ */
+typedef struct Codec40_run_stats {
+        unsigned stages;
+        Codec40_stage_stats stage[CODEC40_MAX_STAGES];
+        Codec40_stage_stats total;
+        Codec40_stage_stats mark;
+} Codec40_run_stats;
+
+const char *Codec40_strerror(Codec40_status status);
+
+size_t Codec40_compressed_size(unsigned width, unsigned height);
+Codec40_status Codec40_compress(const unsigned char *rgb, unsigned width,
+                                unsigned height, unsigned char *out,
+                                size_t out_cap, size_t *out_len);
+Codec40_status Codec40_compress_stats(const unsigned char *rgb,
+                        unsigned width, unsigned height, unsigned char *out,
+                        size_t out_cap, size_t *out_len,
+                        Codec40_quant_stats *stats);
+Codec40_status Codec40_compress_timed(const unsigned char *rgb,
+                        unsigned width, unsigned height, unsigned char *out,
+                        size_t out_cap, size_t *out_len,
+                        Codec40_quant_stats *stats, Codec40_run_stats *run);
+size_t Codec40_quant_stats_json(const Codec40_quant_stats *stats, char *out,
+                                                        size_t out_cap);
+size_t Codec40_run_stats_json(const Codec40_run_stats *run, char *out,
+                                                        size_t out_cap);
+
+Codec40_status Codec40_image_size(const unsigned char *in, size_t in_len,
+                                        unsigned *width, unsigned *height);
+Codec40_status Codec40_decompressed_size(const unsigned char *in,
+                                                size_t in_len, size_t *size);
+Codec40_status Codec40_decompress(const unsigned char *in, size_t in_len,
+                                        unsigned char *rgb, size_t rgb_cap,
+                                        size_t *rgb_len);
+Codec40_status Codec40_decompress_timed(const unsigned char *in,
+                        size_t in_len, unsigned char *rgb, size_t rgb_cap,
+                        size_t *rgb_len, Codec40_run_stats *run);
+
+Codec40_status Codec40_preview_size(const unsigned char *in, size_t in_len,
+                        unsigned scale, unsigned *width, unsigned *height);
+Codec40_status Codec40_decompress_preview(const unsigned char *in,
+                        size_t in_len, unsigned scale, unsigned char *rgb,
+                        size_t rgb_cap, size_t *rgb_len);
+
+#endif
@@ -12,76 +12,117 @@
  **************************************************************/
 
 #include "compress.h"
+#include "decompress.h"
 
 /* Struct definitions */
 
 /*
- * Name: rgb_ints_closure
- * Contains: necessary information to pass into mapping function when converting
- *           from rgb ints to rgb floats - UArray2 of rgb ints, image
- *           denominator, image width and height
+ * Name: estimate_stratum
+ * Contains: one stratum of an estimate's sample - the rectangle of blocks (or
+ *           of tiles) it covers (first column and row, how many across and
+ *           down), how many blocks or tiles that is, and where its samples
+ *           start in the sample arrays and how many there are
  */
-struct rgb_ints_closure {
-        UArray2_T array;
-        float den;
-        int width;
-        int height;
+struct estimate_stratum {
+        unsigned first_col, first_row, cols, rows;
+        uint64_t units;
+        size_t first, samples;
 };
-typedef struct rgb_ints_closure rgb_ints_closure;
+typedef struct estimate_stratum estimate_stratum;
+
+#define DENOMINATOR 255
 
 /*
- * Name: comp_floats_closure
- * Contains: necessary information to pass into mapping function when performing
- *           pixel averaging - UArray2 of averaged component video floats,
- *           sequence to help with calculations
+ * An estimate splits the image into at most ESTIMATE_STRATA by ESTIMATE_STRATA
+ * strata and samples one block in ESTIMATE_SAMPLE_SHARE, but never fewer than
+ * ESTIMATE_MIN_SAMPLES blocks (or the whole image). Coded sizes get a block
+ * budget of the same size, spent on tiles drawn from at most
+ * ESTIMATE_TILE_STRATA by ESTIMATE_TILE_STRATA strata, about
+ * ESTIMATE_TILE_BLOCKS blocks in each, but never fewer than
+ * ESTIMATE_MIN_TILE_BLOCKS. Sampled coded sizes are models of the coder, not
+ * runs of it, so their intervals are never narrower than ESTIMATE_MODEL_ERROR
+ * of the size either side. ESTIMATE_Z is the normal quantile of a 95%
+ * confidence interval
  */
-struct comp_floats_closure {
-        UArray2_T comp_avg_float_arr;
-        Seq_T seq_avg;
-};
-typedef struct comp_floats_closure comp_floats_closure;
-
-#define A2 A2Methods_UArray2
-#define BLOCKSIZE 2
-
-#define SEQ_SIZE 4
-/* Bit packing literals */
-#define WIDTH_A 6
-#define WIDTH_B_C_D 6
-#define WIDTH_Pb_Pr 4
-#define LSB_A 26
-#define LSB_B 20
-#define LSB_C 14
-#define LSB_D 8
-#define LSB_Pb 4
-#define LSB_Pr 0
+#define ESTIMATE_STRATA 8
+#define ESTIMATE_SAMPLE_SHARE 512
+#define ESTIMATE_MIN_SAMPLES 1024
+#define ESTIMATE_TILE_STRATA 4
+#define ESTIMATE_TILE_BLOCKS 128
+#define ESTIMATE_MIN_TILE_BLOCKS 64
+#define ESTIMATE_MODEL_ERROR 0.03
+#define ESTIMATE_Z 1.96
+#define ESTIMATE_SEED UINT64_C(0x243f6a8885a308d3)
 
 /* Helper functions */
 float calculate_comp_video_nums(rgb_floats *curr_float_pixel, float red_num,
                                         float green_num, float blue_num);
-void rgb_int_to_rgb_float_apply(int col, int row, A2 pixmap, void *entry,
-                                                                void *cl);
-void rgb_float_to_component_video_apply(int col, int row, UArray2_T pixmap,
-                                                        void *entry, void *cl);
-void comp_video_floats_to_comp_avg_float_apply(int col, int row,
-                                UArray2b_T pixmap, void *entry, void *cl);
-void clear_seq(Seq_T seq);
-void comp_avg_floats_to_comp_avg_ints_apply(int col, int row, UArray2_T pixmap,
-                                                        void *entry, void *cl);
-void comp_avg_ints_to_out_apply(int col, int row, UArray2_T pixmap, void *entry,
-                                                                void *cl);
+UArray2b_T rgb_int_to_ycocg(Pnm_ppm original, unsigned blocksize);
+UArray2b_T rgb_int_to_gray(Pnm_ppm original, unsigned blocksize);
+size_t print_header(const comp40_header *header, FILE *output);
+bool comp_avg_ints_to_tile(UArray2_T comp_avg_ints_array,
+                        const profile40 *profile, unsigned first_col,
+                        unsigned first_row, unsigned cols, unsigned rows,
+                        unsigned char *out);
+size_t code_tile(unsigned char *words, unsigned cols, unsigned rows,
+                const profile40 *profile, unsigned coding, unsigned char *out,
+                uint32_t *tile_coding);
+void rgb_float_pixel_to_comp_video(rgb_floats *curr_float_pixel,
+                                        comp_video_floats *curr_video_pixel);
+void rgb_int_pixel_to_ycocg(const struct Pnm_rgb *curr_int_pixel,
+                float inverse_den, comp_video_floats *curr_video_pixel);
+void rgb_int_pixel_to_gray(const struct Pnm_rgb *curr_int_pixel,
+                float inverse_den, comp_video_floats *curr_video_pixel);
+void rgb_int_block_to_comp_avg_ints(Pnm_ppm original, unsigned col,
+                unsigned row, const comp40_header *format,
+                const profile40 *profile, comp_avg_ints *curr_avg_ints);
+estimate_stratum *split_strata(unsigned cols, unsigned rows, unsigned grid,
+                double wanted, unsigned *count, size_t *total);
+void estimate_tiled_size(Pnm_ppm original, const comp40_header *header,
+                const profile40 *profile, unsigned coding,
+                comp40_estimate *estimate);
+double sample_tile_bytes(Pnm_ppm original, const comp40_header *header,
+                const profile40 *profile, unsigned coding, unsigned tile_col,
+                unsigned tile_row, size_t samples, uint64_t *random,
+                double *variance);
+double field_entropy_bias(const size_t *counts, unsigned field,
+                        size_t samples, size_t blocks, double *overhead);
+uint32_t estimate_word(Pnm_ppm original, unsigned col, unsigned row,
+                const comp40_header *header, const profile40 *profile,
+                unsigned coding, unsigned first_col, unsigned first_row);
+double estimate_run_bytes(Pnm_ppm original, const comp40_header *header,
+                const profile40 *profile, unsigned first_col,
+                unsigned first_row, unsigned cols, unsigned rows,
+                size_t index);
+size_t rgb_int_tile_to_bytes(Pnm_ppm original, const comp40_header *header,
+                const profile40 *profile, unsigned coding, unsigned tile_col,
+                unsigned tile_row);
+uint64_t rgb_int_block_to_word(Pnm_ppm original, unsigned col, unsigned row,
+                const comp40_header *header, const profile40 *profile);
+void stratified_mean(const double *values, const estimate_stratum *strata,
+                unsigned count, uint64_t units, bool without_replacement,
+                double *mean, double *variance);
+double student_t95(double degrees);
+static inline uint64_t next_random(uint64_t *state);
 float ensure_in_bounds(float val, float min, float max);
+static inline float clamp_field(Codec40_quant_stats *stats, unsigned field,
+                                        float val, float min, float max);
+void record_quantized(Codec40_quant_stats *stats, const profile40 *profile,
+                bool gray, const comp_avg_floats *floats,
+                const comp_avg_ints *ints);
 
 /*
  * Name: ppm_to_rgb_int
  * Purpose: Convert a ppm file to a pnm_ppm struct
  * Parameters: A ppm image file
  * Returns: A Pnm_ppm image struct
- * Notes: The parameter file pointer must not be null
+ * Notes: The parameter file pointer must not be null. The size isn't known
+ *        until the image is read, so the entry tracepoint gives 0x0
  */
 Pnm_ppm ppm_to_rgb_int(FILE *inputfp)
 {
         assert(inputfp != NULL);
+        TRACE40_STAGE_ENTRY("ppm_to_rgb_int", 0, 0);
 
         /* create a methods suite instance */
         A2Methods_T methods = uarray2_methods_plain; 
@@ -89,6 +130,57 @@ Pnm_ppm ppm_to_rgb_int(FILE *inputfp)
 
         /* read the image file into a pnm_ppm*/
         Pnm_ppm input_image = Pnm_ppmread(inputfp, methods);
+        TRACE40_STAGE_EXIT("ppm_to_rgb_int", input_image->width,
+                        input_image->height, rgb_int_bytes(input_image));
+        return input_image;
+}
+
+/*
+ * Name: rgb8_to_rgb_int
+ * Purpose: Copy a caller supplied buffer of 8-bit rgb triples into a pnm_ppm
+ *          struct so that it can go through the same pipeline as a ppm file
+ * Parameters: A buffer of width * height rgb triples stored row major with no
+ *             padding, and the width and height of the image
+ * Returns: A Pnm_ppm image struct with a denominator of 255
+ * Notes: rgb must not be NULL. The buffer is copied, so the caller keeps
+ *        ownership of it
+ */
+Pnm_ppm rgb8_to_rgb_int(const unsigned char *rgb, unsigned width,
+                                                        unsigned height)
+{
+        assert(rgb != NULL);
+        TRACE40_STAGE_ENTRY("rgb8_to_rgb_int", width, height);
+
+        /* create a methods suite instance */
+        A2Methods_T methods = uarray2_methods_plain;
+        assert(methods);
+
+        /* Create and set values in a new Pnm_ppm struct */
+        Pnm_ppm input_image;
+        NEW(input_image);
+        input_image->methods = methods;
+        input_image->denominator = DENOMINATOR;
+        input_image->width = width;
+        input_image->height = height;
+        input_image->pixels = methods->new(width, height,
+                                                sizeof(struct Pnm_rgb));
+
+        /* copy every rgb triple out of the buffer, a row at a time */
+        UArray2_T pixels = rgb_int_pixels(input_image);
+        UARRAY2_FOREACH_ROW(pixels, struct Pnm_rgb, row, curr_int_pixels) {
+                /* 3 bytes per pixel, rows stored one after another */
+                const unsigned char *curr_rgb8 = rgb + (size_t) row * width * 3;
+                for (unsigned col = 0; col < width; col++) {
+                        curr_int_pixels[col].red = curr_rgb8[(size_t) col * 3];
+                        curr_int_pixels[col].green =
+                                        curr_rgb8[(size_t) col * 3 + 1];
+                        curr_int_pixels[col].blue =
+                                        curr_rgb8[(size_t) col * 3 + 2];
+                }
+        }
+
+        TRACE40_STAGE_EXIT("rgb8_to_rgb_int", width, height,
+                                                rgb_int_bytes(input_image));
         return input_image;
 }
 
@@ -103,6 +195,8 @@ Pnm_ppm ppm_to_rgb_int(FILE *inputfp)
 UArray2_T rgb_int_to_rgb_float(Pnm_ppm original)
 {
         assert(original != NULL);
+        unsigned width = original->width, height = original->height;
+        TRACE40_STAGE_ENTRY("rgb_int_to_rgb_float", width, height);
 
         /* Trim the image to even dimentions */
         original->width = original->width - original->width % 2;
@@ -113,111 +207,95 @@ UArray2_T rgb_int_to_rgb_float(Pnm_ppm original)
                                         original->height, sizeof(rgb_floats));
         float den = original->denominator;
 
-        /* Convert all the scaled rgb ints to floats and store them */
-        rgb_ints_closure cl = {.array = rgb_float_array, .den = den,
-                        .width = original->width, .height = original->height};
-        original->methods->map_default(original->pixels,
-                                        rgb_int_to_rgb_float_apply, &cl);
+        /*
+         * Convert all the scaled rgb ints to floats and store them. Only the
+         * columns and rows of the trimmed image are read
+         */
+        UArray2_T pixels = rgb_int_pixels(original);
+        UARRAY2_FOREACH_ROW(rgb_float_array, rgb_floats, row,
+                                                        curr_float_pixels) {
+                const struct Pnm_rgb *curr_int_pixels = UArray2_row(pixels,
+                                                                        row);
+                for (unsigned col = 0; col < original->width; col++) {
+                        /*
+                         * integer value converted to float by dividing by
+                         * denominator value
+                         */
+                        curr_float_pixels[col].red =
+                                ((float) (curr_int_pixels[col].red)) / den;
+                        curr_float_pixels[col].green =
+                                ((float) (curr_int_pixels[col].green)) / den;
+                        curr_float_pixels[col].blue =
+                                ((float) (curr_int_pixels[col].blue)) / den;
+                }
+        }
 
         Pnm_ppmfree(&original);
 
         /* return the array of rgb floats */
+        TRACE40_STAGE_EXIT("rgb_int_to_rgb_float", width, height,
+                                        uarray2_bytes(rgb_float_array));
         return rgb_float_array;
 }
 
-/*
- * Name: rgb_int_to_rgb_float_apply
- * Purpose: convert the given rgb integer pixel to an rgb float pixel
- * Parameters: column and row of the current pixel, the pixmap itself (which is
- *             unused), a void pointer to the current pixel, and void pointer to
- *             the closure variable 
- * Returns: none
- * Notes: since the mapping function maps through the original pixmap, it will
- *        include all rows and columns. However, we ensure that it only converts
- *        the pixels that are at valid indexes for the rgb float array (the
- *        width and height will always be even, and will be one less than the
- *        rgb int array if its width and/or height are odd).
- */
-void rgb_int_to_rgb_float_apply(int col, int row, A2 pixmap, void *entry,
-                                                                void *cl)
-{
-        /* get values from void pointers */
-        rgb_ints_closure *closure = cl;
-        UArray2_T rgb_float_array = closure->array;
-        float den = closure->den;
-
-        /* 
-         * only perform operation if index is within bounds of rgb_float_array
-         * (there may be one less column and/or row)
-         */
-        if (col < closure->width && row < closure->height) {
-                rgb_floats *curr_float_pixel = UArray2_at(rgb_float_array, col,
-                                                                        row);
-                Pnm_rgb curr_int_pixel = entry;
-                /*
-                 * integer value converted to floar by dividing by denominator
-                 * value
-                 */
-                curr_float_pixel->red = ((float) (curr_int_pixel->red))
-                                                                        / den;
-                curr_float_pixel->green = ((float) (curr_int_pixel->green))
-                                                                        / den;
-                curr_float_pixel->blue = ((float) (curr_int_pixel->blue))
-                                                                        / den;
-        }
-
-        (void) pixmap;
-}
-
 /*
  * Name: rgb_float_to_component_video
  * Purpose: Convert the floated rgb values to component video space
- * Parameters: The 2D array pixelmap of floated rgb values
+ * Parameters: The 2D array pixelmap of floated rgb values, and the width (and
+ *             height) of the blocks the image will be compressed in
  * Returns: A UArray2b where each slot represents a pixel in 
  *          component video space
  * Notes: The parameter rgb_float_array must not be NULL, frees rgb_float_array.
  *        Also, the component video space array is a UArray2b because it will be
- *        traversed in block major order.
+ *        traversed in block major order, with blocks of blocksize pixels. The
+ *        image is trimmed to a whole number of blocks, and must hold at least
+ *        one
  */
-UArray2b_T rgb_float_to_component_video(UArray2_T rgb_float_array)
+UArray2b_T rgb_float_to_component_video(UArray2_T rgb_float_array,
+                                                        unsigned blocksize)
 {
         /*
          * make new array and traverse through the inputted one, changing the
          * pixels in the new one based on the pixels in the inputted one
          */
         assert(rgb_float_array != NULL);
-        UArray2b_T comp_video_array = UArray2b_new(
-                UArray2_width(rgb_float_array),
-                UArray2_height(rgb_float_array),
-                sizeof(comp_video_floats), BLOCKSIZE);
-        UArray2_map_row_major(rgb_float_array,
-                        rgb_float_to_component_video_apply, comp_video_array);
+        assert(comp40_valid_block_size(blocksize));
+        unsigned width = UArray2_width(rgb_float_array);
+        unsigned height = UArray2_height(rgb_float_array);
+        assert(width >= blocksize && height >= blocksize);
+        TRACE40_STAGE_ENTRY("rgb_float_to_component_video", width, height);
+        UArray2b_T comp_video_array = UArray2b_new(width - width % blocksize,
+                                        height - height % blocksize,
+                                        sizeof(comp_video_floats), blocksize);
+
+        /* each span of a block comes from part of one row; the rest is cut */
+        UARRAY2B_FOREACH_SPAN(comp_video_array, comp_video_floats, col, row,
+                                                curr_video_pixels, len) {
+                rgb_floats *curr_float_pixels = UArray2_row(rgb_float_array,
+                                                                        row);
+                for (int i = 0; i < len; i++) {
+                        rgb_float_pixel_to_comp_video(
+                                        &curr_float_pixels[col + i],
+                                        &curr_video_pixels[i]);
+                }
+        }
         UArray2_free(&rgb_float_array);
+        TRACE40_STAGE_EXIT("rgb_float_to_component_video", width, height,
+                                        uarray2b_bytes(comp_video_array));
         return comp_video_array;
 }
 
 /*
- * Name: rgb_float_to_component_video_apply
- * Purpose: convert the given rgb float pixel to a component video pixel
- * Parameters: column and row of the current pixel, the pixmap itself (which is
- *             unused), a void pointer to the current pixel, and void pointer to
- *             the closure variable 
+ * Name: rgb_float_pixel_to_comp_video
+ * Purpose: convert one rgb float pixel to a YPbPr component video pixel
+ * Parameters: a pointer to the rgb float pixel, a pointer to the component
+ *             video pixel to fill in
  * Returns: none
- * Notes: none
+ * Notes: Y is kept between 0 and 1
  */
-void rgb_float_to_component_video_apply(int col, int row, UArray2_T pixmap,
-                                                        void *entry, void *cl)
+void rgb_float_pixel_to_comp_video(rgb_floats *curr_float_pixel,
+                                        comp_video_floats *curr_video_pixel)
 {
-        /* get values from void pointers */
-        UArray2b_T comp_video_array = cl;
-        rgb_floats *curr_float_pixel = entry;
-
-        /* 
-         * calculate Y, Pb, and Pr based on curr_float_pixel. Y value must be
-         * between 0 and 1
-         */
-        comp_video_floats *curr_video_pixel = UArray2b_at(comp_video_array, col,
-                                                                        row);
         curr_video_pixel->luma = ensure_in_bounds(
                 calculate_comp_video_nums(curr_float_pixel, 
                                                 0.299, 0.587, 0.114), 0, 1);
@@ -225,8 +303,229 @@ void rgb_float_to_component_video_apply(int col, int row, UArray2_T pixmap,
                                 curr_float_pixel, 0.5, -0.418688, -0.081312);
         curr_video_pixel->bluediff = calculate_comp_video_nums(
                                 curr_float_pixel, -0.168736, -0.331264, 0.5);
+}
+
+/*
+ * Name: rgb_int_to_component_video
+ * Purpose: Convert a pnm_ppm image struct to component video space, in the
+ *          colour space a compressed image says it uses
+ * Parameters: The pnm_ppm image struct, the width (and height) of the blocks
+ *             the image will be compressed in, and the colour space (one of
+ *             the COMP40_COLOR_ values)
+ * Returns: A UArray2b where each slot represents a pixel in component video
+ *          space
+ * Notes: original must not be NULL, frees original. YPbPr goes through rgb
+ *        floats as it always has. YCoCg-R and grayscale are computed straight
+ *        from the rgb integers
+ */
+UArray2b_T rgb_int_to_component_video(Pnm_ppm original, unsigned blocksize,
+                                                        unsigned color)
+{
+        assert(color == COMP40_COLOR_YPBPR || color == COMP40_COLOR_YCOCG ||
+                                                color == COMP40_COLOR_GRAY);
+        if (color == COMP40_COLOR_YCOCG) {
+                return rgb_int_to_ycocg(original, blocksize);
+        }
+        if (color == COMP40_COLOR_GRAY) {
+                return rgb_int_to_gray(original, blocksize);
+        }
+        return rgb_float_to_component_video(rgb_int_to_rgb_float(original),
+                                                                blocksize);
+}
+
+/*
+ * Name: rgb_int_to_ycocg
+ * Purpose: Convert the rgb integers to YCoCg-R component video space
+ * Parameters: The pnm_ppm image struct, the width (and height) of the blocks
+ *             the image will be compressed in
+ * Returns: A UArray2b where each slot represents a pixel in component video
+ *          space, with Y in the luma field, Co in the Pb field and Cg in the
+ *          Pr field
+ * Notes: original must not be NULL, frees original. The image is trimmed to a
+ *        whole number of blocks, and must hold at least one. The transform
+ *        itself is integer adds and shifts, so it is exactly reversible. Y is
+ *        in [0, den] and Co and Cg in [-den, den], so Y / den and Co and Cg
+ *        over twice den land in the same ranges as Y, Pb and Pr
+ */
+UArray2b_T rgb_int_to_ycocg(Pnm_ppm original, unsigned blocksize)
+{
+        assert(original != NULL);
+        assert(comp40_valid_block_size(blocksize));
+        unsigned width = original->width;
+        unsigned height = original->height;
+        assert(width >= blocksize && height >= blocksize);
+        TRACE40_STAGE_ENTRY("rgb_int_to_ycocg", width, height);
+
+        UArray2b_T comp_video_array = UArray2b_new(width - width % blocksize,
+                                        height - height % blocksize,
+                                        sizeof(comp_video_floats), blocksize);
+        float inverse_den = 1.0 / original->denominator;
+
+        /* pixels past the last whole block are never reached */
+        UArray2_T pixels = rgb_int_pixels(original);
+        UARRAY2B_FOREACH_SPAN(comp_video_array, comp_video_floats, col, row,
+                                                curr_video_pixels, len) {
+                const struct Pnm_rgb *curr_int_pixels = UArray2_row(pixels,
+                                                                        row);
+                for (int i = 0; i < len; i++) {
+                        rgb_int_pixel_to_ycocg(&curr_int_pixels[col + i],
+                                        inverse_den, &curr_video_pixels[i]);
+                }
+        }
+        Pnm_ppmfree(&original);
+        TRACE40_STAGE_EXIT("rgb_int_to_ycocg", width, height,
+                                        uarray2b_bytes(comp_video_array));
+        return comp_video_array;
+}
+
+/*
+ * Name: rgb_int_pixel_to_ycocg
+ * Purpose: convert one rgb integer pixel to a YCoCg-R component video pixel
+ * Parameters: a pointer to the rgb integer pixel, one over the image
+ *             denominator, a pointer to the component video pixel to fill in
+ * Returns: none
+ * Notes: see rgb_int_to_ycocg for the ranges
+ */
+void rgb_int_pixel_to_ycocg(const struct Pnm_rgb *curr_int_pixel,
+                float inverse_den, comp_video_floats *curr_video_pixel)
+{
+        int red = curr_int_pixel->red;
+        int green = curr_int_pixel->green;
+        int blue = curr_int_pixel->blue;
+        int co = red - blue;
+        int temp = blue + (co >> 1);
+        int cg = green - temp;
+        int y = temp + (cg >> 1);
+
+        curr_video_pixel->luma = y * inverse_den;
+        curr_video_pixel->bluediff = co * inverse_den / 2;
+        curr_video_pixel->reddiff = cg * inverse_den / 2;
+}
+
+/*
+ * Name: rgb_int_to_gray
+ * Purpose: Convert the rgb integers to luma-only component video space
+ * Parameters: The pnm_ppm image struct, the width (and height) of the blocks
+ *             the image will be compressed in
+ * Returns: A UArray2b where each slot represents a pixel in component video
+ *          space, with Pb and Pr left at 0
+ * Notes: original must not be NULL, frees original. The image is trimmed to a
+ *        whole number of blocks, and must hold at least one. Only Y is
+ *        computed, with the same weights as YPbPr; when red, green and blue
+ *        are equal it is just that value over the denominator
+ */
+UArray2b_T rgb_int_to_gray(Pnm_ppm original, unsigned blocksize)
+{
+        assert(original != NULL);
+        assert(comp40_valid_block_size(blocksize));
+        unsigned width = original->width;
+        unsigned height = original->height;
+        assert(width >= blocksize && height >= blocksize);
+        TRACE40_STAGE_ENTRY("rgb_int_to_gray", width, height);
 
-        (void) pixmap;
+        UArray2b_T comp_video_array = UArray2b_new(width - width % blocksize,
+                                        height - height % blocksize,
+                                        sizeof(comp_video_floats), blocksize);
+        float inverse_den = 1.0 / original->denominator;
+
+        /* pixels past the last whole block are never reached */
+        UArray2_T pixels = rgb_int_pixels(original);
+        UARRAY2B_FOREACH_SPAN(comp_video_array, comp_video_floats, col, row,
+                                                curr_video_pixels, len) {
+                const struct Pnm_rgb *curr_int_pixels = UArray2_row(pixels,
+                                                                        row);
+                for (int i = 0; i < len; i++) {
+                        rgb_int_pixel_to_gray(&curr_int_pixels[col + i],
+                                        inverse_den, &curr_video_pixels[i]);
+                }
+        }
+        Pnm_ppmfree(&original);
+        TRACE40_STAGE_EXIT("rgb_int_to_gray", width, height,
+                                        uarray2b_bytes(comp_video_array));
+        return comp_video_array;
+}
+
+/*
+ * Name: rgb_int_pixel_to_gray
+ * Purpose: convert one rgb integer pixel to a luma-only component video pixel
+ * Parameters: a pointer to the rgb integer pixel, one over the image
+ *             denominator, a pointer to the component video pixel to fill in
+ * Returns: none
+ * Notes: Pb and Pr are set to 0
+ */
+void rgb_int_pixel_to_gray(const struct Pnm_rgb *curr_int_pixel,
+                float inverse_den, comp_video_floats *curr_video_pixel)
+{
+        float luma = 0.299 * curr_int_pixel->red +
+                        0.587 * curr_int_pixel->green +
+                        0.114 * curr_int_pixel->blue;
+
+        curr_video_pixel->luma = ensure_in_bounds(luma * inverse_den, 0, 1);
+        curr_video_pixel->bluediff = 0;
+        curr_video_pixel->reddiff = 0;
+}
+
+/*
+ * Name: rgb_int_pixel_to_comp_video
+ * Purpose: convert one rgb integer pixel straight to component video, giving
+ *          the same floats the whole-image stages do
+ * Parameters: a pointer to the rgb integer pixel, the image denominator, the
+ *             colour space (one of the COMP40_COLOR_ values), a pointer to the
+ *             component video pixel to fill in
+ * Returns: none
+ * Notes: YPbPr goes through rgb floats, as rgb_int_to_component_video does
+ */
+void rgb_int_pixel_to_comp_video(const struct Pnm_rgb *curr_int_pixel,
+                unsigned denominator, unsigned color,
+                comp_video_floats *curr_video_pixel)
+{
+        float inverse_den = 1.0 / denominator;
+        if (color == COMP40_COLOR_YCOCG) {
+                rgb_int_pixel_to_ycocg(curr_int_pixel, inverse_den,
+                                                        curr_video_pixel);
+        } else if (color == COMP40_COLOR_GRAY) {
+                rgb_int_pixel_to_gray(curr_int_pixel, inverse_den,
+                                                        curr_video_pixel);
+        } else {
+                float den = denominator;
+                rgb_floats curr_float_pixel = {
+                        .red = ((float) (curr_int_pixel->red)) / den,
+                        .green = ((float) (curr_int_pixel->green)) / den,
+                        .blue = ((float) (curr_int_pixel->blue)) / den
+                };
+                rgb_float_pixel_to_comp_video(&curr_float_pixel,
+                                                        curr_video_pixel);
+        }
+}
+
+/*
+ * Name: rgb_int_is_gray
+ * Purpose: find out whether an image is grayscale, so it can be compressed
+ *          without chroma
+ * Parameters: The pnm_ppm image struct
+ * Returns: true if every pixel has equal red, green and blue
+ * Notes: original must not be NULL. A PGM input, which Pnm_ppmread reads with
+ *        equal red, green and blue, is always grayscale
+ */
+bool rgb_int_is_gray(Pnm_ppm original)
+{
+        assert(original != NULL);
+        TRACE40_STAGE_ENTRY("rgb_int_is_gray", original->width,
+                                                        original->height);
+        bool gray = true;
+        UArray2_T pixels = rgb_int_pixels(original);
+        UARRAY2_FOREACH_ROW(pixels, struct Pnm_rgb, row, curr_int_pixels) {
+                /* once a pixel isn't gray the rest of the rows are skipped */
+                for (unsigned col = 0; gray && col < original->width; col++) {
+                        gray = curr_int_pixels[col].red ==
+                                        curr_int_pixels[col].green &&
+                                curr_int_pixels[col].green ==
+                                        curr_int_pixels[col].blue;
+                }
+        }
+        TRACE40_STAGE_EXIT("rgb_int_is_gray", original->width,
+                                                        original->height, 0);
+        return gray;
 }
 
 /*
@@ -250,194 +549,328 @@ float calculate_comp_video_nums(rgb_floats *curr_float_pixel, float red_num,
  * Name: comp_video_floats_to_comp_avg_float
  * Purpose: convert pixmap of component video floats to averaged component video
  *          floats pixels
- * Parameters: UArray2b of component video floats pixels
- * Returns: UArray2 of averaged component video
- * Notes: comp_video_array must not be NULL, frees comp_video_array
+ * Parameters: UArray2b of component video floats pixels, and the stats to
+ *             count clamped a, b, c and d in (NULL for none)
+ * Returns: UArray2 of averaged component video, one element per block
+ * Notes: comp_video_array must not be NULL, frees comp_video_array. Its
+ *        blocksize is the block size the image is compressed with. stats must
+ *        have been set up by init_quant_stats
  */
-UArray2_T comp_video_floats_to_comp_avg_float(UArray2b_T comp_video_array)
+UArray2_T comp_video_floats_to_comp_avg_float(UArray2b_T comp_video_array,
+                                                Codec40_quant_stats *stats)
 {
         /*
          * make new array and traverse through the inputted one, changing the
          * pixels in the new one based on the pixels in the inputted one
          */
         assert(comp_video_array != NULL);
-        UArray2_T comp_avg_float_arr = UArray2_new(
-                UArray2b_width(comp_video_array) / BLOCKSIZE,
-                UArray2b_height(comp_video_array) / BLOCKSIZE,
-                sizeof(comp_avg_floats));
-        /* sequence to keep track of data of other pixels in the same block */
-        Seq_T seq_avg = Seq_new(SEQ_SIZE);
-        comp_floats_closure cl = {.comp_avg_float_arr = comp_avg_float_arr,
-                                                        .seq_avg = seq_avg};
-        UArray2b_map(comp_video_array,
-                                comp_video_floats_to_comp_avg_float_apply, &cl);
-        Seq_free(&seq_avg);
+        int blocksize = UArray2b_blocksize(comp_video_array);
+        assert(comp40_valid_block_size(blocksize));
+        unsigned width = UArray2b_width(comp_video_array);
+        unsigned height = UArray2b_height(comp_video_array);
+        TRACE40_STAGE_ENTRY("comp_video_floats_to_comp_avg_float", width,
+                                                                height);
+        int blocks_across = width / blocksize;
+        int blocks_down = height / blocksize;
+        UArray2_T comp_avg_float_arr = UArray2_new(blocks_across, blocks_down,
+                                                sizeof(comp_avg_floats));
+
+        /*
+         * every block's pixels are already together in block order (row major
+         * within it), so each is averaged where it is into 1 set of numbers
+         * that represent different aspects of the pixels. A partial block on
+         * the right or bottom edge has no averaged pixel and is skipped
+         */
+        UARRAY2_FOREACH_ROW(comp_avg_float_arr, comp_avg_floats, block_row,
+                                                        curr_avg_floats) {
+                for (int block_col = 0; block_col < blocks_across;
+                                                                block_col++) {
+                        comp_video_block_to_comp_avg_floats(
+                                UArray2b_block(comp_video_array, block_col,
+                                        block_row), blocksize,
+                                &curr_avg_floats[block_col], stats);
+                }
+                TRACE40_BLOCK_ROW("comp_video_floats_to_comp_avg_float",
+                                                block_row, blocks_down);
+        }
         UArray2b_free(&comp_video_array);
+        TRACE40_STAGE_EXIT("comp_video_floats_to_comp_avg_float", width,
+                                height, uarray2_bytes(comp_avg_float_arr));
         return comp_avg_float_arr;
 }
 
 /*
- * Name: comp_video_floats_to_comp_avg_float_apply
- * Purpose: convert the given component video floats pixel to an averaged
- *          component video float pixel
- * Parameters: column and row of the current pixel, the pixmap itself (which is
- *             unused), a void pointer to the current pixel, and void pointer to
- *             the closure variable 
+ * Name: comp_video_block_to_comp_avg_floats
+ * Purpose: average one block of component video pixels into a, b, c, d and
+ *          the average Pb and Pr
+ * Parameters: the block's pixels in block order (row major within the block),
+ *             the block size, where to store the averaged floats, and the
+ *             stats to count clamped a, b, c and d in (NULL for none)
  * Returns: none
- * Notes: sequences are used to store pixel values in the current block
+ * Notes: none
  */
-void comp_video_floats_to_comp_avg_float_apply(int col, int row,
-                                UArray2b_T pixmap, void *entry, void *cl)
+void comp_video_block_to_comp_avg_floats(const comp_video_floats *pixels,
+                int blocksize, comp_avg_floats *curr_avg_floats,
+                Codec40_quant_stats *stats)
 {
-        /* get values from void pointers */
-        comp_floats_closure *closure = cl;
-        comp_video_floats *curr_video_float = entry;
-        UArray2_T comp_avg_float_arr = closure->comp_avg_float_arr;
-        Seq_T seq_avg = closure->seq_avg;
-
-        /* 
-         * add current pixel to sequence (keeps track of all pixels in given
-         * block)
-         */
-        Seq_addhi(seq_avg, curr_video_float);
+        float bluediff = 0;
+        float reddiff = 0;
 
         /*
-         * whenever all 4 pixels in the block have been traversed, perform
-         * necesssary calculations. This is because the 4 pixels are averaged
-         * into 1 set of numbers that represent different aspects of the pixels
+         * copy the luminance values out for the transform. Also add together
+         * the Pb values and the Pr values.
          */
-        if ((((row + 1) % BLOCKSIZE) == 0) && (((col + 1) % BLOCKSIZE) == 0)) {
-                float bluediff = 0;
-                float reddiff = 0;
-
-                /*
-                 * sequence filled with luminance values (made for easier access
-                 * to the numbers). Also add together the 4 Pb values and 4
-                 * Pr values.
-                 */
-                Seq_T luma_seq = Seq_new(BLOCKSIZE * BLOCKSIZE);
-                for (int i = 0; i < Seq_length(seq_avg); i++) {
-                        curr_video_float = Seq_get(seq_avg, i);
-                        bluediff += curr_video_float->bluediff;
-                        reddiff += curr_video_float->reddiff;
-                        Seq_addhi(luma_seq, &(curr_video_float->luma));
-                }
-
-                /* perform calculations and place them in pixel structs */
-                bluediff /= (BLOCKSIZE * BLOCKSIZE);
-                reddiff /= (BLOCKSIZE * BLOCKSIZE);
-                float *y1 = Seq_get(luma_seq, 0);
-                float *y2 = Seq_get(luma_seq, 1);
-                float *y3 = Seq_get(luma_seq, 2);
-                float *y4 = Seq_get(luma_seq, 3);
-
-                /*
-                 * "a" value must be between 0 and 1. "b", "c", and "d" values
-                 * must be between -0.3 and 0.3
-                 */
-                float a = ensure_in_bounds((*y4 + *y3 + *y2 + *y1)
-                                        / (BLOCKSIZE * BLOCKSIZE), 0, 1);
-                float c = ensure_in_bounds((*y4 - *y3 + *y2 - *y1)
-                                        / (BLOCKSIZE * BLOCKSIZE), -0.3, 0.3);
-                float b = ensure_in_bounds((*y4 + *y3 - *y2 - *y1)
-                                        / (BLOCKSIZE * BLOCKSIZE), -0.3, 0.3);
-                float d = ensure_in_bounds((*y4 - *y3 - *y2 + *y1)
-                                        / (BLOCKSIZE * BLOCKSIZE), -0.3, 0.3);
-
-
-                comp_avg_floats *curr_avg_floats = UArray2_at(
-                        comp_avg_float_arr, col / BLOCKSIZE, row / BLOCKSIZE);
-                curr_avg_floats->bluediff_avg = bluediff;
-                curr_avg_floats->reddiff_avg = reddiff;
-                curr_avg_floats->a = a;
-                curr_avg_floats->b = b;
-                curr_avg_floats->c = c;
-                curr_avg_floats->d = d;
-
-                clear_seq(seq_avg);
-                Seq_free(&luma_seq);
+        float luma[TRANSFORM40_MAX_PIXELS];
+        for (int i = 0; i < blocksize * blocksize; i++) {
+                bluediff += pixels[i].bluediff;
+                reddiff += pixels[i].reddiff;
+                luma[i] = pixels[i].luma;
         }
 
-        (void) pixmap;
+        transform40_forward(luma, blocksize, curr_avg_floats);
+        curr_avg_floats->bluediff_avg = bluediff / (blocksize * blocksize);
+        curr_avg_floats->reddiff_avg = reddiff / (blocksize * blocksize);
+
+        /*
+         * "a" value must be between 0 and 1. "b", "c", and "d" values must be
+         * between -0.3 and 0.3
+         */
+        curr_avg_floats->a = clamp_field(stats, 0, curr_avg_floats->a, 0, 1);
+        curr_avg_floats->b = clamp_field(stats, 1, curr_avg_floats->b,
+                                                                -0.3, 0.3);
+        curr_avg_floats->c = clamp_field(stats, 2, curr_avg_floats->c,
+                                                                -0.3, 0.3);
+        curr_avg_floats->d = clamp_field(stats, 3, curr_avg_floats->d,
+                                                                -0.3, 0.3);
 }
 
 /*
- * Name: clear_seq
- * Purpose: remove all items in a sequence
- * Parameters: the given sequence
- * Returns: none
- * Notes: seq must not be NULL
+ * Name: comp_video_floats_to_next_level
+ * Purpose: build the next level of an image pyramid - a component video image
+ *          half the width and height of this one, whatever the block size
+ * Parameters: UArray2b of component video floats pixels
+ * Returns: UArray2b of component video floats pixels for the smaller image,
+ *          with the same block size, or NULL if it would be less than one
+ *          block across or down
+ * Notes: comp_video_array must not be NULL and is not freed, so it can still
+ *        be averaged into blocks. Each new pixel is the average of a 2x2
+ *        square of this level's pixels, so this is exactly a box filter of
+ *        the image in component video space. Sizes are trimmed to whole blocks
+ *        the same way rgb_float_to_component_video does
  */
-void clear_seq(Seq_T seq)
+UArray2b_T comp_video_floats_to_next_level(UArray2b_T comp_video_array)
 {
-        assert(seq != NULL);
-        while (Seq_length(seq) > 0) {
-                Seq_remhi(seq);
+        assert(comp_video_array != NULL);
+        unsigned blocksize = UArray2b_blocksize(comp_video_array);
+        assert(comp40_valid_block_size(blocksize));
+        unsigned width = UArray2b_width(comp_video_array) / 2;
+        unsigned height = UArray2b_height(comp_video_array) / 2;
+        TRACE40_STAGE_ENTRY("comp_video_floats_to_next_level", width, height);
+        width -= width % blocksize;
+        height -= height % blocksize;
+        if (width == 0 || height == 0) {
+                TRACE40_STAGE_EXIT("comp_video_floats_to_next_level", width,
+                                                                height, 0);
+                return NULL;
+        }
+
+        UArray2b_T next_array = UArray2b_new(width, height,
+                                        sizeof(comp_video_floats), blocksize);
+        UARRAY2B_FOREACH_SPAN(next_array, comp_video_floats, col, row,
+                                                curr_video_floats, len) {
+                /* blocks are even, so a 2x2 square never straddles two */
+                for (int i = 0; i < len; i++) {
+                        unsigned x = 2 * (col + i), y = 2 * row;
+                        const comp_video_floats *square = (comp_video_floats *)
+                                UArray2b_block(comp_video_array, x / blocksize,
+                                y / blocksize) + y % blocksize * blocksize +
+                                                                x % blocksize;
+                        const comp_video_floats *below = square + blocksize;
+                        curr_video_floats[i].luma = (square[0].luma +
+                                square[1].luma + below[0].luma +
+                                                        below[1].luma) / 4;
+                        curr_video_floats[i].bluediff = (square[0].bluediff +
+                                square[1].bluediff + below[0].bluediff +
+                                                        below[1].bluediff) / 4;
+                        curr_video_floats[i].reddiff = (square[0].reddiff +
+                                square[1].reddiff + below[0].reddiff +
+                                                        below[1].reddiff) / 4;
+                }
         }
+        TRACE40_STAGE_EXIT("comp_video_floats_to_next_level", width, height,
+                                                uarray2b_bytes(next_array));
+        return next_array;
 }
 
 /*
  * Name: comp_avg_floats_to_comp_avg_ints
  * Purpose: quantize the pixmap of averaged component video floats pixels (send
  *          a range of float values to a set of integer values)
- * Parameters: UArray2 of averaged component video floats pixels
+ * Parameters: UArray2 of averaged component video floats pixels, the number
+ *             of the codeword profile to quantize for, the colour space (one
+ *             of the COMP40_COLOR_ values), and the stats to record each
+ *             block in (NULL for none)
  * Returns: UArray2 of quantized component video pixels
- * Notes: comp_avg_floats_array must not be NULL, frees comp_avg_floats_array
+ * Notes: comp_avg_floats_array must not be NULL and profile must be a valid
+ *        profile number, frees comp_avg_floats_array. A grayscale image is
+ *        quantized with the profile's luma-only kernel. stats must have been
+ *        set up by init_quant_stats for the same profile
  */
-UArray2_T comp_avg_floats_to_comp_avg_ints(UArray2_T comp_avg_floats_array)
+UArray2_T comp_avg_floats_to_comp_avg_ints(UArray2_T comp_avg_floats_array,
+                unsigned profile, unsigned color, Codec40_quant_stats *stats)
 {
         /*
          * make new array and traverse through the inputted one, changing the
          * pixels in the new one based on the pixels in the inputted one
          */
         assert(comp_avg_floats_array != NULL);
-        UArray2_T comp_avg_ints_array = UArray2_new(
-                UArray2_width(comp_avg_floats_array),
-                UArray2_height(comp_avg_floats_array), sizeof(comp_avg_ints));
-        UArray2_map_row_major(comp_avg_floats_array,
-                comp_avg_floats_to_comp_avg_ints_apply, comp_avg_ints_array);
+        unsigned width = UArray2_width(comp_avg_floats_array);
+        unsigned height = UArray2_height(comp_avg_floats_array);
+        TRACE40_STAGE_ENTRY("comp_avg_floats_to_comp_avg_ints", width, height);
+        const profile40 *codewords = profile40_get(profile);
+        assert(codewords != NULL);
+        assert(stats == NULL || stats->profile == profile);
+        bool gray = (color == COMP40_COLOR_GRAY);
+        UArray2_T comp_avg_ints_array = UArray2_new(width, height,
+                                                        sizeof(comp_avg_ints));
+        UARRAY2_FOREACH_ROW(comp_avg_floats_array, comp_avg_floats, row,
+                                                        curr_avg_floats) {
+                comp_avg_ints *curr_avg_ints = UArray2_row(comp_avg_ints_array,
+                                                                        row);
+                for (unsigned col = 0; col < width; col++) {
+                        /* the profile decides the range each value goes to */
+                        if (gray) {
+                                codewords->quantize_luma(codewords,
+                                                &curr_avg_floats[col],
+                                                &curr_avg_ints[col]);
+                        } else {
+                                codewords->quantize(codewords,
+                                                &curr_avg_floats[col],
+                                                &curr_avg_ints[col]);
+                        }
+                        if (stats != NULL) {
+                                record_quantized(stats, codewords, gray,
+                                                &curr_avg_floats[col],
+                                                &curr_avg_ints[col]);
+                        }
+                }
+                TRACE40_BLOCK_ROW("comp_avg_floats_to_comp_avg_ints", row,
+                                                                height);
+        }
         UArray2_free(&comp_avg_floats_array);
+        TRACE40_STAGE_EXIT("comp_avg_floats_to_comp_avg_ints", width, height,
+                                        uarray2_bytes(comp_avg_ints_array));
         return comp_avg_ints_array;
 }
 
 /*
- * Name: comp_avg_floats_to_comp_avg_ints_apply
- * Purpose: convert the given averaged component video floats pixel to a
- *          quantized integer component video pixel
- * Parameters: column and row of the current pixel, the pixmap itself (which is
- *             unused), a void pointer to the current pixel, and void pointer to
- *             the closure variable 
+ * Name: init_quant_stats
+ * Purpose: set up empty quantization stats for a profile
+ * Parameters: the stats, the number of the codeword profile the image will be
+ *             quantized for
  * Returns: none
- * Notes: none
+ * Notes: stats must not be NULL and profile must be a valid profile number.
+ *        Each field's histogram gets one bin per value its width can hold
  */
-void comp_avg_floats_to_comp_avg_ints_apply(int col, int row, UArray2_T pixmap,
-                                                        void *entry, void *cl)
+void init_quant_stats(Codec40_quant_stats *stats, unsigned profile)
 {
-        /* get values from void pointers */
-        UArray2_T comp_avg_ints_array = cl;
-        comp_avg_ints *curr_avg_ints = UArray2_at(comp_avg_ints_array, col,
-                                                                        row);
-        comp_avg_floats *curr_avg_float = entry;
+        assert(stats != NULL);
+        const profile40 *layout = profile40_get(profile);
+        assert(layout != NULL);
+        memset(stats, 0, sizeof(*stats));
+        stats->profile = profile;
 
-        /*
-         * perform calculations and place results in pixel structs. "a" value
-         * must be between 0 and 511. "b", "c", and "d" values must be between
-         * -15 and and 15
-         */
-        curr_avg_ints->bluediff_avg = Arith40_index_of_chroma(
-                                                curr_avg_float->bluediff_avg);
-        curr_avg_ints->reddiff_avg = Arith40_index_of_chroma(
-                                                curr_avg_float->reddiff_avg);
-        curr_avg_ints->a = (int) round(ensure_in_bounds(
-                                round(63 * (curr_avg_float->a)), 0, 63));
-        curr_avg_ints->b = (int) round(ensure_in_bounds(
-                                round(103.3 * (curr_avg_float->b)), -31, 31));
-        curr_avg_ints->c = (int) round(ensure_in_bounds(
-                                round(103.3 * (curr_avg_float->c)), -31, 31));
-        curr_avg_ints->d = (int) round(ensure_in_bounds(
-                                round(103.3 * (curr_avg_float->d)), -31, 31));
+        unsigned widths[CODEC40_FIELDS] = {
+                layout->width_a, layout->width_bcd, layout->width_bcd,
+                layout->width_bcd, layout->width_chroma, layout->width_chroma
+        };
+        for (unsigned field = 0; field < CODEC40_FIELDS; field++) {
+                assert(((uint64_t) 1 << widths[field]) <= CODEC40_MAX_BINS);
+                stats->bins[field] = 1u << widths[field];
+                stats->first_value[field] = 0;
+        }
+        /* b, c and d are signed, and never use the most negative value */
+        for (unsigned field = 1; field <= 3; field++) {
+                stats->bins[field] -= 1;
+                stats->first_value[field] = -(int64_t) (stats->bins[field] / 2);
+        }
+}
 
-        (void) pixmap;
+/*
+ * Name: clamp_field
+ * Purpose: clamp one of a, b, c and d into its range before quantizing, and
+ *          count it if it had to be moved
+ * Parameters: the stats (NULL for none), the field (0 for a to 3 for d), the
+ *             value, the smallest and largest value allowed
+ * Returns: the clamped value
+ * Notes: the clamped-off part is added to the field's squared error
+ */
+static inline float clamp_field(Codec40_quant_stats *stats, unsigned field,
+                                        float val, float min, float max)
+{
+        float clamped = ensure_in_bounds(val, min, max);
+        if (stats != NULL && clamped != val) {
+                stats->transform_clamps[field]++;
+                stats->squared_error[field] += (double) (val - clamped) *
+                                                        (val - clamped);
+        }
+        return clamped;
+}
+
+/*
+ * Name: record_quantized
+ * Purpose: add one quantized block to the stats
+ * Parameters: the stats, the profile it was quantized for, whether it was
+ *             quantized luma only, its floats, its integers
+ * Returns: none
+ * Notes: the block is unquantized the way the decoder will do it to find each
+ *        field's error. a, b, c and d were clamped by the quantizer if
+ *        rounding their scaled value gives anything but the integer stored,
+ *        which is how the profile's kernels round them. A luma-only block
+ *        leaves Pb and Pr out
+ */
+void record_quantized(Codec40_quant_stats *stats, const profile40 *profile,
+                bool gray, const comp_avg_floats *floats,
+                const comp_avg_ints *ints)
+{
+        comp_avg_floats decoded;
+        if (gray) {
+                profile->unquantize_luma(profile, ints, &decoded);
+        } else {
+                profile->unquantize(profile, ints, &decoded);
+        }
+        float values[CODEC40_FIELDS] = {
+                floats->a, floats->b, floats->c, floats->d,
+                floats->bluediff_avg, floats->reddiff_avg
+        };
+        float decoded_values[CODEC40_FIELDS] = {
+                decoded.a, decoded.b, decoded.c, decoded.d,
+                decoded.bluediff_avg, decoded.reddiff_avg
+        };
+        int64_t quantized[CODEC40_FIELDS] = {
+                ints->a, ints->b, ints->c, ints->d,
+                ints->bluediff_avg, ints->reddiff_avg
+        };
+        double scaled[4] = {
+                round(profile->scale_a * floats->a),
+                round(profile->scale_bcd * floats->b),
+                round(profile->scale_bcd * floats->c),
+                round(profile->scale_bcd * floats->d)
+        };
+
+        stats->blocks++;
+        unsigned fields = gray ? 4 : CODEC40_FIELDS;
+        for (unsigned field = 0; field < fields; field++) {
+                double error = values[field] - decoded_values[field];
+                stats->squared_error[field] += error * error;
+                if (field < 4 && scaled[field] != quantized[field]) {
+                        stats->quantize_clamps[field]++;
+                }
+                int64_t bin = quantized[field] - stats->first_value[field];
+                if (bin >= 0 && bin < stats->bins[field]) {
+                        stats->histogram[field][bin]++;
+                }
+        }
 }
 
 /*
@@ -449,66 +882,1017 @@ void comp_avg_floats_to_comp_avg_ints_apply(int col, int row, UArray2_T pixmap,
  * Notes: comp_avg_ints_array must not be NULL, frees comp_avg_ints_array
  */
 void comp_avg_ints_to_out(UArray2_T comp_avg_ints_array)
+{
+        comp_avg_ints_to_file(comp_avg_ints_array, stdout);
+}
+
+/*
+ * Name: comp_avg_ints_to_file
+ * Purpose: write the information in the pixels in the current UArray2 to a
+ *          file
+ * Parameters: UArray2 of averaged component video ints pixels, the file
+ * Returns: none
+ * Notes: comp_avg_ints_array and output must not be NULL, frees
+ *        comp_avg_ints_array. Format 2 always has 2x2 blocks. Each row of
+ *        blocks is packed into memory and written with one fwrite. Raises
+ *        Bitpack_Overflow if a value doesn't fit in its field
+ */
+void comp_avg_ints_to_file(UArray2_T comp_avg_ints_array, FILE *output)
 {
         /*
          * traverse through the inputted array and output the pixel information
-         * in 32-bit words to standard output
+         * in 32-bit words to the file
          */
-        assert(comp_avg_ints_array != NULL);
-        printf("COMP40 Compressed image format 2\n%u %u\n",
-                UArray2_width(comp_avg_ints_array) * BLOCKSIZE,
-                UArray2_height(comp_avg_ints_array) * BLOCKSIZE);
-        UArray2_map_row_major(comp_avg_ints_array, comp_avg_ints_to_out_apply,
-                                                                        NULL);
+        assert(comp_avg_ints_array != NULL && output != NULL);
+        unsigned width = UArray2_width(comp_avg_ints_array);
+        unsigned height = UArray2_height(comp_avg_ints_array);
+        TRACE40_STAGE_ENTRY("comp_avg_ints_to_file", width, height);
+        comp40_header header = {
+                .version = COMP40_FLAT,
+                .width = width * COMP40_DEFAULT_BLOCK_SIZE,
+                .height = height * COMP40_DEFAULT_BLOCK_SIZE,
+                .block_size = COMP40_DEFAULT_BLOCK_SIZE
+        };
+        const profile40 *profile = profile40_get(PROFILE40_STANDARD);
+        unsigned char *words = ALLOC((long) width * profile->word_bytes);
+        uint64_t written = print_header(&header, output);
+        UARRAY2_FOREACH_ROW(comp_avg_ints_array, comp_avg_ints, row,
+                                                        curr_avg_ints) {
+                /* big endian, one word after another */
+                size_t pos = 0;
+                for (unsigned col = 0; col < width; col++) {
+                        uint64_t word;
+                        if (!profile->pack(profile, &curr_avg_ints[col],
+                                                                &word)) {
+                                RAISE(Bitpack_Overflow);
+                        }
+                        profile40_put_word(profile, word, words + pos);
+                        pos += profile->word_bytes;
+                }
+
+                fwrite(words, 1, pos, output);
+                TRACE40_FLUSH("comp_avg_ints_to_file", pos);
+                TRACE40_BLOCK_ROW("comp_avg_ints_to_file", row, height);
+                written += pos;
+        }
+        FREE(words);
         UArray2_free(&comp_avg_ints_array);
+        TRACE40_STAGE_EXIT("comp_avg_ints_to_file", width, height, written);
+}
+
+/*
+ * Name: compressed_size
+ * Purpose: calculate how many bytes the compressed form of an image takes
+ * Parameters: the width and height of the original image
+ * Returns: the number of bytes comp_avg_ints_to_out or comp_avg_ints_to_buffer
+ *          will write for that image (header included)
+ * Notes: odd dimensions are trimmed the same way rgb_int_to_rgb_float does
+ */
+size_t compressed_size(unsigned width, unsigned height)
+{
+        width = width - width % COMP40_DEFAULT_BLOCK_SIZE;
+        height = height - height % COMP40_DEFAULT_BLOCK_SIZE;
+        comp40_header header = {.version = COMP40_FLAT, .width = width,
+                .height = height, .block_size = COMP40_DEFAULT_BLOCK_SIZE};
+        size_t header_size = write_comp40_header(NULL, 0, &header);
+        return header_size +
+                (size_t) (width / COMP40_DEFAULT_BLOCK_SIZE) *
+                (size_t) (height / COMP40_DEFAULT_BLOCK_SIZE) *
+                profile40_get(PROFILE40_STANDARD)->word_bytes;
 }
 
 /*
- * Name: comp_avg_ints_to_out_apply
- * Purpose: print the current pixel data to standard output
- * Parameters: column and row of the current pixel (which is unused), the pixmap
- *             itself (which is unused), a void pointer to the current pixel,
- *             and void pointer to the closure variable (which is unused)
+ * Name: comp_avg_ints_to_buffer
+ * Purpose: write the header and the information in the pixels in the current
+ *          UArray2 to a caller supplied buffer instead of standard output
+ * Parameters: UArray2 of averaged component video ints pixels, the buffer to
+ *             write to and its capacity in bytes, where to store the number of
+ *             bytes written
+ * Returns: true on success, false if a value didn't fit in its field (the
+ *          buffer contents are then unspecified)
+ * Notes: comp_avg_ints_array, out and out_len must not be NULL, out_cap must be
+ *        at least compressed_size of the image. Frees comp_avg_ints_array.
+ *        Never raises an exception
+ */
+bool comp_avg_ints_to_buffer(UArray2_T comp_avg_ints_array, unsigned char *out,
+                                        size_t out_cap, size_t *out_len)
+{
+        assert(comp_avg_ints_array != NULL && out != NULL && out_len != NULL);
+        unsigned width = UArray2_width(comp_avg_ints_array) *
+                                                COMP40_DEFAULT_BLOCK_SIZE;
+        unsigned height = UArray2_height(comp_avg_ints_array) *
+                                                COMP40_DEFAULT_BLOCK_SIZE;
+        assert(out_cap >= compressed_size(width, height));
+        TRACE40_STAGE_ENTRY("comp_avg_ints_to_buffer", width, height);
+
+        /*
+         * snprintf always writes a terminating '\0', but the header is
+         * followed by the first codeword, which overwrites it
+         */
+        comp40_header header = {.version = COMP40_FLAT, .width = width,
+                .height = height, .block_size = COMP40_DEFAULT_BLOCK_SIZE};
+        size_t pos = write_comp40_header((char *) out, out_cap, &header);
+
+        /*
+         * same byte order as comp_avg_ints_to_file (big endian). An overflow
+         * is remembered instead of raising Bitpack_Overflow
+         */
+        const profile40 *profile = profile40_get(PROFILE40_STANDARD);
+        unsigned blocks_across = UArray2_width(comp_avg_ints_array);
+        bool overflow = false;
+        UARRAY2_FOREACH_ROW(comp_avg_ints_array, comp_avg_ints, row,
+                                                        curr_avg_ints) {
+                for (unsigned col = 0; col < blocks_across; col++) {
+                        uint64_t word;
+                        if (!profile->pack(profile, &curr_avg_ints[col],
+                                                                &word)) {
+                                overflow = true;
+                        }
+                        profile40_put_word(profile, word, out + pos);
+                        pos += profile->word_bytes;
+                }
+                TRACE40_BLOCK_ROW("comp_avg_ints_to_buffer", row,
+                                        UArray2_height(comp_avg_ints_array));
+        }
+        UArray2_free(&comp_avg_ints_array);
+        *out_len = pos;
+        TRACE40_FLUSH("comp_avg_ints_to_buffer", pos);
+        TRACE40_STAGE_EXIT("comp_avg_ints_to_buffer", width, height, pos);
+        return !overflow;
+}
+
+/*
+ * Name: comp_avg_ints_to_tiled_out
+ * Purpose: write the information in the pixels in the current UArray2 to a
+ *          file in the tiled format (format 3)
+ * Parameters: UArray2 of averaged component video ints pixels, the file, a
+ *             header giving the layout to write (its tile_size, block_size,
+ *             profile and color - the size in pixels is taken from the array),
+ *             and the coding to use for the tiles (one of the COMP40_CODING_
+ *             values)
+ * Returns: none
+ * Notes: comp_avg_ints_array and format must not be NULL, the tile size must
+ *        be a positive multiple of the block size, at most
+ *        COMP40_MAX_TILE_SIZE. Frees comp_avg_ints_array.
+ *        The whole index has to be written before the first tile, so the
+ *        tiles are packed into memory first. A tile the entropy or run-length
+ *        coder can't shrink is stored raw, and a profile other than the
+ *        standard one is never entropy coded.
+ *        Raises Bitpack_Overflow if a value doesn't fit in its field
+ */
+void comp_avg_ints_to_tiled_out(UArray2_T comp_avg_ints_array, FILE *output,
+                                const comp40_header *format, unsigned coding)
+{
+        assert(comp_avg_ints_array != NULL && output != NULL && format != NULL);
+        unsigned tile_size = format->tile_size;
+        unsigned block_size = format->block_size;
+        assert(comp40_valid_block_size(block_size));
+        assert(tile_size > 0 && tile_size % block_size == 0);
+        assert(tile_size <= COMP40_MAX_TILE_SIZE);
+        const profile40 *profile = profile40_get(format->profile);
+        assert(profile != NULL);
+        assert(coding == COMP40_CODING_RAW || coding == COMP40_CODING_RANS ||
+                                        coding == COMP40_CODING_RANS_MED ||
+                                        coding == COMP40_CODING_RLE);
+        comp40_header header = {
+                .version = COMP40_TILED,
+                .width = UArray2_width(comp_avg_ints_array) * block_size,
+                .height = UArray2_height(comp_avg_ints_array) * block_size,
+                .tile_size = tile_size,
+                .block_size = block_size,
+                .profile = format->profile,
+                .color = format->color
+        };
+        TRACE40_STAGE_ENTRY("comp_avg_ints_to_tiled_out",
+                                        UArray2_width(comp_avg_ints_array),
+                                        UArray2_height(comp_avg_ints_array));
+        unsigned tiles_across = comp40_tiles_across(&header);
+        unsigned tiles_down = comp40_tiles_down(&header);
+        size_t index_size = comp40_index_size(&header);
+        unsigned char *index = ALLOC(index_size);
+        unsigned char *data = ALLOC((size_t) UArray2_width(comp_avg_ints_array)
+                * UArray2_height(comp_avg_ints_array) * profile->word_bytes);
+        size_t tile_blocks = tile_size / block_size;
+
+        /* no tile is bigger than the image, however big the tile size is */
+        size_t cols = UArray2_width(comp_avg_ints_array);
+        size_t rows = UArray2_height(comp_avg_ints_array);
+        cols = cols < tile_blocks ? cols : tile_blocks;
+        rows = rows < tile_blocks ? rows : tile_blocks;
+        assert(rows <= SIZE_MAX / cols / profile->word_bytes);
+        unsigned char *words = ALLOC(cols * rows * profile->word_bytes);
+
+        /* tiles are stored row major, each right after the one before it */
+        size_t data_len = 0;
+        for (unsigned tile_row = 0; tile_row < tiles_down; tile_row++) {
+                for (unsigned tile_col = 0; tile_col < tiles_across;
+                                                                tile_col++) {
+                        unsigned first_col, first_row, cols, rows;
+                        comp40_tile_blocks(&header, tile_col, tile_row,
+                                        &first_col, &first_row, &cols, &rows);
+                        if (!comp_avg_ints_to_tile(comp_avg_ints_array,
+                                profile, first_col, first_row, cols, rows,
+                                words)) {
+                                RAISE(Bitpack_Overflow);
+                        }
+                        comp40_tile tile = {.offset = data_len};
+                        size_t tile_len = code_tile(words, cols, rows, profile,
+                                        coding, data + data_len, &tile.coding);
+                        assert(tile_len <= UINT32_MAX);
+                        tile.length = tile_len;
+                        tile.crc = crc32c(0, data + data_len, tile_len);
+                        write_comp40_tile(index + ((size_t) tile_row *
+                                tiles_across + tile_col) *
+                                COMP40_TILE_ENTRY_SIZE, &tile);
+                        data_len += tile_len;
+                }
+                unsigned height = UArray2_height(comp_avg_ints_array);
+                size_t end_row = (tile_row + 1) * tile_blocks;
+                TRACE40_BLOCK_ROW("comp_avg_ints_to_tiled_out",
+                        (end_row < height ? end_row : height) - 1, height);
+        }
+
+        size_t header_len = print_header(&header, output);
+        fwrite(index, 1, index_size, output);
+        TRACE40_FLUSH("comp_avg_ints_to_tiled_out", index_size);
+        fwrite(data, 1, data_len, output);
+        TRACE40_FLUSH("comp_avg_ints_to_tiled_out", data_len);
+        TRACE40_STAGE_EXIT("comp_avg_ints_to_tiled_out",
+                                UArray2_width(comp_avg_ints_array),
+                                UArray2_height(comp_avg_ints_array),
+                                header_len + index_size + data_len);
+        FREE(index);
+        FREE(data);
+        FREE(words);
+        UArray2_free(&comp_avg_ints_array);
+}
+
+/*
+ * Name: comp_avg_ints_to_tile
+ * Purpose: pack the codewords of the blocks in one tile into memory
+ * Parameters: UArray2 of averaged component video ints pixels, the codeword
+ *             profile, the first block column and row in the tile, the number
+ *             of blocks across and down it, where to write the codewords
+ * Returns: true on success, false if a value didn't fit in its field
+ * Notes: codewords are big endian and row major within the tile
+ */
+bool comp_avg_ints_to_tile(UArray2_T comp_avg_ints_array,
+                        const profile40 *profile, unsigned first_col,
+                        unsigned first_row, unsigned cols, unsigned rows,
+                        unsigned char *out)
+{
+        size_t pos = 0;
+        for (unsigned row = first_row; row < first_row + rows; row++) {
+                const comp_avg_ints *curr_avg_ints = UArray2_row(
+                                                comp_avg_ints_array, row);
+                for (unsigned col = first_col; col < first_col + cols; col++) {
+                        uint64_t word;
+                        if (!profile->pack(profile, &curr_avg_ints[col],
+                                                                &word)) {
+                                return false;
+                        }
+                        profile40_put_word(profile, word, out + pos);
+                        pos += profile->word_bytes;
+                }
+        }
+        return true;
+}
+
+/*
+ * Name: code_tile
+ * Purpose: store a tile's codewords with the requested coding, or raw if that
+ *          coding doesn't make them smaller
+ * Parameters: the tile's codewords, the number of blocks across and down the
+ *             tile, the codeword profile, the requested coding, where to write
+ *             the stored bytes (room for the raw codewords is enough) and where
+ *             to store the coding actually used
+ * Returns: the number of bytes written
+ * Notes: the entropy coder and predictor only know the standard profile's
+ *        32-bit codewords, so other profiles are stored raw when asked for
+ *        them. Runs work with any profile
+ */
+size_t code_tile(unsigned char *words, unsigned cols, unsigned rows,
+                const profile40 *profile, unsigned coding, unsigned char *out,
+                uint32_t *tile_coding)
+{
+        size_t count = (size_t) cols * rows;
+        size_t raw_len = count * profile->word_bytes;
+        size_t len = 0;
+        if (profile->id != PROFILE40_STANDARD && coding != COMP40_CODING_RLE) {
+                coding = COMP40_CODING_RAW;
+        }
+        if (coding == COMP40_CODING_RLE) {
+                len = rle40_encode(words, count, profile->word_bytes, out,
+                                                                raw_len - 1);
+        } else if (coding == COMP40_CODING_RANS) {
+                len = rans40_encode(words, count, out, raw_len - 1);
+        } else if (coding == COMP40_CODING_RANS_MED) {
+                unsigned char *residuals = ALLOC(raw_len);
+                memcpy(residuals, words, raw_len);
+                predict40_residuals(residuals, cols, rows);
+                len = rans40_encode(residuals, count, out, raw_len - 1);
+                FREE(residuals);
+        }
+
+        if (len != 0) {
+                *tile_coding = coding;
+                return len;
+        }
+        memcpy(out, words, raw_len);
+        *tile_coding = COMP40_CODING_RAW;
+        return raw_len;
+}
+
+/*
+ * Name: print_header
+ * Purpose: print the text part of a compressed image header to a file
+ * Parameters: the header, the file
+ * Returns: the number of bytes written
+ * Notes: header must not be NULL
+ */
+size_t print_header(const comp40_header *header, FILE *output)
+{
+        char text[COMP40_MAX_HEADER_LENGTH];
+        int length = write_comp40_header(text, sizeof(text), header);
+        assert(length > 0 && (size_t) length < sizeof(text));
+        fwrite(text, 1, length, output);
+        return length;
+}
+
+/*
+ * Name: rgb_int_to_estimate
+ * Purpose: predict the RMS error and the size of a compressed image without
+ *          compressing it, from stratified random samples of its blocks and
+ *          tiles
+ * Parameters: The pnm_ppm image struct, a header giving the layout the image
+ *             would be written in (its version, and for format 3 its
+ *             tile_size, block_size, profile and color), and the coding the
+ *             tiles would be written with (one of the COMP40_CODING_ values)
+ * Returns: the estimate
+ * Notes: original and format must not be NULL, and the image must hold at
+ *        least one block. original is not freed. For the RMS error the blocks
+ *        are split into a grid of strata and each stratum is sampled in
+ *        proportion to its size, so every part of the image is represented.
+ *        Each sampled block goes through the same colour conversion,
+ *        transform and quantizing as a full encode, and is then decoded and
+ *        compared with the original the way --compare does it. Sampling is
+ *        seeded, so the same image always gets the same estimate, and a
+ *        stratum small enough to be sampled whole adds nothing to the
+ *        confidence intervals.
+ *
+ *        Raw sizes are exact. Entropy and run-length coded sizes are
+ *        estimated from a sample of tiles and of blocks within them (see
+ *        estimate_tiled_size), since the coder fits its tables, or finds its
+ *        runs, a tile at a time
+ */
+comp40_estimate rgb_int_to_estimate(Pnm_ppm original,
+                                const comp40_header *format, unsigned coding)
+{
+        assert(original != NULL && format != NULL);
+        unsigned blocksize = format->block_size;
+        assert(comp40_valid_block_size(blocksize));
+        const profile40 *profile = profile40_get(format->profile);
+        assert(profile != NULL);
+        unsigned cols = original->width / blocksize;
+        unsigned rows = original->height / blocksize;
+        assert(cols > 0 && rows > 0);
+        bool tiled = format->version == COMP40_TILED;
+        /* code_tile stores other profiles raw unless asked for runs */
+        if (profile->id != PROFILE40_STANDARD && coding != COMP40_CODING_RLE) {
+                coding = COMP40_CODING_RAW;
+        }
+        comp40_estimate estimate = {.blocks = (uint64_t) cols * rows};
+
+        /* split the blocks into strata and share the sample between them */
+        double wanted = estimate.blocks / ESTIMATE_SAMPLE_SHARE;
+        unsigned count;
+        size_t total;
+        estimate_stratum *strata = split_strata(cols, rows, ESTIMATE_STRATA,
+                        wanted < ESTIMATE_MIN_SAMPLES ? ESTIMATE_MIN_SAMPLES :
+                                                        wanted, &count, &total);
+        estimate.samples = total;
+
+        /* run every sampled block through the encoder and the decoder */
+        double *squares = ALLOC(total * sizeof(double));
+        uint64_t random = ESTIMATE_SEED;
+        for (unsigned h = 0; h < count; h++) {
+                const estimate_stratum *stratum = &strata[h];
+                bool whole = stratum->samples == stratum->units;
+                for (size_t k = 0; k < stratum->samples; k++) {
+                        uint64_t index = whole ? k :
+                                next_random(&random) % stratum->units;
+                        unsigned col = stratum->first_col +
+                                                index % stratum->cols;
+                        unsigned row = stratum->first_row +
+                                                index / stratum->cols;
+
+                        comp_avg_ints curr_avg_ints;
+                        rgb_int_block_to_comp_avg_ints(original, col, row,
+                                        format, profile, &curr_avg_ints);
+                        uint64_t block_squares[3] = {0, 0, 0};
+                        unsigned max_diff[3] = {0, 0, 0};
+                        comp_avg_ints_to_block_error(&curr_avg_ints, profile,
+                                        format->color, blocksize, original,
+                                        col, row, block_squares, max_diff);
+                        squares[stratum->first + k] = (double)
+                                        block_squares[0] + block_squares[1] +
+                                        block_squares[2];
+                }
+        }
+
+        /* squared errors are summed over a block's pixels and channels */
+        double mean, variance;
+        stratified_mean(squares, strata, count, estimate.blocks, false, &mean,
+                                                                &variance);
+        double scale = 3.0 * blocksize * blocksize * DENOMINATOR *
+                                                                DENOMINATOR;
+        double margin = ESTIMATE_Z * sqrt(variance);
+        estimate.rms = sqrt(mean / scale);
+        estimate.rms_low = sqrt((mean > margin ? mean - margin : 0) / scale);
+        estimate.rms_high = sqrt((mean + margin) / scale);
+        FREE(squares);
+        FREE(strata);
+
+        comp40_header header = *format;
+        header.width = cols * blocksize;
+        header.height = rows * blocksize;
+        if (!tiled) {
+                estimate.size = compressed_size(header.width, header.height);
+                estimate.size_low = estimate.size_high = estimate.size;
+        } else if (coding == COMP40_CODING_RAW) {
+                estimate.size = write_comp40_header(NULL, 0, &header) +
+                        comp40_index_size(&header) +
+                        (double) estimate.blocks * profile->word_bytes;
+                estimate.size_low = estimate.size_high = estimate.size;
+        } else {
+                estimate_tiled_size(original, &header, profile, coding,
+                                                                &estimate);
+        }
+        return estimate;
+}
+
+/*
+ * Name: split_strata
+ * Purpose: split a grid of blocks or tiles into strata, and share a sample
+ *          between them in proportion to their size
+ * Parameters: how many blocks or tiles there are across and down, how many
+ *             strata at most to cut each way, how big a sample is wanted,
+ *             where to store the number of strata and the size of the sample
+ * Returns: the strata, which the caller must FREE
+ * Notes: each stratum gets at least two samples, so its variance can be
+ *        estimated, unless it is smaller than that
+ */
+estimate_stratum *split_strata(unsigned cols, unsigned rows, unsigned grid,
+                double wanted, unsigned *count, size_t *total)
+{
+        unsigned across = cols < grid ? cols : grid;
+        unsigned down = rows < grid ? rows : grid;
+        uint64_t units = (uint64_t) cols * rows;
+        *count = across * down;
+        *total = 0;
+        estimate_stratum *strata = ALLOC(*count * sizeof(*strata));
+        for (unsigned h = 0; h < *count; h++) {
+                estimate_stratum *stratum = &strata[h];
+                unsigned i = h % across, j = h / across;
+                stratum->first_col = (uint64_t) cols * i / across;
+                stratum->first_row = (uint64_t) rows * j / down;
+                stratum->cols = (uint64_t) cols * (i + 1) / across -
+                                                        stratum->first_col;
+                stratum->rows = (uint64_t) rows * (j + 1) / down -
+                                                        stratum->first_row;
+                stratum->units = (uint64_t) stratum->cols * stratum->rows;
+                uint64_t samples = llround(wanted * stratum->units / units);
+                samples = samples < 2 ? 2 : samples;
+                samples = samples > stratum->units ? stratum->units : samples;
+                stratum->first = *total;
+                stratum->samples = samples;
+                *total += samples;
+        }
+        return strata;
+}
+
+/*
+ * Name: estimate_tiled_size
+ * Purpose: predict the size of an entropy or run-length coded format 3 image
+ *          from a sample of its tiles, and of blocks within those tiles
+ * Parameters: The pnm_ppm image struct, the header the image would be written
+ *             with (its width and height in whole blocks), the codeword
+ *             profile, the tile coding, and the estimate to store the size
+ *             and its 95% confidence interval in
+ * Returns: none
+ * Notes: every tile gets frequency tables (or runs) of its own, so the sample
+ *        is taken in two stages: a stratified sample of tiles, drawn without
+ *        replacement, and in each of those a sample of blocks that stands in
+ *        for the tile (see sample_tile_bytes). All of it is held to the same
+ *        budget as the block sample, one block in ESTIMATE_SAMPLE_SHARE. The
+ *        interval adds the spread between tiles, with Student's t since there
+ *        may be few of them, to the uncertainty within the sampled tiles, and
+ *        is widened to ESTIMATE_MODEL_ERROR if that is narrower
+ */
+void estimate_tiled_size(Pnm_ppm original, const comp40_header *header,
+                const profile40 *profile, unsigned coding,
+                comp40_estimate *estimate)
+{
+        unsigned tiles_across = comp40_tiles_across(header);
+        unsigned tiles_down = comp40_tiles_down(header);
+        uint64_t tiles = (uint64_t) tiles_across * tiles_down;
+        double tile_blocks = header->tile_size / header->block_size;
+
+        /* share the block budget out between the sampled tiles */
+        double budget = estimate->blocks / ESTIMATE_SAMPLE_SHARE;
+        budget = budget < ESTIMATE_MIN_SAMPLES ? ESTIMATE_MIN_SAMPLES : budget;
+        double per_tile = tile_blocks * tile_blocks;
+        per_tile = per_tile < ESTIMATE_TILE_BLOCKS ? per_tile :
+                                                        ESTIMATE_TILE_BLOCKS;
+        unsigned count;
+        size_t total;
+        estimate_stratum *strata = split_strata(tiles_across, tiles_down,
+                        ESTIMATE_TILE_STRATA, budget / per_tile, &count,
+                                                                &total);
+        size_t samples = budget / total;
+        samples = samples < ESTIMATE_MIN_TILE_BLOCKS ?
+                                        ESTIMATE_MIN_TILE_BLOCKS : samples;
+
+        double *bytes = ALLOC(total * sizeof(double));
+        double within = 0, degrees = 0;
+        uint64_t random = ESTIMATE_SEED;
+        for (unsigned h = 0; h < count; h++) {
+                const estimate_stratum *stratum = &strata[h];
+                if (stratum->samples < stratum->units) {
+                        degrees += stratum->samples - 1;
+                }
+
+                /* a partial shuffle picks the tiles without replacement */
+                uint64_t *order = ALLOC(stratum->units * sizeof(uint64_t));
+                for (uint64_t i = 0; i < stratum->units; i++) {
+                        order[i] = i;
+                }
+                for (size_t k = 0; k < stratum->samples; k++) {
+                        uint64_t pick = k + next_random(&random) %
+                                                        (stratum->units - k);
+                        uint64_t index = order[pick];
+                        order[pick] = order[k];
+                        order[k] = index;
+                        double variance;
+                        bytes[stratum->first + k] = sample_tile_bytes(
+                                original, header, profile, coding,
+                                stratum->first_col + index % stratum->cols,
+                                stratum->first_row + index / stratum->cols,
+                                samples, &random, &variance);
+                        within += (double) stratum->units / stratum->samples *
+                                                                variance;
+                }
+                FREE(order);
+        }
+
+        /* with every tile sampled, only the spread within tiles is left */
+        double tiles_bytes = 0, variance = within;
+        if (degrees == 0) {
+                for (size_t k = 0; k < total; k++) {
+                        tiles_bytes += bytes[k];
+                }
+        } else {
+                double mean, between;
+                stratified_mean(bytes, strata, count, tiles, true, &mean,
+                                                                &between);
+                tiles_bytes = tiles * mean;
+                variance += (double) tiles * tiles * between;
+        }
+        double margin = (degrees > 0 ? student_t95(degrees) : ESTIMATE_Z) *
+                                                        sqrt(variance);
+        if (variance > 0 && margin < ESTIMATE_MODEL_ERROR * tiles_bytes) {
+                margin = ESTIMATE_MODEL_ERROR * tiles_bytes;
+        }
+        double fixed = write_comp40_header(NULL, 0, header) +
+                                                comp40_index_size(header);
+        estimate->size = fixed + tiles_bytes;
+        estimate->size_low = fixed + (tiles_bytes > margin ?
+                                                tiles_bytes - margin : 0);
+        estimate->size_high = fixed + tiles_bytes + margin;
+
+        FREE(bytes);
+        FREE(strata);
+}
+
+/*
+ * Name: sample_tile_bytes
+ * Purpose: predict how many bytes one tile takes from a random sample of its
+ *          blocks
+ * Parameters: The pnm_ppm image struct, the header the image would be written
+ *             with, the codeword profile, the tile coding, the column and row
+ *             of the tile, how many blocks to sample, the sampling's random
+ *             state, and where to store the variance of the prediction
+ * Returns: the predicted bytes
+ * Notes: a tile no bigger than twice the sample is compressed whole instead,
+ *        and its size is exact. For rANS the sample's symbol frequencies
+ *        stand in for the tile's: each block costs the bits its symbols
+ *        would take under them, plus a correction for the values the
+ *        sample missed (see field_entropy_bias), and the tile adds the tables
+ *        rans40 would write for them. For runs, a block costs nothing unless
+ *        it starts a run, and then the run's length and codeword. Like
+ *        code_tile, a tile that wouldn't come out smaller than its raw
+ *        codewords is counted raw
+ */
+double sample_tile_bytes(Pnm_ppm original, const comp40_header *header,
+                const profile40 *profile, unsigned coding, unsigned tile_col,
+                unsigned tile_row, size_t samples, uint64_t *random,
+                double *variance)
+{
+        unsigned first_col, first_row, cols, rows;
+        comp40_tile_blocks(header, tile_col, tile_row, &first_col, &first_row,
+                                                                &cols, &rows);
+        size_t blocks = (size_t) cols * rows;
+        *variance = 0;
+        if (blocks <= 2 * samples) {
+                return rgb_int_tile_to_bytes(original, header, profile,
+                                                coding, tile_col, tile_row);
+        }
+
+        double *values = ALLOC(samples * sizeof(double));
+        unsigned char *symbols = ALLOC(samples * RANS40_FIELDS);
+        size_t counts[RANS40_FIELDS][RANS40_MAX_SYMBOLS];
+        memset(counts, 0, sizeof(counts));
+        for (size_t k = 0; k < samples; k++) {
+                size_t index = next_random(random) % blocks;
+                if (coding == COMP40_CODING_RLE) {
+                        values[k] = estimate_run_bytes(original, header,
+                                        profile, first_col, first_row, cols,
+                                                                rows, index);
+                        continue;
+                }
+                unsigned char *curr = symbols + k * RANS40_FIELDS;
+                rans40_symbols(estimate_word(original, first_col + index %
+                                cols, first_row + index / cols, header,
+                                profile, coding, first_col, first_row), curr);
+                for (unsigned f = 0; f < RANS40_FIELDS; f++) {
+                        counts[f][curr[f]]++;
+                }
+        }
+
+        double overhead = 0;
+        if (coding != COMP40_CODING_RLE) {
+                double correction = 0;
+                for (unsigned f = 0; f < RANS40_FIELDS; f++) {
+                        correction += field_entropy_bias(counts[f], f,
+                                                samples, blocks, &overhead);
+                }
+                for (size_t k = 0; k < samples; k++) {
+                        const unsigned char *curr = symbols +
+                                                        k * RANS40_FIELDS;
+                        double bits = correction;
+                        for (unsigned f = 0; f < RANS40_FIELDS; f++) {
+                                bits -= log2((double) counts[f][curr[f]] /
+                                                                samples);
+                        }
+                        values[k] = bits / 8;
+                }
+                overhead += rans40_overhead_estimate(counts, samples,
+                                                                blocks);
+        }
+
+        double sum = 0, squares = 0;
+        for (size_t k = 0; k < samples; k++) {
+                sum += values[k];
+        }
+        double mean = sum / samples;
+        for (size_t k = 0; k < samples; k++) {
+                squares += (values[k] - mean) * (values[k] - mean);
+        }
+        /*
+         * a sample that saw nothing happen (no run starts, one value) has no
+         * spread, so the variance is never less than one block's codeword
+         * landing on the other side
+         */
+        double spread = squares / (samples - 1) / samples;
+        double least = (double) profile->word_bytes * profile->word_bytes /
+                                                        samples / samples;
+        *variance = (double) blocks * blocks * (spread > least ? spread :
+                                least) * (1 - (double) samples / blocks);
+        FREE(symbols);
+        FREE(values);
+
+        double bytes = overhead + blocks * mean;
+        double raw = (double) blocks * profile->word_bytes;
+        return bytes < raw ? bytes : raw;
+}
+
+/*
+ * Name: field_entropy_bias
+ * Purpose: correct the entropy of one codeword field measured on a sample for
+ *          the values the sample missed or saw too rarely
+ * Parameters: how often each value of the field turned up, the field (0 for a
+ *             to 5 for Pr), the sample size, the blocks in the tile, and the
+ *             table overhead to add the missed values' table entries to
+ * Returns: the bits per block to add to the sample's own entropy
+ * Notes: the sample's entropy is biased low. The Chao-Shen estimator scales
+ *        the frequencies by the share of the field the sample covers (one
+ *        less the share of values seen once) and weights each value by the
+ *        chance the sample would have seen it. The values it missed are
+ *        counted with Chao1 (seen once squared, over twice seen twice), and
+ *        each is given a one byte table entry. The tile is coded with its own
+ *        frequencies, which fit it better than the source it came from, by
+ *        the Miller-Madow term for the tile's size
+ */
+double field_entropy_bias(const size_t *counts, unsigned field,
+                        size_t samples, size_t blocks, double *overhead)
+{
+        unsigned seen = 0, once = 0, twice = 0;
+        double plugin = 0, adjusted = 0;
+        size_t singles = 0;
+        for (unsigned v = 0; v < RANS40_MAX_SYMBOLS; v++) {
+                if (counts[v] == 0) {
+                        continue;
+                }
+                seen++;
+                once += counts[v] == 1;
+                twice += counts[v] == 2;
+                singles += counts[v] == 1;
+        }
+        singles = singles == samples ? samples - 1 : singles;
+        double coverage = 1 - (double) singles / samples;
+        for (unsigned v = 0; v < RANS40_MAX_SYMBOLS; v++) {
+                if (counts[v] == 0) {
+                        continue;
+                }
+                double p = (double) counts[v] / samples;
+                double q = coverage * p;
+                plugin -= p * log2(p);
+                adjusted -= q * log2(q) / (1 - pow(1 - q, (double) samples));
+        }
+
+        double missed = twice > 0 ? (double) once * once / (2.0 * twice) :
+                                        (double) once * (once - 1) / 2.0;
+        unsigned room = rans40_field_symbols(field) - seen;
+        missed = missed < room ? missed : room;
+        *overhead += missed;
+
+        /* the coder's own tables fit the tile, so it beats the entropy */
+        double fitted = (seen + missed - 1) / (2.0 * blocks * log(2));
+        return adjusted - fitted - plugin;
+}
+
+/*
+ * Name: estimate_word
+ * Purpose: find the codeword the entropy coder would see for one block
+ * Parameters: The pnm_ppm image struct, the column and row of the block, the
+ *             header the image would be written with, the codeword profile,
+ *             the tile coding, and the first column and row of the block's
+ *             tile
+ * Returns: the codeword, or with prediction its residual
+ * Notes: prediction only looks left, above and above left within the tile,
+ *        so those neighbours (the ones the tile has) are compressed too and
+ *        predicted as a tile of their own
+ */
+uint32_t estimate_word(Pnm_ppm original, unsigned col, unsigned row,
+                const comp40_header *header, const profile40 *profile,
+                unsigned coding, unsigned first_col, unsigned first_row)
+{
+        unsigned left = coding == COMP40_CODING_RANS_MED && col > first_col;
+        unsigned above = coding == COMP40_CODING_RANS_MED && row > first_row;
+        unsigned tile_cols = left + 1, tile_rows = above + 1;
+        unsigned char words[4 * PROFILE40_MAX_WORD_BYTES];
+        for (unsigned i = 0; i < tile_cols * tile_rows; i++) {
+                profile40_put_word(profile, rgb_int_block_to_word(original,
+                                col - left + i % tile_cols,
+                                row - above + i / tile_cols, header, profile),
+                                words + i * profile->word_bytes);
+        }
+        if (coding == COMP40_CODING_RANS_MED) {
+                predict40_residuals(words, tile_cols, tile_rows);
+        }
+        return profile40_get_word(profile, words + (tile_cols * tile_rows -
+                                                1) * profile->word_bytes);
+}
+
+/*
+ * Name: estimate_run_bytes
+ * Purpose: find what one block of a run-length coded tile costs
+ * Parameters: The pnm_ppm image struct, the header the image would be written
+ *             with, the codeword profile, the first column and row of the
+ *             tile and its blocks across and down, and the block's index in
+ *             the tile (row major, the order runs are found in)
+ * Returns: 0 if the block continues a run, and otherwise the bytes of the run
+ *          it starts: its length in 7-bit groups, and its codeword
+ * Notes: a run is followed to its end to find its length, which costs as many
+ *        blocks, on average, as the one sampled
+ */
+double estimate_run_bytes(Pnm_ppm original, const comp40_header *header,
+                const profile40 *profile, unsigned first_col,
+                unsigned first_row, unsigned cols, unsigned rows,
+                size_t index)
+{
+        size_t blocks = (size_t) cols * rows;
+        uint64_t word = rgb_int_block_to_word(original,
+                        first_col + index % cols, first_row + index / cols,
+                                                        header, profile);
+        if (index > 0 && rgb_int_block_to_word(original,
+                        first_col + (index - 1) % cols,
+                        first_row + (index - 1) / cols, header,
+                                                        profile) == word) {
+                return 0;
+        }
+        size_t length = 1;
+        while (index + length < blocks && rgb_int_block_to_word(original,
+                        first_col + (index + length) % cols,
+                        first_row + (index + length) / cols, header,
+                                                        profile) == word) {
+                length++;
+        }
+        unsigned length_bytes = 1;
+        for (size_t rest = length >> 7; rest > 0; rest >>= 7) {
+                length_bytes++;
+        }
+        return length_bytes + profile->word_bytes;
+}
+
+/*
+ * Name: rgb_int_tile_to_bytes
+ * Purpose: compress one tile of an image on its own, the same way the whole
+ *          image stages and comp_avg_ints_to_tiled_out would
+ * Parameters: The pnm_ppm image struct, the header the image would be written
+ *             with, the codeword profile, the tile coding, and the column and
+ *             row of the tile
+ * Returns: how many bytes the tile takes in the file
+ * Notes: raises Bitpack_Overflow if a value doesn't fit in its field
+ */
+size_t rgb_int_tile_to_bytes(Pnm_ppm original, const comp40_header *header,
+                const profile40 *profile, unsigned coding, unsigned tile_col,
+                unsigned tile_row)
+{
+        unsigned first_col, first_row, cols, rows;
+        comp40_tile_blocks(header, tile_col, tile_row, &first_col, &first_row,
+                                                                &cols, &rows);
+        size_t raw_len = (size_t) cols * rows * profile->word_bytes;
+        unsigned char *words = ALLOC(raw_len);
+        unsigned char *out = ALLOC(raw_len);
+        unsigned char *curr = words;
+        for (unsigned row = first_row; row < first_row + rows; row++) {
+                for (unsigned col = first_col; col < first_col + cols; col++) {
+                        profile40_put_word(profile, rgb_int_block_to_word(
+                                original, col, row, header, profile), curr);
+                        curr += profile->word_bytes;
+                }
+        }
+        uint32_t tile_coding;
+        size_t bytes = code_tile(words, cols, rows, profile, coding, out,
+                                                                &tile_coding);
+        FREE(out);
+        FREE(words);
+        return bytes;
+}
+
+/*
+ * Name: rgb_int_block_to_word
+ * Purpose: compress one block of an image to the codeword the encoder would
+ *          write for it
+ * Parameters: The pnm_ppm image struct, the column and row of the block, the
+ *             header the image would be written with, and the codeword
+ *             profile
+ * Returns: the codeword
+ * Notes: raises Bitpack_Overflow if a value doesn't fit in its field
+ */
+uint64_t rgb_int_block_to_word(Pnm_ppm original, unsigned col, unsigned row,
+                const comp40_header *header, const profile40 *profile)
+{
+        comp_avg_ints curr_avg_ints;
+        rgb_int_block_to_comp_avg_ints(original, col, row, header, profile,
+                                                        &curr_avg_ints);
+        uint64_t word;
+        if (!profile->pack(profile, &curr_avg_ints, &word)) {
+                RAISE(Bitpack_Overflow);
+        }
+        return word;
+}
+
+/*
+ * Name: rgb_int_block_to_comp_avg_ints
+ * Purpose: compress one block of an image on its own, the same way the whole
+ *          image stages would
+ * Parameters: The pnm_ppm image struct, the column and row of the block, the
+ *             header giving the block size and colour space, the codeword
+ *             profile, where to store the quantized ints
  * Returns: none
  * Notes: none
  */
-void comp_avg_ints_to_out_apply(int col, int row, UArray2_T pixmap, void *entry,
-                                                                void *cl)
-{
-        /* get values from void pointers */
-        comp_avg_ints *curr_avg_ints = entry;
-        uint64_t word = 0;
-
-        /* place the values in the correct spots in the word */
-        word = Bitpack_newu(word, WIDTH_A, LSB_A, curr_avg_ints->a);
-        word = Bitpack_news(word, WIDTH_B_C_D, LSB_B, curr_avg_ints->b);
-        word = Bitpack_news(word, WIDTH_B_C_D, LSB_C, curr_avg_ints->c);
-        word = Bitpack_news(word, WIDTH_B_C_D, LSB_D, curr_avg_ints->d);
-        word = Bitpack_newu(word, WIDTH_Pb_Pr, LSB_Pb,
-                                                curr_avg_ints->bluediff_avg);
-        word = Bitpack_newu(word, WIDTH_Pb_Pr, LSB_Pr,
-                                                curr_avg_ints->reddiff_avg);
-        
-        /* write the word out 1 byte at a time to standard output */
-        for (int lsb = 24; lsb >= 0; lsb -= 8) {
-                putchar((int) (Bitpack_getu(word, 8, lsb)));
-        }
-        
-        (void) row;
-        (void) col;
-        (void) cl;
-        (void) pixmap;
-}
-
-#undef A2
-#undef BLOCKSIZE
-#undef SEQ_SIZE
-#undef WIDTH_A
-#undef WIDTH_B_C_D
-#undef WIDTH_Pb_Pr
-#undef LSB_A
-#undef LSB_B
-#undef LSB_C
-#undef LSB_D
-#undef LSB_Pb
-#undef LSB_Pr
\ No newline at end of file
+void rgb_int_block_to_comp_avg_ints(Pnm_ppm original, unsigned col,
+                unsigned row, const comp40_header *format,
+                const profile40 *profile, comp_avg_ints *curr_avg_ints)
+{
+        int blocksize = format->block_size;
+        comp_video_floats pixels[TRANSFORM40_MAX_PIXELS];
+        for (int i = 0; i < blocksize * blocksize; i++) {
+                Pnm_rgb curr_int_pixel = original->methods->at(
+                                        original->pixels,
+                                        col * blocksize + i % blocksize,
+                                        row * blocksize + i / blocksize);
+                rgb_int_pixel_to_comp_video(curr_int_pixel,
+                        original->denominator, format->color, &pixels[i]);
+        }
+
+        comp_avg_floats curr_avg_floats;
+        comp_video_block_to_comp_avg_floats(pixels, blocksize,
+                                                &curr_avg_floats, NULL);
+        if (format->color == COMP40_COLOR_GRAY) {
+                profile->quantize_luma(profile, &curr_avg_floats,
+                                                        curr_avg_ints);
+        } else {
+                profile->quantize(profile, &curr_avg_floats, curr_avg_ints);
+        }
+}
+
+/*
+ * Name: stratified_mean
+ * Purpose: estimate the mean of a value over every block (or tile) of an
+ *          image from a stratified sample of it
+ * Parameters: the sampled values, the strata they were sampled from and how
+ *             many there are, the number of blocks or tiles in the image,
+ *             whether they were sampled without replacement, and where to
+ *             store the estimated mean and the variance of that estimate
+ * Returns: none
+ * Notes: each stratum's mean is weighted by its share of the units. Its
+ *        sample variance over its sample size, weighted by the share squared,
+ *        adds to the variance, unless the stratum was sampled whole. Without
+ *        replacement, only the share of the stratum that wasn't sampled adds
+ *        (the finite population correction)
+ */
+void stratified_mean(const double *values, const estimate_stratum *strata,
+                unsigned count, uint64_t units, bool without_replacement,
+                double *mean, double *variance)
+{
+        *mean = 0;
+        *variance = 0;
+        for (unsigned h = 0; h < count; h++) {
+                const estimate_stratum *stratum = &strata[h];
+                const double *curr = values + stratum->first;
+                size_t samples = stratum->samples;
+                double weight = (double) stratum->units / units;
+                double sum = 0;
+                for (size_t k = 0; k < samples; k++) {
+                        sum += curr[k];
+                }
+                double stratum_mean = sum / samples;
+                *mean += weight * stratum_mean;
+                if (samples == stratum->units) {
+                        continue;
+                }
+                double squares = 0;
+                for (size_t k = 0; k < samples; k++) {
+                        squares += (curr[k] - stratum_mean) *
+                                                (curr[k] - stratum_mean);
+                }
+                double unsampled = without_replacement ?
+                        1 - (double) samples / stratum->units : 1;
+                *variance += weight * weight * squares / (samples - 1) /
+                                                        samples * unsampled;
+        }
+}
+
+/*
+ * Name: student_t95
+ * Purpose: find the quantile of Student's t distribution that a two sided
+ *          95% confidence interval uses
+ * Parameters: the degrees of freedom, at least 1
+ * Returns: the quantile, which falls towards ESTIMATE_Z as degrees grows
+ * Notes: exact below 5 degrees, and from there a Cornish-Fisher expansion
+ *        around ESTIMATE_Z, good to better than 0.1%
+ */
+double student_t95(double degrees)
+{
+        static const double small[] = {12.706, 4.303, 3.182, 2.776};
+        assert(degrees >= 1);
+        if (degrees < 5) {
+                return small[(int) degrees - 1];
+        }
+        double z = ESTIMATE_Z;
+        double z3 = z * z * z, z5 = z3 * z * z, z7 = z5 * z * z;
+        return z + (z3 + z) / (4 * degrees) +
+                (5 * z5 + 16 * z3 + 3 * z) / (96 * degrees * degrees) +
+                (3 * z7 + 19 * z5 + 17 * z3 - 15 * z) /
+                                        (384 * degrees * degrees * degrees);
+}
+
+/*
+ * Name: next_random
+ * Purpose: step a splitmix64 generator
+ * Parameters: the generator's state
+ * Returns: the next 64 random bits
+ * Notes: none
+ */
+static inline uint64_t next_random(uint64_t *state)
+{
+        uint64_t z = (*state += UINT64_C(0x9e3779b97f4a7c15));
+        z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+        z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+        return z ^ (z >> 31);
+}
+
+#undef DENOMINATOR
+#undef ESTIMATE_STRATA
+#undef ESTIMATE_SAMPLE_SHARE
+#undef ESTIMATE_MIN_SAMPLES
+#undef ESTIMATE_TILE_STRATA
+#undef ESTIMATE_TILE_BLOCKS
+#undef ESTIMATE_MIN_TILE_BLOCKS
+#undef ESTIMATE_MODEL_ERROR
+#undef ESTIMATE_Z
+#undef ESTIMATE_SEED
@@ -18,23 +18,74 @@
 #include "uarray2.h"
 #include "uarray2b.h"
 #include "bitpack.h"
+#include "bitpack_checked.h"
 #include "arith40.h"
 #include "pixel_structs.h"
+#include "container40.h"
+#include "rans40.h"
+#include "predict40.h"
+#include "rle40.h"
+#include "transform40.h"
+#include "profile40.h"
+#include "trace40.h"
 #include "mem.h"
-#include "seq.h"
+#include "foreach40.h"
 #include <math.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 
 
 #ifndef COMPRESS_INCLUDED
 #define COMPRESS_INCLUDED
 
+/*
+ * Name: comp40_estimate
+ * Contains: what rgb_int_to_estimate predicts compressing an image will give -
+ *           the number of blocks in the image and how many were sampled, the
+ *           RMS error ppmdiff would report (as a fraction of the
+ *           denominator), and the compressed size in bytes. Each
+ *           prediction comes with the low and high ends of its 95% confidence
+ *           interval
+ */
+struct comp40_estimate {
+        uint64_t blocks, samples;
+        double rms, rms_low, rms_high;
+        double size, size_low, size_high;
+};
+typedef struct comp40_estimate comp40_estimate;
+
 Pnm_ppm ppm_to_rgb_int(FILE *inputfp);
+Pnm_ppm rgb8_to_rgb_int(const unsigned char *rgb, unsigned width,
+                                                        unsigned height);
 UArray2_T rgb_int_to_rgb_float(Pnm_ppm original);
-UArray2b_T rgb_float_to_component_video(UArray2_T rgb_float_array);
-UArray2_T comp_video_floats_to_comp_avg_float(UArray2b_T comp_video_array);
-UArray2_T comp_avg_floats_to_comp_avg_ints(UArray2_T comp_avg_array);
+UArray2b_T rgb_float_to_component_video(UArray2_T rgb_float_array,
+                                                        unsigned blocksize);
+UArray2b_T rgb_int_to_component_video(Pnm_ppm original, unsigned blocksize,
+                                                        unsigned color);
+bool rgb_int_is_gray(Pnm_ppm original);
+void rgb_int_pixel_to_comp_video(const struct Pnm_rgb *curr_int_pixel,
+                unsigned denominator, unsigned color,
+                comp_video_floats *curr_video_pixel);
+UArray2_T comp_video_floats_to_comp_avg_float(UArray2b_T comp_video_array,
+                                                Codec40_quant_stats *stats);
+UArray2_T comp_avg_floats_to_comp_avg_ints(UArray2_T comp_avg_array,
+                unsigned profile, unsigned color, Codec40_quant_stats *stats);
+void comp_video_block_to_comp_avg_floats(const comp_video_floats *pixels,
+                int blocksize, comp_avg_floats *curr_avg_floats,
+                Codec40_quant_stats *stats);
+void init_quant_stats(Codec40_quant_stats *stats, unsigned profile);
+UArray2b_T comp_video_floats_to_next_level(UArray2b_T comp_video_array);
 void comp_avg_ints_to_out(UArray2_T comp_avg_ints_array);
+void comp_avg_ints_to_file(UArray2_T comp_avg_ints_array, FILE *output);
+void comp_avg_ints_to_tiled_out(UArray2_T comp_avg_ints_array, FILE *output,
+                                const comp40_header *format, unsigned coding);
+bool comp_avg_ints_to_buffer(UArray2_T comp_avg_ints_array, unsigned char *out,
+                                        size_t out_cap, size_t *out_len);
+size_t compressed_size(unsigned width, unsigned height);
+comp40_estimate rgb_int_to_estimate(Pnm_ppm original,
+                                const comp40_header *format, unsigned coding);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,513 @@
+/**************************************************************
+ *
+ *                     container40.c
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  Implementation of the compressed image layout:
+ *               reading and writing headers of both formats, the
+ *               tile index of format 3, and the CRC32C that
+ *               protects each tile.
+ *
+ **************************************************************/
+
+#include <limits.h>
+#include <pthread.h>
+#include <string.h>
+#include <assert.h>
+#include "container40.h"
+
+#define MAX_BLOCK_SIZE 8
+#define HEADER_PREFIX "COMP40 Compressed image format "
+#define CRC32C_POLY 0x82F63B78
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+/* Helper functions */
+size_t read_header_number(const unsigned char *in, size_t in_len, size_t pos,
+                                                                unsigned *num);
+Codec40_status parse_header_params(const unsigned char *in, size_t in_len,
+                                        size_t pos, comp40_header *header);
+Codec40_status set_header_param(comp40_header *header, const char *key,
+                                                                unsigned val);
+uint64_t get_be(const unsigned char *bytes, unsigned count);
+void put_be(unsigned char *bytes, unsigned count, uint64_t val);
+
+#if !defined(__SSE4_2__)
+void init_crc32c_table(void);
+
+static uint32_t crc32c_table[256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+#endif
+
+/*
+ * Name: parse_comp40_header
+ * Purpose: check that a buffer starts with a compressed image header of a
+ *          known format and get everything it says out of it
+ * Parameters: the buffer and its length in bytes, the header struct to fill
+ * Returns: CODEC40_OK, CODEC40_ETRUNCATED if the buffer ends inside the
+ *          header, CODEC40_EFORMAT if it isn't a valid header
+ * Notes: in and header must not be NULL. Never reads past in_len. On success
+ *        header->length is the number of bytes the header takes
+ */
+Codec40_status parse_comp40_header(const unsigned char *in, size_t in_len,
+                                                        comp40_header *header)
+{
+        assert(in != NULL && header != NULL);
+        memset(header, 0, sizeof(*header));
+        header->block_size = COMP40_DEFAULT_BLOCK_SIZE;
+
+        /* the first line names the format version */
+        size_t prefix_len = strlen(HEADER_PREFIX);
+        size_t compare_len = in_len < prefix_len ? in_len : prefix_len;
+        if (memcmp(in, HEADER_PREFIX, compare_len) != 0) {
+                return CODEC40_EFORMAT;
+        }
+        size_t pos = read_header_number(in, in_len, compare_len,
+                                                        &header->version);
+        if (pos >= in_len) {
+                return CODEC40_ETRUNCATED;
+        }
+        if (pos == 0 || in[pos] != '\n' || (header->version != COMP40_FLAT &&
+                                        header->version != COMP40_TILED)) {
+                return CODEC40_EFORMAT;
+        }
+
+        /* "<width> <height>\n" follows the first line */
+        pos = read_header_number(in, in_len, pos + 1, &header->width);
+        if (pos >= in_len) {
+                return CODEC40_ETRUNCATED;
+        }
+        if (pos == 0 || in[pos] != ' ') {
+                return CODEC40_EFORMAT;
+        }
+        pos = read_header_number(in, in_len, pos + 1, &header->height);
+        if (pos >= in_len) {
+                return CODEC40_ETRUNCATED;
+        }
+        if (pos == 0 || in[pos] != '\n') {
+                return CODEC40_EFORMAT;
+        }
+        pos++;
+        if (header->width > INT_MAX || header->height > INT_MAX) {
+                return CODEC40_EFORMAT;
+        }
+
+        if (header->version == COMP40_TILED) {
+                Codec40_status status = parse_header_params(in, in_len, pos,
+                                                                header);
+                if (status != CODEC40_OK) {
+                        return status;
+                }
+        } else {
+                header->length = pos;
+        }
+
+        /* there must be at least one whole block */
+        if (header->width < header->block_size ||
+                                header->height < header->block_size) {
+                return CODEC40_EFORMAT;
+        }
+        return CODEC40_OK;
+}
+
+/*
+ * Name: parse_header_params
+ * Purpose: read the "key=value key=value" line of a format 3 header
+ * Parameters: the buffer and its length, the position the line starts at, the
+ *             header struct to fill
+ * Returns: the same status codes as parse_comp40_header
+ * Notes: unknown keys are rejected, so an old decoder never silently misreads
+ *        a file written with a newer option
+ */
+Codec40_status parse_header_params(const unsigned char *in, size_t in_len,
+                                        size_t pos, comp40_header *header)
+{
+        while (pos < in_len && in[pos] != '\n') {
+                /* key */
+                char key[16];
+                size_t key_len = 0;
+                while (pos < in_len && in[pos] != '=' && in[pos] != '\n' &&
+                                                key_len < sizeof(key) - 1) {
+                        key[key_len++] = in[pos++];
+                }
+                key[key_len] = '\0';
+                if (pos >= in_len) {
+                        return CODEC40_ETRUNCATED;
+                }
+                if (in[pos] != '=') {
+                        return CODEC40_EFORMAT;
+                }
+
+                /* value */
+                unsigned val;
+                pos = read_header_number(in, in_len, pos + 1, &val);
+                if (pos >= in_len) {
+                        return CODEC40_ETRUNCATED;
+                }
+                if (pos == 0 || (in[pos] != ' ' && in[pos] != '\n') ||
+                    set_header_param(header, key, val) != CODEC40_OK) {
+                        return CODEC40_EFORMAT;
+                }
+                if (in[pos] == ' ') {
+                        pos++;
+                }
+        }
+        if (pos >= in_len) {
+                return CODEC40_ETRUNCATED;
+        }
+
+        /* tiles hold whole blocks, and no more than an index entry can count */
+        if (header->tile_size == 0 ||
+            header->tile_size > COMP40_MAX_TILE_SIZE ||
+            !comp40_valid_block_size(header->block_size) ||
+            header->tile_size % header->block_size != 0) {
+                return CODEC40_EFORMAT;
+        }
+
+        /* tiny tiles on a huge image could make an index too big to size */
+        if ((uint64_t) comp40_tiles_across(header) *
+                                comp40_tiles_down(header) >
+                                SIZE_MAX / COMP40_TILE_ENTRY_SIZE) {
+                return CODEC40_EFORMAT;
+        }
+        header->length = pos + 1;
+        return CODEC40_OK;
+}
+
+/*
+ * Name: set_header_param
+ * Purpose: store one "key=value" pair of a format 3 header
+ * Parameters: the header struct, the key and the value
+ * Returns: CODEC40_OK, or CODEC40_EFORMAT if the key is unknown or names a
+ *          profile or colour space that doesn't exist
+ * Notes: none
+ */
+Codec40_status set_header_param(comp40_header *header, const char *key,
+                                                                unsigned val)
+{
+        if (strcmp(key, "tile") == 0) {
+                header->tile_size = val;
+                return CODEC40_OK;
+        }
+        if (strcmp(key, "block") == 0) {
+                header->block_size = val;
+                return CODEC40_OK;
+        }
+        if (strcmp(key, "profile") == 0 && profile40_get(val) != NULL) {
+                header->profile = val;
+                return CODEC40_OK;
+        }
+        if (strcmp(key, "color") == 0 && (val == COMP40_COLOR_YPBPR ||
+                                                val == COMP40_COLOR_YCOCG ||
+                                                val == COMP40_COLOR_GRAY)) {
+                header->color = val;
+                return CODEC40_OK;
+        }
+        return CODEC40_EFORMAT;
+}
+
+/*
+ * Name: read_header_number
+ * Purpose: read an unsigned decimal number out of a header in a buffer
+ * Parameters: the buffer and its length, the position the number starts at,
+ *             a pointer to where the number should be stored
+ * Returns: the position just past the number (in_len if the buffer ends
+ *          inside it), or 0 if there are no digits or the number does not fit
+ *          in 32 bits
+ * Notes: none
+ */
+size_t read_header_number(const unsigned char *in, size_t in_len, size_t pos,
+                                                                unsigned *num)
+{
+        uint64_t val = 0;
+        size_t start = pos;
+        while (pos < in_len && in[pos] >= '0' && in[pos] <= '9') {
+                val = val * 10 + (in[pos] - '0');
+                if (val > UINT32_MAX) {
+                        return 0;
+                }
+                pos++;
+        }
+        if (pos == start && pos < in_len) {
+                return 0;
+        }
+        *num = val;
+        return pos;
+}
+
+/*
+ * Name: read_comp40_header_file
+ * Purpose: read the header of a compressed image from a file
+ * Parameters: pointer to input file, the header struct to fill
+ * Returns: the same status codes as parse_comp40_header
+ * Notes: input and header must not be NULL. Reads one line at a time until
+ *        the header is complete, so on success the file is positioned just
+ *        past it, at the first codeword (format 2) or the tile index (3)
+ */
+Codec40_status read_comp40_header_file(FILE *input, comp40_header *header)
+{
+        assert(input != NULL && header != NULL);
+        unsigned char text[COMP40_MAX_HEADER_LENGTH];
+        size_t length = 0;
+        Codec40_status status = CODEC40_ETRUNCATED;
+
+        while (status == CODEC40_ETRUNCATED && length < sizeof(text)) {
+                int c = getc(input);
+                if (c == EOF) {
+                        return CODEC40_ETRUNCATED;
+                }
+                text[length++] = c;
+                if (c == '\n') {
+                        status = parse_comp40_header(text, length, header);
+                }
+        }
+        return status == CODEC40_ETRUNCATED ? CODEC40_EFORMAT : status;
+}
+
+/*
+ * Name: write_comp40_header
+ * Purpose: write the text part of a compressed image header
+ * Parameters: the buffer to write to and its capacity (snprintf rules, so a
+ *             NULL buffer with capacity 0 just measures), the header to write
+ * Returns: the length of the header in bytes, not counting the '\0'
+ * Notes: header must not be NULL. The block size, profile and colour space
+ *        are only written when they aren't the default, so files that use
+ *        none of them stay readable by decoders that don't know the keys
+ */
+int write_comp40_header(char *out, size_t out_cap, const comp40_header *header)
+{
+        assert(header != NULL);
+        if (header->version != COMP40_TILED) {
+                return snprintf(out, out_cap, HEADER_PREFIX "%u\n%u %u\n",
+                                header->version, header->width, header->height);
+        }
+
+        /* the tile line, with only the keys that aren't the default */
+        char params[COMP40_MAX_HEADER_LENGTH];
+        int len = snprintf(params, sizeof(params), "tile=%u",
+                                                        header->tile_size);
+        if (header->block_size != COMP40_DEFAULT_BLOCK_SIZE) {
+                len += snprintf(params + len, sizeof(params) - len,
+                                        " block=%u", header->block_size);
+        }
+        if (header->profile != PROFILE40_STANDARD) {
+                len += snprintf(params + len, sizeof(params) - len,
+                                        " profile=%u", header->profile);
+        }
+        if (header->color != COMP40_COLOR_YPBPR) {
+                len += snprintf(params + len, sizeof(params) - len,
+                                        " color=%u", header->color);
+        }
+        return snprintf(out, out_cap, HEADER_PREFIX "%u\n%u %u\n%s\n",
+                        header->version, header->width, header->height,
+                        params);
+}
+
+/*
+ * Name: comp40_valid_block_size
+ * Purpose: check whether a block size is one the codec has a transform for
+ * Parameters: the width (and height) of a block in pixels
+ * Returns: true for 2, 4 and 8
+ * Notes: none
+ */
+bool comp40_valid_block_size(unsigned block_size)
+{
+        return block_size >= COMP40_DEFAULT_BLOCK_SIZE &&
+                block_size <= MAX_BLOCK_SIZE &&
+                (block_size & (block_size - 1)) == 0;
+}
+
+/*
+ * Name: comp40_tiles_across
+ * Purpose: count the tiles in one row of a format 3 image
+ * Parameters: the header
+ * Returns: the number of tiles across (the last one may be narrower)
+ * Notes: header must be a format 3 header. Counted in whole blocks, so a
+ *        partial block at the edge never makes a tile of its own
+ */
+unsigned comp40_tiles_across(const comp40_header *header)
+{
+        assert(header != NULL && header->tile_size > 0);
+        unsigned tile_blocks = header->tile_size / header->block_size;
+        unsigned width_blocks = header->width / header->block_size;
+        return (width_blocks + tile_blocks - 1) / tile_blocks;
+}
+
+/*
+ * Name: comp40_tiles_down
+ * Purpose: count the rows of tiles in a format 3 image
+ * Parameters: the header
+ * Returns: the number of tiles down (the last row may be shorter)
+ * Notes: header must be a format 3 header. Counted in whole blocks
+ */
+unsigned comp40_tiles_down(const comp40_header *header)
+{
+        assert(header != NULL && header->tile_size > 0);
+        unsigned tile_blocks = header->tile_size / header->block_size;
+        unsigned height_blocks = header->height / header->block_size;
+        return (height_blocks + tile_blocks - 1) / tile_blocks;
+}
+
+/*
+ * Name: comp40_index_size
+ * Purpose: find how many bytes the tile index of a format 3 image takes
+ * Parameters: the header
+ * Returns: the size of the index in bytes
+ * Notes: header must be a format 3 header
+ */
+size_t comp40_index_size(const comp40_header *header)
+{
+        return (size_t) comp40_tiles_across(header) *
+                (size_t) comp40_tiles_down(header) * COMP40_TILE_ENTRY_SIZE;
+}
+
+/*
+ * Name: comp40_tile_blocks
+ * Purpose: find which blocks of the image a tile of a format 3 image holds
+ * Parameters: the header, the column and row of the tile, and where to store
+ *             the first block column and row in the tile and the number of
+ *             blocks across and down it
+ * Returns: none
+ * Notes: tiles on the right and bottom edges may hold fewer blocks
+ */
+void comp40_tile_blocks(const comp40_header *header, unsigned tile_col,
+                        unsigned tile_row, unsigned *first_col,
+                        unsigned *first_row, unsigned *cols, unsigned *rows)
+{
+        assert(header != NULL && header->tile_size > 0);
+        unsigned tile_blocks = header->tile_size / header->block_size;
+        unsigned width_blocks = header->width / header->block_size;
+        unsigned height_blocks = header->height / header->block_size;
+        *first_col = tile_col * tile_blocks;
+        *first_row = tile_row * tile_blocks;
+        *cols = width_blocks - *first_col < tile_blocks ?
+                                width_blocks - *first_col : tile_blocks;
+        *rows = height_blocks - *first_row < tile_blocks ?
+                                height_blocks - *first_row : tile_blocks;
+}
+
+/*
+ * Name: parse_comp40_tile
+ * Purpose: read one entry of the tile index
+ * Parameters: pointer to the entry's COMP40_TILE_ENTRY_SIZE bytes, the tile
+ *             struct to fill
+ * Returns: none
+ * Notes: neither pointer may be NULL
+ */
+void parse_comp40_tile(const unsigned char *entry, comp40_tile *tile)
+{
+        assert(entry != NULL && tile != NULL);
+        tile->offset = get_be(entry, 8);
+        tile->length = get_be(entry + 8, 4);
+        tile->crc = get_be(entry + 12, 4);
+        tile->coding = get_be(entry + 16, 4);
+}
+
+/*
+ * Name: write_comp40_tile
+ * Purpose: write one entry of the tile index
+ * Parameters: pointer to room for the entry's COMP40_TILE_ENTRY_SIZE bytes,
+ *             the tile struct to write
+ * Returns: none
+ * Notes: neither pointer may be NULL
+ */
+void write_comp40_tile(unsigned char *entry, const comp40_tile *tile)
+{
+        assert(entry != NULL && tile != NULL);
+        put_be(entry, 8, tile->offset);
+        put_be(entry + 8, 4, tile->length);
+        put_be(entry + 12, 4, tile->crc);
+        put_be(entry + 16, 4, tile->coding);
+}
+
+/*
+ * Name: get_be
+ * Purpose: read a big endian unsigned number
+ * Parameters: pointer to its bytes, how many bytes it takes (at most 8)
+ * Returns: the number
+ * Notes: none
+ */
+uint64_t get_be(const unsigned char *bytes, unsigned count)
+{
+        uint64_t val = 0;
+        for (unsigned i = 0; i < count; i++) {
+                val = (val << 8) | bytes[i];
+        }
+        return val;
+}
+
+/*
+ * Name: put_be
+ * Purpose: write a big endian unsigned number
+ * Parameters: pointer to room for its bytes, how many bytes it takes (at
+ *             most 8), the number
+ * Returns: none
+ * Notes: none
+ */
+void put_be(unsigned char *bytes, unsigned count, uint64_t val)
+{
+        for (unsigned i = count; i > 0; i--) {
+                bytes[i - 1] = val & 0xff;
+                val >>= 8;
+        }
+}
+
+/*
+ * Name: crc32c
+ * Purpose: compute the CRC32C (Castagnoli) of some bytes
+ * Parameters: the CRC so far (0 to start), the bytes and how many there are
+ * Returns: the updated CRC
+ * Notes: uses the SSE4.2 crc32 instruction when compiled for it, and a table
+ *        otherwise. The table is built once, safely from any thread
+ */
+uint32_t crc32c(uint32_t crc, const unsigned char *bytes, size_t length)
+{
+        crc = ~crc;
+#if defined(__SSE4_2__)
+        while (length >= 8) {
+                uint64_t chunk;
+                memcpy(&chunk, bytes, 8);
+                crc = _mm_crc32_u64(crc, chunk);
+                bytes += 8;
+                length -= 8;
+        }
+        while (length-- > 0) {
+                crc = _mm_crc32_u8(crc, *bytes++);
+        }
+#else
+        pthread_once(&crc32c_once, init_crc32c_table);
+        while (length-- > 0) {
+                crc = crc32c_table[(crc ^ *bytes++) & 0xff] ^ (crc >> 8);
+        }
+#endif
+        return ~crc;
+}
+
+#if !defined(__SSE4_2__)
+/*
+ * Name: init_crc32c_table
+ * Purpose: fill in the byte at a time CRC32C table
+ * Parameters: none
+ * Returns: none
+ * Notes: only called through pthread_once
+ */
+void init_crc32c_table(void)
+{
+        for (uint32_t i = 0; i < 256; i++) {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; bit++) {
+                        crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+                }
+                crc32c_table[i] = crc;
+        }
+}
+#endif
+
+#undef MAX_BLOCK_SIZE
+#undef HEADER_PREFIX
+#undef CRC32C_POLY
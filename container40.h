@@ -0,0 +1,150 @@
+/**************************************************************
+ *
+ *                     container40.h
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  Interface for the layout of compressed image
+ *               files: the header, and the tile index of the
+ *               tiled format.
+ *
+ *               Format 2 is a header followed by one codeword per
+ *               block, row major:
+ *
+ *                 COMP40 Compressed image format 2\n
+ *                 <width> <height>\n
+ *                 <codewords>
+ *
+ *               Format 3 splits the blocks into square tiles that
+ *               can be checked and decoded on their own:
+ *
+ *                 COMP40 Compressed image format 3\n
+ *                 <width> <height>\n
+ *                 tile=<pixels>[ block=<pixels>][ profile=<n>][ color=<n>]\n
+ *                 <tile index, one entry per tile, row major>
+ *                 <tile data>
+ *
+ *               Each index entry is 20 bytes, big endian: the
+ *               offset of the tile from the end of the index (8),
+ *               its length (4), the CRC32C of its bytes (4) and how
+ *               its codewords are coded (4). With coding 0 the
+ *               tile holds its blocks' codewords row major. With
+ *               coding 1 the same codewords are entropy coded by
+ *               rans40.c. Coding 2 is coding 1 applied to the
+ *               residuals left by predict40.c. With coding 3 they
+ *               are stored as runs of identical codewords by
+ *               rle40.c. A writer may pick the coding per tile.
+ *
+ *               Blocks are 2x2 pixels unless the header says
+ *               block=4 or block=8. A codeword always holds the
+ *               same six fields, but for bigger blocks a, b, c and
+ *               d are the DC and the three lowest frequency DCT
+ *               coefficients of the block's luma (for 2x2 blocks
+ *               the DCT is exactly the a, b, c, d Haar transform).
+ *
+ *               Codewords are laid out by the profile the header
+ *               names (see profile40.h), profile 0 if it names
+ *               none. Format 2 always uses profile 0, and
+ *               codings 1 and 2 are only used with profile 0.
+ *
+ *               Luma and chroma are Y, Pb and Pr unless the header
+ *               says color=1, in which case they are the Y, Co and
+ *               Cg of the integer YCoCg-R transform (Co in the Pb
+ *               field and Cg in the Pr field), or color=2, in which
+ *               case the image is grayscale: only Y is stored, the
+ *               Pb and Pr fields are 0 and the decoder ignores
+ *               them. Format 2 is always YPbPr.
+ *
+ **************************************************************/
+
+#ifndef CONTAINER40_INCLUDED
+#define CONTAINER40_INCLUDED
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "codec40.h"
+#include "profile40.h"
+
+#define COMP40_FLAT 2
+#define COMP40_TILED 3
+
+/* longest header write_comp40_header can produce, '\0' included */
+#define COMP40_MAX_HEADER_LENGTH 128
+
+/* the block size of format 2, and of format 3 without a block= key */
+#define COMP40_DEFAULT_BLOCK_SIZE 2
+
+/* the colour spaces a header can name with color= */
+#define COMP40_COLOR_YPBPR 0
+#define COMP40_COLOR_YCOCG 1
+#define COMP40_COLOR_GRAY 2
+
+/*
+ * the largest tile= a header can give. Even with 2 pixel blocks and the
+ * widest codewords, a raw tile (16384 by 16384 blocks of 8 bytes, 2 GiB) fits
+ * the 32 bit length of its index entry
+ */
+#define COMP40_MAX_TILE_SIZE 32768
+
+#define COMP40_TILE_ENTRY_SIZE 20
+#define COMP40_CODING_RAW 0
+#define COMP40_CODING_RANS 1
+#define COMP40_CODING_RANS_MED 2
+#define COMP40_CODING_RLE 3
+
+/*
+ * Name: comp40_header
+ * Contains: everything the header of a compressed image says - the format
+ *           version, the image size in pixels, the tile size in pixels (format
+ *           3 only), the width and height of a block in pixels, the codeword
+ *           profile, the colour space, and the number of bytes the text part
+ *           of the header takes
+ */
+struct comp40_header {
+        unsigned version;
+        unsigned width, height;
+        unsigned tile_size;
+        unsigned block_size;
+        unsigned profile;
+        unsigned color;
+        size_t length;
+};
+typedef struct comp40_header comp40_header;
+
+/*
+ * Name: comp40_tile
+ * Contains: one entry of the tile index - where the tile's bytes start
+ *           (counted from the end of the index), how many there are, their
+ *           CRC32C, and how the codewords in them are coded
+ */
+struct comp40_tile {
+        uint64_t offset;
+        uint32_t length;
+        uint32_t crc;
+        uint32_t coding;
+};
+typedef struct comp40_tile comp40_tile;
+
+Codec40_status parse_comp40_header(const unsigned char *in, size_t in_len,
+                                                        comp40_header *header);
+Codec40_status read_comp40_header_file(FILE *input, comp40_header *header);
+int write_comp40_header(char *out, size_t out_cap,
+                                        const comp40_header *header);
+
+bool comp40_valid_block_size(unsigned block_size);
+unsigned comp40_tiles_across(const comp40_header *header);
+unsigned comp40_tiles_down(const comp40_header *header);
+size_t comp40_index_size(const comp40_header *header);
+void comp40_tile_blocks(const comp40_header *header, unsigned tile_col,
+                        unsigned tile_row, unsigned *first_col,
+                        unsigned *first_row, unsigned *cols, unsigned *rows);
+void parse_comp40_tile(const unsigned char *entry, comp40_tile *tile);
+void write_comp40_tile(unsigned char *entry, const comp40_tile *tile);
+
+uint32_t crc32c(uint32_t crc, const unsigned char *bytes, size_t length);
+
+#endif
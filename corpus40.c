@@ -0,0 +1,160 @@
+/**************************************************************
+ *
+ *                     corpus40.c
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  The corpus of synthetic test images (see
+ *               corpus40.h), generated as binary PPM files in
+ *               memory.
+ *
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "assert.h"
+#include "mem.h"
+#include "corpus40.h"
+
+#define SEED UINT64_C(0x40b0a5e5eed)
+
+/*
+ * The corpus. 2x2 and 3x5 are the smallest images the codec takes, 1001x803
+ * has odd sides to trim, and the stripe is 64 full rows of a 32768x32768
+ * (gigapixel) image
+ */
+static const corpus40_image corpus[] = {
+        {"gradient-2x2", CORPUS40_GRADIENT, 2, 2},
+        {"noise-3x5", CORPUS40_NOISE, 3, 5},
+        {"photo-1001x803", CORPUS40_PHOTO, 1001, 803},
+        {"noise-1024x768", CORPUS40_NOISE, 1024, 768},
+        {"gradient-1024x768", CORPUS40_GRADIENT, 1024, 768},
+        {"flat-1024x768", CORPUS40_FLAT, 1024, 768},
+        {"photo-2048x1536", CORPUS40_PHOTO, 2048, 1536},
+        {"stripe-32768x64", CORPUS40_PHOTO, 32768, 64}
+};
+
+/* Helper functions */
+unsigned char generate_sample(const corpus40_image *image, unsigned col,
+                        unsigned row, unsigned channel, uint64_t *random);
+static inline uint64_t next_random(uint64_t *state);
+
+/*
+ * Name: corpus40_count
+ * Purpose: find how many images the corpus has
+ * Parameters: none
+ * Returns: the number of images
+ * Notes: none
+ */
+unsigned corpus40_count(void)
+{
+        return sizeof(corpus) / sizeof(corpus[0]);
+}
+
+/*
+ * Name: corpus40_get
+ * Purpose: look up one image of the corpus
+ * Parameters: its index, below corpus40_count()
+ * Returns: the image
+ * Notes: none
+ */
+const corpus40_image *corpus40_get(unsigned index)
+{
+        assert(index < corpus40_count());
+        return &corpus[index];
+}
+
+/*
+ * Name: corpus40_ppm
+ * Purpose: make one image of the corpus as the bytes of a binary PPM file
+ * Parameters: the image to make, where to store the length of the file
+ * Returns: the file's bytes, which the caller frees with FREE
+ * Notes: the generator is seeded from the image's kind alone, so the same
+ *        image comes out on every run
+ */
+unsigned char *corpus40_ppm(const corpus40_image *image, size_t *length)
+{
+        char header[64];
+        int header_length = snprintf(header, sizeof(header), "P6\n%u %u\n255\n",
+                                                image->width, image->height);
+        assert(header_length > 0 && (size_t) header_length < sizeof(header));
+        *length = header_length + (size_t) image->width * image->height * 3;
+        unsigned char *ppm = ALLOC(*length);
+        memcpy(ppm, header, header_length);
+
+        uint64_t random = SEED ^ image->kind;
+        unsigned char *pixel = ppm + header_length;
+        for (unsigned row = 0; row < image->height; row++) {
+                for (unsigned col = 0; col < image->width; col++) {
+                        for (unsigned channel = 0; channel < 3; channel++) {
+                                *pixel++ = generate_sample(image, col, row,
+                                                        channel, &random);
+                        }
+                }
+        }
+        return ppm;
+}
+
+/*
+ * Name: generate_sample
+ * Purpose: make one sample of a corpus image
+ * Parameters: the image, the column and row of the pixel, the channel (0 for
+ *             red to 2 for blue), and the generator's random state
+ * Returns: the sample, from 0 to 255
+ * Notes: noise is uniform. Gradients run red across, green down and blue
+ *        along the diagonal. Flat images are 48x32 rectangles, most of them
+ *        white, the rest one of a few solid colours, like a screenshot.
+ *        Photographs are smooth waves of light and colour with a few hard
+ *        edges and a little grain
+ */
+unsigned char generate_sample(const corpus40_image *image, unsigned col,
+                        unsigned row, unsigned channel, uint64_t *random)
+{
+        double x = (double) col / image->width;
+        double y = (double) row / image->height;
+        if (image->kind == CORPUS40_NOISE) {
+                return next_random(random) >> 56;
+        }
+        if (image->kind == CORPUS40_GRADIENT) {
+                double t = channel == 0 ? x : channel == 1 ? y : (x + y) / 2;
+                return t * 255;
+        }
+        if (image->kind == CORPUS40_FLAT) {
+                uint64_t cell = (uint64_t) (col / 48) << 32 | (row / 32);
+                uint64_t hash = next_random(&cell);
+                if (hash % 10 < 7) {
+                        return 255;
+                }
+                return (hash >> (8 * (channel + 1))) & 0xc0;
+        }
+
+        double value = 0.5 + 0.25 * sin(6.1 * x + 2.3 * channel) *
+                                        cos(4.7 * y - 1.1 * channel) +
+                        0.1 * sin(40 * x * y + channel) +
+                        ((int) (5 * x + 3 * y) % 2 ? 0.12 : -0.12);
+        value += ((double) (next_random(random) >> 40) / (1 << 24) - 0.5) *
+                                                                        0.06;
+        value = value < 0 ? 0 : value > 1 ? 1 : value;
+        return round(value * 255);
+}
+
+/*
+ * Name: next_random
+ * Purpose: step a splitmix64 generator
+ * Parameters: the generator's state
+ * Returns: the next 64 random bits
+ * Notes: none
+ */
+static inline uint64_t next_random(uint64_t *state)
+{
+        uint64_t z = (*state += UINT64_C(0x9e3779b97f4a7c15));
+        z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+        z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+        return z ^ (z >> 31);
+}
+
+#undef SEED
@@ -0,0 +1,45 @@
+/**************************************************************
+ *
+ *                     corpus40.h
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  Interface for the corpus of synthetic test
+ *               images that bench40 times and estimate_test
+ *               checks the estimator on: noise, gradients, flat
+ *               areas, photograph-like scenes, odd sizes from 2x2
+ *               up, and a full width stripe of a gigapixel image.
+ *               Every image comes from a seeded generator, so the
+ *               same bytes come out on every run.
+ *
+ **************************************************************/
+
+#ifndef CORPUS40_INCLUDED
+#define CORPUS40_INCLUDED
+
+#include <stddef.h>
+
+#define CORPUS40_NOISE 0
+#define CORPUS40_GRADIENT 1
+#define CORPUS40_FLAT 2
+#define CORPUS40_PHOTO 3
+
+/*
+ * Name: corpus40_image
+ * Contains: one image of the corpus - its name, which generator makes it (one
+ *           of the CORPUS40_ kinds), and its width and height
+ */
+struct corpus40_image {
+        const char *name;
+        unsigned kind;
+        unsigned width, height;
+};
+typedef struct corpus40_image corpus40_image;
+
+unsigned corpus40_count(void);
+const corpus40_image *corpus40_get(unsigned index);
+unsigned char *corpus40_ppm(const corpus40_image *image, size_t *length);
+
+#endif
@@ -13,35 +13,84 @@
 
 #include "decompress.h"
 
+/*
+ * Name: tile_jobs
+ * Contains: everything the threads decoding a set of format 3 tiles share -
+ *           the header, which tiles to decode (a rectangle of them, row
+ *           major) and their index entries, where the tile data is (in memory,
+ *           or in a file to pread from), the UArray2 to decode into and the
+ *           block its top left element stands for, and under the lock the next
+ *           job to hand out and the first error seen
+ */
+struct tile_jobs {
+        const comp40_header *header;
+        unsigned first_tile_col, first_tile_row;
+        unsigned tiles_across;
+        unsigned count;
+        comp40_tile *tiles;
+        const unsigned char *data;
+        size_t data_len;
+        int fd;
+        off_t data_offset;
+        UArray2_T dest;
+        unsigned dest_col, dest_row;
+        pthread_mutex_t lock;
+        unsigned next;
+        Codec40_status status;
+};
+typedef struct tile_jobs tile_jobs;
+
 #define DENOMINATOR 255
-#define A2 A2Methods_UArray2
 #define PNM_RGB_SIZE 12
-#define BLOCKSIZE 2
-#define WORD_LENGTH 32
-/* Bit packing literals */
-#define WIDTH_A 6
-#define WIDTH_B_C_D 6
-#define WIDTH_Pb_Pr 4
-#define LSB_A 26
-#define LSB_B 20
-#define LSB_C 14
-#define LSB_D 8
-#define LSB_Pb 4
-#define LSB_Pr 0
+#define MAX_DECODE_THREADS 64
+#define PREVIEW_MAX_SCALE 8
+#define READ_CHUNK 65536       /* first read buffer for a format 3 pipe */
 
 /* Helper functions */
 float calculate_rgb_float(comp_video_floats *curr_video_pixel,
                                         float bluediff_num, float reddiff_num);
-void rgb_float_to_rgb_int_apply(int col, int row, A2 pixmap, void *entry,
-                                                                void *cl);
-void component_video_to_rgb_float_apply(int col, int row, UArray2b_T pixmap,
-                                                        void *entry, void *cl);
-void comp_avg_float_to_comp_video_floats_apply(int col, int row,
-                                UArray2_T pixmap, void *entry, void *cl);
-void comp_avg_ints_to_comp_avg_floats_apply(int col, int row, UArray2_T pixmap,
-                                                        void *entry, void *cl);
-void word_to_comp_avg_ints_apply(int col, int row, UArray2_T pixmap,
-                                                        void *entry, void *cl);
+Pnm_ppm int_video_to_rgb_int(UArray2b_T comp_video_array, unsigned color);
+void rgb_int_to_pgm(Pnm_ppm output_image);
+void ycocg_pixel_to_rgb_int(const comp_video_floats *curr_video_pixel,
+                                                Pnm_rgb curr_int_pixel);
+int scale_to_int(float val, float scale, int min, int max);
+static inline bool same_comp_avg_ints(const comp_avg_ints *x,
+                                                const comp_avg_ints *y);
+static inline bool same_comp_avg_floats(const comp_avg_floats *x,
+                                                const comp_avg_floats *y);
+void comp_avg_floats_to_rgb_block(const comp_avg_floats *curr_avg_floats,
+                unsigned blocksize, unsigned color, struct Pnm_rgb *block);
+void comp_video_pixel_to_rgb_int(comp_video_floats *curr_video_pixel,
+                                unsigned color, Pnm_rgb curr_int_pixel);
+void kahan_add(double *sum, double *compensation, double val);
+UArray2_T tiled_file_to_comp_avg_ints(FILE *input, const comp40_header *header,
+                                                        Codec40_status *status);
+bool file_to_comp_avg_ints(FILE *input, const profile40 *profile,
+                                        UArray2_T comp_avg_ints_array);
+int64_t file_bytes_left(FILE *input);
+unsigned char *file_to_buffer(FILE *input, size_t *length);
+UArray2_T flat_buffer_to_comp_avg_ints(const comp40_header *header,
+                const unsigned char *in, size_t in_len, Codec40_status *status,
+                const char *stage);
+UArray2_T tiled_buffer_to_comp_avg_ints(const comp40_header *header,
+                const unsigned char *in, size_t in_len, Codec40_status *status);
+Codec40_status tiled_region_to_comp_avg_ints(int fd, off_t index_offset,
+                        const comp40_header *header, unsigned first_col,
+                        unsigned first_row, UArray2_T comp_avg_ints_array);
+Codec40_status flat_region_to_comp_avg_ints(int fd, off_t data_offset,
+                        const comp40_header *header, unsigned first_col,
+                        unsigned first_row, UArray2_T comp_avg_ints_array);
+Codec40_status decode_tiles(tile_jobs *jobs);
+void *decode_tiles_thread(void *cl);
+Codec40_status decode_tile(tile_jobs *jobs, unsigned job);
+bool runs_to_comp_avg_ints(tile_jobs *jobs, const profile40 *profile,
+                        const unsigned char *in, size_t in_len,
+                        unsigned first_col, unsigned first_row, unsigned cols,
+                        unsigned rows);
+void comp_avg_ints_to_preview_pixel(UArray2_T comp_avg_ints_array,
+                const profile40 *profile, unsigned color, unsigned factor,
+                unsigned col, unsigned row, Pnm_rgb curr_int_pixel);
+unsigned scale_to_rgb_int(float val);
 float ensure_in_bounds(float val, float min, float max);
 
 /*
@@ -56,7 +105,100 @@ void rgb_int_to_ppm(Pnm_ppm output_image)
         /* write the image file to standard out and free the pnm_ppm struct */
         assert(output_image != NULL);
         Pnm_ppmwrite(stdout, output_image);
+        TRACE40_FLUSH("rgb_int_to_ppm", (uint64_t) output_image->width *
+                                                output_image->height * 3);
+        Pnm_ppmfree(&output_image);
+}
+
+/*
+ * Name: rgb_int_to_pnm
+ * Purpose: Print a decompressed image to standard output in the form its
+ *          colour space calls for
+ * Parameters: A ppm image struct, the colour space of the compressed image
+ *             (one of the COMP40_COLOR_ values)
+ * Returns: none
+ * Notes: output_image must not be NULL, frees output_image. A grayscale image
+ *        is written as a PGM, anything else as a PPM
+ */
+void rgb_int_to_pnm(Pnm_ppm output_image, unsigned color)
+{
+        assert(output_image != NULL);
+        unsigned width = output_image->width, height = output_image->height;
+        TRACE40_STAGE_ENTRY("rgb_int_to_pnm", width, height);
+        if (color == COMP40_COLOR_GRAY) {
+                rgb_int_to_pgm(output_image);
+        } else {
+                rgb_int_to_ppm(output_image);
+        }
+        TRACE40_STAGE_EXIT("rgb_int_to_pnm", width, height,
+                        (uint64_t) width * height *
+                                        (color == COMP40_COLOR_GRAY ? 1 : 3));
+}
+
+/*
+ * Name: rgb_int_to_pgm
+ * Purpose: Print a grayscale pnm_ppm image struct to standard output as a raw
+ *          PGM
+ * Parameters: A ppm image struct whose red, green and blue are equal
+ * Returns: none
+ * Notes: output_image must not be NULL and its denominator must be 255, so
+ *        each pixel is one byte. Frees output_image
+ */
+void rgb_int_to_pgm(Pnm_ppm output_image)
+{
+        assert(output_image != NULL);
+        assert(output_image->denominator == DENOMINATOR);
+        fprintf(stdout, "P5\n%u %u\n%u\n", output_image->width,
+                        output_image->height, output_image->denominator);
+
+        /* each row's gray values are gathered into a buffer and written */
+        unsigned width = output_image->width;
+        unsigned char *gray_row = ALLOC(width);
+        UArray2_T pixels = rgb_int_pixels(output_image);
+        UARRAY2_FOREACH_ROW(pixels, struct Pnm_rgb, row, curr_int_pixels) {
+                for (unsigned col = 0; col < width; col++) {
+                        gray_row[col] = curr_int_pixels[col].green;
+                }
+                fwrite(gray_row, 1, width, stdout);
+                TRACE40_FLUSH("rgb_int_to_pgm", width);
+        }
+        FREE(gray_row);
+        Pnm_ppmfree(&output_image);
+}
+
+/*
+ * Name: rgb_int_to_rgb8
+ * Purpose: Copy a pnm_ppm image struct into a caller supplied buffer of 8-bit
+ *          rgb triples instead of printing it
+ * Parameters: A ppm image struct, a buffer with room for width * height rgb
+ *             triples
+ * Returns: none
+ * Notes: output_image and rgb must not be NULL, the image denominator must be
+ *        255. Frees output_image
+ */
+void rgb_int_to_rgb8(Pnm_ppm output_image, unsigned char *rgb)
+{
+        assert(output_image != NULL && rgb != NULL);
+        assert(output_image->denominator == DENOMINATOR);
+        unsigned width = output_image->width, height = output_image->height;
+        TRACE40_STAGE_ENTRY("rgb_int_to_rgb8", width, height);
+
+        /* rows are stored one after another with no padding */
+        UArray2_T pixels = rgb_int_pixels(output_image);
+        UARRAY2_FOREACH_ROW(pixels, struct Pnm_rgb, row, curr_int_pixels) {
+                unsigned char *curr_rgb8 = rgb + (size_t) row * width * 3;
+                for (unsigned col = 0; col < width; col++) {
+                        curr_rgb8[(size_t) col * 3] = curr_int_pixels[col].red;
+                        curr_rgb8[(size_t) col * 3 + 1] =
+                                                curr_int_pixels[col].green;
+                        curr_rgb8[(size_t) col * 3 + 2] =
+                                                curr_int_pixels[col].blue;
+                }
+        }
         Pnm_ppmfree(&output_image);
+        TRACE40_FLUSH("rgb_int_to_rgb8", (uint64_t) width * height * 3);
+        TRACE40_STAGE_EXIT("rgb_int_to_rgb8", width, height,
+                                                (uint64_t) width * height * 3);
 }
 
 /*
@@ -83,49 +225,36 @@ Pnm_ppm rgb_float_to_rgb_int(UArray2_T rgb_float_array)
         output_image->denominator = DENOMINATOR;
         output_image->width = UArray2_width(rgb_float_array);
         output_image->height = UArray2_height(rgb_float_array);
-        A2 rgb_int_array = methods->new(output_image->width,
+        UArray2_T rgb_int_array = methods->new(output_image->width,
                                         output_image->height, PNM_RGB_SIZE);
 
         output_image->pixels = rgb_int_array;
 
-        /* Convert all the rgb floats to scaled rgb ints and store them */
-        methods->map_default(rgb_int_array, rgb_float_to_rgb_int_apply,
-                                                        rgb_float_array);
-        UArray2_free(&rgb_float_array);
-        return output_image;
-}
-
-/*
- * Name: rgb_float_to_rgb_int_apply
- * Purpose: convert the given rgb float pixel to an rgb integer pixel
- * Parameters: column and row of the current pixel, the pixmap itself (which is
- *             unused), a void pointer to the current pixel, and void pointer to
- *             the closure variable 
- * Returns: none
- * Notes: none
- */
-void rgb_float_to_rgb_int_apply(int col, int row, A2 pixmap, void *entry,
-                                                                void *cl)
-{
-        /* get values from void pointers */
-        Pnm_rgb curr_int_pixel = entry;
-        UArray2_T rgb_float_array = cl;
-
         /*
-         * perform calculations and place results in pixel structs. Values must
-         * be between 0 and 255 (denominator)
+         * Convert all the rgb floats to scaled rgb ints and store them. Values
+         * must be between 0 and 255 (denominator)
          */
-        rgb_floats *curr_float_pixel = UArray2_at(rgb_float_array, col, row);
-        curr_int_pixel->red = (unsigned) round(ensure_in_bounds(
-                round(((curr_float_pixel->red) * DENOMINATOR)),
-                                                        0, DENOMINATOR));
-        curr_int_pixel->green = (unsigned) round(ensure_in_bounds(
-                round(((curr_float_pixel->green) * DENOMINATOR)),
-                                                        0, DENOMINATOR));
-        curr_int_pixel->blue = (unsigned) round(ensure_in_bounds(
-                round(((curr_float_pixel->blue) * DENOMINATOR)),
-                                                        0, DENOMINATOR));
-        (void) pixmap;
+        UARRAY2_FOREACH_ROW(rgb_float_array, rgb_floats, row,
+                                                        curr_float_pixels) {
+                struct Pnm_rgb *curr_int_pixels = UArray2_row(rgb_int_array,
+                                                                        row);
+                for (unsigned col = 0; col < output_image->width; col++) {
+                        curr_int_pixels[col].red = (unsigned) round(
+                                ensure_in_bounds(round(((curr_float_pixels[col]
+                                        .red) * DENOMINATOR)), 0,
+                                                                DENOMINATOR));
+                        curr_int_pixels[col].green = (unsigned) round(
+                                ensure_in_bounds(round(((curr_float_pixels[col]
+                                        .green) * DENOMINATOR)), 0,
+                                                                DENOMINATOR));
+                        curr_int_pixels[col].blue = (unsigned) round(
+                                ensure_in_bounds(round(((curr_float_pixels[col]
+                                        .blue) * DENOMINATOR)), 0,
+                                                                DENOMINATOR));
+                }
+        }
+        UArray2_free(&rgb_float_array);
+        return output_image;
 }
 
 /*
@@ -145,40 +274,29 @@ UArray2_T component_video_to_rgb_float(UArray2b_T comp_video_array)
         UArray2_T rgb_float_array = UArray2_new(
                 UArray2b_width(comp_video_array),
                 UArray2b_height(comp_video_array), sizeof(rgb_floats));
-        UArray2b_map(comp_video_array, component_video_to_rgb_float_apply,
-                                                        rgb_float_array);
-        UArray2b_free(&comp_video_array);
-        return rgb_float_array;
-}
-
-/*
- * Name: component_video_to_rgb_float_apply
- * Purpose: convert the given component video pixel to an rgb float pixel
- * Parameters: column and row of the current pixel, the pixmap itself (which is
- *             unused), a void pointer to the current pixel, and void pointer to
- *             the closure variable 
- * Returns: none
- * Notes: none
- */
-void component_video_to_rgb_float_apply(int col, int row, UArray2b_T pixmap,
-                                                        void *entry, void *cl)
-{
-        /* get values from void pointers */
-        UArray2_T rgb_float_array = cl;
-        rgb_floats *curr_float_pixel = UArray2_at(rgb_float_array, col, row);
 
         /*
          * perform calculations and place results in pixel structs. Values must
          * be between 0 and 1
          */
-        comp_video_floats *curr_video_pixel = entry;
-        curr_float_pixel->red =
-                 calculate_rgb_float(curr_video_pixel, 0, 1.402);
-        curr_float_pixel->green =
-                calculate_rgb_float(curr_video_pixel, -0.344136, -0.714136);
-        curr_float_pixel->blue =
-                calculate_rgb_float(curr_video_pixel, 1.772, 0);
-        (void) pixmap;
+        UARRAY2B_FOREACH_SPAN(comp_video_array, comp_video_floats, col, row,
+                                                curr_video_pixels, len) {
+                rgb_floats *curr_float_pixels = UArray2_row(rgb_float_array,
+                                                                        row);
+                for (int i = 0; i < len; i++) {
+                        rgb_floats *curr_float_pixel = &curr_float_pixels[col +
+                                                                        i];
+                        curr_float_pixel->red = calculate_rgb_float(
+                                        &curr_video_pixels[i], 0, 1.402);
+                        curr_float_pixel->green = calculate_rgb_float(
+                                        &curr_video_pixels[i], -0.344136,
+                                                                -0.714136);
+                        curr_float_pixel->blue = calculate_rgb_float(
+                                        &curr_video_pixels[i], 1.772, 0);
+                }
+        }
+        UArray2b_free(&comp_video_array);
+        return rgb_float_array;
 }
 
 /*
@@ -199,248 +317,1515 @@ float calculate_rgb_float(comp_video_floats *curr_video_pixel,
         return ensure_in_bounds(val, 0, 1);
 }
 
+/*
+ * Name: component_video_to_rgb_int
+ * Purpose: Convert component video space pixels to a pnm_ppm image struct, from
+ *          the colour space the compressed image says it uses
+ * Parameters: A UArray2b of the component video space pixels, the colour space
+ *             (one of the COMP40_COLOR_ values)
+ * Returns: A Pnm_ppm containing a pixmap of the rgb ints pixels
+ * Notes: comp_video_array must not be NULL, frees comp_video_array. YPbPr goes
+ *        through rgb floats as it always has. YCoCg-R and grayscale go
+ *        straight to the rgb integers, and grayscale skips chroma entirely
+ */
+Pnm_ppm component_video_to_rgb_int(UArray2b_T comp_video_array, unsigned color)
+{
+        assert(color == COMP40_COLOR_YPBPR || color == COMP40_COLOR_YCOCG ||
+                                                color == COMP40_COLOR_GRAY);
+        assert(comp_video_array != NULL);
+        unsigned width = UArray2b_width(comp_video_array);
+        unsigned height = UArray2b_height(comp_video_array);
+        TRACE40_STAGE_ENTRY("component_video_to_rgb_int", width, height);
+        Pnm_ppm output_image;
+        if (color == COMP40_COLOR_YCOCG || color == COMP40_COLOR_GRAY) {
+                output_image = int_video_to_rgb_int(comp_video_array, color);
+        } else {
+                output_image = rgb_float_to_rgb_int(
+                                component_video_to_rgb_float(comp_video_array));
+        }
+        TRACE40_STAGE_EXIT("component_video_to_rgb_int", width, height,
+                                                rgb_int_bytes(output_image));
+        return output_image;
+}
+
+/*
+ * Name: int_video_to_rgb_int
+ * Purpose: Convert YCoCg-R or grayscale component video space pixels to rgb
+ *          integers
+ * Parameters: A UArray2b of the component video space pixels, and the colour
+ *             space (COMP40_COLOR_YCOCG or COMP40_COLOR_GRAY)
+ * Returns: A Pnm_ppm containing a pixmap of the rgb ints pixels
+ * Notes: comp_video_array must not be NULL, frees comp_video_array. For
+ *        grayscale only the luma is read; red, green and blue are all set to it
+ */
+Pnm_ppm int_video_to_rgb_int(UArray2b_T comp_video_array, unsigned color)
+{
+        assert(comp_video_array != NULL);
+
+        /* create a methods suite instance */
+        A2Methods_T methods = uarray2_methods_plain;
+        assert(methods);
+
+        /* Create and set values in a new Pnm_ppm struct */
+        Pnm_ppm output_image;
+        NEW(output_image);
+        output_image->methods = methods;
+        output_image->denominator = DENOMINATOR;
+        output_image->width = UArray2b_width(comp_video_array);
+        output_image->height = UArray2b_height(comp_video_array);
+        output_image->pixels = methods->new(output_image->width,
+                                        output_image->height, PNM_RGB_SIZE);
+
+        UArray2_T pixels = rgb_int_pixels(output_image);
+        UARRAY2B_FOREACH_SPAN(comp_video_array, comp_video_floats, col, row,
+                                                curr_video_pixels, len) {
+                struct Pnm_rgb *curr_int_pixels = UArray2_row(pixels, row);
+                for (int i = 0; i < len; i++) {
+                        if (color == COMP40_COLOR_YCOCG) {
+                                ycocg_pixel_to_rgb_int(&curr_video_pixels[i],
+                                                &curr_int_pixels[col + i]);
+                        } else {
+                                unsigned gray = scale_to_rgb_int(
+                                                curr_video_pixels[i].luma);
+                                curr_int_pixels[col + i].red = gray;
+                                curr_int_pixels[col + i].green = gray;
+                                curr_int_pixels[col + i].blue = gray;
+                        }
+                }
+        }
+        UArray2b_free(&comp_video_array);
+        return output_image;
+}
+
+/*
+ * Name: ycocg_pixel_to_rgb_int
+ * Purpose: undo the YCoCg-R transform for one pixel
+ * Parameters: a pointer to the YCoCg-R pixel, a pointer to the rgb integer
+ *             pixel to fill in
+ * Returns: none
+ * Notes: Y, Co and Cg are first scaled back to the integers the encoder made
+ *        (for a denominator of 255), after which the inverse is integer adds
+ *        and shifts. Values must be between 0 and 255 (denominator)
+ */
+void ycocg_pixel_to_rgb_int(const comp_video_floats *curr_video_pixel,
+                                                Pnm_rgb curr_int_pixel)
+{
+        int y = scale_to_int(curr_video_pixel->luma, DENOMINATOR, 0,
+                                                                DENOMINATOR);
+        int co = scale_to_int(curr_video_pixel->bluediff, 2 * DENOMINATOR,
+                                                -DENOMINATOR, DENOMINATOR);
+        int cg = scale_to_int(curr_video_pixel->reddiff, 2 * DENOMINATOR,
+                                                -DENOMINATOR, DENOMINATOR);
+        int temp = y - (cg >> 1);
+        int green = cg + temp;
+        int blue = temp - (co >> 1);
+        int red = blue + co;
+
+        curr_int_pixel->red = red < 0 ? 0 : red > DENOMINATOR ? DENOMINATOR :
+                                                                        red;
+        curr_int_pixel->green = green < 0 ? 0 : green > DENOMINATOR ?
+                                                        DENOMINATOR : green;
+        curr_int_pixel->blue = blue < 0 ? 0 : blue > DENOMINATOR ? DENOMINATOR :
+                                                                        blue;
+}
+
+/*
+ * Name: scale_to_int
+ * Purpose: scale a float to the nearest integer in a range
+ * Parameters: the float, what to multiply it by, the smallest and largest
+ *             integer allowed
+ * Returns: the integer
+ * Notes: none
+ */
+int scale_to_int(float val, float scale, int min, int max)
+{
+        return (int) round(ensure_in_bounds(round(val * scale), min, max));
+}
+
 /*
  * Name: comp_avg_float_to_comp_video_floats
  * Purpose: convert pixmap of averaged component video floats to component video
  *          floats pixels
- * Parameters: UArray2 of averaged component video float pixels
+ * Parameters: UArray2 of averaged component video float pixels, and the width
+ *             (and height) in pixels of the blocks they stand for
  * Returns: UArray2b of component video floats pixels
  * Notes: comp_avg_float_arr must not be NULL, frees comp_avg_float_arr. Also,
  *        the component video space array is a UArray2b because it will be
  *        traversed in block major order.
  */
-UArray2b_T comp_avg_float_to_comp_video_floats(UArray2_T comp_avg_float_arr) {
+UArray2b_T comp_avg_float_to_comp_video_floats(UArray2_T comp_avg_float_arr,
+                                                        unsigned blocksize) {
         /*
          * make new array and traverse through the inputted one, changing the
          * pixels in the new one based on the pixels in the inputted one
          */
         assert(comp_avg_float_arr != NULL);
-        UArray2b_T comp_video_array = UArray2b_new(
-                UArray2_width(comp_avg_float_arr) * BLOCKSIZE,
-                UArray2_height(comp_avg_float_arr) * BLOCKSIZE,
-                sizeof(comp_video_floats), BLOCKSIZE);
-        UArray2_map_row_major(comp_avg_float_arr,
-                comp_avg_float_to_comp_video_floats_apply, comp_video_array);
+        assert(comp40_valid_block_size(blocksize));
+        unsigned width = UArray2_width(comp_avg_float_arr);
+        unsigned height = UArray2_height(comp_avg_float_arr);
+        TRACE40_STAGE_ENTRY("comp_avg_float_to_comp_video_floats", width,
+                                                                height);
+        UArray2b_T comp_video_array = UArray2b_new(width * blocksize,
+                        height * blocksize, sizeof(comp_video_floats),
+                                                                blocksize);
+
+        /*
+         * distribute averaged values into the pixels of the block - these
+         * pixels all have the same Pb and Pr, but they have different Y values.
+         * The blocks are whole, and their pixels are in the same order (row
+         * major within the block) as the inverse transform gives the lumas
+         */
+        UARRAY2B_FOREACH_BLOCK(comp_video_array, comp_video_floats, block_col,
+                                                block_row, curr_video_floats) {
+                const comp_avg_floats *curr_avg_floats = UArray2_at(
+                                comp_avg_float_arr, block_col, block_row);
+                float luma[TRANSFORM40_MAX_PIXELS];
+                transform40_inverse(curr_avg_floats, blocksize, luma);
+                for (unsigned i = 0; i < blocksize * blocksize; i++) {
+                        curr_video_floats[i].bluediff =
+                                                curr_avg_floats->bluediff_avg;
+                        curr_video_floats[i].reddiff =
+                                                curr_avg_floats->reddiff_avg;
+
+                        /* luminance values must be between 0 and 1 */
+                        curr_video_floats[i].luma = ensure_in_bounds(luma[i],
+                                                                        0, 1);
+                }
+                if (block_col + 1 == (int) width) {
+                        TRACE40_BLOCK_ROW(
+                                "comp_avg_float_to_comp_video_floats",
+                                block_row, height);
+                }
+        }
         UArray2_free(&comp_avg_float_arr);
+        TRACE40_STAGE_EXIT("comp_avg_float_to_comp_video_floats", width,
+                                height, uarray2b_bytes(comp_video_array));
         return comp_video_array;
 }
 
 /*
- * Name: comp_avg_float_to_comp_video_floats_apply
- * Purpose: convert the given averaged component video floats pixel to a
- *          component video float pixel
- * Parameters: column and row of the current pixel, the pixmap itself (which is
- *             unused), a void pointer to the current pixel, and void pointer to
- *             the closure variable 
+ * Name: comp_avg_float_to_rgb_int
+ * Purpose: convert the pixmap of averaged component video floats straight to
+ *          a pnm_ppm image struct, block by block
+ * Parameters: UArray2 of averaged component video float pixels, the width (and
+ *             height) in pixels of the blocks they stand for, and the colour
+ *             space (one of the COMP40_COLOR_ values)
+ * Returns: A Pnm_ppm containing a pixmap of the rgb ints pixels
+ * Notes: comp_avg_float_arr must not be NULL, frees comp_avg_float_arr. Gives
+ *        the same pixels as comp_avg_float_to_comp_video_floats followed by
+ *        component_video_to_rgb_int, without the image sized arrays between
+ *        them. Flat areas and run-length coded tiles repeat the block before
+ *        (comp_avg_ints_to_comp_avg_floats copies a repeated block exactly),
+ *        so a run of identical blocks is inverse transformed and colour
+ *        converted once, and its pixels are copied into every block of it
+ */
+Pnm_ppm comp_avg_float_to_rgb_int(UArray2_T comp_avg_float_arr,
+                                        unsigned blocksize, unsigned color)
+{
+        assert(comp_avg_float_arr != NULL);
+        assert(comp40_valid_block_size(blocksize));
+        assert(color == COMP40_COLOR_YPBPR || color == COMP40_COLOR_YCOCG ||
+                                                color == COMP40_COLOR_GRAY);
+        unsigned width = UArray2_width(comp_avg_float_arr);
+        unsigned height = UArray2_height(comp_avg_float_arr);
+        TRACE40_STAGE_ENTRY("comp_avg_float_to_rgb_int", width, height);
+
+        /* create a methods suite instance */
+        A2Methods_T methods = uarray2_methods_plain;
+        assert(methods);
+
+        /* Create and set values in a new Pnm_ppm struct */
+        Pnm_ppm output_image;
+        NEW(output_image);
+        output_image->methods = methods;
+        output_image->denominator = DENOMINATOR;
+        output_image->width = width * blocksize;
+        output_image->height = height * blocksize;
+        output_image->pixels = methods->new(output_image->width,
+                                        output_image->height, PNM_RGB_SIZE);
+
+        UArray2_T pixels = rgb_int_pixels(output_image);
+        struct Pnm_rgb block[TRANSFORM40_MAX_PIXELS];
+        const comp_avg_floats *last_floats = NULL;
+        UARRAY2_FOREACH_ROW(comp_avg_float_arr, comp_avg_floats, block_row,
+                                                        curr_avg_floats) {
+                for (unsigned block_col = 0; block_col < width; block_col++) {
+                        const comp_avg_floats *curr = &curr_avg_floats[
+                                                                block_col];
+                        if (last_floats == NULL ||
+                                        !same_comp_avg_floats(curr,
+                                                        last_floats)) {
+                                comp_avg_floats_to_rgb_block(curr, blocksize,
+                                                                color, block);
+                                last_floats = curr;
+                        }
+
+                        /* the block's pixels are row major, like the rows */
+                        for (unsigned y = 0; y < blocksize; y++) {
+                                struct Pnm_rgb *row = UArray2_row(pixels,
+                                                block_row * blocksize + y);
+                                memcpy(&row[block_col * blocksize],
+                                        &block[y * blocksize],
+                                        blocksize * sizeof(struct Pnm_rgb));
+                        }
+                }
+                TRACE40_BLOCK_ROW("comp_avg_float_to_rgb_int", block_row,
+                                                                height);
+        }
+        UArray2_free(&comp_avg_float_arr);
+        TRACE40_STAGE_EXIT("comp_avg_float_to_rgb_int", width, height,
+                                                rgb_int_bytes(output_image));
+        return output_image;
+}
+
+/*
+ * Name: comp_avg_floats_to_rgb_block
+ * Purpose: inverse transform one block and convert its pixels to rgb integers
+ * Parameters: the block's averaged component video floats, the block size,
+ *             the colour space (one of the COMP40_COLOR_ values), and where
+ *             to store the block's pixels (row major within the block)
  * Returns: none
- * Notes: none
+ * Notes: the same lumas, clamping and colour conversion as
+ *        comp_avg_float_to_comp_video_floats and component_video_to_rgb_int
  */
-void comp_avg_float_to_comp_video_floats_apply(int col, int row,
-                                        UArray2_T pixmap, void *entry, void *cl)
+void comp_avg_floats_to_rgb_block(const comp_avg_floats *curr_avg_floats,
+                unsigned blocksize, unsigned color, struct Pnm_rgb *block)
 {
-        /* get values from void pointers */
-        UArray2b_T comp_video_array = cl;
-        comp_avg_floats *curr_avg_floats = entry;
+        float luma[TRANSFORM40_MAX_PIXELS];
+        transform40_inverse(curr_avg_floats, blocksize, luma);
+        for (unsigned i = 0; i < blocksize * blocksize; i++) {
+                comp_video_floats pixel = {
+                        .bluediff = curr_avg_floats->bluediff_avg,
+                        .reddiff = curr_avg_floats->reddiff_avg,
+                        .luma = ensure_in_bounds(luma[i], 0, 1)
+                };
+                comp_video_pixel_to_rgb_int(&pixel, color, &block[i]);
+        }
+}
 
-        /*
-         * distribute averaged values into 4 pixels - these pixels all have the
-         * same Pb and Pr, but they have different Y values
-         */
-        comp_video_floats *curr_video_floats1 = UArray2b_at(comp_video_array,
-                                col * BLOCKSIZE, row * BLOCKSIZE);
-        comp_video_floats *curr_video_floats2 = UArray2b_at(comp_video_array,
-                                col * BLOCKSIZE + 1, row * BLOCKSIZE);
-        comp_video_floats *curr_video_floats3 = UArray2b_at(comp_video_array,
-                                col * BLOCKSIZE, row * BLOCKSIZE + 1);
-        comp_video_floats *curr_video_floats4 = UArray2b_at(comp_video_array,
-                                col * BLOCKSIZE + 1, row * BLOCKSIZE + 1);
-
-        float a = curr_avg_floats->a;
-        float b = curr_avg_floats->b;
-        float c = curr_avg_floats->c;
-        float d = curr_avg_floats->d;
-        float reddiff_avg = curr_avg_floats->reddiff_avg;
-        float bluediff_avg = curr_avg_floats->bluediff_avg;
-
-        curr_video_floats1->bluediff = bluediff_avg;
-        curr_video_floats2->bluediff = bluediff_avg;
-        curr_video_floats3->bluediff = bluediff_avg;
-        curr_video_floats4->bluediff = bluediff_avg;
-
-        curr_video_floats1->reddiff = reddiff_avg;
-        curr_video_floats2->reddiff = reddiff_avg;
-        curr_video_floats3->reddiff = reddiff_avg;
-        curr_video_floats4->reddiff = reddiff_avg;
-
-        /* luminance values must be between 0 and 1 */
-        curr_video_floats1->luma =
-                        ensure_in_bounds((a - b - c + d), 0, 1);
-        curr_video_floats2->luma =
-                        ensure_in_bounds((a - b + c - d), 0, 1);
-        curr_video_floats3->luma =
-                        ensure_in_bounds((a + b - c - d), 0, 1);
-        curr_video_floats4->luma =
-                        ensure_in_bounds((a + b + c + d), 0, 1);
-
-        (void) pixmap;
+/*
+ * Name: same_comp_avg_floats
+ * Purpose: check whether two blocks unquantized to the same floats
+ * Parameters: the two blocks
+ * Returns: true if every field is equal
+ * Notes: none
+ */
+static inline bool same_comp_avg_floats(const comp_avg_floats *x,
+                                                const comp_avg_floats *y)
+{
+        return x->a == y->a && x->b == y->b && x->c == y->c && x->d == y->d &&
+                x->bluediff_avg == y->bluediff_avg &&
+                x->reddiff_avg == y->reddiff_avg;
 }
 
 /*
  * Name: comp_avg_ints_to_comp_avg_floats
  * Purpose: unquantize the pixmap of averaged component video int pixels (send
  *          the integers to their float forms)
- * Parameters: UArray2 of quantized component video pixels
+ * Parameters: UArray2 of quantized component video pixels, the number of the
+ *             codeword profile they were quantized for, and the colour space
+ *             (one of the COMP40_COLOR_ values)
  * Returns: UArray2 of unquantized component video float pixels
- * Notes: comp_avg_int_arr must not be NULL, frees comp_avg_int_arr
+ * Notes: comp_avg_int_arr must not be NULL and profile must be a valid profile
+ *        number, frees comp_avg_int_arr. A grayscale image is unquantized with
+ *        the profile's luma-only kernel, which leaves Pb and Pr at 0
  */
-UArray2_T comp_avg_ints_to_comp_avg_floats(UArray2_T comp_avg_int_arr)
+UArray2_T comp_avg_ints_to_comp_avg_floats(UArray2_T comp_avg_int_arr,
+                                        unsigned profile, unsigned color)
 {
         /*
          * make new array and traverse through the inputted one, changing the
          * pixels in the new one based on the pixels in the inputted one
          */
         assert(comp_avg_int_arr != NULL);
-        UArray2_T comp_avg_float_arr =UArray2_new(
-                UArray2_width(comp_avg_int_arr),
-                UArray2_height(comp_avg_int_arr), sizeof(comp_avg_floats));
-        UArray2_map_row_major(comp_avg_int_arr,
-                comp_avg_ints_to_comp_avg_floats_apply, comp_avg_float_arr);
+        unsigned width = UArray2_width(comp_avg_int_arr);
+        unsigned height = UArray2_height(comp_avg_int_arr);
+        TRACE40_STAGE_ENTRY("comp_avg_ints_to_comp_avg_floats", width, height);
+        const profile40 *codewords = profile40_get(profile);
+        assert(codewords != NULL);
+        bool gray = (color == COMP40_COLOR_GRAY);
+        UArray2_T comp_avg_float_arr = UArray2_new(width, height,
+                                                sizeof(comp_avg_floats));
+
+        /*
+         * flat areas repeat the block before, so the last block unquantized is
+         * kept and a run of identical blocks is only unquantized once
+         */
+        const comp_avg_ints *last_ints = NULL;
+        const comp_avg_floats *last_floats = NULL;
+        UARRAY2_FOREACH_ROW(comp_avg_int_arr, comp_avg_ints, row,
+                                                        curr_avg_ints) {
+                comp_avg_floats *curr_avg_floats = UArray2_row(
+                                                comp_avg_float_arr, row);
+                for (unsigned col = 0; col < width; col++) {
+                        if (last_ints != NULL && same_comp_avg_ints(
+                                        &curr_avg_ints[col], last_ints)) {
+                                curr_avg_floats[col] = *last_floats;
+                                continue;
+                        }
+
+                        /*
+                         * "a" value must be between 0 and 1. "b", "c", and
+                         * "d" values must be between -0.5 and and 0.5
+                         */
+                        if (gray) {
+                                codewords->unquantize_luma(codewords,
+                                                &curr_avg_ints[col],
+                                                &curr_avg_floats[col]);
+                        } else {
+                                codewords->unquantize(codewords,
+                                                &curr_avg_ints[col],
+                                                &curr_avg_floats[col]);
+                        }
+                        last_ints = &curr_avg_ints[col];
+                        last_floats = &curr_avg_floats[col];
+                }
+                TRACE40_BLOCK_ROW("comp_avg_ints_to_comp_avg_floats", row,
+                                                                height);
+        }
         UArray2_free(&comp_avg_int_arr);
+        TRACE40_STAGE_EXIT("comp_avg_ints_to_comp_avg_floats", width, height,
+                                        uarray2_bytes(comp_avg_float_arr));
         return comp_avg_float_arr;
 }
 
 /*
- * Name: comp_avg_ints_to_comp_avg_floats_apply
- * Purpose: convert the given quantized component video pixel to an unquantized
- *          component video float pixel
- * Parameters: column and row of the current pixel, the pixmap itself (which is
- *             unused), a void pointer to the current pixel, and void pointer to
- *             the closure variable 
- * Returns: none
+ * Name: same_comp_avg_ints
+ * Purpose: check whether two blocks quantized to the same integers
+ * Parameters: the two blocks
+ * Returns: true if every field is equal
  * Notes: none
  */
-void comp_avg_ints_to_comp_avg_floats_apply(int col, int row, UArray2_T pixmap,
-                                                        void *entry, void *cl)
+static inline bool same_comp_avg_ints(const comp_avg_ints *x,
+                                                const comp_avg_ints *y)
 {
-        /* get values from void pointers */
-        UArray2_T comp_avg_float_arr = cl;
-        comp_avg_floats *curr_avg_floats = UArray2_at(comp_avg_float_arr, col,
-                                                                        row);
-        comp_avg_ints *curr_avg_ints = entry;
-
-        /*
-         * perform calculations and place results in pixel structs. "a" value
-         * must be between 0 and 1. "b", "c", and "d" values must be between
-         * -0.5 and and 0.5
-         */
-        curr_avg_floats->bluediff_avg =
-                        Arith40_chroma_of_index(curr_avg_ints->bluediff_avg);
-        curr_avg_floats->reddiff_avg =
-                        Arith40_chroma_of_index(curr_avg_ints->reddiff_avg);
-        curr_avg_floats->a =
-        ensure_in_bounds(((float) curr_avg_ints->a) / 63, 0, 1);
-        curr_avg_floats->b =
-        ensure_in_bounds(((float) curr_avg_ints->b) / 103.3, -0.5, 0.5);
-        curr_avg_floats->c =
-        ensure_in_bounds(((float) curr_avg_ints->c) / 103.3, -0.5, 0.5);
-        curr_avg_floats->d =
-        ensure_in_bounds(((float) curr_avg_ints->d) / 103.3, -0.5, 0.5);
-        
-        (void) pixmap;
+        return x->a == y->a && x->b == y->b && x->c == y->c && x->d == y->d &&
+                x->bluediff_avg == y->bluediff_avg &&
+                x->reddiff_avg == y->reddiff_avg;
 }
 
 /*
  * Name: word_to_comp_avg_ints
  * Purpose: reads in data from file and puts it into a UArray2
- * Parameters: pointer to input file
- * Returns: UArray2 of component video int pixels
- * Notes: input must not be NULL
+ * Parameters: pointer to input file, where to store the file's header (the
+ *             later stages need its block size), where to store why decoding
+ *             failed
+ * Returns: UArray2 of component video int pixels, or NULL if the file does not
+ *          start with a valid header, ends before the last codeword, or holds
+ *          a tile that fails its checksum
+ * Notes: input, header and status must not be NULL. Reads both format 2 and
+ *        format 3 (tiled) files. Bad input is reported through the return value
+ *        rather than an assertion, so the caller decides what to do
  */
-UArray2_T word_to_comp_avg_ints(FILE *input)
+UArray2_T word_to_comp_avg_ints(FILE *input, comp40_header *header,
+                                                        Codec40_status *status)
 {
-        assert(input != NULL);
+        assert(input != NULL && header != NULL && status != NULL);
+        TRACE40_STAGE_ENTRY("word_to_comp_avg_ints", 0, 0);
 
         /* check for the correct header and get the width and height */
-        unsigned height, width;
-        int read = fscanf(input, "COMP40 Compressed image format 2\n%u %u",
-                                                        &width, &height);
-        assert(read == 2);
-        int c = getc(input);
-        assert(c == '\n');
+        *status = read_comp40_header_file(input, header);
+        if (*status != CODEC40_OK) {
+                TRACE40_STAGE_EXIT("word_to_comp_avg_ints", 0, 0, 0);
+                return NULL;
+        }
+        unsigned width = header->width / header->block_size;
+        unsigned height = header->height / header->block_size;
+        UArray2_T comp_avg_ints_array;
+        if (header->version == COMP40_TILED) {
+                comp_avg_ints_array = tiled_file_to_comp_avg_ints(input,
+                                                        header, status);
+                TRACE40_STAGE_EXIT("word_to_comp_avg_ints", width, height,
+                                comp_avg_ints_array == NULL ? 0 :
+                                        uarray2_bytes(comp_avg_ints_array));
+                return comp_avg_ints_array;
+        }
+
+        /*
+         * the header can claim any size, so check a file holds the codewords
+         * before making room for them. A pipe can't be measured, so it is
+         * read to the end first
+         */
+        const profile40 *profile = profile40_get(header->profile);
+        int64_t left = file_bytes_left(input);
+        if (left < 0) {
+                size_t length;
+                unsigned char *bytes = file_to_buffer(input, &length);
+                comp_avg_ints_array = flat_buffer_to_comp_avg_ints(header,
+                                bytes, length, status, "word_to_comp_avg_ints");
+                FREE(bytes);
+                TRACE40_STAGE_EXIT("word_to_comp_avg_ints", width, height,
+                                comp_avg_ints_array == NULL ? 0 :
+                                        uarray2_bytes(comp_avg_ints_array));
+                return comp_avg_ints_array;
+        }
+        if ((uint64_t) left < (uint64_t) width * height * profile->word_bytes) {
+                *status = CODEC40_ETRUNCATED;
+                TRACE40_STAGE_EXIT("word_to_comp_avg_ints", width, height, 0);
+                return NULL;
+        }
 
         /*
          * make new array and traverse through it, changing the pixels in it
          * based on the input from the file
          */
-        UArray2_T comp_avg_ints_array = UArray2_new(width / BLOCKSIZE,
-                                height / BLOCKSIZE, sizeof(comp_avg_ints));
-        UArray2_map_row_major(comp_avg_ints_array, word_to_comp_avg_ints_apply,
-                                                                        input);
+        comp_avg_ints_array = UArray2_new(width, height,
+                                                        sizeof(comp_avg_ints));
+        if (!file_to_comp_avg_ints(input, profile, comp_avg_ints_array)) {
+                UArray2_free(&comp_avg_ints_array);
+                *status = CODEC40_ETRUNCATED;
+                TRACE40_STAGE_EXIT("word_to_comp_avg_ints", width, height, 0);
+                return NULL;
+        }
+
+        TRACE40_STAGE_EXIT("word_to_comp_avg_ints", width, height,
+                                        uarray2_bytes(comp_avg_ints_array));
+        return comp_avg_ints_array;
+}
+
+/*
+ * Name: tiled_file_to_comp_avg_ints
+ * Purpose: read the rest of a format 3 file and decode all of its tiles
+ * Parameters: pointer to input file (positioned at the tile index), its
+ *             header, where to store why decoding failed
+ * Returns: UArray2 of component video int pixels, or NULL on bad input
+ * Notes: the file is read to the end in one go (see file_to_buffer), so pipes
+ *        work too. The tiles are then decoded in parallel
+ */
+UArray2_T tiled_file_to_comp_avg_ints(FILE *input, const comp40_header *header,
+                                                        Codec40_status *status)
+{
+        size_t length;
+        unsigned char *bytes = file_to_buffer(input, &length);
+        UArray2_T comp_avg_ints_array = tiled_buffer_to_comp_avg_ints(header,
+                                                        bytes, length, status);
+        FREE(bytes);
+        return comp_avg_ints_array;
+}
+
+/*
+ * Name: file_to_comp_avg_ints
+ * Purpose: read a format 2 file's codewords into a UArray2, a row of blocks
+ *          at a time
+ * Parameters: pointer to input file (positioned at the first codeword), the
+ *             codeword profile, the UArray2 to fill in (its size is the
+ *             image's size in blocks)
+ * Returns: true, or false if the file ran out before the last codeword
+ * Notes: each row of codewords is read with one fread and then the fields
+ *        are taken out of each word
+ */
+bool file_to_comp_avg_ints(FILE *input, const profile40 *profile,
+                                        UArray2_T comp_avg_ints_array)
+{
+        unsigned width = UArray2_width(comp_avg_ints_array);
+        unsigned height = UArray2_height(comp_avg_ints_array);
+        size_t word_size = profile->word_bytes;
+        size_t span = (size_t) width * word_size;
+        unsigned char *row_words = ALLOC(span > 0 ? span : 1);
+        bool truncated = false;
+        UARRAY2_FOREACH_ROW(comp_avg_ints_array, comp_avg_ints, row,
+                                                        curr_avg_ints) {
+                if (truncated || fread(row_words, 1, span, input) != span) {
+                        truncated = true;
+                        continue;
+                }
+                for (unsigned col = 0; col < width; col++) {
+                        profile->unpack(profile, profile40_get_word(profile,
+                                        row_words + col * word_size),
+                                        &curr_avg_ints[col]);
+                }
+                TRACE40_BLOCK_ROW("word_to_comp_avg_ints", row, height);
+        }
+        FREE(row_words);
+        return !truncated;
+}
+
+/*
+ * Name: file_bytes_left
+ * Purpose: measure how much of a file is still to be read
+ * Parameters: pointer to input file
+ * Returns: the number of bytes from the current position to the end, or -1
+ *          if input isn't a regular file (a pipe, for example)
+ * Notes: none
+ */
+int64_t file_bytes_left(FILE *input)
+{
+        struct stat st;
+        off_t position = ftello(input);
+        if (position < 0 || fstat(fileno(input), &st) < 0 ||
+                                                !S_ISREG(st.st_mode)) {
+                return -1;
+        }
+        return st.st_size > position ? st.st_size - position : 0;
+}
+
+/*
+ * Name: file_to_buffer
+ * Purpose: read the rest of a file into memory
+ * Parameters: pointer to input file, where to store how many bytes were read
+ * Returns: the bytes, which the caller must FREE
+ * Notes: the buffer starts at the size of the rest of a regular file, or at
+ *        READ_CHUNK bytes for a pipe, and grows as data arrives. It is never
+ *        sized from a header, whose width and height say nothing about how
+ *        much data there really is
+ */
+unsigned char *file_to_buffer(FILE *input, size_t *length)
+{
+        int64_t left = file_bytes_left(input);
+        /* one more, so reaching the end of a file needs no resize */
+        size_t capacity = left < 0 ? READ_CHUNK : (size_t) left + 1;
+        unsigned char *bytes = ALLOC(capacity);
+        size_t got;
+        *length = 0;
+        while ((got = fread(bytes + *length, 1, capacity - *length, input)) >
+                                                                        0) {
+                *length += got;
+                if (*length == capacity) {
+                        capacity *= 2;
+                        RESIZE(bytes, capacity);
+                }
+        }
+        return bytes;
+}
+
+/*
+ * Name: region_to_comp_avg_ints
+ * Purpose: read in only the codewords covering a region of the image, going
+ *          straight to them with pread instead of reading the whole file
+ * Parameters: pointer to input file (positioned just past the header, as
+ *             read_comp40_header_file leaves it), the header, the left column,
+ *             top row, width and height of the region, and where to store why
+ *             decoding failed
+ * Returns: UArray2 of component video int pixels for every block the region
+ *          touches, or NULL if a read comes up short, a tile fails its
+ *          checksum, or the file can't be read with pread (a pipe, for example)
+ * Notes: input, header and status must not be NULL, the region must be
+ *        non-empty and lie inside the whole blocks of the image. In format 2
+ *        codewords are stored row major with a fixed size, so the offset of
+ *        any block is simple arithmetic. In format 3 only the tiles under the
+ *        region are read
+ */
+UArray2_T region_to_comp_avg_ints(FILE *input, const comp40_header *header,
+                                unsigned x, unsigned y, unsigned w, unsigned h,
+                                Codec40_status *status)
+{
+        assert(input != NULL && header != NULL && status != NULL);
+        assert(w > 0 && h > 0);
+        assert(x + w <= header->width - header->width % header->block_size);
+        assert(y + h <= header->height - header->height % header->block_size);
+        TRACE40_STAGE_ENTRY("region_to_comp_avg_ints", w, h);
+
+        off_t data_offset = ftello(input);
+        if (data_offset < 0) {
+                *status = CODEC40_ETRUNCATED;
+                TRACE40_STAGE_EXIT("region_to_comp_avg_ints", w, h, 0);
+                return NULL;
+        }
+
+        /* every block that holds at least one pixel of the region */
+        unsigned block_size = header->block_size;
+        unsigned first_col = x / block_size;
+        unsigned first_row = y / block_size;
+        unsigned cols = (x + w + block_size - 1) / block_size - first_col;
+        unsigned rows = (y + h + block_size - 1) / block_size - first_row;
 
+        UArray2_T comp_avg_ints_array = UArray2_new(cols, rows,
+                                                        sizeof(comp_avg_ints));
+        if (header->version == COMP40_TILED) {
+                *status = tiled_region_to_comp_avg_ints(fileno(input),
+                        data_offset, header, first_col, first_row,
+                        comp_avg_ints_array);
+        } else {
+                *status = flat_region_to_comp_avg_ints(fileno(input),
+                        data_offset, header, first_col, first_row,
+                        comp_avg_ints_array);
+        }
+
+        if (*status != CODEC40_OK) {
+                UArray2_free(&comp_avg_ints_array);
+                TRACE40_STAGE_EXIT("region_to_comp_avg_ints", w, h, 0);
+                return NULL;
+        }
+        TRACE40_STAGE_EXIT("region_to_comp_avg_ints", w, h,
+                                        uarray2_bytes(comp_avg_ints_array));
         return comp_avg_ints_array;
 }
 
 /*
- * Name: word_to_comp_avg_ints_apply
- * Purpose: read in one 32-bit word from input file and place data in current
- *          pixel struct
- * Parameters: column and row of the current pixel (which is unused), the pixmap
- *             itself (which is unused), a void pointer to the current pixel,
- *             and void pointer to the closure variable
+ * Name: tiled_region_to_comp_avg_ints
+ * Purpose: decode just the tiles of a format 3 file that cover a window of
+ *          blocks
+ * Parameters: the file descriptor, the offset of the tile index in the file,
+ *             the header, the first block column and row of the window, and
+ *             the UArray2 the window is decoded into (its size is the size of
+ *             the window)
+ * Returns: CODEC40_OK, or why decoding failed
+ * Notes: reads the index entries of one row of tiles with a single pread, and
+ *        each tile with another, so nothing outside the window is read
+ */
+Codec40_status tiled_region_to_comp_avg_ints(int fd, off_t index_offset,
+                        const comp40_header *header, unsigned first_col,
+                        unsigned first_row, UArray2_T comp_avg_ints_array)
+{
+        unsigned tile_blocks = header->tile_size / header->block_size;
+        unsigned tiles_across = comp40_tiles_across(header);
+        unsigned first_tile_col = first_col / tile_blocks;
+        unsigned first_tile_row = first_row / tile_blocks;
+        unsigned region_across = (first_col + UArray2_width(comp_avg_ints_array)
+                        - 1) / tile_blocks - first_tile_col + 1;
+        unsigned region_down = (first_row + UArray2_height(comp_avg_ints_array)
+                        - 1) / tile_blocks - first_tile_row + 1;
+
+        tile_jobs jobs = {
+                .header = header,
+                .first_tile_col = first_tile_col,
+                .first_tile_row = first_tile_row,
+                .tiles_across = region_across,
+                .count = region_across * region_down,
+                .data = NULL, .fd = fd,
+                .data_offset = index_offset + comp40_index_size(header),
+                .dest = comp_avg_ints_array,
+                .dest_col = first_col, .dest_row = first_row
+        };
+        jobs.tiles = ALLOC((long) jobs.count * sizeof(comp40_tile));
+
+        /* the index entries of the tiles in one row are next to each other */
+        size_t span = (size_t) region_across * COMP40_TILE_ENTRY_SIZE;
+        unsigned char *entries = ALLOC(span);
+        Codec40_status status = CODEC40_OK;
+        for (unsigned row = 0; row < region_down; row++) {
+                off_t offset = index_offset + ((off_t) (first_tile_row + row) *
+                                tiles_across + first_tile_col) *
+                                COMP40_TILE_ENTRY_SIZE;
+                if (pread(fd, entries, span, offset) != (ssize_t) span) {
+                        status = CODEC40_ETRUNCATED;
+                        break;
+                }
+                for (unsigned col = 0; col < region_across; col++) {
+                        parse_comp40_tile(entries + (size_t) col *
+                                COMP40_TILE_ENTRY_SIZE, &jobs.tiles[(size_t)
+                                row * region_across + col]);
+                }
+        }
+        FREE(entries);
+
+        if (status == CODEC40_OK) {
+                status = decode_tiles(&jobs);
+        }
+        FREE(jobs.tiles);
+        return status;
+}
+
+/*
+ * Name: flat_region_to_comp_avg_ints
+ * Purpose: read just the codewords of a format 2 file that cover a window of
+ *          blocks
+ * Parameters: the file descriptor, the offset of the first codeword in the
+ *             file, the header, the first block column and row of the window,
+ *             and the UArray2 the window is read into (its size is the size of
+ *             the window)
+ * Returns: CODEC40_OK, or CODEC40_ETRUNCATED if a read comes up short
+ * Notes: one pread per block row, of just the codewords the window needs
+ */
+Codec40_status flat_region_to_comp_avg_ints(int fd, off_t data_offset,
+                        const comp40_header *header, unsigned first_col,
+                        unsigned first_row, UArray2_T comp_avg_ints_array)
+{
+        const profile40 *profile = profile40_get(header->profile);
+        unsigned width_blocks = header->width / header->block_size;
+        unsigned cols = UArray2_width(comp_avg_ints_array);
+        unsigned rows = UArray2_height(comp_avg_ints_array);
+        size_t word_size = profile->word_bytes;
+        size_t span = (size_t) cols * word_size;
+        unsigned char *row_words = ALLOC(span);
+        Codec40_status status = CODEC40_OK;
+        UARRAY2_FOREACH_ROW(comp_avg_ints_array, comp_avg_ints, row,
+                                                        curr_avg_ints) {
+                off_t offset = data_offset + ((off_t) (first_row + row) *
+                                width_blocks + first_col) * (off_t) word_size;
+                if (status != CODEC40_OK || pread(fd, row_words, span,
+                                                offset) != (ssize_t) span) {
+                        status = CODEC40_ETRUNCATED;
+                        continue;
+                }
+                for (unsigned col = 0; col < cols; col++) {
+                        profile->unpack(profile, profile40_get_word(profile,
+                                        row_words + col * word_size),
+                                        &curr_avg_ints[col]);
+                }
+                TRACE40_BLOCK_ROW("region_to_comp_avg_ints", row, rows);
+        }
+        FREE(row_words);
+        return status;
+}
+
+/*
+ * Name: crop_rgb_int
+ * Purpose: cut a region out of a pixmap decoded by region_to_comp_avg_ints,
+ *          which starts at the block holding the region's top left pixel
+ * Parameters: the decoded pixmap, the width (and height) of a block, and the
+ *             left column, top row, width and height of the region in the
+ *             full image
+ * Returns: A Pnm_ppm holding exactly the region
+ * Notes: image must not be NULL, frees image
+ */
+Pnm_ppm crop_rgb_int(Pnm_ppm image, unsigned block_size, unsigned x,
+                                        unsigned y, unsigned w, unsigned h)
+{
+        assert(image != NULL && block_size > 0);
+        unsigned x_offset = x % block_size, y_offset = y % block_size;
+        assert(x_offset + w <= image->width);
+        assert(y_offset + h <= image->height);
+
+        Pnm_ppm output_image;
+        NEW(output_image);
+        output_image->methods = image->methods;
+        output_image->denominator = image->denominator;
+        output_image->width = w;
+        output_image->height = h;
+        output_image->pixels = image->methods->new(w, h, PNM_RGB_SIZE);
+
+        /* each row of the region is one run of pixels in the decoded row */
+        UArray2_T pixels = rgb_int_pixels(image);
+        UARRAY2_FOREACH_ROW(rgb_int_pixels(output_image), struct Pnm_rgb, row,
+                                                        curr_int_pixels) {
+                const struct Pnm_rgb *source_pixels = UArray2_row(pixels,
+                                                        row + y_offset);
+                memcpy(curr_int_pixels, source_pixels + x_offset,
+                                        (size_t) w * sizeof(struct Pnm_rgb));
+        }
+        Pnm_ppmfree(&image);
+        return output_image;
+}
+
+/*
+ * Name: valid_preview_scale
+ * Purpose: check that a preview can be built at some scale
+ * Parameters: the scale, the width (and height) of the image's blocks
+ * Returns: true if it is a power of two from the block size (one pixel per
+ *          block) up to PREVIEW_MAX_SCALE
+ * Notes: none
+ */
+bool valid_preview_scale(unsigned scale, unsigned block_size)
+{
+        return scale >= block_size && scale <= PREVIEW_MAX_SCALE &&
+                                                (scale & (scale - 1)) == 0;
+}
+
+/*
+ * Name: preview_size
+ * Purpose: find the width or height of a preview
+ * Parameters: the width or height of the full image in pixels, the block
+ *             size, the scale
+ * Returns: the size of the preview in pixels
+ * Notes: scale must be valid for the block size. A partial group of blocks on
+ *        the right or bottom edge still gets a pixel of its own, so nothing is
+ *        dropped
+ */
+unsigned preview_size(unsigned pixels, unsigned block_size, unsigned scale)
+{
+        assert(valid_preview_scale(scale, block_size));
+        unsigned factor = scale / block_size;
+        return (pixels / block_size + factor - 1) / factor;
+}
+
+/*
+ * Name: comp_avg_ints_to_preview
+ * Purpose: build a downscaled image straight from the quantized blocks, using
+ *          only a, Pb and Pr
+ * Parameters: UArray2 of quantized component video pixels, the header of the
+ *             image they came from (for its block size and profile), the
+ *             scale (2 for half size, 4 for a quarter, 8 for an eighth)
+ * Returns: A Pnm_ppm holding the preview
+ * Notes: comp_avg_ints_array and header must not be NULL, frees
+ *        comp_avg_ints_array. The scale must be valid for the block size. At
+ *        a scale equal to the block size each block is one pixel, since a is
+ *        the block's average luma and its chroma is already averaged. Larger
+ *        scales average the a, Pb and Pr of groups of blocks. b, c and d are
+ *        never used
+ */
+Pnm_ppm comp_avg_ints_to_preview(UArray2_T comp_avg_ints_array,
+                        const comp40_header *header, unsigned scale)
+{
+        assert(comp_avg_ints_array != NULL && header != NULL);
+        unsigned block_size = header->block_size;
+        assert(valid_preview_scale(scale, block_size));
+        unsigned width = UArray2_width(comp_avg_ints_array);
+        unsigned height = UArray2_height(comp_avg_ints_array);
+        TRACE40_STAGE_ENTRY("comp_avg_ints_to_preview", width, height);
+
+        /* create a methods suite instance */
+        A2Methods_T methods = uarray2_methods_plain;
+        assert(methods);
+
+        Pnm_ppm output_image;
+        NEW(output_image);
+        output_image->methods = methods;
+        output_image->denominator = DENOMINATOR;
+        output_image->width = preview_size(width * block_size, block_size,
+                                                                        scale);
+        output_image->height = preview_size(height * block_size, block_size,
+                                                                        scale);
+        output_image->pixels = methods->new(output_image->width,
+                                        output_image->height, PNM_RGB_SIZE);
+
+        const profile40 *profile = profile40_get(header->profile);
+        unsigned factor = scale / block_size;
+        UARRAY2_FOREACH_ROW(rgb_int_pixels(output_image), struct Pnm_rgb, row,
+                                                        curr_int_pixels) {
+                for (unsigned col = 0; col < output_image->width; col++) {
+                        comp_avg_ints_to_preview_pixel(comp_avg_ints_array,
+                                        profile, header->color, factor, col,
+                                        row, &curr_int_pixels[col]);
+                }
+        }
+        UArray2_free(&comp_avg_ints_array);
+        TRACE40_STAGE_EXIT("comp_avg_ints_to_preview", width, height,
+                                                rgb_int_bytes(output_image));
+        return output_image;
+}
+
+/*
+ * Name: comp_avg_ints_to_preview_pixel
+ * Purpose: average the a, Pb and Pr of the blocks under one preview pixel and
+ *          convert them to an rgb integer pixel
+ * Parameters: UArray2 of quantized component video pixels, their codeword
+ *             profile and colour space, how many blocks across and down go
+ *             into one preview pixel, the column and row of the preview pixel,
+ *             and a pointer to it
  * Returns: none
  * Notes: none
  */
-void word_to_comp_avg_ints_apply(int col, int row, UArray2_T pixmap,
-                                                        void *entry, void *cl)
+void comp_avg_ints_to_preview_pixel(UArray2_T comp_avg_ints_array,
+                const profile40 *profile, unsigned color, unsigned factor,
+                unsigned col, unsigned row, Pnm_rgb curr_int_pixel)
 {
-        /* get values from void pointers */
-        FILE *input = cl;
-        comp_avg_ints *curr_avg_int = entry;
-        
-        /* 
-         * read from the file 1 byte at a time  and place that byte in its
-         * appropriate spot in the word
+        unsigned width = UArray2_width(comp_avg_ints_array);
+        unsigned height = UArray2_height(comp_avg_ints_array);
+
+        /* the group of blocks under this pixel, cut short at the edges */
+        unsigned first_col = col * factor;
+        unsigned first_row = row * factor;
+        unsigned end_col = first_col + factor;
+        unsigned end_row = first_row + factor;
+        end_col = end_col > width ? width : end_col;
+        end_row = end_row > height ? height : end_row;
+
+        float a = 0, bluediff = 0, reddiff = 0;
+        for (unsigned r = first_row; r < end_row; r++) {
+                const comp_avg_ints *ints = UArray2_row(comp_avg_ints_array,
+                                                                        r);
+                for (unsigned c = first_col; c < end_col; c++) {
+                        comp_avg_floats block;
+                        if (color == COMP40_COLOR_GRAY) {
+                                profile->unquantize_luma(profile, &ints[c],
+                                                                &block);
+                        } else {
+                                profile->unquantize(profile, &ints[c], &block);
+                        }
+                        a += block.a;
+                        bluediff += block.bluediff_avg;
+                        reddiff += block.reddiff_avg;
+                }
+        }
+        float blocks = (end_col - first_col) * (end_row - first_row);
+        comp_video_floats average = {
+                .luma = ensure_in_bounds(a / blocks, 0, 1),
+                .bluediff = bluediff / blocks,
+                .reddiff = reddiff / blocks
+        };
+
+        comp_video_pixel_to_rgb_int(&average, color, curr_int_pixel);
+}
+
+/*
+ * Name: comp_video_pixel_to_rgb_int
+ * Purpose: convert one component video pixel to an rgb integer pixel, giving
+ *          the same integers the whole-image stages do
+ * Parameters: a pointer to the component video pixel, the colour space (one of
+ *             the COMP40_COLOR_ values), a pointer to the rgb integer pixel to
+ *             fill in
+ * Returns: none
+ * Notes: the pixel's luma must already be between 0 and 1
+ */
+void comp_video_pixel_to_rgb_int(comp_video_floats *curr_video_pixel,
+                                unsigned color, Pnm_rgb curr_int_pixel)
+{
+        if (color == COMP40_COLOR_GRAY) {
+                unsigned gray = scale_to_rgb_int(curr_video_pixel->luma);
+                curr_int_pixel->red = gray;
+                curr_int_pixel->green = gray;
+                curr_int_pixel->blue = gray;
+        } else if (color == COMP40_COLOR_YCOCG) {
+                ycocg_pixel_to_rgb_int(curr_video_pixel, curr_int_pixel);
+        } else {
+                curr_int_pixel->red = scale_to_rgb_int(
+                        calculate_rgb_float(curr_video_pixel, 0, 1.402));
+                curr_int_pixel->green = scale_to_rgb_int(calculate_rgb_float(
+                        curr_video_pixel, -0.344136, -0.714136));
+                curr_int_pixel->blue = scale_to_rgb_int(
+                        calculate_rgb_float(curr_video_pixel, 1.772, 0));
+        }
+}
+
+/*
+ * Name: comp_avg_ints_to_error
+ * Purpose: measure how far the decoded image is from its original, without
+ *          building the decoded image
+ * Parameters: UArray2 of quantized component video pixels, the header they
+ *             were read with, and the original image
+ * Returns: the error of each channel, over the pixels the blocks cover
+ * Notes: comp_avg_int_arr, header and original must not be NULL, frees
+ *        comp_avg_int_arr but not original. The original must cover every
+ *        block. Blocks are visited row major and each one goes through the
+ *        same unquantize, inverse transform and colour conversion as a full
+ *        decode, straight into the comparison, so the result is what ppmdiff
+ *        gives on the decoded image. An original whose denominator isn't 255
+ *        is scaled to 255 first, as the decoder's output is
+ */
+comp40_error comp_avg_ints_to_error(UArray2_T comp_avg_int_arr,
+                        const comp40_header *header, Pnm_ppm original)
+{
+        assert(comp_avg_int_arr != NULL && header != NULL);
+        assert(original != NULL);
+        assert(original->width >= UArray2_width(comp_avg_int_arr) *
+                                                        header->block_size);
+        assert(original->height >= UArray2_height(comp_avg_int_arr) *
+                                                        header->block_size);
+        const profile40 *profile = profile40_get(header->profile);
+        assert(profile != NULL);
+        unsigned width = UArray2_width(comp_avg_int_arr);
+        unsigned height = UArray2_height(comp_avg_int_arr);
+        comp40_error error = {
+                .sum_squares = {0, 0, 0}, .max_diff = {0, 0, 0},
+                .pixels = (uint64_t) width * height * header->block_size *
+                                                        header->block_size
+        };
+        TRACE40_STAGE_ENTRY("comp_avg_ints_to_error", width, height);
+
+        /*
+         * squared differences are summed exactly in integers along a row of
+         * blocks, and each finished row is added to the doubles with Kahan
+         * compensation, so the sum doesn't drift on big images
          */
-        int curr_bits;
-        uint64_t word = 0;
-        for (int i = 0; i < WORD_LENGTH / 8; i++) {
-                curr_bits = getc(input);
-                assert(!feof(input));
-                word = Bitpack_newu(word, 8, WORD_LENGTH - (i + 1) * 8,
-                                                                curr_bits);
-        }
-
-        /* get the desired values from there spots in the word */
-        uint64_t a = Bitpack_getu(word, WIDTH_A, LSB_A);
-        int64_t b = Bitpack_gets(word, WIDTH_B_C_D, LSB_B);
-        int64_t c = Bitpack_gets(word, WIDTH_B_C_D, LSB_C);
-        int64_t d = Bitpack_gets(word, WIDTH_B_C_D, LSB_D);
-        uint64_t bluediff_avg = Bitpack_getu(word, WIDTH_Pb_Pr, LSB_Pb);
-        uint64_t reddiff_avg = Bitpack_getu(word, WIDTH_Pb_Pr, LSB_Pr);
-
-        /* place the values in the current pixel struct */
-        curr_avg_int->a = a;
-        curr_avg_int->b = b;
-        curr_avg_int->c = c;
-        curr_avg_int->d = d;
-        curr_avg_int->bluediff_avg = bluediff_avg;
-        curr_avg_int->reddiff_avg = reddiff_avg;
-        
-        (void) col;
-        (void) row;
-        (void) pixmap;
+        double compensation[3] = {0, 0, 0};
+        UARRAY2_FOREACH_ROW(comp_avg_int_arr, comp_avg_ints, row,
+                                                        curr_avg_ints) {
+                uint64_t row_squares[3] = {0, 0, 0};
+                for (unsigned col = 0; col < width; col++) {
+                        comp_avg_ints_to_block_error(&curr_avg_ints[col],
+                                        profile, header->color,
+                                        header->block_size, original, col,
+                                        row, row_squares, error.max_diff);
+                }
+                for (int c = 0; c < 3; c++) {
+                        kahan_add(&error.sum_squares[c], &compensation[c],
+                                                        row_squares[c]);
+                }
+                TRACE40_BLOCK_ROW("comp_avg_ints_to_error", row, height);
+        }
+        UArray2_free(&comp_avg_int_arr);
+        TRACE40_STAGE_EXIT("comp_avg_ints_to_error", width, height, 0);
+        return error;
+}
+
+/*
+ * Name: comp_avg_ints_to_block_error
+ * Purpose: decode one block and measure how far it is from the original
+ * Parameters: the block's quantized ints, the codeword profile and colour
+ *             space they are in, the block size, the original image, the
+ *             column and row of the block, the per-channel sums to add the
+ *             squared differences to, and the per-channel largest differences
+ *             to update
+ * Returns: none
+ * Notes: the block goes through the same unquantize, inverse transform and
+ *        colour conversion as a full decode. Differences are in units of 255,
+ *        so an original whose denominator isn't 255 is scaled first, as the
+ *        decoder's output is
+ */
+void comp_avg_ints_to_block_error(const comp_avg_ints *curr_avg_ints,
+                const profile40 *profile, unsigned color, int blocksize,
+                Pnm_ppm original, unsigned col, unsigned row,
+                uint64_t squares[3], unsigned max_diff[3])
+{
+        comp_avg_floats curr_avg_floats;
+        if (color == COMP40_COLOR_GRAY) {
+                profile->unquantize_luma(profile, curr_avg_ints,
+                                                        &curr_avg_floats);
+        } else {
+                profile->unquantize(profile, curr_avg_ints, &curr_avg_floats);
+        }
+
+        float luma[TRANSFORM40_MAX_PIXELS];
+        transform40_inverse(&curr_avg_floats, blocksize, luma);
+        for (int i = 0; i < blocksize * blocksize; i++) {
+                comp_video_floats curr_video_floats = {
+                        .bluediff = curr_avg_floats.bluediff_avg,
+                        .reddiff = curr_avg_floats.reddiff_avg,
+                        .luma = ensure_in_bounds(luma[i], 0, 1)
+                };
+                struct Pnm_rgb decoded;
+                comp_video_pixel_to_rgb_int(&curr_video_floats, color,
+                                                                &decoded);
+                Pnm_rgb source = original->methods->at(original->pixels,
+                                        col * blocksize + i % blocksize,
+                                        row * blocksize + i / blocksize);
+                unsigned decoded_rgb[3] = {decoded.red, decoded.green,
+                                                                decoded.blue};
+                unsigned source_rgb[3] = {source->red, source->green,
+                                                                source->blue};
+                for (int c = 0; c < 3; c++) {
+                        unsigned val = source_rgb[c];
+                        if (original->denominator != DENOMINATOR) {
+                                val = round((double) val * DENOMINATOR /
+                                                original->denominator);
+                        }
+                        unsigned diff = val > decoded_rgb[c] ?
+                                val - decoded_rgb[c] : decoded_rgb[c] - val;
+                        squares[c] += diff * diff;
+                        if (diff > max_diff[c]) {
+                                max_diff[c] = diff;
+                        }
+                }
+        }
+}
+
+/*
+ * Name: kahan_add
+ * Purpose: add a value to a running sum, carrying the rounding error forward
+ * Parameters: the sum, its compensation, the value to add
+ * Returns: none
+ * Notes: none
+ */
+void kahan_add(double *sum, double *compensation, double val)
+{
+        double y = val - *compensation;
+        double t = *sum + y;
+        *compensation = (t - *sum) - y;
+        *sum = t;
+}
+
+/*
+ * Name: scale_to_rgb_int
+ * Purpose: scale an rgb float to an rgb integer the same way
+ *          rgb_float_to_rgb_int does
+ * Parameters: the float, between 0 and 1
+ * Returns: the integer, between 0 and the denominator
+ * Notes: none
+ */
+unsigned scale_to_rgb_int(float val)
+{
+        return (unsigned) round(ensure_in_bounds(round(val * DENOMINATOR), 0,
+                                                                DENOMINATOR));
+}
+
+/*
+ * Name: uarray2_bytes, uarray2b_bytes, rgb_int_bytes
+ * Purpose: find how much memory the elements of an array or image take, for
+ *          the stage exit tracepoints
+ * Parameters: the array or image
+ * Returns: its width times its height times its element size, in bytes
+ * Notes: none
+ */
+uint64_t uarray2_bytes(UArray2_T array)
+{
+        return (uint64_t) UArray2_width(array) * UArray2_height(array) *
+                                                        UArray2_size(array);
+}
+
+uint64_t uarray2b_bytes(UArray2b_T array)
+{
+        return (uint64_t) UArray2b_width(array) * UArray2b_height(array) *
+                                                        UArray2b_size(array);
+}
+
+uint64_t rgb_int_bytes(Pnm_ppm image)
+{
+        return (uint64_t) image->width * image->height * PNM_RGB_SIZE;
+}
+
+/*
+ * Name: rgb_int_pixels
+ * Purpose: get the pixmap of an image as the UArray2 it is, so a stage can
+ *          walk its rows with foreach40.h
+ * Parameters: the image
+ * Returns: its pixels, a UArray2 of struct Pnm_rgb
+ * Notes: image must not be NULL and must use uarray2_methods_plain, as every
+ *        image the codec reads or makes does
+ */
+UArray2_T rgb_int_pixels(Pnm_ppm image)
+{
+        assert(image != NULL && image->methods == uarray2_methods_plain);
+        return image->pixels;
+}
+
+/*
+ * Name: buffer_to_comp_avg_ints
+ * Purpose: reads in compressed data from a buffer and puts it into a UArray2
+ * Parameters: the buffer and its length in bytes, where to store its header,
+ *             where to store why decoding failed
+ * Returns: UArray2 of component video int pixels, or NULL on bad input
+ * Notes: in, header and status must not be NULL. Reads both format 2 and
+ *        format 3. Never reads past in_len
+ */
+UArray2_T buffer_to_comp_avg_ints(const unsigned char *in, size_t in_len,
+                                comp40_header *header, Codec40_status *status)
+{
+        assert(in != NULL && header != NULL && status != NULL);
+        TRACE40_STAGE_ENTRY("buffer_to_comp_avg_ints", 0, 0);
+
+        /* check for the correct header and get the width and height */
+        *status = parse_comp40_header(in, in_len, header);
+        if (*status != CODEC40_OK) {
+                TRACE40_STAGE_EXIT("buffer_to_comp_avg_ints", 0, 0, 0);
+                return NULL;
+        }
+        in += header->length;
+        in_len -= header->length;
+        unsigned cols = header->width / header->block_size;
+        unsigned rows = header->height / header->block_size;
+        UArray2_T comp_avg_ints_array;
+        if (header->version == COMP40_TILED) {
+                comp_avg_ints_array = tiled_buffer_to_comp_avg_ints(header,
+                                                        in, in_len, status);
+                TRACE40_STAGE_EXIT("buffer_to_comp_avg_ints", cols, rows,
+                                comp_avg_ints_array == NULL ? 0 :
+                                        uarray2_bytes(comp_avg_ints_array));
+                return comp_avg_ints_array;
+        }
+
+        comp_avg_ints_array = flat_buffer_to_comp_avg_ints(header, in, in_len,
+                                        status, "buffer_to_comp_avg_ints");
+        TRACE40_STAGE_EXIT("buffer_to_comp_avg_ints", cols, rows,
+                                comp_avg_ints_array == NULL ? 0 :
+                                        uarray2_bytes(comp_avg_ints_array));
+        return comp_avg_ints_array;
+}
+
+/*
+ * Name: flat_buffer_to_comp_avg_ints
+ * Purpose: unpack the codewords of a format 2 image held in memory
+ * Parameters: the header, the codewords that follow it and how many bytes
+ *             there are, where to store why decoding failed, and the name of
+ *             the calling stage for the block row probes
+ * Returns: UArray2 of component video int pixels, or NULL (with
+ *          CODEC40_ETRUNCATED) if in_len is short of the last codeword
+ * Notes: none of header, in, status and stage may be NULL
+ */
+UArray2_T flat_buffer_to_comp_avg_ints(const comp40_header *header,
+                const unsigned char *in, size_t in_len, Codec40_status *status,
+                const char *stage)
+{
+        unsigned cols = header->width / header->block_size;
+        unsigned rows = header->height / header->block_size;
+        const profile40 *profile = profile40_get(header->profile);
+        if (in_len < (size_t) cols * rows * profile->word_bytes) {
+                *status = CODEC40_ETRUNCATED;
+                return NULL;
+        }
+
+        /* the codewords are row major, one after another */
+        UArray2_T comp_avg_ints_array = UArray2_new(cols, rows,
+                                                        sizeof(comp_avg_ints));
+        UARRAY2_FOREACH_ROW(comp_avg_ints_array, comp_avg_ints, row,
+                                                        curr_avg_ints) {
+                for (unsigned col = 0; col < cols; col++) {
+                        profile->unpack(profile, profile40_get_word(profile,
+                                                in), &curr_avg_ints[col]);
+                        in += profile->word_bytes;
+                }
+                TRACE40_BLOCK_ROW(stage, row, rows);
+        }
+        *status = CODEC40_OK;
+        return comp_avg_ints_array;
+}
+
+/*
+ * Name: tiled_buffer_to_comp_avg_ints
+ * Purpose: decode every tile of a format 3 image held in memory
+ * Parameters: the header, the bytes that follow it (index and tile data) and
+ *             how many there are, where to store why decoding failed
+ * Returns: UArray2 of component video int pixels, or NULL on bad input
+ * Notes: none of header, in and status may be NULL. The index and every tile
+ *        it lists must be inside in before the image is allocated, so a short
+ *        file whose header claims a huge image fails with CODEC40_ETRUNCATED
+ */
+UArray2_T tiled_buffer_to_comp_avg_ints(const comp40_header *header,
+                const unsigned char *in, size_t in_len, Codec40_status *status)
+{
+        size_t index_size = comp40_index_size(header);
+        if (in_len < index_size) {
+                *status = CODEC40_ETRUNCATED;
+                return NULL;
+        }
+
+        tile_jobs jobs = {
+                .header = header,
+                .first_tile_col = 0, .first_tile_row = 0,
+                .tiles_across = comp40_tiles_across(header),
+                .count = index_size / COMP40_TILE_ENTRY_SIZE,
+                .data = in + index_size, .data_len = in_len - index_size,
+                .fd = -1, .data_offset = 0,
+                .dest_col = 0, .dest_row = 0
+        };
+        jobs.tiles = ALLOC((long) jobs.count * sizeof(comp40_tile));
+        for (unsigned i = 0; i < jobs.count; i++) {
+                comp40_tile *tile = &jobs.tiles[i];
+                parse_comp40_tile(in + (size_t) i * COMP40_TILE_ENTRY_SIZE,
+                                                                        tile);
+                if (tile->offset > jobs.data_len ||
+                    tile->length > jobs.data_len - tile->offset) {
+                        FREE(jobs.tiles);
+                        *status = CODEC40_ETRUNCATED;
+                        return NULL;
+                }
+        }
+
+        UArray2_T comp_avg_ints_array = UArray2_new(
+                                header->width / header->block_size,
+                                header->height / header->block_size,
+                                sizeof(comp_avg_ints));
+        jobs.dest = comp_avg_ints_array;
+        *status = decode_tiles(&jobs);
+        FREE(jobs.tiles);
+        if (*status != CODEC40_OK) {
+                UArray2_free(&comp_avg_ints_array);
+                return NULL;
+        }
+        return comp_avg_ints_array;
+}
+
+/*
+ * Name: decode_tiles
+ * Purpose: decode a set of tiles, in parallel when there are enough of them
+ * Parameters: the jobs to run
+ * Returns: CODEC40_OK, or why the first failing tile failed
+ * Notes: starts one thread per online processor (but no more than there are
+ *        tiles) and has the calling thread work too. If a thread can't be
+ *        started the others just take on its tiles
+ */
+Codec40_status decode_tiles(tile_jobs *jobs)
+{
+        jobs->next = 0;
+        jobs->status = CODEC40_OK;
+        pthread_mutex_init(&jobs->lock, NULL);
+
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        unsigned threads = processors < 1 ? 1 : processors;
+        if (threads > MAX_DECODE_THREADS) {
+                threads = MAX_DECODE_THREADS;
+        }
+        if (threads > jobs->count) {
+                threads = jobs->count;
+        }
+
+        pthread_t helpers[MAX_DECODE_THREADS];
+        unsigned started = 0;
+        for (unsigned i = 1; i < threads; i++) {
+                if (pthread_create(&helpers[started], NULL, decode_tiles_thread,
+                                                                jobs) == 0) {
+                        started++;
+                }
+        }
+        decode_tiles_thread(jobs);
+        for (unsigned i = 0; i < started; i++) {
+                pthread_join(helpers[i], NULL);
+        }
+
+        pthread_mutex_destroy(&jobs->lock);
+        return jobs->status;
+}
+
+/*
+ * Name: decode_tiles_thread
+ * Purpose: keep taking the next tile and decoding it until there are none left
+ *          or one has failed
+ * Parameters: void pointer to the jobs
+ * Returns: NULL
+ * Notes: tiles cover separate blocks, so threads never write the same element
+ *        of the destination UArray2
+ */
+void *decode_tiles_thread(void *cl)
+{
+        tile_jobs *jobs = cl;
+        for (;;) {
+                pthread_mutex_lock(&jobs->lock);
+                unsigned job = jobs->next++;
+                bool stop = job >= jobs->count || jobs->status != CODEC40_OK;
+                pthread_mutex_unlock(&jobs->lock);
+                if (stop) {
+                        return NULL;
+                }
+
+                Codec40_status status = decode_tile(jobs, job);
+                if (status != CODEC40_OK) {
+                        pthread_mutex_lock(&jobs->lock);
+                        if (jobs->status == CODEC40_OK) {
+                                jobs->status = status;
+                        }
+                        pthread_mutex_unlock(&jobs->lock);
+                }
+        }
+}
+
+/*
+ * Name: decode_tile
+ * Purpose: check one tile against its CRC32C, undo its entropy coding and
+ *          prediction if it has any, and unpack the blocks in it that fall
+ *          inside the destination window
+ * Parameters: the jobs, which job to run
+ * Returns: CODEC40_OK, CODEC40_ETRUNCATED if the tile's bytes aren't all
+ *          there, CODEC40_ECHECKSUM if they don't match the CRC, or
+ *          CODEC40_EFORMAT if the tile's coding or length is wrong (only
+ *          the standard profile can be entropy coded) or its entropy or
+ *          run-length coded stream is corrupt
+ * Notes: never raises an exception, so it is safe to call from more than one
+ *        thread
+ */
+Codec40_status decode_tile(tile_jobs *jobs, unsigned job)
+{
+        const comp40_tile *tile = &jobs->tiles[job];
+        unsigned first_col, first_row, cols, rows;
+        comp40_tile_blocks(jobs->header,
+                        jobs->first_tile_col + job % jobs->tiles_across,
+                        jobs->first_tile_row + job / jobs->tiles_across,
+                        &first_col, &first_row, &cols, &rows);
+        const profile40 *profile = profile40_get(jobs->header->profile);
+        size_t word_size = profile->word_bytes;
+        size_t blocks = (size_t) cols * rows;
+        bool entropy_coded = profile->id == PROFILE40_STANDARD &&
+                                (tile->coding == COMP40_CODING_RANS ||
+                                tile->coding == COMP40_CODING_RANS_MED);
+        bool run_length_coded = tile->coding == COMP40_CODING_RLE;
+        if (!(tile->coding == COMP40_CODING_RAW &&
+                        tile->length == blocks * word_size) && !entropy_coded &&
+                        !run_length_coded) {
+                return CODEC40_EFORMAT;
+        }
+
+        /* get the tile's bytes, from memory or straight from the file */
+        const unsigned char *bytes;
+        unsigned char *buffer = NULL;
+        if (jobs->data != NULL) {
+                if (tile->offset > jobs->data_len ||
+                    tile->length > jobs->data_len - tile->offset) {
+                        return CODEC40_ETRUNCATED;
+                }
+                bytes = jobs->data + tile->offset;
+        } else {
+                buffer = ALLOC(tile->length);
+                if (pread(jobs->fd, buffer, tile->length, jobs->data_offset +
+                        (off_t) tile->offset) != (ssize_t) tile->length) {
+                        FREE(buffer);
+                        return CODEC40_ETRUNCATED;
+                }
+                bytes = buffer;
+        }
+        if (crc32c(0, bytes, tile->length) != tile->crc) {
+                FREE(buffer);
+                return CODEC40_ECHECKSUM;
+        }
+
+        /* runs are expanded straight into the destination */
+        if (run_length_coded) {
+                bool ok = runs_to_comp_avg_ints(jobs, profile, bytes,
+                        tile->length, first_col, first_row, cols, rows);
+                FREE(buffer);
+                return ok ? CODEC40_OK : CODEC40_EFORMAT;
+        }
+
+        /* entropy coded tiles are decoded back to raw codewords first */
+        unsigned char *words = NULL;
+        if (entropy_coded) {
+                words = ALLOC(blocks * word_size);
+                Codec40_status status = rans40_decode(bytes, tile->length,
+                                                                words, blocks);
+                FREE(buffer);
+                if (status != CODEC40_OK) {
+                        FREE(words);
+                        return status;
+                }
+                if (tile->coding == COMP40_CODING_RANS_MED) {
+                        predict40_restore(words, cols, rows);
+                }
+                bytes = words;
+        }
+
+        /* unpack the blocks that land in the destination */
+        unsigned dest_width = UArray2_width(jobs->dest);
+        unsigned dest_height = UArray2_height(jobs->dest);
+        for (unsigned row = first_row; row < first_row + rows; row++) {
+                for (unsigned col = first_col; col < first_col + cols; col++) {
+                        const unsigned char *curr = bytes;
+                        bytes += word_size;
+                        if (col < jobs->dest_col || row < jobs->dest_row ||
+                            col - jobs->dest_col >= dest_width ||
+                            row - jobs->dest_row >= dest_height) {
+                                continue;
+                        }
+                        profile->unpack(profile,
+                                profile40_get_word(profile, curr),
+                                UArray2_at(jobs->dest, col - jobs->dest_col,
+                                                row - jobs->dest_row));
+                }
+        }
+        FREE(buffer);
+        FREE(words);
+        return CODEC40_OK;
+}
+
+/*
+ * Name: runs_to_comp_avg_ints
+ * Purpose: expand the runs of a run-length coded tile into the blocks that
+ *          land in the destination
+ * Parameters: the decoding jobs, the codeword profile, the tile's bytes and
+ *             their length, the first block column and row in the tile, the
+ *             number of blocks across and down it
+ * Returns: true on success, false if the runs are corrupt or don't add up to
+ *          the blocks in the tile
+ * Notes: each run's codeword is unpacked once and copied to every block in
+ *        the run. Never raises an exception
+ */
+bool runs_to_comp_avg_ints(tile_jobs *jobs, const profile40 *profile,
+                        const unsigned char *in, size_t in_len,
+                        unsigned first_col, unsigned first_row, unsigned cols,
+                        unsigned rows)
+{
+        const unsigned char *end = in + in_len;
+        unsigned dest_width = UArray2_width(jobs->dest);
+        unsigned dest_height = UArray2_height(jobs->dest);
+        size_t blocks_left = (size_t) cols * rows;
+        size_t run_left = 0;
+        comp_avg_ints run;
+        for (unsigned row = first_row; row < first_row + rows; row++) {
+                for (unsigned col = first_col; col < first_col + cols; col++) {
+                        if (run_left == 0) {
+                                const unsigned char *word;
+                                if (!rle40_next_run(&in, end,
+                                        profile->word_bytes, blocks_left,
+                                        &run_left, &word)) {
+                                        return false;
+                                }
+                                profile->unpack(profile, profile40_get_word(
+                                                        profile, word), &run);
+                        }
+                        run_left--;
+                        blocks_left--;
+                        if (col < jobs->dest_col || row < jobs->dest_row ||
+                            col - jobs->dest_col >= dest_width ||
+                            row - jobs->dest_row >= dest_height) {
+                                continue;
+                        }
+                        *(comp_avg_ints *) UArray2_at(jobs->dest,
+                                col - jobs->dest_col,
+                                row - jobs->dest_row) = run;
+                }
+        }
+        return in == end;
 }
 
 #undef DENOMINATOR
-#undef A2
 #undef PNM_RGB_SIZE
-#undef BLOCKSIZE
-#undef WIDTH_A
-#undef WIDTH_B_C_D
-#undef WIDTH_Pb_Pr
-#undef LSB_A
-#undef LSB_B
-#undef LSB_C
-#undef LSB_D
-#undef LSB_Pb
-#undef LSB_Pr
\ No newline at end of file
+#undef MAX_DECODE_THREADS
+#undef PREVIEW_MAX_SCALE
+#undef READ_CHUNK
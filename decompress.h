@@ -20,22 +20,84 @@
 #include "bitpack.h"
 #include "arith40.h"
 #include "pixel_structs.h"
+#include "container40.h"
+#include "rans40.h"
+#include "predict40.h"
+#include "rle40.h"
+#include "transform40.h"
+#include "profile40.h"
+#include "trace40.h"
+#include "foreach40.h"
 #include "mem.h"
 #include <math.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #ifndef DECOMPRESS_INCLUDED
 #define DECOMPRESS_INCLUDED
 
 #define A2 A2Methods_UArray2
 
+/*
+ * Name: comp40_error
+ * Contains: how far a decoded image is from its original - for red, green and
+ *           blue, the sum of the squared differences and the largest
+ *           difference, in units of a denominator of 255, and the number of
+ *           pixels compared
+ */
+struct comp40_error {
+        double sum_squares[3];
+        unsigned max_diff[3];
+        uint64_t pixels;
+};
+typedef struct comp40_error comp40_error;
+
 void rgb_int_to_ppm(Pnm_ppm output_image);
+void rgb_int_to_pnm(Pnm_ppm output_image, unsigned color);
+void rgb_int_to_rgb8(Pnm_ppm output_image, unsigned char *rgb);
 Pnm_ppm rgb_float_to_rgb_int(UArray2_T rgb_float_array);
 UArray2_T component_video_to_rgb_float(UArray2b_T comp_video_array);
-UArray2b_T comp_avg_float_to_comp_video_floats(UArray2_T comp_avg_float_arr);
-UArray2_T comp_avg_ints_to_comp_avg_floats(UArray2_T comp_avg_int_arr);
-UArray2_T word_to_comp_avg_ints(FILE *input);
+Pnm_ppm component_video_to_rgb_int(UArray2b_T comp_video_array, unsigned color);
+UArray2b_T comp_avg_float_to_comp_video_floats(UArray2_T comp_avg_float_arr,
+                                                        unsigned blocksize);
+Pnm_ppm comp_avg_float_to_rgb_int(UArray2_T comp_avg_float_arr,
+                                        unsigned blocksize, unsigned color);
+UArray2_T comp_avg_ints_to_comp_avg_floats(UArray2_T comp_avg_int_arr,
+                                        unsigned profile, unsigned color);
+UArray2_T word_to_comp_avg_ints(FILE *input, comp40_header *header,
+                                                        Codec40_status *status);
+UArray2_T region_to_comp_avg_ints(FILE *input, const comp40_header *header,
+                                unsigned x, unsigned y, unsigned w, unsigned h,
+                                Codec40_status *status);
+bool valid_preview_scale(unsigned scale, unsigned block_size);
+unsigned preview_size(unsigned pixels, unsigned block_size, unsigned scale);
+Pnm_ppm comp_avg_ints_to_preview(UArray2_T comp_avg_ints_array,
+                        const comp40_header *header, unsigned scale);
+Pnm_ppm crop_rgb_int(Pnm_ppm image, unsigned block_size, unsigned x,
+                                        unsigned y, unsigned w, unsigned h);
+void decompress40_region(FILE *fp, unsigned x, unsigned y, unsigned w,
+                                                                unsigned h);
+void decompress40_preview(FILE *fp, unsigned scale);
+comp40_error comp_avg_ints_to_error(UArray2_T comp_avg_int_arr,
+                        const comp40_header *header, Pnm_ppm original);
+void comp_avg_ints_to_block_error(const comp_avg_ints *curr_avg_ints,
+                const profile40 *profile, unsigned color, int blocksize,
+                Pnm_ppm original, unsigned col, unsigned row,
+                uint64_t squares[3], unsigned max_diff[3]);
+void decompress40_compare(FILE *fp, FILE *original_fp);
+UArray2_T buffer_to_comp_avg_ints(const unsigned char *in, size_t in_len,
+                                comp40_header *header, Codec40_status *status);
+uint64_t uarray2_bytes(UArray2_T array);
+uint64_t uarray2b_bytes(UArray2b_T array);
+uint64_t rgb_int_bytes(Pnm_ppm image);
+UArray2_T rgb_int_pixels(Pnm_ppm image);
 
 #undef A2
 
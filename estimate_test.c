@@ -0,0 +1,120 @@
+#include "compress.h"
+#include "corpus40.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "assert.h"
+
+#define TILE_SIZE 256
+#define SMALL_TILE_SIZE 64
+
+/*
+ * Name: estimate_layout
+ * Contains: one way of compressing an image that is estimated - its format,
+ *           tile size (0 for format 2) and tile coding
+ */
+struct estimate_layout {
+        unsigned version, tile_size, coding;
+};
+typedef struct estimate_layout estimate_layout;
+
+static const estimate_layout layouts[] = {
+        {COMP40_FLAT, 0, COMP40_CODING_RAW},
+        {COMP40_TILED, TILE_SIZE, COMP40_CODING_RANS},
+        {COMP40_TILED, TILE_SIZE, COMP40_CODING_RANS_MED},
+        {COMP40_TILED, TILE_SIZE, COMP40_CODING_RLE},
+        {COMP40_TILED, SMALL_TILE_SIZE, COMP40_CODING_RANS_MED}
+};
+
+/* Helper functions */
+size_t compressed_bytes(const unsigned char *ppm, size_t ppm_length,
+                        const comp40_header *format, unsigned coding);
+
+/*
+ * Every image of the corpus is estimated, then compressed for real, in each
+ * layout. The actual size must land inside the estimate's 95% interval. The
+ * sampling is seeded, so a miss here is a miss every time, not bad luck.
+ */
+int main() {
+        unsigned count = sizeof(layouts) / sizeof(layouts[0]);
+        for (unsigned c = 0; c < corpus40_count(); c++) {
+                const corpus40_image *image = corpus40_get(c);
+                size_t ppm_length;
+                unsigned char *ppm = corpus40_ppm(image, &ppm_length);
+                FILE *input = fmemopen(ppm, ppm_length, "rb");
+                assert(input != NULL);
+                Pnm_ppm original = ppm_to_rgb_int(input);
+                fclose(input);
+                bool gray = rgb_int_is_gray(original);
+                for (unsigned l = 0; l < count; l++) {
+                        comp40_header format = {
+                                .version = layouts[l].version,
+                                .tile_size = layouts[l].tile_size,
+                                .block_size = COMP40_DEFAULT_BLOCK_SIZE,
+                                .profile = PROFILE40_STANDARD,
+                                .color = layouts[l].tile_size != 0 && gray ?
+                                        COMP40_COLOR_GRAY : COMP40_COLOR_YPBPR
+                        };
+                        comp40_estimate estimate = rgb_int_to_estimate(
+                                        original, &format, layouts[l].coding);
+                        size_t actual = compressed_bytes(ppm, ppm_length,
+                                                &format, layouts[l].coding);
+                        if (actual < estimate.size_low ||
+                                                actual > estimate.size_high) {
+                                fprintf(stderr, "estimate_test: %s tile %u "
+                                        "coding %u is %zu bytes, estimated "
+                                        "%.0f to %.0f\n", image->name,
+                                        format.tile_size, layouts[l].coding,
+                                        actual, estimate.size_low,
+                                        estimate.size_high);
+                                assert(0);
+                        }
+                }
+                Pnm_ppmfree(&original);
+                FREE(ppm);
+        }
+        printf("estimate_test: ok\n");
+        return 0;
+}
+
+/*
+ * Name: compressed_bytes
+ * Purpose: compress an image the way 40image -c does, and measure the result
+ * Parameters: the image as a PPM file in memory and its length, the layout
+ *             to compress it in, and the tile coding
+ * Returns: the size of the compressed image in bytes
+ * Notes: the compressed image is written to memory and thrown away
+ */
+size_t compressed_bytes(const unsigned char *ppm, size_t ppm_length,
+                        const comp40_header *format, unsigned coding)
+{
+        FILE *input = fmemopen((void *) ppm, ppm_length, "rb");
+        assert(input != NULL);
+        Pnm_ppm original = ppm_to_rgb_int(input);
+        fclose(input);
+        UArray2b_T comp_video_array = rgb_int_to_component_video(original,
+                                        format->block_size, format->color);
+        UArray2_T comp_avg_float_array = comp_video_floats_to_comp_avg_float(
+                                                comp_video_array, NULL);
+        UArray2_T comp_avg_int_array =
+                        comp_avg_floats_to_comp_avg_ints(comp_avg_float_array,
+                                        format->profile, format->color, NULL);
+
+        char *compressed = NULL;
+        size_t length = 0;
+        FILE *output = open_memstream(&compressed, &length);
+        assert(output != NULL);
+        if (format->version == COMP40_FLAT) {
+                comp_avg_ints_to_file(comp_avg_int_array, output);
+        } else {
+                comp_avg_ints_to_tiled_out(comp_avg_int_array, output, format,
+                                                                        coding);
+        }
+        fclose(output);
+        free(compressed);
+        return length;
+}
+
+#undef TILE_SIZE
+#undef SMALL_TILE_SIZE
@@ -0,0 +1,166 @@
+/**************************************************************
+ *
+ *                     foreach40.h
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  Loops over UArray2s and UArray2bs that the
+ *               compiler can see into. UArray2_map_row_major and
+ *               UArray2b_map call an apply function through a
+ *               pointer for every element, with its column, row,
+ *               the array and a closure, so nothing can be
+ *               inlined. Each FOREACH here is a macro that opens
+ *               nested for loops, and is followed by the loop body
+ *               the way a for statement is:
+ *
+ *                 UARRAY2_FOREACH_ROW(floats, rgb_floats, row, pixels) {
+ *                         for (int col = 0; col < width; col++) {
+ *                                 pixels[col].red = ...;
+ *                         }
+ *                 }
+ *
+ *               The body sees the caller's own variables, so there
+ *               is no closure, and works on raw pointers:
+ *
+ *               - A row of a UArray2 is contiguous, but rows are
+ *                 allocated one by one, so each row is reached by
+ *                 its own pointer (UARRAY2_FOREACH_ROW).
+ *               - A block of a UArray2b is contiguous and row
+ *                 major, with a stride of blocksize elements from
+ *                 one of its rows to the next (UARRAY2B_FOREACH_BLOCK).
+ *                 Blocks on the right and bottom edges can stick
+ *                 out past the array. A span is the part of one row
+ *                 of a block that is inside it: len contiguous
+ *                 elements starting at (col, row)
+ *                 (UARRAY2B_FOREACH_SPAN).
+ *
+ *               UARRAY2_FOREACH and UARRAY2B_FOREACH visit single
+ *               elements in the same order as UArray2_map_row_major
+ *               and UArray2b_map.
+ *
+ *               The index and pointer names given to a macro are
+ *               declared by it, and only exist in the body. type
+ *               must be the type of the array's elements (checked
+ *               once per traversal). The array expression is
+ *               evaluated more than once. Each macro is several
+ *               loops deep, so break in the body only leaves the
+ *               innermost of them; leave a traversal early with
+ *               goto or return.
+ *
+ **************************************************************/
+
+#ifndef FOREACH40_INCLUDED
+#define FOREACH40_INCLUDED
+
+#include <stddef.h>
+#include "uarray2.h"
+#include "uarray2b.h"
+
+/* the including file's assert (CII's or the C library's) checks the type */
+#ifndef assert
+#include <assert.h>
+#endif
+
+void *UArray2_row(UArray2_T array2, int row);
+void *UArray2b_block(UArray2b_T array2b, int block_col, int block_row);
+
+/* how far to step from first to the next block, without passing end */
+#define FOREACH40_NEXT_(first, end, step) \
+        ((end) - (first) > (step) ? (first) + (step) : (end))
+
+/*
+ * Every row of a UArray2, top to bottom: ptr (a type *) points at the
+ * element in column 0 of row row. An array with no columns has no rows
+ */
+#define UARRAY2_FOREACH_ROW(array, type, row, ptr) \
+        for (int row = (assert(UArray2_size(array) == sizeof(type)), 0), \
+                        row##_end_ = UArray2_width(array) > 0 ? \
+                                        UArray2_height(array) : 0; \
+                        row < row##_end_; row++) \
+                for (type *ptr = UArray2_row((array), row); ptr != NULL; \
+                                                                ptr = NULL)
+
+/* Every element of a UArray2, in row major order: elem is at (col, row) */
+#define UARRAY2_FOREACH(array, type, col, row, elem) \
+        UARRAY2_FOREACH_ROW(array, type, row, elem##_row_) \
+                for (int col = 0, col##_end_ = UArray2_width(array); \
+                                                col < col##_end_; col++) \
+                        for (type *elem = elem##_row_ + col; elem != NULL; \
+                                                                elem = NULL)
+
+/*
+ * Every block of a UArray2b, a row of blocks at a time: ptr (a type *) points
+ * at the block's top left element, which is at (block_col * blocksize,
+ * block_row * blocksize), and element (i, j) of the block is
+ * ptr[j * blocksize + i]. Parts of edge blocks that are outside the array
+ * hold nothing
+ */
+#define UARRAY2B_FOREACH_BLOCK(array, type, block_col, block_row, ptr) \
+        for (int block_row = (assert(UArray2b_size(array) == sizeof(type)), \
+                                                                        0), \
+                        block_row##_end_ = \
+                                UArray2b_height(array) / \
+                                UArray2b_blocksize(array) + \
+                                (UArray2b_height(array) % \
+                                UArray2b_blocksize(array) != 0), \
+                        block_col##_end_ = \
+                                UArray2b_width(array) / \
+                                UArray2b_blocksize(array) + \
+                                (UArray2b_width(array) % \
+                                UArray2b_blocksize(array) != 0); \
+                        block_row < block_row##_end_; block_row++) \
+                for (int block_col = 0; block_col < block_col##_end_; \
+                                                                block_col++) \
+                        for (type *ptr = UArray2b_block((array), block_col, \
+                                        block_row); ptr != NULL; ptr = NULL)
+
+/*
+ * Every span of a UArray2b, in UArray2b_map's order (block by block, and row
+ * by row within a block): span (a type *) points at len contiguous elements,
+ * the first of which is at (col, row)
+ */
+#define UARRAY2B_FOREACH_SPAN(array, type, col, row, span, len) \
+        for (int span##_bs_ = (assert(UArray2b_size(array) == \
+                                                        sizeof(type)), \
+                                        UArray2b_blocksize(array)), \
+                        span##_width_ = UArray2b_width(array), \
+                        span##_height_ = UArray2b_height(array), \
+                        span##_top_ = 0; \
+                        span##_top_ < span##_height_; \
+                        span##_top_ = FOREACH40_NEXT_(span##_top_, \
+                                        span##_height_, span##_bs_)) \
+                for (int span##_left_ = 0; \
+                                span##_left_ < span##_width_; \
+                                span##_left_ = FOREACH40_NEXT_(span##_left_, \
+                                        span##_width_, span##_bs_)) \
+                        for (type *span##_block_ = UArray2b_block((array), \
+                                        span##_left_ / span##_bs_, \
+                                        span##_top_ / span##_bs_); \
+                                        span##_block_ != NULL; \
+                                        span##_block_ = NULL) \
+                                for (int col = span##_left_, \
+                                        len = FOREACH40_NEXT_(col, \
+                                                span##_width_, span##_bs_) - \
+                                                                        col, \
+                                        row = span##_top_, \
+                                        row##_end_ = FOREACH40_NEXT_(row, \
+                                                span##_height_, span##_bs_); \
+                                        row < row##_end_; row++) \
+                                        for (type *span = span##_block_ + \
+                                                (size_t) (row - span##_top_) * \
+                                                span##_bs_; span != NULL; \
+                                                                span = NULL)
+
+/* Every element of a UArray2b, in UArray2b_map's order, at (col, row) */
+#define UARRAY2B_FOREACH(array, type, col, row, elem) \
+        UARRAY2B_FOREACH_SPAN(array, type, elem##_col_, row, elem##_span_, \
+                                                                elem##_len_) \
+                for (int col = elem##_col_; \
+                                col < elem##_col_ + elem##_len_; col++) \
+                        for (type *elem = elem##_span_ + \
+                                        (col - elem##_col_); elem != NULL; \
+                                                                elem = NULL)
+
+#endif
@@ -1,34 +1,211 @@
+/**************************************************************
+ *
+ *                     ppmdiff.c
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  Print the root mean square difference of two
+ *               images, as a percentage of the first image's
+ *               denominator. Images may differ in width and
+ *               height by at most one; the extra row or column
+ *               is ignored.
+ *
+ *               Each image is read straight into one buffer of
+ *               samples (P6 and P5 with one fread), and the rows
+ *               are split into bands that are compared by
+ *               separate threads. A row's squared differences
+ *               are summed exactly in integers (16 samples at a
+ *               time with SSE2), and the rows are added up in
+ *               Kahan-compensated doubles.
+ *
+ *               With --metrics it prints, for each channel and
+ *               for all three, the RMS error, PSNR, largest
+ *               error, SSIM (11x11 Gaussian window, sigma 1.5)
+ *               and five-scale MS-SSIM. SSIM streams through the
+ *               image keeping only the last 11 horizontally
+ *               filtered rows, one band of rows per thread. With
+ *               --heatmap file it writes the RMS error of every
+ *               2x2 block as a PGM.
+ *
+ **************************************************************/
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdbool.h>
+#include <ctype.h>
 #include <math.h>
-#include "pnm.h"
-#include "a2methods.h"
-#include "a2plain.h"
+#include <pthread.h>
+#include <unistd.h>
 #include "assert.h"
 
-float square (float num);
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define CHANNELS 3
+#define MAX_THREADS 64
+#define MAX_DENOMINATOR 65535
+#define SSIM_RADIUS 5
+#define SSIM_WINDOW (2 * SSIM_RADIUS + 1)
+#define SSIM_SIGMA 1.5
+#define SSIM_K1 0.01
+#define SSIM_K2 0.03
+#define SSIM_STATS 5
+#define MS_SSIM_SCALES 5
+#define HEATMAP_BLOCK 2
+
+/*
+ * Name: pnm_image
+ * Contains: a PPM or PGM read into memory - its width, height and denominator,
+ *           the bytes per sample (1, or 2 if the denominator is above 255),
+ *           and the samples, row major, three per pixel (a PGM's gray is
+ *           repeated as red, green and blue)
+ */
+struct pnm_image {
+        unsigned width, height;
+        unsigned denominator;
+        unsigned sample_bytes;
+        unsigned char *samples;
+};
+typedef struct pnm_image pnm_image;
+
+/*
+ * Name: channel_stats
+ * Contains: the error of each channel - the sum of its squared differences
+ *           and its largest difference, in units of the samples
+ */
+struct channel_stats {
+        double sum_squares[CHANNELS];
+        unsigned max_diff[CHANNELS];
+};
+typedef struct channel_stats channel_stats;
+
+/*
+ * Name: diff_band
+ * Contains: one thread's share of the comparison - the two images, the width
+ *           being compared, the rows it covers, the Kahan sum of the squared
+ *           sample differences over them, and, if per-channel stats were asked
+ *           for, each channel's Kahan sum and largest difference
+ */
+struct diff_band {
+        const pnm_image *image1, *image2;
+        unsigned width;
+        unsigned first_row, end_row;
+        double sum, compensation;
+        bool per_channel;
+        channel_stats stats;
+        double channel_compensation[CHANNELS];
+};
+typedef struct diff_band diff_band;
 
-int main(int argc, char *argv[]) 
+/*
+ * Name: channel_view
+ * Contains: one channel of an image at one scale, as SSIM reads it - either
+ *           the full size image and the channel in it, or (image NULL) a
+ *           downsampled plane of floats, row major - its width and height, and
+ *           what to multiply samples by to bring them between 0 and 1
+ */
+struct channel_view {
+        const pnm_image *image;
+        unsigned channel;
+        const float *plane;
+        unsigned width, height;
+        float scale;
+};
+typedef struct channel_view channel_view;
+
+/*
+ * Name: ssim_band
+ * Contains: one thread's share of an SSIM pass - the two channels, the window
+ *           weights, the SSIM constants, the rows of windows it covers (by
+ *           their top row), and the Kahan sums of SSIM and of its contrast
+ *           and structure term (cs) over those windows
+ */
+struct ssim_band {
+        const channel_view *view1, *view2;
+        const float *weights;
+        float c1, c2;
+        unsigned first_row, end_row;
+        double ssim_sum, ssim_compensation;
+        double cs_sum, cs_compensation;
+};
+typedef struct ssim_band ssim_band;
+
+/* Helper functions */
+pnm_image *read_image(FILE *input);
+bool read_number(FILE *input, unsigned *num);
+bool read_raw_samples(FILE *input, pnm_image *image, unsigned channels);
+bool read_plain_samples(FILE *input, pnm_image *image, unsigned channels);
+void free_image(pnm_image **image);
+static inline unsigned sample(const pnm_image *image,
+                                const unsigned char *row, size_t i);
+unsigned thread_count(unsigned rows);
+void run_bands(void *work(void *), void *bands, size_t band_size,
+                                                        unsigned count);
+double sum_squared_diffs(const pnm_image *image1, const pnm_image *image2,
+                unsigned width, unsigned height, channel_stats *stats);
+void *diff_band_thread(void *cl);
+uint64_t row_squared_diffs_8(const unsigned char *row1,
+                                const unsigned char *row2, size_t samples);
+uint64_t row_squared_diffs_16(const unsigned char *row1,
+                                const unsigned char *row2, size_t samples);
+void kahan_add(double *sum, double *compensation, double val);
+void print_metrics(const pnm_image *image1, const pnm_image *image2,
+                                        unsigned width, unsigned height);
+void channel_ssim(const pnm_image *image1, const pnm_image *image2,
+                unsigned channel, unsigned width, unsigned height,
+                double *ssim, double *ms_ssim);
+bool ssim_means(const channel_view *view1, const channel_view *view2,
+                                                double *ssim, double *cs);
+void *ssim_band_thread(void *cl);
+void load_row(const channel_view *view, unsigned row, float *out);
+void filter_row(const float *in, const float *weights, float *out,
+                                                        unsigned out_width);
+float *downsample(const channel_view *view);
+bool write_heatmap(const char *path, const pnm_image *image1,
+                const pnm_image *image2, unsigned width, unsigned height);
+void print_value(const char *label, double value);
+
+int main(int argc, char *argv[])
 {
+        //read the options, then the two file names
+        bool metrics = false;
+        const char *heatmap_path = NULL;
+        int first = 1;
+        while (first < argc && strncmp(argv[first], "--", 2) == 0) {
+                if (strcmp(argv[first], "--metrics") == 0) {
+                        metrics = true;
+                } else if (strcmp(argv[first], "--heatmap") == 0 &&
+                                                        first + 1 < argc) {
+                        heatmap_path = argv[++first];
+                } else {
+                        break;
+                }
+                first++;
+        }
+
         //create file pointers and assert correct number of command line args
         FILE *input1fp = stdin;
         FILE *input2fp = stdin;
         int numIns = 2;
-        if (argc != 3) {
-                fprintf(stderr, "usage: ppmdiff [file1] [file2]");
+        if (argc - first != 2) {
+                fprintf(stderr, "usage: ppmdiff [--metrics] "
+                                "[--heatmap out.pgm] [file1] [file2]");
                 return EXIT_FAILURE;
         }
 
         //open the files
-        if (strcmp(argv[1], "-") != 0) {
-                input1fp = fopen(argv[1], "r");
+        if (strcmp(argv[first], "-") != 0) {
+                input1fp = fopen(argv[first], "rb");
                 assert(input1fp != NULL);
                 numIns--;
         }
-        if (strcmp(argv[2], "-") != 0) {
-                input2fp = fopen(argv[2], "r");
+        if (strcmp(argv[first + 1], "-") != 0) {
+                input2fp = fopen(argv[first + 1], "rb");
                 assert(input2fp != NULL);
                 numIns--;
         }
@@ -36,78 +213,910 @@ int main(int argc, char *argv[])
                 fprintf(stderr, "ONLY ONE ARG MAY BE STDIN");
                 return EXIT_FAILURE;
         }
-        
-        //turn files into Pnm_ppms
-        A2Methods_T methods = uarray2_methods_plain; 
-        Pnm_ppm input_image1 = Pnm_ppmread(input1fp, methods);
-        Pnm_ppm input_image2 = Pnm_ppmread(input2fp, methods);
+
+        //read both images straight into sample buffers
+        pnm_image *input_image1 = read_image(input1fp);
+        pnm_image *input_image2 = read_image(input2fp);
         fclose(input1fp);
         fclose(input2fp);
+        if (input_image1 == NULL || input_image2 == NULL) {
+                fprintf(stderr, "ppmdiff: input is not a PPM or PGM image\n");
+                return EXIT_FAILURE;
+        }
 
         //check width and height difference
-        int heightDiff = abs((int)
-                        input_image1->height - (int) input_image2->height);
-        int widthDiff = abs((int)
-                        input_image1->width - (int) input_image2->width);
+        long heightDiff = labs((long)
+                        input_image1->height - (long) input_image2->height);
+        long widthDiff = labs((long)
+                        input_image1->width - (long) input_image2->width);
         if (heightDiff > 1 || widthDiff > 1) {
                 fprintf(stderr, "INCOMPATABLE IMAGES");
                 fprintf(stdout, "1.0");
                 return EXIT_FAILURE;
         }
-        
+
         // set width and height to be traversed
-        int width = 0;
-        int height = 0;
-        float den = input_image1->denominator;
-        
-        if (input_image1->height < input_image2->height) {
-                height = input_image1->height;
+        unsigned width = input_image1->width < input_image2->width ?
+                                input_image1->width : input_image2->width;
+        unsigned height = input_image1->height < input_image2->height ?
+                                input_image1->height : input_image2->height;
+
+        if (metrics) {
+                print_metrics(input_image1, input_image2, width, height);
         } else {
-                height = input_image2->height;
+                /*
+                 * both images are scaled by the first one's denominator, so
+                 * the sum of squared integer differences is divided by its
+                 * square once
+                 */
+                double den = input_image1->denominator;
+                double sum = sum_squared_diffs(input_image1, input_image2,
+                                                        width, height, NULL);
+                sum = sum / (den * den * CHANNELS * (double) width *
+                                                        (double) height);
+                sum = sqrt(sum);
+                printf("%f%%\n", sum * 100);
+        }
+
+        bool ok = true;
+        if (heatmap_path != NULL) {
+                ok = write_heatmap(heatmap_path, input_image1, input_image2,
+                                                                width, height);
+        }
+
+        free_image(&input_image1);
+        free_image(&input_image2);
+
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+ * Name: read_image
+ * Purpose: read a PPM or PGM, raw (P6, P5) or plain (P3, P2), into memory
+ * Parameters: the file to read
+ * Returns: the image, or NULL if the file isn't a PPM or PGM or is cut short
+ * Notes: input must not be NULL. The caller frees the image with free_image
+ */
+pnm_image *read_image(FILE *input)
+{
+        assert(input != NULL);
+        if (getc(input) != 'P') {
+                return NULL;
+        }
+        int kind = getc(input);
+        unsigned channels = (kind == '6' || kind == '3') ? CHANNELS : 1;
+        if (kind != '6' && kind != '5' && kind != '3' && kind != '2') {
+                return NULL;
         }
 
-        if (input_image1->width < input_image2->width) {
-                width = input_image1->width;
+        pnm_image header;
+        if (!read_number(input, &header.width) ||
+            !read_number(input, &header.height) ||
+            !read_number(input, &header.denominator) ||
+            header.width == 0 || header.height == 0 ||
+            header.denominator == 0 ||
+            header.denominator > MAX_DENOMINATOR) {
+                return NULL;
+        }
+        header.sample_bytes = header.denominator > 255 ? 2 : 1;
+
+        pnm_image *image = malloc(sizeof(*image));
+        assert(image != NULL);
+        *image = header;
+        image->samples = malloc((size_t) image->width * image->height *
+                                        CHANNELS * image->sample_bytes);
+        assert(image->samples != NULL);
+
+        bool ok;
+        if (kind == '6' || kind == '5') {
+                /* exactly one whitespace byte separates header and raster */
+                ok = isspace(getc(input)) &&
+                                read_raw_samples(input, image, channels);
         } else {
-                width = input_image2->width;
+                ok = read_plain_samples(input, image, channels);
+        }
+        if (!ok) {
+                free_image(&image);
+        }
+        return image;
+}
+
+/*
+ * Name: read_number
+ * Purpose: read one decimal number from a PNM header
+ * Parameters: the file, where to store the number
+ * Returns: true on success, false at end of file, on anything but a number,
+ *          or if the number doesn't fit in 32 bits
+ * Notes: skips whitespace and '#' comments first, and stops on the byte just
+ *        after the number, without reading it
+ */
+bool read_number(FILE *input, unsigned *num)
+{
+        int c = getc(input);
+        while (isspace(c) || c == '#') {
+                if (c == '#') {
+                        while (c != '\n' && c != EOF) {
+                                c = getc(input);
+                        }
+                }
+                c = getc(input);
+        }
+        if (!isdigit(c)) {
+                return false;
+        }
+        uint64_t val = 0;
+        while (isdigit(c)) {
+                val = val * 10 + (c - '0');
+                if (val > UINT32_MAX) {
+                        return false;
+                }
+                c = getc(input);
+        }
+        ungetc(c, input);
+        *num = val;
+        return true;
+}
+
+/*
+ * Name: read_raw_samples
+ * Purpose: read the raster of a P6 or P5 into the image's samples
+ * Parameters: the file, positioned at the raster, the image, and the number of
+ *             channels in the file (3 for a PPM, 1 for a PGM)
+ * Returns: true on success, false if the file is cut short
+ * Notes: a PPM is read with a single fread. A PGM is read into the last third
+ *        of the buffer, and each gray sample is then spread to red, green and
+ *        blue from the front, which never overtakes the samples still unread
+ */
+bool read_raw_samples(FILE *input, pnm_image *image, unsigned channels)
+{
+        size_t sample_bytes = image->sample_bytes;
+        size_t pixels = (size_t) image->width * image->height;
+        size_t total = pixels * CHANNELS * sample_bytes;
+        size_t length = pixels * channels * sample_bytes;
+        unsigned char *dest = image->samples + (total - length);
+        if (fread(dest, 1, length, input) != length) {
+                return false;
+        }
+        if (channels == CHANNELS) {
+                return true;
+        }
+        for (size_t i = 0; i < pixels; i++) {
+                for (unsigned c = 0; c < CHANNELS; c++) {
+                        memmove(image->samples + (i * CHANNELS + c) *
+                                sample_bytes, dest + i * sample_bytes,
+                                sample_bytes);
+                }
+        }
+        return true;
+}
+
+/*
+ * Name: read_plain_samples
+ * Purpose: read the raster of a P3 or P2 into the image's samples
+ * Parameters: the file, positioned at the raster, the image, and the number of
+ *             channels in the file
+ * Returns: true on success, false if the file is cut short or holds a sample
+ *          above the denominator
+ * Notes: samples are stored big endian when they take two bytes, as in a raw
+ *        file
+ */
+bool read_plain_samples(FILE *input, pnm_image *image, unsigned channels)
+{
+        size_t pixels = (size_t) image->width * image->height;
+        unsigned char *dest = image->samples;
+        for (size_t i = 0; i < pixels; i++) {
+                unsigned pixel[CHANNELS];
+                for (unsigned c = 0; c < channels; c++) {
+                        if (!read_number(input, &pixel[c]) ||
+                                        pixel[c] > image->denominator) {
+                                return false;
+                        }
+                }
+                for (unsigned c = 0; c < CHANNELS; c++) {
+                        unsigned val = pixel[channels == CHANNELS ? c : 0];
+                        if (image->sample_bytes == 2) {
+                                *dest++ = val >> 8;
+                        }
+                        *dest++ = val & 0xff;
+                }
+        }
+        return true;
+}
+
+/*
+ * Name: free_image
+ * Purpose: free an image read by read_image
+ * Parameters: a pointer to the image
+ * Returns: none
+ * Notes: image and *image must not be NULL. Sets *image to NULL
+ */
+void free_image(pnm_image **image)
+{
+        assert(image != NULL && *image != NULL);
+        free((*image)->samples);
+        free(*image);
+        *image = NULL;
+}
+
+
+/*
+ * Name: sample
+ * Purpose: read one sample of a row
+ * Parameters: the image the row is from, the row, the index of the sample in
+ *             it (three per pixel)
+ * Returns: the sample
+ * Notes: none
+ */
+static inline unsigned sample(const pnm_image *image,
+                                const unsigned char *row, size_t i)
+{
+        if (image->sample_bytes == 2) {
+                return row[2 * i] << 8 | row[2 * i + 1];
+        }
+        return row[i];
+}
+
+/*
+ * Name: thread_count
+ * Purpose: decide how many threads to split some rows between
+ * Parameters: the number of rows
+ * Returns: one per online processor, but never more than MAX_THREADS or the
+ *          number of rows, and at least 1
+ * Notes: none
+ */
+unsigned thread_count(unsigned rows)
+{
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        unsigned threads = processors < 1 ? 1 : processors > MAX_THREADS ?
+                                        MAX_THREADS : (unsigned) processors;
+        threads = threads > rows ? rows : threads;
+        return threads == 0 ? 1 : threads;
+}
+
+/*
+ * Name: run_bands
+ * Purpose: run a function on every band in an array, each on its own thread
+ * Parameters: the function, the array of bands, the size of one band, and how
+ *             many there are
+ * Returns: none
+ * Notes: count must be at most MAX_THREADS. The first band runs on the calling
+ *        thread, as does any band whose thread can't be started. Returns once
+ *        every band is done
+ */
+void run_bands(void *work(void *), void *bands, size_t band_size,
+                                                        unsigned count)
+{
+        assert(count <= MAX_THREADS);
+        pthread_t ids[MAX_THREADS];
+        bool started[MAX_THREADS];
+        unsigned char *band = bands;
+        for (unsigned t = 0; t < count; t++) {
+                started[t] = t > 0 && pthread_create(&ids[t], NULL, work,
+                                                band + t * band_size) == 0;
         }
+        for (unsigned t = 0; t < count; t++) {
+                if (!started[t]) {
+                        work(band + t * band_size);
+                }
+        }
+        for (unsigned t = 0; t < count; t++) {
+                if (started[t]) {
+                        pthread_join(ids[t], NULL);
+                }
+        }
+}
 
-        ///traverse and keep the sum
-        Pnm_rgb curr_pixel_img1;
-        Pnm_rgb curr_pixel_img2;
-        float red1, red2, green1, green2, blue1, blue2 = 0;
-        float sum = 0;
-        for (int i = 0; i < width; i++) {
-                for (int j = 0; j < height; j++) {
-                        curr_pixel_img1 =
-                          input_image1->methods->at(input_image1->pixels, i, j);
-                        curr_pixel_img2 =
-                          input_image2->methods->at(input_image2->pixels, i, j);
-                        
-                        red1 = (float) curr_pixel_img1->red / den;
-                        red2 = (float) curr_pixel_img2->red / den;
-                        green1 = (float) curr_pixel_img1->green / den;
-                        green2 = (float) curr_pixel_img2->green / den;
-                        blue1 = (float) curr_pixel_img1->blue / den;
-                        blue2 = (float) curr_pixel_img2->blue / den;
+/*
+ * Name: sum_squared_diffs
+ * Purpose: add up the squared differences of every sample of two images,
+ *          over the width and height they share
+ * Parameters: the two images, the width and height to compare, and where to
+ *             store each channel's error (NULL if it isn't wanted)
+ * Returns: the sum, in units of the samples themselves
+ * Notes: the rows are split into one contiguous band per thread. Without
+ *        stats the fast whole-row kernels are used; with them each channel
+ *        is counted separately
+ */
+double sum_squared_diffs(const pnm_image *image1, const pnm_image *image2,
+                unsigned width, unsigned height, channel_stats *stats)
+{
+        unsigned threads = thread_count(height);
+        diff_band bands[MAX_THREADS];
+        for (unsigned t = 0; t < threads; t++) {
+                bands[t] = (diff_band) {
+                        .image1 = image1, .image2 = image2, .width = width,
+                        .first_row = (uint64_t) height * t / threads,
+                        .end_row = (uint64_t) height * (t + 1) / threads,
+                        .sum = 0, .compensation = 0,
+                        .per_channel = stats != NULL
+                };
+        }
+        run_bands(diff_band_thread, bands, sizeof(bands[0]), threads);
 
-                        sum += square(red1 - red2) + square(green1 - green2) +
-                                                        square(blue1 - blue2);
+        double sum = 0, compensation = 0;
+        double channel_compensation[CHANNELS] = {0, 0, 0};
+        if (stats != NULL) {
+                *stats = (channel_stats) {{0, 0, 0}, {0, 0, 0}};
+        }
+        for (unsigned t = 0; t < threads; t++) {
+                kahan_add(&sum, &compensation, bands[t].sum);
+                for (unsigned c = 0; stats != NULL && c < CHANNELS; c++) {
+                        kahan_add(&stats->sum_squares[c],
+                                        &channel_compensation[c],
+                                        bands[t].stats.sum_squares[c]);
+                        if (bands[t].stats.max_diff[c] > stats->max_diff[c]) {
+                                stats->max_diff[c] =
+                                                bands[t].stats.max_diff[c];
+                        }
                 }
         }
+        return sum;
+}
 
-        sum = sum / ((float) 3 * (float) width * (float) height);
-        sum = sqrt(sum);
-        printf("%f%%\n", sum * 100);
-        
-        Pnm_ppmfree(&input_image1);
-        Pnm_ppmfree(&input_image2);
+/*
+ * Name: diff_band_thread
+ * Purpose: add up the squared differences of one band of rows
+ * Parameters: the band (a diff_band)
+ * Returns: NULL
+ * Notes: each row is summed exactly in integers and then added to the band's
+ *        Kahan sum. Rows are read in order, so both buffers are streamed
+ *        through once
+ */
+void *diff_band_thread(void *cl)
+{
+        diff_band *band = cl;
+        const pnm_image *image1 = band->image1, *image2 = band->image2;
+        size_t samples = (size_t) band->width * CHANNELS;
+        size_t stride1 = (size_t) image1->width * CHANNELS *
+                                                        image1->sample_bytes;
+        size_t stride2 = (size_t) image2->width * CHANNELS *
+                                                        image2->sample_bytes;
+        bool narrow = image1->sample_bytes == 1 && image2->sample_bytes == 1;
+        bool wide = image1->sample_bytes == 2 && image2->sample_bytes == 2;
+        band->stats = (channel_stats) {{0, 0, 0}, {0, 0, 0}};
+        for (unsigned c = 0; c < CHANNELS; c++) {
+                band->channel_compensation[c] = 0;
+        }
 
-        return EXIT_SUCCESS;
+        for (unsigned row = band->first_row; row < band->end_row; row++) {
+                const unsigned char *row1 = image1->samples + row * stride1;
+                const unsigned char *row2 = image2->samples + row * stride2;
+                uint64_t row_sum = 0;
+                if (band->per_channel) {
+                        uint64_t channel_sums[CHANNELS] = {0, 0, 0};
+                        for (size_t i = 0; i < samples; i++) {
+                                int64_t d = (int64_t) sample(image1, row1, i) -
+                                                sample(image2, row2, i);
+                                unsigned diff = d < 0 ? -d : d;
+                                channel_sums[i % CHANNELS] += d * d;
+                                if (diff > band->stats.max_diff[i % CHANNELS]) {
+                                        band->stats.max_diff[i % CHANNELS] =
+                                                                        diff;
+                                }
+                        }
+                        for (unsigned c = 0; c < CHANNELS; c++) {
+                                kahan_add(&band->stats.sum_squares[c],
+                                        &band->channel_compensation[c],
+                                        channel_sums[c]);
+                                row_sum += channel_sums[c];
+                        }
+                } else if (narrow) {
+                        row_sum = row_squared_diffs_8(row1, row2, samples);
+                } else if (wide) {
+                        row_sum = row_squared_diffs_16(row1, row2, samples);
+                } else {
+                        for (size_t i = 0; i < samples; i++) {
+                                int64_t d = (int64_t) sample(image1, row1, i) -
+                                                sample(image2, row2, i);
+                                row_sum += d * d;
+                        }
+                }
+                kahan_add(&band->sum, &band->compensation, row_sum);
+        }
+        return NULL;
 }
 
+/*
+ * Name: row_squared_diffs_8
+ * Purpose: add up the squared differences of one row of one byte samples
+ * Parameters: the two rows, the number of samples in them
+ * Returns: the exact sum
+ * Notes: with SSE2, 16 samples are widened to 16 bits, subtracted, and
+ *        squared and added in pairs by one multiply-add. Each 32 bit lane then
+ *        gets at most 2 * 255^2 per step, so lanes are flushed to 64 bits
+ *        every FLUSH_STEPS steps, well before they could overflow
+ */
+uint64_t row_squared_diffs_8(const unsigned char *row1,
+                                const unsigned char *row2, size_t samples)
+{
+        uint64_t sum = 0;
+        size_t i = 0;
+#if defined(__SSE2__)
+#define FLUSH_STEPS 4096
+        const __m128i zero = _mm_setzero_si128();
+        while (samples - i >= 16) {
+                __m128i lanes = zero;
+                for (unsigned step = 0; step < FLUSH_STEPS &&
+                                        samples - i >= 16; step++, i += 16) {
+                        __m128i a = _mm_loadu_si128((const __m128i *)
+                                                                (row1 + i));
+                        __m128i b = _mm_loadu_si128((const __m128i *)
+                                                                (row2 + i));
+                        __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(a, zero),
+                                                _mm_unpacklo_epi8(b, zero));
+                        __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(a, zero),
+                                                _mm_unpackhi_epi8(b, zero));
+                        lanes = _mm_add_epi32(lanes, _mm_madd_epi16(lo, lo));
+                        lanes = _mm_add_epi32(lanes, _mm_madd_epi16(hi, hi));
+                }
+                uint32_t lane[4];
+                _mm_storeu_si128((__m128i *) lane, lanes);
+                sum += (uint64_t) lane[0] + lane[1] + lane[2] + lane[3];
+        }
+#endif
+        for (; i < samples; i++) {
+                int d = row1[i] - row2[i];
+                sum += d * d;
+        }
+        return sum;
+}
+
+/*
+ * Name: row_squared_diffs_16
+ * Purpose: add up the squared differences of one row of two byte (big endian)
+ *          samples
+ * Parameters: the two rows, the number of samples in them
+ * Returns: the exact sum
+ * Notes: a square can take 32 bits, so the sum is kept in 64
+ */
+uint64_t row_squared_diffs_16(const unsigned char *row1,
+                                const unsigned char *row2, size_t samples)
+{
+        uint64_t sum = 0;
+        for (size_t i = 0; i < samples; i++) {
+                int64_t d = (int64_t) (row1[2 * i] << 8 | row1[2 * i + 1]) -
+                                (int64_t) (row2[2 * i] << 8 | row2[2 * i + 1]);
+                sum += d * d;
+        }
+        return sum;
+}
+
+/*
+ * Name: kahan_add
+ * Purpose: add a value to a running sum, carrying the rounding error forward
+ * Parameters: the sum, its compensation, the value to add
+ * Returns: none
+ * Notes: none
+ */
+void kahan_add(double *sum, double *compensation, double val)
+{
+        double y = val - *compensation;
+        double t = *sum + y;
+        *compensation = (t - *sum) - y;
+        *sum = t;
+}
+
+/*
+ * Name: print_metrics
+ * Purpose: print the --metrics table: RMS error, PSNR, largest error, SSIM and
+ *          MS-SSIM of each channel, and of all three together
+ * Parameters: the two images, the width and height to compare
+ * Returns: none
+ * Notes: like the plain output, both images are scaled by the first one's
+ *        denominator. RMS error is a percentage of it, the largest error is in
+ *        samples. The "all" SSIM and MS-SSIM are the mean of the channels'.
+ *        A similarity the image is too small for is printed as n/a (SSIM
+ *        needs 11x11 pixels, MS-SSIM 176x176)
+ */
+void print_metrics(const pnm_image *image1, const pnm_image *image2,
+                                        unsigned width, unsigned height)
+{
+        channel_stats stats;
+        double sum = sum_squared_diffs(image1, image2, width, height, &stats);
+        double ssim[CHANNELS + 1], ms_ssim[CHANNELS + 1];
+        ssim[CHANNELS] = 0;
+        ms_ssim[CHANNELS] = 0;
+        unsigned all_max = 0;
+        for (unsigned c = 0; c < CHANNELS; c++) {
+                channel_ssim(image1, image2, c, width, height, &ssim[c],
+                                                                &ms_ssim[c]);
+                ssim[CHANNELS] += ssim[c] / CHANNELS;
+                ms_ssim[CHANNELS] += ms_ssim[c] / CHANNELS;
+                all_max = stats.max_diff[c] > all_max ? stats.max_diff[c] :
+                                                                all_max;
+        }
+
+        const char *names[CHANNELS + 1] = {"red", "green", "blue", "all"};
+        double pixels = (double) width * height;
+        for (unsigned c = 0; c <= CHANNELS; c++) {
+                double squares = c < CHANNELS ? stats.sum_squares[c] : sum;
+                double samples = c < CHANNELS ? pixels : pixels * CHANNELS;
+                double rms = sqrt(squares / samples) / image1->denominator;
+                printf("%-6s rms %f%%  psnr %.2f dB  max %u", names[c],
+                        rms * 100, -20 * log10(rms),
+                        c < CHANNELS ? stats.max_diff[c] : all_max);
+                print_value("ssim", ssim[c]);
+                print_value("ms-ssim", ms_ssim[c]);
+                printf("\n");
+        }
+}
+
+/*
+ * Name: channel_ssim
+ * Purpose: measure the SSIM and MS-SSIM of one channel of two images
+ * Parameters: the two images, the channel (0 red, 1 green, 2 blue), the width
+ *             and height to compare, where to store the SSIM and the MS-SSIM
+ * Returns: none
+ * Notes: either result is NAN if the image is too small for it. MS-SSIM is
+ *        the product over five scales of the mean contrast and structure term
+ *        (the full SSIM at the last scale), each raised to its weight from
+ *        Wang, Simoncelli and Bovik, with a 2x2 average between scales. The
+ *        first scale's SSIM is the single-scale SSIM, so it is only measured
+ *        once
+ */
+void channel_ssim(const pnm_image *image1, const pnm_image *image2,
+                unsigned channel, unsigned width, unsigned height,
+                double *ssim, double *ms_ssim)
+{
+        static const double weights[MS_SSIM_SCALES] = {
+                0.0448, 0.2856, 0.3001, 0.2363, 0.1333
+        };
+        channel_view view1 = {
+                .image = image1, .channel = channel, .plane = NULL,
+                .width = width, .height = height,
+                .scale = 1.0f / image1->denominator
+        };
+        channel_view view2 = view1;
+        view2.image = image2;
+        float *plane1 = NULL, *plane2 = NULL;
+
+        *ssim = NAN;
+        *ms_ssim = NAN;
+        double product = 1;
+        for (unsigned scale = 0; scale < MS_SSIM_SCALES; scale++) {
+                double scale_ssim, cs;
+                if (!ssim_means(&view1, &view2, &scale_ssim, &cs)) {
+                        break;
+                }
+                if (scale == 0) {
+                        *ssim = scale_ssim;
+                }
+                double val = scale + 1 == MS_SSIM_SCALES ? scale_ssim : cs;
+                product *= pow(val > 0 ? val : 0, weights[scale]);
+                if (scale + 1 == MS_SSIM_SCALES) {
+                        *ms_ssim = product;
+                        break;
+                }
+
+                /* the next scale is read from the one just measured */
+                float *next1 = downsample(&view1);
+                float *next2 = downsample(&view2);
+                free(plane1);
+                free(plane2);
+                plane1 = next1;
+                plane2 = next2;
+                view1 = (channel_view) {
+                        .image = NULL, .channel = 0, .plane = plane1,
+                        .width = view1.width / 2, .height = view1.height / 2,
+                        .scale = 1
+                };
+                view2 = view1;
+                view2.plane = plane2;
+        }
+        free(plane1);
+        free(plane2);
+}
+
+/*
+ * Name: ssim_means
+ * Purpose: measure the mean SSIM, and the mean of its contrast and structure
+ *          term, of one channel of two images at one scale
+ * Parameters: the two channels, where to store the mean SSIM and mean cs
+ * Returns: true on success, false if the channels are smaller than the window
+ * Notes: the two channels must be the same size and their samples between 0
+ *        and 1. Only windows that fit inside the image are counted. Their rows
+ *        are split into one band per thread
+ */
+bool ssim_means(const channel_view *view1, const channel_view *view2,
+                                                double *ssim, double *cs)
+{
+        assert(view1->width == view2->width);
+        assert(view1->height == view2->height);
+        if (view1->width < SSIM_WINDOW || view1->height < SSIM_WINDOW) {
+                return false;
+        }
+
+        float weights[SSIM_WINDOW];
+        float total = 0;
+        for (int k = 0; k < SSIM_WINDOW; k++) {
+                int offset = k - SSIM_RADIUS;
+                weights[k] = exp(-offset * offset /
+                                        (2 * SSIM_SIGMA * SSIM_SIGMA));
+                total += weights[k];
+        }
+        for (int k = 0; k < SSIM_WINDOW; k++) {
+                weights[k] /= total;
+        }
+
+        unsigned rows = view1->height - 2 * SSIM_RADIUS;
+        unsigned threads = thread_count(rows);
+        ssim_band bands[MAX_THREADS];
+        for (unsigned t = 0; t < threads; t++) {
+                bands[t] = (ssim_band) {
+                        .view1 = view1, .view2 = view2, .weights = weights,
+                        .c1 = SSIM_K1 * SSIM_K1, .c2 = SSIM_K2 * SSIM_K2,
+                        .first_row = (uint64_t) rows * t / threads,
+                        .end_row = (uint64_t) rows * (t + 1) / threads,
+                        .ssim_sum = 0, .ssim_compensation = 0,
+                        .cs_sum = 0, .cs_compensation = 0
+                };
+        }
+        run_bands(ssim_band_thread, bands, sizeof(bands[0]), threads);
+
+        double ssim_sum = 0, ssim_compensation = 0;
+        double cs_sum = 0, cs_compensation = 0;
+        for (unsigned t = 0; t < threads; t++) {
+                kahan_add(&ssim_sum, &ssim_compensation, bands[t].ssim_sum);
+                kahan_add(&cs_sum, &cs_compensation, bands[t].cs_sum);
+        }
+        double windows = (double) rows * (view1->width - 2 * SSIM_RADIUS);
+        *ssim = ssim_sum / windows;
+        *cs = cs_sum / windows;
+        return true;
+}
+
+/*
+ * Name: ssim_band_thread
+ * Purpose: add up SSIM and cs over one band of window rows
+ * Parameters: the band (an ssim_band)
+ * Returns: NULL
+ * Notes: the Gaussian window is separable. Each image row is read once,
+ *        filtered across into its five statistics (x, y, x^2, y^2 and xy), and
+ *        kept in a ring of the last SSIM_WINDOW rows, which is then filtered
+ *        down to give one row of windows. Both filters are plain loops over
+ *        contiguous floats, which the compiler vectorizes
+ */
+void *ssim_band_thread(void *cl)
+{
+        ssim_band *band = cl;
+        unsigned width = band->view1->width;
+        size_t out_width = width - 2 * SSIM_RADIUS;
+        size_t stats_width = SSIM_STATS * out_width;
+        float *inputs = malloc(SSIM_STATS * width * sizeof(float));
+        float *ring = malloc(SSIM_WINDOW * stats_width * sizeof(float));
+        float *sums = malloc(stats_width * sizeof(float));
+        assert(inputs != NULL && ring != NULL && sums != NULL);
+        float *x = inputs, *y = inputs + width, *xx = inputs + 2 * width;
+        float *yy = inputs + 3 * width, *xy = inputs + 4 * width;
+
+        for (unsigned row = band->first_row;
+                        row < band->end_row + 2 * SSIM_RADIUS; row++) {
+                load_row(band->view1, row, x);
+                load_row(band->view2, row, y);
+                for (unsigned i = 0; i < width; i++) {
+                        xx[i] = x[i] * x[i];
+                        yy[i] = y[i] * y[i];
+                        xy[i] = x[i] * y[i];
+                }
+                float *slot = ring + (row % SSIM_WINDOW) * stats_width;
+                for (unsigned q = 0; q < SSIM_STATS; q++) {
+                        filter_row(inputs + q * width, band->weights,
+                                        slot + q * out_width, out_width);
+                }
+                if (row < band->first_row + 2 * SSIM_RADIUS) {
+                        continue;
+                }
+
+                /* the ring now holds every row of this row of windows */
+                unsigned top = row - 2 * SSIM_RADIUS;
+                memset(sums, 0, stats_width * sizeof(float));
+                for (unsigned k = 0; k < SSIM_WINDOW; k++) {
+                        const float *src = ring + ((top + k) % SSIM_WINDOW) *
+                                                                stats_width;
+                        float weight = band->weights[k];
+                        for (size_t i = 0; i < stats_width; i++) {
+                                sums[i] += weight * src[i];
+                        }
+                }
+                double row_ssim = 0, row_cs = 0;
+                for (size_t i = 0; i < out_width; i++) {
+                        float mu1 = sums[i], mu2 = sums[out_width + i];
+                        float var1 = sums[2 * out_width + i] - mu1 * mu1;
+                        float var2 = sums[3 * out_width + i] - mu2 * mu2;
+                        float covar = sums[4 * out_width + i] - mu1 * mu2;
+                        float cs = (2 * covar + band->c2) /
+                                                (var1 + var2 + band->c2);
+                        float luminance = (2 * mu1 * mu2 + band->c1) /
+                                        (mu1 * mu1 + mu2 * mu2 + band->c1);
+                        row_ssim += luminance * cs;
+                        row_cs += cs;
+                }
+                kahan_add(&band->ssim_sum, &band->ssim_compensation, row_ssim);
+                kahan_add(&band->cs_sum, &band->cs_compensation, row_cs);
+        }
+
+        free(inputs);
+        free(ring);
+        free(sums);
+        return NULL;
+}
+
+/*
+ * Name: load_row
+ * Purpose: read one row of a channel as floats between 0 and 1
+ * Parameters: the channel, the row, where to store its width floats
+ * Returns: none
+ * Notes: none
+ */
+void load_row(const channel_view *view, unsigned row, float *out)
+{
+        if (view->image == NULL) {
+                memcpy(out, view->plane + (size_t) row * view->width,
+                                                view->width * sizeof(float));
+                return;
+        }
+        const pnm_image *image = view->image;
+        const unsigned char *samples = image->samples + (size_t) row *
+                        image->width * CHANNELS * image->sample_bytes;
+        for (unsigned col = 0; col < view->width; col++) {
+                out[col] = sample(image, samples, (size_t) col * CHANNELS +
+                                                view->channel) * view->scale;
+        }
+}
+
+/*
+ * Name: filter_row
+ * Purpose: filter a row across with the SSIM window
+ * Parameters: the row, the window's weights, where to store the result and
+ *             its width (the row's width less the window's, plus one)
+ * Returns: none
+ * Notes: written tap by tap over the whole row so that the inner loop is a
+ *        vectorizable multiply-add over contiguous floats
+ */
+void filter_row(const float *restrict in, const float *weights,
+                                float *restrict out, unsigned out_width)
+{
+        for (unsigned i = 0; i < out_width; i++) {
+                out[i] = 0;
+        }
+        for (unsigned k = 0; k < SSIM_WINDOW; k++) {
+                float weight = weights[k];
+                const float *src = in + k;
+                for (unsigned i = 0; i < out_width; i++) {
+                        out[i] += weight * src[i];
+                }
+        }
+}
+
+/*
+ * Name: downsample
+ * Purpose: halve a channel's width and height for the next MS-SSIM scale
+ * Parameters: the channel
+ * Returns: a plane of floats, each the average of a 2x2 block of the channel
+ * Notes: an odd last row or column is dropped. The caller frees the plane
+ */
+float *downsample(const channel_view *view)
+{
+        unsigned width = view->width / 2, height = view->height / 2;
+        float *plane = malloc((size_t) width * height * sizeof(float));
+        float *top = malloc(view->width * sizeof(float));
+        float *bottom = malloc(view->width * sizeof(float));
+        assert(plane != NULL && top != NULL && bottom != NULL);
+        for (unsigned row = 0; row < height; row++) {
+                load_row(view, 2 * row, top);
+                load_row(view, 2 * row + 1, bottom);
+                float *out = plane + (size_t) row * width;
+                for (unsigned col = 0; col < width; col++) {
+                        out[col] = (top[2 * col] + top[2 * col + 1] +
+                                bottom[2 * col] + bottom[2 * col + 1]) / 4;
+                }
+        }
+        free(top);
+        free(bottom);
+        return plane;
+}
+
+/*
+ * Name: write_heatmap
+ * Purpose: write the RMS error of every 2x2 block of pixels as a PGM
+ * Parameters: the file to write, the two images, the width and height to
+ *             compare
+ * Returns: true on success, false (after printing why) if the images are
+ *          smaller than one block or the file can't be written
+ * Notes: each PGM pixel is the RMS of the block's twelve sample differences,
+ *        in samples of the first image, which also gives the PGM its
+ *        denominator. An odd last row or column is left out
+ */
+bool write_heatmap(const char *path, const pnm_image *image1,
+                const pnm_image *image2, unsigned width, unsigned height)
+{
+        unsigned map_width = width / HEATMAP_BLOCK;
+        unsigned map_height = height / HEATMAP_BLOCK;
+        if (map_width == 0 || map_height == 0) {
+                fprintf(stderr, "ppmdiff: images are too small for a "
+                                                                "heatmap\n");
+                return false;
+        }
+        FILE *output = fopen(path, "wb");
+        if (output == NULL) {
+                perror(path);
+                return false;
+        }
+
+        unsigned den = image1->denominator;
+        unsigned out_bytes = den > 255 ? 2 : 1;
+        unsigned char *out = malloc((size_t) map_width * out_bytes);
+        assert(out != NULL);
+        size_t stride1 = (size_t) image1->width * CHANNELS *
+                                                        image1->sample_bytes;
+        size_t stride2 = (size_t) image2->width * CHANNELS *
+                                                        image2->sample_bytes;
+        fprintf(output, "P5\n%u %u\n%u\n", map_width, map_height, den);
+        for (unsigned row = 0; row < map_height; row++) {
+                for (unsigned col = 0; col < map_width; col++) {
+                        uint64_t squares = 0;
+                        for (unsigned dy = 0; dy < HEATMAP_BLOCK; dy++) {
+                                size_t r = (size_t) row * HEATMAP_BLOCK + dy;
+                                const unsigned char *row1 = image1->samples +
+                                                                r * stride1;
+                                const unsigned char *row2 = image2->samples +
+                                                                r * stride2;
+                                size_t first = (size_t) col * HEATMAP_BLOCK *
+                                                                CHANNELS;
+                                for (size_t i = first; i < first +
+                                        HEATMAP_BLOCK * CHANNELS; i++) {
+                                        int64_t d = (int64_t) sample(image1,
+                                                row1, i) - sample(image2,
+                                                row2, i);
+                                        squares += d * d;
+                                }
+                        }
+                        unsigned val = round(sqrt(squares / (double)
+                                (HEATMAP_BLOCK * HEATMAP_BLOCK * CHANNELS)));
+                        val = val > den ? den : val;
+                        if (out_bytes == 2) {
+                                out[2 * col] = val >> 8;
+                                out[2 * col + 1] = val & 0xff;
+                        } else {
+                                out[col] = val;
+                        }
+                }
+                fwrite(out, out_bytes, map_width, output);
+        }
+        free(out);
+
+        bool ok = !ferror(output);
+        ok = (fclose(output) == 0) && ok;
+        if (!ok) {
+                perror(path);
+        }
+        return ok;
+}
+
+/*
+ * Name: print_value
+ * Purpose: print one labelled similarity of the --metrics table
+ * Parameters: the label, the value (NAN if it couldn't be measured)
+ * Returns: none
+ * Notes: none
+ */
+void print_value(const char *label, double value)
+{
+        if (isnan(value)) {
+                printf("  %s n/a", label);
+        } else {
+                printf("  %s %.6f", label, value);
+        }
+}
 
-//quick LIL square function cs11 ya know what I'm SAYINNNN
-float square (float num) {
-        return num * num;
-}
\ No newline at end of file
+#undef CHANNELS
+#undef MAX_THREADS
+#undef MAX_DENOMINATOR
+#undef SSIM_RADIUS
+#undef SSIM_WINDOW
+#undef SSIM_SIGMA
+#undef SSIM_K1
+#undef SSIM_K2
+#undef SSIM_STATS
+#undef MS_SSIM_SCALES
+#undef HEATMAP_BLOCK
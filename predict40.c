@@ -0,0 +1,215 @@
+/**************************************************************
+ *
+ *                     predict40.c
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  Implementation of the MED (median edge detector)
+ *               prediction of a, Pb and Pr across the blocks of
+ *               a tile, and of its inverse.
+ *
+ **************************************************************/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+#include "predict40.h"
+
+#define BYTES_PER_WORD 4
+#define NUM_PREDICTED 3
+
+/* Width and lsb of a, Pb and Pr in a codeword */
+static const unsigned field_width[NUM_PREDICTED] = {6, 4, 4};
+static const unsigned field_lsb[NUM_PREDICTED] = {26, 4, 0};
+
+/* Helper functions */
+uint32_t get_word(const unsigned char *words, unsigned cols, unsigned col,
+                                                                unsigned row);
+void put_word(unsigned char *words, unsigned cols, unsigned col, unsigned row,
+                                                                uint32_t word);
+uint32_t predict_word(const unsigned char *words, unsigned cols, unsigned col,
+                                                                unsigned row);
+unsigned med(unsigned left, unsigned above, unsigned above_left);
+unsigned get_field(uint32_t word, unsigned f);
+uint32_t set_field(uint32_t word, unsigned f, unsigned val);
+
+/*
+ * Name: predict40_residuals
+ * Purpose: replace a, Pb and Pr in every codeword of a tile by the residual
+ *          from its prediction
+ * Parameters: the tile's big endian codewords (row major), and the number of
+ *             blocks across and down the tile
+ * Returns: none
+ * Notes: words must not be NULL. Works from the last block back to the first,
+ *        so every prediction is made from neighbours that still hold their
+ *        original values
+ */
+void predict40_residuals(unsigned char *words, unsigned cols, unsigned rows)
+{
+        assert(words != NULL);
+        for (unsigned row = rows; row-- > 0; ) {
+                for (unsigned col = cols; col-- > 0; ) {
+                        uint32_t word = get_word(words, cols, col, row);
+                        uint32_t prediction = predict_word(words, cols, col,
+                                                                        row);
+                        for (unsigned f = 0; f < NUM_PREDICTED; f++) {
+                                word = set_field(word, f, get_field(word, f)
+                                                - get_field(prediction, f));
+                        }
+                        put_word(words, cols, col, row, word);
+                }
+        }
+}
+
+/*
+ * Name: predict40_restore
+ * Purpose: undo predict40_residuals
+ * Parameters: the tile's big endian codewords holding residuals (row major),
+ *             and the number of blocks across and down the tile
+ * Returns: none
+ * Notes: words must not be NULL. Works from the first block on, so every
+ *        prediction is made from neighbours that are already restored
+ */
+void predict40_restore(unsigned char *words, unsigned cols, unsigned rows)
+{
+        assert(words != NULL);
+        for (unsigned row = 0; row < rows; row++) {
+                for (unsigned col = 0; col < cols; col++) {
+                        uint32_t word = get_word(words, cols, col, row);
+                        uint32_t prediction = predict_word(words, cols, col,
+                                                                        row);
+                        for (unsigned f = 0; f < NUM_PREDICTED; f++) {
+                                word = set_field(word, f, get_field(word, f)
+                                                + get_field(prediction, f));
+                        }
+                        put_word(words, cols, col, row, word);
+                }
+        }
+}
+
+/*
+ * Name: predict_word
+ * Purpose: predict a, Pb and Pr of one block from its neighbours in the tile
+ * Parameters: the tile's codewords, the number of blocks across the tile, the
+ *             column and row of the block
+ * Returns: a codeword holding the predictions in the a, Pb and Pr fields (and
+ *          0 everywhere else)
+ * Notes: the first row predicts from the left, the first column from above,
+ *        and the first block predicts 0
+ */
+uint32_t predict_word(const unsigned char *words, unsigned cols, unsigned col,
+                                                                unsigned row)
+{
+        if (col == 0 && row == 0) {
+                return 0;
+        }
+        uint32_t left = col > 0 ? get_word(words, cols, col - 1, row) : 0;
+        uint32_t above = row > 0 ? get_word(words, cols, col, row - 1) : 0;
+        uint32_t above_left = col > 0 && row > 0 ?
+                                get_word(words, cols, col - 1, row - 1) : 0;
+
+        uint32_t prediction = 0;
+        for (unsigned f = 0; f < NUM_PREDICTED; f++) {
+                unsigned guess;
+                if (row == 0) {
+                        guess = get_field(left, f);
+                } else if (col == 0) {
+                        guess = get_field(above, f);
+                } else {
+                        guess = med(get_field(left, f), get_field(above, f),
+                                                get_field(above_left, f));
+                }
+                prediction = set_field(prediction, f, guess);
+        }
+        return prediction;
+}
+
+/*
+ * Name: med
+ * Purpose: the median edge detector (LOCO-I) prediction
+ * Parameters: the values to the left, above and above left
+ * Returns: the smaller of left and above if above left is at least both (an
+ *          edge), the larger if it is at most both, and the planar guess
+ *          left + above - above left otherwise
+ * Notes: the planar guess always lies between left and above, so it stays in
+ *        the field's range
+ */
+unsigned med(unsigned left, unsigned above, unsigned above_left)
+{
+        unsigned low = left < above ? left : above;
+        unsigned high = left < above ? above : left;
+        if (above_left >= high) {
+                return low;
+        }
+        if (above_left <= low) {
+                return high;
+        }
+        return left + above - above_left;
+}
+
+/*
+ * Name: get_field
+ * Purpose: get one of the predicted fields out of a codeword
+ * Parameters: the codeword, which predicted field (0 for a, 1 for Pb, 2 for Pr)
+ * Returns: the field's value
+ * Notes: none
+ */
+unsigned get_field(uint32_t word, unsigned f)
+{
+        return (word >> field_lsb[f]) & ((1u << field_width[f]) - 1);
+}
+
+/*
+ * Name: set_field
+ * Purpose: replace one of the predicted fields of a codeword
+ * Parameters: the codeword, which predicted field, the new value (only its
+ *             low bits are kept, so differences wrap around the field size)
+ * Returns: the new codeword
+ * Notes: none
+ */
+uint32_t set_field(uint32_t word, unsigned f, unsigned val)
+{
+        uint32_t mask = ((1u << field_width[f]) - 1) << field_lsb[f];
+        return (word & ~mask) | (((uint32_t) val << field_lsb[f]) & mask);
+}
+
+/*
+ * Name: get_word
+ * Purpose: read one big endian codeword of a tile
+ * Parameters: the codewords, the number of blocks across the tile, the column
+ *             and row of the block
+ * Returns: the codeword
+ * Notes: none
+ */
+uint32_t get_word(const unsigned char *words, unsigned cols, unsigned col,
+                                                                unsigned row)
+{
+        const unsigned char *curr = words + ((size_t) row * cols + col) *
+                                                                BYTES_PER_WORD;
+        return (uint32_t) curr[0] << 24 | (uint32_t) curr[1] << 16 |
+                                        (uint32_t) curr[2] << 8 | curr[3];
+}
+
+/*
+ * Name: put_word
+ * Purpose: write one big endian codeword of a tile
+ * Parameters: the codewords, the number of blocks across the tile, the column
+ *             and row of the block, the codeword
+ * Returns: none
+ * Notes: none
+ */
+void put_word(unsigned char *words, unsigned cols, unsigned col, unsigned row,
+                                                                uint32_t word)
+{
+        unsigned char *curr = words + ((size_t) row * cols + col) *
+                                                                BYTES_PER_WORD;
+        curr[0] = word >> 24;
+        curr[1] = word >> 16;
+        curr[2] = word >> 8;
+        curr[3] = word;
+}
+
+#undef BYTES_PER_WORD
+#undef NUM_PREDICTED
@@ -0,0 +1,27 @@
+/**************************************************************
+ *
+ *                     predict40.h
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  Interface for the spatial predictor used by
+ *               tiles with coding 2 (COMP40_CODING_RANS_MED).
+ *               The a, Pb and Pr fields of each codeword are
+ *               replaced by their difference (mod the field size)
+ *               from a MED prediction made from the blocks to the
+ *               left, above and above left. Predictions never
+ *               look outside the tile, so tiles still decode on
+ *               their own and in parallel. b, c and d are left
+ *               alone, since they already cluster around 0.
+ *
+ **************************************************************/
+
+#ifndef PREDICT40_INCLUDED
+#define PREDICT40_INCLUDED
+
+void predict40_residuals(unsigned char *words, unsigned cols, unsigned rows);
+void predict40_restore(unsigned char *words, unsigned cols, unsigned rows);
+
+#endif
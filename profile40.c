@@ -0,0 +1,403 @@
+/**************************************************************
+ *
+ *                     profile40.c
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  Implementation of the codeword profiles and the
+ *               kernels that pack, unpack, quantize and
+ *               unquantize codewords for each of them.
+ *
+ **************************************************************/
+
+#include <math.h>
+#include <stddef.h>
+#include <assert.h>
+#include <arith40.h>
+#include "profile40.h"
+
+/*
+ * Every profile, in number order: its number and name, bytes per codeword, the
+ * widths of a, of b, c and d, and of Pb and Pr, and the scales a and b, c, d
+ * are quantized with. The scales are written the way the original quantizer
+ * wrote them, to keep the standard profile bit for bit the same
+ */
+#define PROFILE40_LIST(X) \
+        X(PROFILE40_STANDARD, standard, 4, 6, 6, 4, 63, 103.3) \
+        X(PROFILE40_FINE, fine, 8, 10, 10, 12, 1023, 1703.3)
+
+/* the only chroma width with a table in the Arith40 interface */
+#define ARITH40_CHROMA_WIDTH 4
+
+/* Helper functions */
+static inline bool pack_fields(unsigned width_a, unsigned width_bcd,
+                unsigned width_chroma, const comp_avg_ints *ints,
+                uint64_t *word);
+static inline void unpack_fields(unsigned width_a, unsigned width_bcd,
+                unsigned width_chroma, uint64_t word, comp_avg_ints *ints);
+static inline void quantize_fields(unsigned width_a, unsigned width_bcd,
+                unsigned width_chroma, float scale_a, double scale_bcd,
+                bool chroma, const comp_avg_floats *floats,
+                comp_avg_ints *ints);
+static inline void unquantize_fields(unsigned width_chroma, float scale_a,
+                double scale_bcd, bool chroma, const comp_avg_ints *ints,
+                comp_avg_floats *floats);
+static inline uint64_t quantize_chroma(unsigned width, float chroma);
+static inline float unquantize_chroma(unsigned width, uint64_t index);
+static inline uint64_t field_max(unsigned width);
+static inline int64_t signed_field_max(unsigned width);
+float ensure_in_bounds(float val, float min, float max);
+
+#ifdef PROFILE40_GENERIC
+/*
+ * Name: pack_generic, unpack_generic, quantize_generic, unquantize_generic,
+ *       quantize_luma_generic, unquantize_luma_generic
+ * Purpose: the same kernels, reading the widths and scales from the profile
+ * Parameters: as for the kernels in profile40
+ * Returns: as for the kernels in profile40
+ * Notes: only used when built with -DPROFILE40_GENERIC, to check the
+ *        specialised kernels against, or to try out a new layout
+ */
+static bool pack_generic(const profile40 *profile, const comp_avg_ints *ints,
+                                                                uint64_t *word)
+{
+        return pack_fields(profile->width_a, profile->width_bcd,
+                                profile->width_chroma, ints, word);
+}
+
+static void unpack_generic(const profile40 *profile, uint64_t word,
+                                                        comp_avg_ints *ints)
+{
+        unpack_fields(profile->width_a, profile->width_bcd,
+                                profile->width_chroma, word, ints);
+}
+
+static void quantize_generic(const profile40 *profile,
+                        const comp_avg_floats *floats, comp_avg_ints *ints)
+{
+        quantize_fields(profile->width_a, profile->width_bcd,
+                        profile->width_chroma, profile->scale_a,
+                        profile->scale_bcd, true, floats, ints);
+}
+
+static void unquantize_generic(const profile40 *profile,
+                        const comp_avg_ints *ints, comp_avg_floats *floats)
+{
+        unquantize_fields(profile->width_chroma, profile->scale_a,
+                                profile->scale_bcd, true, ints, floats);
+}
+
+static void quantize_luma_generic(const profile40 *profile,
+                        const comp_avg_floats *floats, comp_avg_ints *ints)
+{
+        quantize_fields(profile->width_a, profile->width_bcd,
+                        profile->width_chroma, profile->scale_a,
+                        profile->scale_bcd, false, floats, ints);
+}
+
+static void unquantize_luma_generic(const profile40 *profile,
+                        const comp_avg_ints *ints, comp_avg_floats *floats)
+{
+        unquantize_fields(profile->width_chroma, profile->scale_a,
+                                profile->scale_bcd, false, ints, floats);
+}
+
+#define PROFILE40_ENTRY(id, name, bytes, wa, wbcd, wc, sa, sbcd) \
+        {id, #name, bytes, wa, wbcd, wc, sa, sbcd, pack_generic, \
+                unpack_generic, quantize_generic, unquantize_generic, \
+                quantize_luma_generic, unquantize_luma_generic},
+#else
+/*
+ * One set of kernels per profile. Each passes its profile's widths and scales
+ * to the inlined general kernels as constants, so the compiler can fold the
+ * shifts, masks and bounds for that layout
+ */
+#define PROFILE40_KERNELS(id, name, bytes, wa, wbcd, wc, sa, sbcd) \
+static bool pack_##name(const profile40 *profile, const comp_avg_ints *ints, \
+                                                        uint64_t *word) \
+{ \
+        (void) profile; \
+        return pack_fields(wa, wbcd, wc, ints, word); \
+} \
+static void unpack_##name(const profile40 *profile, uint64_t word, \
+                                                        comp_avg_ints *ints) \
+{ \
+        (void) profile; \
+        unpack_fields(wa, wbcd, wc, word, ints); \
+} \
+static void quantize_##name(const profile40 *profile, \
+                        const comp_avg_floats *floats, comp_avg_ints *ints) \
+{ \
+        (void) profile; \
+        quantize_fields(wa, wbcd, wc, sa, sbcd, true, floats, ints); \
+} \
+static void unquantize_##name(const profile40 *profile, \
+                        const comp_avg_ints *ints, comp_avg_floats *floats) \
+{ \
+        (void) profile; \
+        unquantize_fields(wc, sa, sbcd, true, ints, floats); \
+} \
+static void quantize_luma_##name(const profile40 *profile, \
+                        const comp_avg_floats *floats, comp_avg_ints *ints) \
+{ \
+        (void) profile; \
+        quantize_fields(wa, wbcd, wc, sa, sbcd, false, floats, ints); \
+} \
+static void unquantize_luma_##name(const profile40 *profile, \
+                        const comp_avg_ints *ints, comp_avg_floats *floats) \
+{ \
+        (void) profile; \
+        unquantize_fields(wc, sa, sbcd, false, ints, floats); \
+}
+PROFILE40_LIST(PROFILE40_KERNELS)
+
+#define PROFILE40_ENTRY(id, name, bytes, wa, wbcd, wc, sa, sbcd) \
+        {id, #name, bytes, wa, wbcd, wc, sa, sbcd, pack_##name, \
+                unpack_##name, quantize_##name, unquantize_##name, \
+                quantize_luma_##name, unquantize_luma_##name},
+#endif
+
+static const profile40 profiles[] = {
+        PROFILE40_LIST(PROFILE40_ENTRY)
+};
+
+#define NUM_PROFILES (sizeof(profiles) / sizeof(profiles[0]))
+
+/*
+ * Name: profile40_get
+ * Purpose: look up a profile by the number a header names it with
+ * Parameters: the profile number
+ * Returns: the profile, or NULL if there is no profile with that number
+ * Notes: the table is in number order, so the number is just the index
+ */
+const profile40 *profile40_get(unsigned id)
+{
+        if (id >= NUM_PROFILES) {
+                return NULL;
+        }
+        assert(profiles[id].id == id);
+        return &profiles[id];
+}
+
+/*
+ * Name: profile40_put_word
+ * Purpose: write a codeword out big endian
+ * Parameters: the profile, the codeword, where to write its bytes
+ * Returns: none
+ * Notes: profile and out must not be NULL, writes profile->word_bytes bytes
+ */
+void profile40_put_word(const profile40 *profile, uint64_t word,
+                                                        unsigned char *out)
+{
+        assert(profile != NULL && out != NULL);
+        for (unsigned i = profile->word_bytes; i > 0; i--) {
+                out[i - 1] = (unsigned char) word;
+                word >>= 8;
+        }
+}
+
+/*
+ * Name: profile40_get_word
+ * Purpose: read a big endian codeword
+ * Parameters: the profile, where its bytes are
+ * Returns: the codeword
+ * Notes: profile and in must not be NULL, reads profile->word_bytes bytes
+ */
+uint64_t profile40_get_word(const profile40 *profile, const unsigned char *in)
+{
+        assert(profile != NULL && in != NULL);
+        uint64_t word = 0;
+        for (unsigned i = 0; i < profile->word_bytes; i++) {
+                word = (word << 8) | in[i];
+        }
+        return word;
+}
+
+/*
+ * Name: pack_fields
+ * Purpose: pack the quantized values of one block into a codeword
+ * Parameters: the widths of a, of b, c and d and of Pb and Pr, the quantized
+ *             values, where to store the codeword
+ * Returns: true if every value fit in its field, false if not
+ * Notes: fields go a, b, c, d, Pb, Pr from the most significant end down to
+ *        bit 0. Never raises an exception, so it is safe to call from more
+ *        than one thread
+ */
+static inline bool pack_fields(unsigned width_a, unsigned width_bcd,
+                unsigned width_chroma, const comp_avg_ints *ints,
+                uint64_t *word)
+{
+        int64_t bcd_max = signed_field_max(width_bcd);
+        int64_t bcd[3] = {ints->b, ints->c, ints->d};
+        if (ints->a > field_max(width_a) ||
+                        ints->bluediff_avg > field_max(width_chroma) ||
+                        ints->reddiff_avg > field_max(width_chroma)) {
+                return false;
+        }
+
+        uint64_t packed = ints->a;
+        for (int i = 0; i < 3; i++) {
+                if (bcd[i] < -bcd_max - 1 || bcd[i] > bcd_max) {
+                        return false;
+                }
+                packed = (packed << width_bcd) |
+                                ((uint64_t) bcd[i] & field_max(width_bcd));
+        }
+        packed = (packed << width_chroma) | ints->bluediff_avg;
+        packed = (packed << width_chroma) | ints->reddiff_avg;
+        *word = packed;
+        return true;
+}
+
+/*
+ * Name: unpack_fields
+ * Purpose: split a codeword back into the quantized values of its block
+ * Parameters: the widths of a, of b, c and d and of Pb and Pr, the codeword,
+ *             where to store the values
+ * Returns: none
+ * Notes: b, c and d are sign extended. Bits above the fields are ignored
+ */
+static inline void unpack_fields(unsigned width_a, unsigned width_bcd,
+                unsigned width_chroma, uint64_t word, comp_avg_ints *ints)
+{
+        int64_t bcd[3];
+        ints->reddiff_avg = word & field_max(width_chroma);
+        word >>= width_chroma;
+        ints->bluediff_avg = word & field_max(width_chroma);
+        word >>= width_chroma;
+        for (int i = 2; i >= 0; i--) {
+                uint64_t field = word & field_max(width_bcd);
+                int64_t half = (int64_t) 1 << (width_bcd - 1);
+                bcd[i] = ((int64_t) field ^ half) - half;
+                word >>= width_bcd;
+        }
+        ints->a = word & field_max(width_a);
+        ints->b = bcd[0];
+        ints->c = bcd[1];
+        ints->d = bcd[2];
+}
+
+/*
+ * Name: quantize_fields
+ * Purpose: send the averaged floats of one block to the integers that fit in
+ *          its codeword
+ * Parameters: the widths of a, of b, c and d and of Pb and Pr, the scales a
+ *             and b, c, d are multiplied by, whether to quantize Pb and Pr,
+ *             the floats, where to store the integers
+ * Returns: none
+ * Notes: scale_a is a float and scale_bcd a double, as 63 and 103.3 were in
+ *        the original quantizer, so the standard profile rounds the same way.
+ *        Without chroma (a grayscale image) Pb and Pr are stored as 0
+ */
+static inline void quantize_fields(unsigned width_a, unsigned width_bcd,
+                unsigned width_chroma, float scale_a, double scale_bcd,
+                bool chroma, const comp_avg_floats *floats,
+                comp_avg_ints *ints)
+{
+        float a_max = field_max(width_a);
+        float bcd_max = signed_field_max(width_bcd);
+        if (chroma) {
+                ints->bluediff_avg = quantize_chroma(width_chroma,
+                                                        floats->bluediff_avg);
+                ints->reddiff_avg = quantize_chroma(width_chroma,
+                                                        floats->reddiff_avg);
+        } else {
+                ints->bluediff_avg = 0;
+                ints->reddiff_avg = 0;
+        }
+        ints->a = (int) round(ensure_in_bounds(
+                                round(scale_a * floats->a), 0, a_max));
+        ints->b = (int) round(ensure_in_bounds(
+                        round(scale_bcd * floats->b), -bcd_max, bcd_max));
+        ints->c = (int) round(ensure_in_bounds(
+                        round(scale_bcd * floats->c), -bcd_max, bcd_max));
+        ints->d = (int) round(ensure_in_bounds(
+                        round(scale_bcd * floats->d), -bcd_max, bcd_max));
+}
+
+/*
+ * Name: unquantize_fields
+ * Purpose: send the integers of one codeword back to averaged floats
+ * Parameters: the width of Pb and Pr, the scales a and b, c, d were multiplied
+ *             by, whether to unquantize Pb and Pr, the integers, where to
+ *             store the floats
+ * Returns: none
+ * Notes: a is kept in [0, 1] and b, c and d in [-0.5, 0.5]. Without chroma
+ *        Pb and Pr are 0, whatever their fields hold
+ */
+static inline void unquantize_fields(unsigned width_chroma, float scale_a,
+                double scale_bcd, bool chroma, const comp_avg_ints *ints,
+                comp_avg_floats *floats)
+{
+        if (chroma) {
+                floats->bluediff_avg = unquantize_chroma(width_chroma,
+                                                        ints->bluediff_avg);
+                floats->reddiff_avg = unquantize_chroma(width_chroma,
+                                                        ints->reddiff_avg);
+        } else {
+                floats->bluediff_avg = 0;
+                floats->reddiff_avg = 0;
+        }
+        floats->a = ensure_in_bounds(((float) ints->a) / scale_a, 0, 1);
+        floats->b = ensure_in_bounds(((float) ints->b) / scale_bcd, -0.5, 0.5);
+        floats->c = ensure_in_bounds(((float) ints->c) / scale_bcd, -0.5, 0.5);
+        floats->d = ensure_in_bounds(((float) ints->d) / scale_bcd, -0.5, 0.5);
+}
+
+/*
+ * Name: quantize_chroma
+ * Purpose: send a Pb or Pr value to a chroma index
+ * Parameters: the width of the chroma fields, the value
+ * Returns: the index
+ * Notes: 4-bit fields use the Arith40 table, wider ones are linear over
+ *        [-0.5, 0.5]
+ */
+static inline uint64_t quantize_chroma(unsigned width, float chroma)
+{
+        if (width == ARITH40_CHROMA_WIDTH) {
+                return Arith40_index_of_chroma(chroma);
+        }
+        float max = field_max(width);
+        return (uint64_t) round(ensure_in_bounds(
+                                        round((chroma + 0.5) * max), 0, max));
+}
+
+/*
+ * Name: unquantize_chroma
+ * Purpose: send a chroma index back to a Pb or Pr value
+ * Parameters: the width of the chroma fields, the index
+ * Returns: the value
+ * Notes: the inverse of quantize_chroma
+ */
+static inline float unquantize_chroma(unsigned width, uint64_t index)
+{
+        if (width == ARITH40_CHROMA_WIDTH) {
+                return Arith40_chroma_of_index(index);
+        }
+        return (float) index / field_max(width) - 0.5;
+}
+
+/*
+ * Name: field_max, signed_field_max
+ * Purpose: the largest value an unsigned or signed field of a width can hold
+ * Parameters: the width in bits, 1 to 63
+ * Returns: the largest value
+ * Notes: none
+ */
+static inline uint64_t field_max(unsigned width)
+{
+        return ((uint64_t) 1 << width) - 1;
+}
+
+static inline int64_t signed_field_max(unsigned width)
+{
+        return ((int64_t) 1 << (width - 1)) - 1;
+}
+
+#undef PROFILE40_LIST
+#undef ARITH40_CHROMA_WIDTH
+#undef PROFILE40_KERNELS
+#undef PROFILE40_ENTRY
+#undef NUM_PROFILES
@@ -0,0 +1,83 @@
+/**************************************************************
+ *
+ *                     profile40.h
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  Interface for codeword profiles: how many bits
+ *               each field of a codeword gets, where it sits,
+ *               and the scales a, b, c and d are quantized with.
+ *               A format 3 header names its profile with
+ *               profile=<n>; format 2 is always profile 0.
+ *
+ *                 0 standard  32-bit words, a 6 bits, b, c, d 6
+ *                             bits signed, Pb and Pr 4 bits
+ *                             (the original layout)
+ *                 1 fine      64-bit words, a 10 bits, b, c, d
+ *                             10 bits signed, Pb and Pr 12 bits
+ *
+ *               Fields are packed from the most significant end:
+ *               a, b, c, d, Pb, Pr. 4-bit chroma uses the
+ *               Arith40 chroma table; wider chroma is linear
+ *               over [-0.5, 0.5].
+ *
+ *               Each profile in the table gets its own pack,
+ *               unpack, quantize and unquantize kernels, with its
+ *               widths and scales as constants, and luma-only
+ *               quantize and unquantize kernels for grayscale
+ *               images, which leave Pb and Pr at 0. Building with
+ *               -DPROFILE40_GENERIC uses one set of kernels that
+ *               reads them from the profile instead.
+ *
+ **************************************************************/
+
+#ifndef PROFILE40_INCLUDED
+#define PROFILE40_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "pixel_structs.h"
+
+#define PROFILE40_STANDARD 0
+#define PROFILE40_FINE 1
+
+/* bytes in the widest codeword of any profile */
+#define PROFILE40_MAX_WORD_BYTES 8
+
+typedef struct profile40 profile40;
+
+/*
+ * Name: profile40
+ * Contains: the number and name of a profile, the bytes in one of its
+ *           codewords, the width of each field, the scales a and b, c, d are
+ *           quantized with, and its kernels (the luma ones skip Pb and Pr)
+ */
+struct profile40 {
+        unsigned id;
+        const char *name;
+        unsigned word_bytes;
+        unsigned width_a, width_bcd, width_chroma;
+        float scale_a;
+        double scale_bcd;
+        bool (*pack)(const profile40 *profile, const comp_avg_ints *ints,
+                                                                uint64_t *word);
+        void (*unpack)(const profile40 *profile, uint64_t word,
+                                                        comp_avg_ints *ints);
+        void (*quantize)(const profile40 *profile,
+                        const comp_avg_floats *floats, comp_avg_ints *ints);
+        void (*unquantize)(const profile40 *profile,
+                        const comp_avg_ints *ints, comp_avg_floats *floats);
+        void (*quantize_luma)(const profile40 *profile,
+                        const comp_avg_floats *floats, comp_avg_ints *ints);
+        void (*unquantize_luma)(const profile40 *profile,
+                        const comp_avg_ints *ints, comp_avg_floats *floats);
+};
+
+const profile40 *profile40_get(unsigned id);
+void profile40_put_word(const profile40 *profile, uint64_t word,
+                                                        unsigned char *out);
+uint64_t profile40_get_word(const profile40 *profile, const unsigned char *in);
+
+#endif
@@ -0,0 +1,470 @@
+/**************************************************************
+ *
+ *                     rans40.c
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  Implementation of the per-field, four way
+ *               interleaved rANS coder for tile codewords. The
+ *               coder works with byte renormalization and 12 bit
+ *               probabilities, so every state step is one table
+ *               lookup, one multiply and at most two byte reads.
+ *
+ **************************************************************/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "mem.h"
+#include "rans40.h"
+
+#define NUM_FIELDS RANS40_FIELDS
+#define MAX_SYMBOLS RANS40_MAX_SYMBOLS
+#define BITMAP_BYTES 8
+#define BYTES_PER_WORD 4
+#define LANES 4
+#define PROB_BITS 12
+#define PROB_SCALE (1u << PROB_BITS)
+#define RANS_L (1u << 23)
+
+/*
+ * Name: rans_model
+ * Contains: the frequency model of one field - how often each value occurs
+ *           (out of PROB_SCALE), where each value's range starts, and for
+ *           decoding the value that owns each slot of the range
+ */
+struct rans_model {
+        uint32_t freq[MAX_SYMBOLS];
+        uint32_t start[MAX_SYMBOLS];
+        unsigned char symbol[PROB_SCALE];
+};
+typedef struct rans_model rans_model;
+
+/*
+ * Width and lsb of each field in a codeword, in the order the fields are
+ * coded. These match the bit packing literals in compress.c and decompress.c
+ */
+static const unsigned field_width[NUM_FIELDS] = {6, 6, 6, 6, 4, 4};
+static const unsigned field_lsb[NUM_FIELDS] = {26, 20, 14, 8, 4, 0};
+
+/* Helper functions */
+void normalize_model(const size_t *counts, unsigned symbols, rans_model *model);
+size_t write_model(const rans_model *model, unsigned symbols,
+                                        unsigned char *out, size_t out_cap);
+size_t read_model(const unsigned char *in, size_t in_len, unsigned symbols,
+                                                        rans_model *model);
+void rans_put(uint32_t *state, unsigned char **ptr, uint32_t start,
+                                                                uint32_t freq);
+
+/*
+ * Name: rans40_encode
+ * Purpose: entropy code a run of big endian 32-bit codewords
+ * Parameters: the codewords and how many there are, the buffer to write to
+ *             and its capacity in bytes
+ * Returns: the number of bytes written, or 0 if they would not fit in out_cap
+ * Notes: words and out must not be NULL, count must be positive. Passing the
+ *        raw size less one as out_cap asks for coding only if it saves space
+ */
+size_t rans40_encode(const unsigned char *words, size_t count,
+                                        unsigned char *out, size_t out_cap)
+{
+        assert(words != NULL && out != NULL && count > 0);
+        size_t num_symbols = count * NUM_FIELDS;
+
+        /* split the codewords into fields and count each field's values */
+        unsigned char *symbols = ALLOC(num_symbols);
+        size_t counts[NUM_FIELDS][MAX_SYMBOLS];
+        memset(counts, 0, sizeof(counts));
+        for (size_t i = 0; i < count; i++) {
+                const unsigned char *curr = words + i * BYTES_PER_WORD;
+                uint32_t word = (uint32_t) curr[0] << 24 | curr[1] << 16 |
+                                                        curr[2] << 8 | curr[3];
+                for (unsigned f = 0; f < NUM_FIELDS; f++) {
+                        unsigned val = (word >> field_lsb[f]) &
+                                                ((1u << field_width[f]) - 1);
+                        symbols[i * NUM_FIELDS + f] = val;
+                        counts[f][val]++;
+                }
+        }
+
+        /* the tables go first */
+        rans_model *models = ALLOC(NUM_FIELDS * sizeof(rans_model));
+        size_t pos = 0;
+        for (unsigned f = 0; f < NUM_FIELDS; f++) {
+                normalize_model(counts[f], 1u << field_width[f], &models[f]);
+        }
+        for (unsigned f = 0; f < NUM_FIELDS && pos <= out_cap; f++) {
+                size_t len = write_model(&models[f], 1u << field_width[f],
+                                                out + pos, out_cap - pos);
+                pos = len == 0 ? out_cap + 1 : pos + len;
+        }
+
+        /*
+         * rANS works like a stack, so the symbols are coded last to first into
+         * the end of a scratch buffer. Symbol i uses lane i % LANES
+         */
+        size_t scratch_size = LANES * 4 + num_symbols * 2;
+        unsigned char *scratch = ALLOC(scratch_size);
+        unsigned char *ptr = scratch + scratch_size;
+        uint32_t state[LANES];
+        for (unsigned lane = 0; lane < LANES; lane++) {
+                state[lane] = RANS_L;
+        }
+        for (size_t i = num_symbols; i-- > 0; ) {
+                const rans_model *model = &models[i % NUM_FIELDS];
+                unsigned val = symbols[i];
+                rans_put(&state[i % LANES], &ptr, model->start[val],
+                                                        model->freq[val]);
+        }
+        for (unsigned lane = LANES; lane-- > 0; ) {
+                ptr -= 4;
+                ptr[0] = state[lane];
+                ptr[1] = state[lane] >> 8;
+                ptr[2] = state[lane] >> 16;
+                ptr[3] = state[lane] >> 24;
+        }
+
+        size_t payload = scratch + scratch_size - ptr;
+        size_t written = 0;
+        if (pos <= out_cap && payload <= out_cap - pos) {
+                memcpy(out + pos, ptr, payload);
+                written = pos + payload;
+        }
+        FREE(scratch);
+        FREE(models);
+        FREE(symbols);
+        return written;
+}
+
+/*
+ * Name: rans_put
+ * Purpose: code one symbol into a rANS state, first moving bytes out of the
+ *          state so it stays in range
+ * Parameters: the state, the write pointer (bytes are written downwards), the
+ *             start and frequency of the symbol
+ * Returns: none
+ * Notes: none
+ */
+void rans_put(uint32_t *state, unsigned char **ptr, uint32_t start,
+                                                                uint32_t freq)
+{
+        uint32_t x = *state;
+        uint32_t x_max = ((RANS_L >> PROB_BITS) << 8) * freq;
+        while (x >= x_max) {
+                *--*ptr = x & 0xff;
+                x >>= 8;
+        }
+        *state = ((x / freq) << PROB_BITS) + (x % freq) + start;
+}
+
+/*
+ * Name: rans40_decode
+ * Purpose: decode codewords coded by rans40_encode
+ * Parameters: the coded bytes and how many there are, where to write the big
+ *             endian 32-bit codewords, and how many codewords there are
+ * Returns: CODEC40_OK, or CODEC40_EFORMAT if the bytes are not a valid coding
+ *          of exactly count codewords
+ * Notes: never reads past in_len and never raises an exception (short of
+ *        running out of memory), so it is safe to call from more than one
+ *        thread. A corrupt stream is caught by the final state check
+ */
+Codec40_status rans40_decode(const unsigned char *in, size_t in_len,
+                                        unsigned char *words, size_t count)
+{
+        assert(in != NULL && words != NULL);
+        rans_model *models = ALLOC(NUM_FIELDS * sizeof(rans_model));
+        size_t pos = 0;
+        for (unsigned f = 0; f < NUM_FIELDS; f++) {
+                size_t len = read_model(in + pos, in_len - pos,
+                                        1u << field_width[f], &models[f]);
+                if (len == 0) {
+                        FREE(models);
+                        return CODEC40_EFORMAT;
+                }
+                pos += len;
+        }
+        if (in_len - pos < LANES * 4) {
+                FREE(models);
+                return CODEC40_EFORMAT;
+        }
+
+        const unsigned char *ptr = in + pos;
+        const unsigned char *end = in + in_len;
+        uint32_t state[LANES];
+        for (unsigned lane = 0; lane < LANES; lane++) {
+                state[lane] = (uint32_t) ptr[0] | (uint32_t) ptr[1] << 8 |
+                        (uint32_t) ptr[2] << 16 | (uint32_t) ptr[3] << 24;
+                ptr += 4;
+        }
+
+        /*
+         * each codeword takes NUM_FIELDS symbols, spread across the lanes in
+         * turn, so consecutive symbols never wait on each other
+         */
+        bool overrun = false;
+        unsigned lane = 0;
+        for (size_t i = 0; i < count; i++) {
+                uint32_t word = 0;
+                for (unsigned f = 0; f < NUM_FIELDS; f++) {
+                        const rans_model *model = &models[f];
+                        uint32_t x = state[lane];
+                        uint32_t slot = x & (PROB_SCALE - 1);
+                        unsigned val = model->symbol[slot];
+                        x = model->freq[val] * (x >> PROB_BITS) + slot -
+                                                        model->start[val];
+                        while (x < RANS_L) {
+                                if (ptr == end) {
+                                        overrun = true;
+                                        break;
+                                }
+                                x = (x << 8) | *ptr++;
+                        }
+                        state[lane] = x;
+                        lane = (lane + 1) % LANES;
+                        word |= (uint32_t) val << field_lsb[f];
+                }
+                unsigned char *curr = words + i * BYTES_PER_WORD;
+                curr[0] = word >> 24;
+                curr[1] = word >> 16;
+                curr[2] = word >> 8;
+                curr[3] = word;
+        }
+        FREE(models);
+
+        /* a clean stream ends with every state back where the encoder began */
+        if (overrun || ptr != end) {
+                return CODEC40_EFORMAT;
+        }
+        for (lane = 0; lane < LANES; lane++) {
+                if (state[lane] != RANS_L) {
+                        return CODEC40_EFORMAT;
+                }
+        }
+        return CODEC40_OK;
+}
+
+/*
+ * Name: rans40_symbols
+ * Purpose: split a codeword into the symbols rans40_encode codes it as
+ * Parameters: the codeword, where to store its RANS40_FIELDS symbols
+ * Returns: none
+ * Notes: symbols must not be NULL. Field f's symbol is below
+ *        rans40_field_symbols(f)
+ */
+void rans40_symbols(uint32_t word, unsigned char *symbols)
+{
+        assert(symbols != NULL);
+        for (unsigned f = 0; f < NUM_FIELDS; f++) {
+                symbols[f] = (word >> field_lsb[f]) &
+                                                ((1u << field_width[f]) - 1);
+        }
+}
+
+/*
+ * Name: rans40_field_symbols
+ * Purpose: find how many values one field can take
+ * Parameters: the field (0 for a to 5 for Pr)
+ * Returns: the number of values
+ * Notes: none
+ */
+unsigned rans40_field_symbols(unsigned field)
+{
+        assert(field < NUM_FIELDS);
+        return 1u << field_width[field];
+}
+
+/*
+ * Name: rans40_overhead_estimate
+ * Purpose: estimate how many bytes of a coded run are not the symbols
+ *          themselves - the frequency tables and the final states
+ * Parameters: how often each value of each field turned up in a sample of
+ *             codewords, the number of codewords sampled, and the number of
+ *             codewords in the run
+ * Returns: the expected number of bytes
+ * Notes: counts must not be NULL and sampled must be positive. Treats the run
+ *        as count codewords drawn from the sampled distribution: a value with
+ *        probability p has a table entry if it turns up at all, which it does
+ *        with probability 1 - (1 - p)^count, and its entry takes two bytes if
+ *        its frequency is 128 or more out of PROB_SCALE
+ */
+double rans40_overhead_estimate(size_t counts[][RANS40_MAX_SYMBOLS],
+                                                size_t sampled, size_t count)
+{
+        assert(counts != NULL && sampled > 0);
+        double bytes = LANES * 4;
+        for (unsigned f = 0; f < NUM_FIELDS; f++) {
+                bytes += BITMAP_BYTES;
+                for (unsigned s = 0; s < (1u << field_width[f]); s++) {
+                        if (counts[f][s] == 0) {
+                                continue;
+                        }
+                        double p = (double) counts[f][s] / sampled;
+                        double present = 1 - pow(1 - p, (double) count);
+                        bytes += present * (p * PROB_SCALE < 0x80 ? 1 : 2);
+                }
+        }
+        return bytes;
+}
+
+/*
+ * Name: normalize_model
+ * Purpose: scale a field's value counts to frequencies that add up to
+ *          PROB_SCALE, keeping every value that occurs at least 1
+ * Parameters: the counts, how many values the field can take, the model to
+ *             fill in (frequencies and starts)
+ * Returns: none
+ * Notes: at least one count must be positive
+ */
+void normalize_model(const size_t *counts, unsigned symbols, rans_model *model)
+{
+        size_t total = 0;
+        for (unsigned s = 0; s < symbols; s++) {
+                total += counts[s];
+        }
+        assert(total > 0);
+
+        uint32_t sum = 0;
+        unsigned largest = 0;
+        for (unsigned s = 0; s < symbols; s++) {
+                model->freq[s] = 0;
+                if (counts[s] > 0) {
+                        uint64_t scaled = (uint64_t) counts[s] * PROB_SCALE /
+                                                                        total;
+                        model->freq[s] = scaled > 0 ? scaled : 1;
+                }
+                sum += model->freq[s];
+                if (model->freq[s] > model->freq[largest]) {
+                        largest = s;
+                }
+        }
+
+        /*
+         * rounding down leaves the sum short, and rounding rare values up to 1
+         * can leave it over. Shortfalls go to the most common value; any
+         * excess is taken one at a time from whichever value is then largest
+         */
+        if (sum <= PROB_SCALE) {
+                model->freq[largest] += PROB_SCALE - sum;
+        }
+        while (sum > PROB_SCALE) {
+                for (unsigned s = 0; s < symbols; s++) {
+                        if (model->freq[s] > model->freq[largest]) {
+                                largest = s;
+                        }
+                }
+                model->freq[largest]--;
+                sum--;
+        }
+
+        uint32_t start = 0;
+        for (unsigned s = 0; s < symbols; s++) {
+                model->start[s] = start;
+                start += model->freq[s];
+        }
+}
+
+/*
+ * Name: write_model
+ * Purpose: write a field's frequency table
+ * Parameters: the model, how many values the field can take, the buffer to
+ *             write to and its capacity
+ * Returns: the number of bytes written, or 0 if they don't fit
+ * Notes: see rans40.h for the layout
+ */
+size_t write_model(const rans_model *model, unsigned symbols,
+                                        unsigned char *out, size_t out_cap)
+{
+        if (out_cap < BITMAP_BYTES) {
+                return 0;
+        }
+        uint64_t present = 0;
+        for (unsigned s = 0; s < symbols; s++) {
+                if (model->freq[s] > 0) {
+                        present |= (uint64_t) 1 << s;
+                }
+        }
+        for (unsigned i = 0; i < BITMAP_BYTES; i++) {
+                out[i] = present >> (8 * (BITMAP_BYTES - 1 - i));
+        }
+
+        size_t pos = BITMAP_BYTES;
+        for (unsigned s = 0; s < symbols; s++) {
+                uint32_t freq = model->freq[s];
+                if (freq == 0) {
+                        continue;
+                }
+                if (pos + (freq < 0x80 ? 1 : 2) > out_cap) {
+                        return 0;
+                }
+                if (freq < 0x80) {
+                        out[pos++] = freq;
+                } else {
+                        out[pos++] = 0x80 | freq >> 8;
+                        out[pos++] = freq & 0xff;
+                }
+        }
+        return pos;
+}
+
+/*
+ * Name: read_model
+ * Purpose: read a field's frequency table and build its decoding table
+ * Parameters: the buffer and its length, how many values the field can take,
+ *             the model to fill in
+ * Returns: the number of bytes read, or 0 if the table is cut off, names a
+ *          value the field can't take, or doesn't add up to PROB_SCALE
+ * Notes: never reads past in_len
+ */
+size_t read_model(const unsigned char *in, size_t in_len, unsigned symbols,
+                                                        rans_model *model)
+{
+        if (in_len < BITMAP_BYTES) {
+                return 0;
+        }
+        uint64_t present = 0;
+        for (unsigned i = 0; i < BITMAP_BYTES; i++) {
+                present = (present << 8) | in[i];
+        }
+        if (symbols < 64 && (present >> symbols) != 0) {
+                return 0;
+        }
+
+        size_t pos = BITMAP_BYTES;
+        uint32_t start = 0;
+        for (unsigned s = 0; s < symbols; s++) {
+                uint32_t freq = 0;
+                if ((present >> s) & 1) {
+                        if (pos >= in_len) {
+                                return 0;
+                        }
+                        freq = in[pos++];
+                        if (freq & 0x80) {
+                                if (pos >= in_len) {
+                                        return 0;
+                                }
+                                freq = (freq & 0x7f) << 8 | in[pos++];
+                        }
+                        if (freq == 0 || freq > PROB_SCALE - start) {
+                                return 0;
+                        }
+                }
+                model->freq[s] = freq;
+                model->start[s] = start;
+                memset(model->symbol + start, s, freq);
+                start += freq;
+        }
+        return start == PROB_SCALE ? pos : 0;
+}
+
+#undef NUM_FIELDS
+#undef MAX_SYMBOLS
+#undef BITMAP_BYTES
+#undef BYTES_PER_WORD
+#undef LANES
+#undef PROB_BITS
+#undef PROB_SCALE
+#undef RANS_L
@@ -0,0 +1,44 @@
+/**************************************************************
+ *
+ *                     rans40.h
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  Interface for the entropy coder used by tiles
+ *               with coding 1 (COMP40_CODING_RANS). It codes a
+ *               run of 32-bit codewords, modelling each of the
+ *               six fields (a, b, c, d, Pb, Pr) separately, with
+ *               four interleaved rANS states so that a decoder
+ *               has four independent dependency chains.
+ *
+ *               Coded layout: for each field a frequency table
+ *               (an 8 byte big endian bitmap of the values that
+ *               occur, then the frequency of each one, in one
+ *               byte if below 128 and two otherwise, out of
+ *               4096), then the four final rANS states and the
+ *               renormalization bytes.
+ *
+ **************************************************************/
+
+#ifndef RANS40_INCLUDED
+#define RANS40_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include "codec40.h"
+
+#define RANS40_FIELDS 6
+#define RANS40_MAX_SYMBOLS 64
+
+size_t rans40_encode(const unsigned char *words, size_t count,
+                                        unsigned char *out, size_t out_cap);
+Codec40_status rans40_decode(const unsigned char *in, size_t in_len,
+                                        unsigned char *words, size_t count);
+void rans40_symbols(uint32_t word, unsigned char *symbols);
+unsigned rans40_field_symbols(unsigned field);
+double rans40_overhead_estimate(size_t counts[][RANS40_MAX_SYMBOLS],
+                                                size_t sampled, size_t count);
+
+#endif
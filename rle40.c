@@ -0,0 +1,146 @@
+/**************************************************************
+ *
+ *                     rle40.c
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  Implementation of the run-length coder for tile
+ *               codewords.
+ *
+ **************************************************************/
+
+#include <string.h>
+#include <assert.h>
+#include "rle40.h"
+
+#define GROUP_BITS 7
+#define GROUP_MASK 0x7f
+#define MORE_GROUPS 0x80
+
+/* Helper functions */
+size_t run_length(const unsigned char *words, size_t count, unsigned word_bytes,
+                                                                size_t first);
+size_t put_length(size_t length, unsigned char *out, size_t out_cap);
+
+/*
+ * Name: rle40_encode
+ * Purpose: store a tile's codewords as runs of identical codewords
+ * Parameters: the tile's codewords (row major), how many there are, the bytes
+ *             in one codeword, where to write the runs and how much room there
+ *             is
+ * Returns: the number of bytes written, or 0 if the runs don't fit in out_cap
+ * Notes: words and out must not be NULL, count and word_bytes must be positive.
+ *        The caller passes less room than the raw codewords take to find out
+ *        whether the runs are worth it
+ */
+size_t rle40_encode(const unsigned char *words, size_t count,
+                unsigned word_bytes, unsigned char *out, size_t out_cap)
+{
+        assert(words != NULL && out != NULL);
+        assert(count > 0 && word_bytes > 0);
+        size_t len = 0;
+        for (size_t first = 0; first < count; ) {
+                size_t length = run_length(words, count, word_bytes, first);
+                size_t written = put_length(length, out + len, out_cap - len);
+                if (written == 0 || out_cap - len - written < word_bytes) {
+                        return 0;
+                }
+                len += written;
+                memcpy(out + len, words + first * word_bytes, word_bytes);
+                len += word_bytes;
+                first += length;
+        }
+        return len;
+}
+
+/*
+ * Name: rle40_next_run
+ * Purpose: read the next run from a tile stored by rle40_encode
+ * Parameters: where the run starts (moved past it), the end of the tile, the
+ *             bytes in one codeword, the longest run allowed (the blocks left
+ *             in the tile), where to store the run's length and where to store
+ *             a pointer to its codeword
+ * Returns: true on success, false if the run is cut off, empty or longer than
+ *          max_length
+ * Notes: none of the pointers may be NULL. Never reads at or past end, so it
+ *        is safe on corrupt input
+ */
+bool rle40_next_run(const unsigned char **in, const unsigned char *end,
+                unsigned word_bytes, size_t max_length, size_t *length,
+                const unsigned char **word)
+{
+        assert(in != NULL && *in != NULL && end != NULL);
+        assert(length != NULL && word != NULL);
+        const unsigned char *pos = *in;
+        size_t value = 0;
+        unsigned char byte;
+        do {
+                /* checking before the shift also keeps it from overflowing */
+                if (pos == end || value > max_length) {
+                        return false;
+                }
+                byte = *pos++;
+                value = (value << GROUP_BITS) | (byte & GROUP_MASK);
+        } while (byte & MORE_GROUPS);
+        if (value == 0 || value > max_length ||
+                                (size_t) (end - pos) < word_bytes) {
+                return false;
+        }
+        *length = value;
+        *word = pos;
+        *in = pos + word_bytes;
+        return true;
+}
+
+/*
+ * Name: run_length
+ * Purpose: count the identical codewords starting at one position
+ * Parameters: the codewords, how many there are, the bytes in one codeword,
+ *             the position of the first codeword in the run
+ * Returns: the length of the run, at least 1
+ * Notes: none
+ */
+size_t run_length(const unsigned char *words, size_t count, unsigned word_bytes,
+                                                                size_t first)
+{
+        const unsigned char *word = words + first * word_bytes;
+        size_t next = first + 1;
+        while (next < count &&
+                memcmp(words + next * word_bytes, word, word_bytes) == 0) {
+                next++;
+        }
+        return next - first;
+}
+
+/*
+ * Name: put_length
+ * Purpose: write a run length in 7-bit groups, most significant first
+ * Parameters: the length, where to write it and how much room there is
+ * Returns: the number of bytes written, or 0 if they don't fit
+ * Notes: length must be positive
+ */
+size_t put_length(size_t length, unsigned char *out, size_t out_cap)
+{
+        size_t groups = 1;
+        while (groups * GROUP_BITS < sizeof(length) * 8 &&
+                                (length >> (groups * GROUP_BITS)) != 0) {
+                groups++;
+        }
+        if (groups > out_cap) {
+                return 0;
+        }
+        for (size_t i = 0; i < groups; i++) {
+                unsigned shift = (groups - 1 - i) * GROUP_BITS;
+                out[i] = (length >> shift) & GROUP_MASK;
+                if (i + 1 < groups) {
+                        out[i] |= MORE_GROUPS;
+                }
+        }
+        return groups;
+}
+
+#undef GROUP_BITS
+#undef GROUP_MASK
+#undef MORE_GROUPS
@@ -0,0 +1,38 @@
+/**************************************************************
+ *
+ *                     rle40.h
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  Interface for the run-length coder used by tiles
+ *               with coding 3 (COMP40_CODING_RLE). Flat areas
+ *               (screenshots, scanned pages) give long runs of
+ *               identical codewords, so a tile's codewords, row
+ *               major, are stored as runs instead.
+ *
+ *               Coded layout: one entry per run, in order - the
+ *               run length (at least 1) in 7-bit groups, most
+ *               significant first, with the top bit set on every
+ *               byte but the last, then the codeword repeated,
+ *               in the profile's word size. The runs add up to
+ *               exactly the blocks in the tile.
+ *
+ *               Works on codewords of any profile.
+ *
+ **************************************************************/
+
+#ifndef RLE40_INCLUDED
+#define RLE40_INCLUDED
+
+#include <stdbool.h>
+#include <stddef.h>
+
+size_t rle40_encode(const unsigned char *words, size_t count,
+                unsigned word_bytes, unsigned char *out, size_t out_cap);
+bool rle40_next_run(const unsigned char **in, const unsigned char *end,
+                unsigned word_bytes, size_t max_length, size_t *length,
+                const unsigned char **word);
+
+#endif
@@ -0,0 +1,922 @@
+/**************************************************************
+ *
+ *                     serve40.c
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  Implementation of the codec daemon. One thread
+ *               accepts connections and polls them (epoll), and
+ *               puts each request on a queue once all of it has
+ *               arrived. A fixed pool of worker threads takes the
+ *               requests off the queue and runs them with the
+ *               codec40 library (the same pipeline stages as
+ *               compress40 and decompress40), so an idle client
+ *               never holds a worker. Recently decoded
+ *               images are kept in an optional LRU cache of
+ *               sealed memfds, so a repeated decode is answered by
+ *               sending the same memfd again.
+ *
+ **************************************************************/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "assert.h"
+#include "mem.h"
+#include "seq.h"
+#include "codec40.h"
+#include "serve40.h"
+
+#define LISTEN_BACKLOG 128
+#define MAX_EVENTS 64
+#define SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)
+#define PAYLOAD_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE)
+
+/* Struct definitions */
+
+/*
+ * Name: connection
+ * Contains: a connected client socket, and the request being read from it:
+ *           the bytes of it that have arrived so far and the payload fd that
+ *           came with them (-1 until it does)
+ * Notes: belongs to the polling thread while its socket is watched, and to
+ *        one worker from when its request is queued until it is watched again
+ */
+struct connection {
+        int sock;
+        Serve40_request request;
+        size_t have;
+        int payload_fd;
+};
+typedef struct connection connection;
+
+/*
+ * Name: job_queue
+ * Contains: connections with a complete request waiting for a worker, and
+ *           the lock and condition variable that guard them
+ */
+struct job_queue {
+        Seq_T jobs;
+        pthread_mutex_t lock;
+        pthread_cond_t nonempty;
+};
+typedef struct job_queue job_queue;
+
+/*
+ * Name: cache_entry
+ * Contains: one decoded image in the LRU cache - a copy of the compressed
+ *           image it came from (the key) and its hash, the sealed memfd with
+ *           the rgb triples, the reply that goes with it, and its neighbours
+ *           in the recently used list
+ */
+struct cache_entry {
+        uint64_t hash;
+        unsigned char *key;
+        size_t key_len;
+        int fd;
+        Serve40_reply reply;
+        struct cache_entry *prev, *next;
+};
+typedef struct cache_entry cache_entry;
+
+/*
+ * Name: lru_cache
+ * Contains: the cached images, most recently used first, how many there are,
+ *           how many there may be, and the lock that guards them
+ * Notes: lookups are a linear scan, which is fine for the few dozen entries a
+ *        cache of full images holds
+ */
+struct lru_cache {
+        cache_entry *head, *tail;
+        unsigned length, capacity;
+        pthread_mutex_t lock;
+};
+typedef struct lru_cache lru_cache;
+
+/*
+ * Name: server
+ * Contains: everything the polling and worker threads share: the epoll
+ *           instance watching the sockets, the queue of requests and the cache
+ */
+struct server {
+        int epoll_fd;
+        job_queue queue;
+        lru_cache cache;
+};
+typedef struct server server;
+
+/* Helper functions */
+int listen_on(const char *socket_path);
+void accept_connection(server *srv, int listen_fd);
+void read_request(server *srv, connection *conn);
+int watch_connection(server *srv, connection *conn, int op);
+void close_connection(connection *conn);
+void *worker_main(void *cl);
+int answer_request(server *srv, connection *conn);
+ssize_t recv_some(int sock, void *buf, size_t len, int flags, int *fd);
+int recv_with_fd(int sock, void *buf, size_t len, int *fd);
+int send_with_fd(int sock, const void *buf, size_t len, int fd, int flags);
+int run_job(server *srv, const Serve40_request *request, int payload_fd,
+                                                        Serve40_reply *reply);
+int run_compress(const unsigned char *payload, const Serve40_request *request,
+                                                        Serve40_reply *reply);
+int run_decompress(server *srv, const unsigned char *payload,
+                        const Serve40_request *request, Serve40_reply *reply);
+int new_result_fd(size_t length, unsigned char **map);
+int seal_result_fd(int fd, unsigned char *map, size_t map_length,
+                                                        size_t length);
+void queue_push(job_queue *queue, connection *conn);
+connection *queue_pop(job_queue *queue);
+uint64_t hash_bytes(const unsigned char *bytes, size_t length);
+int cache_lookup(lru_cache *cache, const unsigned char *key, size_t key_len,
+                                                        Serve40_reply *reply);
+void cache_insert(lru_cache *cache, const unsigned char *key, size_t key_len,
+                                        int fd, const Serve40_reply *reply);
+void cache_unlink(lru_cache *cache, cache_entry *entry);
+void cache_push_front(lru_cache *cache, cache_entry *entry);
+
+/*
+ * Name: serve40
+ * Purpose: listen on a Unix domain socket and run compress and decompress jobs
+ *          until the process is killed
+ * Parameters: the path of the socket (replaced if it already exists), the
+ *             number of worker threads, and the number of decoded images to
+ *             cache (0 turns the cache off)
+ * Returns: only on a setup error, with -1 and a message on stderr
+ * Notes: socket_path must not be NULL and workers must be positive
+ */
+int serve40(const char *socket_path, unsigned workers, unsigned cache_size)
+{
+        assert(socket_path != NULL && workers > 0);
+
+        /* a client hanging up mid reply must not kill the daemon */
+        signal(SIGPIPE, SIG_IGN);
+
+        int listen_fd = listen_on(socket_path);
+        if (listen_fd < 0) {
+                return -1;
+        }
+
+        server srv;
+        srv.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        struct epoll_event listen_event = {.events = EPOLLIN,
+                                                .data.ptr = NULL};
+        if (srv.epoll_fd < 0 || epoll_ctl(srv.epoll_fd, EPOLL_CTL_ADD,
+                                        listen_fd, &listen_event) < 0) {
+                perror("serve40: epoll");
+                return -1;
+        }
+        srv.queue.jobs = Seq_new(0);
+        pthread_mutex_init(&srv.queue.lock, NULL);
+        pthread_cond_init(&srv.queue.nonempty, NULL);
+        srv.cache.head = srv.cache.tail = NULL;
+        srv.cache.length = 0;
+        srv.cache.capacity = cache_size;
+        pthread_mutex_init(&srv.cache.lock, NULL);
+
+        for (unsigned i = 0; i < workers; i++) {
+                pthread_t thread;
+                if (pthread_create(&thread, NULL, worker_main, &srv) != 0) {
+                        perror("serve40: pthread_create");
+                        return -1;
+                }
+                pthread_detach(thread);
+        }
+
+        /* this thread only accepts and reads requests; the workers run them */
+        for (;;) {
+                struct epoll_event events[MAX_EVENTS];
+                int n = epoll_wait(srv.epoll_fd, events, MAX_EVENTS, -1);
+                if (n < 0 && errno != EINTR) {
+                        perror("serve40: epoll_wait");
+                }
+                for (int i = 0; i < n; i++) {
+                        if (events[i].data.ptr == NULL) {
+                                accept_connection(&srv, listen_fd);
+                        } else {
+                                read_request(&srv, events[i].data.ptr);
+                        }
+                }
+        }
+}
+
+/*
+ * Name: listen_on
+ * Purpose: create a listening Unix domain socket
+ * Parameters: the path of the socket
+ * Returns: the socket, or -1 (with a message on stderr) on failure
+ * Notes: an existing file at socket_path is removed first. The socket is non
+ *        blocking, so a client that gives up before it is accepted can't stall
+ *        the polling thread
+ */
+int listen_on(const char *socket_path)
+{
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+                fprintf(stderr, "serve40: socket path too long\n");
+                return -1;
+        }
+        strcpy(addr.sun_path, socket_path);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (fd < 0) {
+                perror("serve40: socket");
+                return -1;
+        }
+        unlink(socket_path);
+        if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+            listen(fd, LISTEN_BACKLOG) < 0) {
+                perror("serve40: bind");
+                close(fd);
+                return -1;
+        }
+        return fd;
+}
+
+/*
+ * Name: accept_connection
+ * Purpose: accept a waiting client and start watching its socket for requests
+ * Parameters: the server, the listening socket
+ * Returns: none
+ * Notes: does nothing if the client has already gone away
+ */
+void accept_connection(server *srv, int listen_fd)
+{
+        int sock = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (sock < 0) {
+                if (errno != EINTR && errno != ECONNABORTED &&
+                                errno != EAGAIN && errno != EWOULDBLOCK) {
+                        perror("serve40: accept");
+                }
+                return;
+        }
+
+        connection *conn;
+        NEW(conn);
+        conn->sock = sock;
+        conn->have = 0;
+        conn->payload_fd = -1;
+        if (watch_connection(srv, conn, EPOLL_CTL_ADD) < 0) {
+                perror("serve40: epoll_ctl");
+                close_connection(conn);
+        }
+}
+
+/*
+ * Name: read_request
+ * Purpose: read what has arrived of a connection's request, and queue the
+ *          request for a worker once all of it is there
+ * Parameters: the server, a connection whose socket is readable
+ * Returns: none
+ * Notes: never blocks. An extra fd sent with the same request is closed, and
+ *        so is the connection if the client has closed it or it failed
+ */
+void read_request(server *srv, connection *conn)
+{
+        int fd;
+        ssize_t got = recv_some(conn->sock, (char *) &conn->request +
+                                conn->have, sizeof(conn->request) - conn->have,
+                                MSG_DONTWAIT, &fd);
+        if (fd >= 0) {
+                if (conn->payload_fd < 0) {
+                        conn->payload_fd = fd;
+                } else {
+                        close(fd);
+                }
+        }
+        if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+                                                        errno != EINTR)) {
+                close_connection(conn);
+                return;
+        }
+        if (got > 0) {
+                conn->have += got;
+        }
+
+        if (conn->have < sizeof(conn->request)) {
+                if (watch_connection(srv, conn, EPOLL_CTL_MOD) < 0) {
+                        close_connection(conn);
+                }
+                return;
+        }
+        queue_push(&srv->queue, conn);
+}
+
+/*
+ * Name: watch_connection
+ * Purpose: have the polling thread wake up for the next bytes a client sends
+ * Parameters: the server, the connection, EPOLL_CTL_ADD for a new connection
+ *             or EPOLL_CTL_MOD to watch one again
+ * Returns: 0 on success, -1 on failure
+ * Notes: one shot, so a socket stops being watched as soon as it is readable,
+ *        and whoever then owns the connection must watch it again or close it
+ */
+int watch_connection(server *srv, connection *conn, int op)
+{
+        struct epoll_event event = {.events = EPOLLIN | EPOLLONESHOT,
+                                                        .data.ptr = conn};
+        return epoll_ctl(srv->epoll_fd, op, conn->sock, &event);
+}
+
+/*
+ * Name: close_connection
+ * Purpose: close a client's socket and free what was kept for it
+ * Parameters: the connection
+ * Returns: none
+ * Notes: closing the socket also stops epoll watching it
+ */
+void close_connection(connection *conn)
+{
+        if (conn->payload_fd >= 0) {
+                close(conn->payload_fd);
+        }
+        close(conn->sock);
+        FREE(conn);
+}
+
+/*
+ * Name: worker_main
+ * Purpose: take requests off the queue and answer them, forever
+ * Parameters: void pointer to the shared server struct
+ * Returns: never
+ * Notes: after each reply the connection goes back to the polling thread, so
+ *        a worker is only ever busy with a request, never with a client
+ */
+void *worker_main(void *cl)
+{
+        server *srv = cl;
+        for (;;) {
+                connection *conn = queue_pop(&srv->queue);
+                if (answer_request(srv, conn) < 0 ||
+                        watch_connection(srv, conn, EPOLL_CTL_MOD) < 0) {
+                        close_connection(conn);
+                }
+        }
+        return NULL;
+}
+
+/*
+ * Name: answer_request
+ * Purpose: run a connection's request and send the reply
+ * Parameters: the server, a connection holding a complete request
+ * Returns: 0 on success, -1 if the reply couldn't be sent
+ * Notes: a job that fails still gets a reply. The reply is sent without
+ *        blocking, so a client that stops reading its replies is dropped
+ *        rather than holding the worker
+ */
+int answer_request(server *srv, connection *conn)
+{
+        Serve40_reply reply;
+        int result_fd = run_job(srv, &conn->request, conn->payload_fd, &reply);
+        if (conn->payload_fd >= 0) {
+                close(conn->payload_fd);
+                conn->payload_fd = -1;
+        }
+        conn->have = 0;
+
+        int sent = send_with_fd(conn->sock, &reply, sizeof(reply), result_fd,
+                                                                MSG_DONTWAIT);
+        if (result_fd >= 0) {
+                close(result_fd);
+        }
+        return sent;
+}
+
+/*
+ * Name: recv_some
+ * Purpose: read up to len bytes of a message, and the fd sent with them
+ * Parameters: the connected socket, where to store the bytes and how many
+ *             there is room for, recvmsg flags, where to store the fd
+ * Returns: the number of bytes read, 0 if the other end closed the
+ *          connection, -1 on error (errno is set)
+ * Notes: *fd is -1 if no fd came with the bytes
+ */
+ssize_t recv_some(int sock, void *buf, size_t len, int flags, int *fd)
+{
+        union {
+                char buf[CMSG_SPACE(sizeof(int))];
+                struct cmsghdr align;
+        } control;
+        struct iovec iov = {.iov_base = buf, .iov_len = len};
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        *fd = -1;
+        ssize_t got = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC | flags);
+        if (got <= 0) {
+                return got;
+        }
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
+                                        cmsg->cmsg_type == SCM_RIGHTS) {
+                memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+        return got;
+}
+
+/*
+ * Name: recv_with_fd
+ * Purpose: read one fixed size message and the fd sent with it, if any
+ * Parameters: the connected socket, where to store the message and its size,
+ *             where to store the fd
+ * Returns: 1 on success, 0 if the other end closed the connection, -1 on error
+ * Notes: *fd is -1 if no fd came with the message. Blocks until all of the
+ *        message is there
+ */
+int recv_with_fd(int sock, void *buf, size_t len, int *fd)
+{
+        ssize_t got = recv_some(sock, buf, len, 0, fd);
+        if (got <= 0) {
+                return got == 0 ? 0 : -1;
+        }
+
+        /* the message may arrive in more than one piece */
+        size_t have = got;
+        while (have < len) {
+                got = recv(sock, (char *) buf + have, len - have, 0);
+                if (got <= 0) {
+                        if (*fd >= 0) {
+                                close(*fd);
+                                *fd = -1;
+                        }
+                        return -1;
+                }
+                have += got;
+        }
+        return 1;
+}
+
+/*
+ * Name: send_with_fd
+ * Purpose: send one fixed size message, and an fd with it if there is one
+ * Parameters: the connected socket, the message and its size, the fd (or -1),
+ *             sendmsg flags
+ * Returns: 0 on success, -1 on error
+ * Notes: never raises SIGPIPE
+ */
+int send_with_fd(int sock, const void *buf, size_t len, int fd, int flags)
+{
+        union {
+                char buf[CMSG_SPACE(sizeof(int))];
+                struct cmsghdr align;
+        } control;
+        struct iovec iov = {.iov_base = (void *) buf, .iov_len = len};
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        if (fd >= 0) {
+                msg.msg_control = control.buf;
+                msg.msg_controllen = sizeof(control.buf);
+                struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+                cmsg->cmsg_level = SOL_SOCKET;
+                cmsg->cmsg_type = SCM_RIGHTS;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+                memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+        }
+        return sendmsg(sock, &msg, MSG_NOSIGNAL | flags) == (ssize_t) len ? 0
+                                                                        : -1;
+}
+
+/*
+ * Name: run_job
+ * Purpose: map the payload and run the requested job on it
+ * Parameters: the server, the request, the payload fd, where to store the
+ *             reply
+ * Returns: the result fd, or -1 if the job failed (reply->status says why)
+ * Notes: payload_fd is left open for the caller to close. It must be sealed
+ *        against writing, shrinking and growing (CODEC40_EINVAL otherwise):
+ *        the client still has it, and could truncate it under the mapping
+ *        (SIGBUS, killing the daemon) or change the bytes while they are
+ *        decoded and copied into the cache
+ */
+int run_job(server *srv, const Serve40_request *request, int payload_fd,
+                                                        Serve40_reply *reply)
+{
+        memset(reply, 0, sizeof(*reply));
+        reply->status = CODEC40_EINVAL;
+
+        struct stat st;
+        if (payload_fd < 0 || request->length == 0) {
+                return -1;
+        }
+        int seals = fcntl(payload_fd, F_GET_SEALS);
+        if (seals < 0 || (seals & PAYLOAD_SEALS) != PAYLOAD_SEALS) {
+                return -1;
+        }
+        if (fstat(payload_fd, &st) < 0) {
+                reply->status = SERVE40_ESYSTEM;
+                return -1;
+        }
+        if ((uint64_t) st.st_size < request->length) {
+                reply->status = CODEC40_ETRUNCATED;
+                return -1;
+        }
+
+        unsigned char *payload = mmap(NULL, request->length, PROT_READ,
+                                                MAP_SHARED, payload_fd, 0);
+        if (payload == MAP_FAILED) {
+                reply->status = SERVE40_ESYSTEM;
+                return -1;
+        }
+
+        int result_fd = -1;
+        if (request->op == SERVE40_COMPRESS) {
+                result_fd = run_compress(payload, request, reply);
+        } else if (request->op == SERVE40_DECOMPRESS) {
+                result_fd = run_decompress(srv, payload, request, reply);
+        }
+        munmap(payload, request->length);
+        return result_fd;
+}
+
+/*
+ * Name: run_compress
+ * Purpose: compress the rgb triples in a payload into a new memfd
+ * Parameters: the mapped payload, the request, where to store the reply
+ * Returns: the sealed result fd, or -1 on failure
+ * Notes: none
+ */
+int run_compress(const unsigned char *payload, const Serve40_request *request,
+                                                        Serve40_reply *reply)
+{
+        if ((uint64_t) request->width * request->height * 3 >
+                                                        request->length) {
+                reply->status = CODEC40_ETRUNCATED;
+                return -1;
+        }
+
+        size_t cap = Codec40_compressed_size(request->width, request->height);
+        unsigned char *map;
+        int fd = new_result_fd(cap, &map);
+        if (fd < 0) {
+                reply->status = SERVE40_ESYSTEM;
+                return -1;
+        }
+
+        size_t length;
+        reply->status = Codec40_compress(payload, request->width,
+                                request->height, map, cap, &length);
+        if (reply->status != CODEC40_OK ||
+                                seal_result_fd(fd, map, cap, length) < 0) {
+                if (reply->status == CODEC40_OK) {
+                        reply->status = SERVE40_ESYSTEM;
+                } else {
+                        munmap(map, cap);
+                }
+                close(fd);
+                return -1;
+        }
+        reply->length = length;
+        return fd;
+}
+
+/*
+ * Name: run_decompress
+ * Purpose: decompress the image in a payload into a new memfd, or find it in
+ *          the cache
+ * Parameters: the server, the mapped payload, the request, where to store the
+ *             reply
+ * Returns: the sealed result fd, or -1 on failure
+ * Notes: the fd returned from a cache hit is a dup of the cached one
+ */
+int run_decompress(server *srv, const unsigned char *payload,
+                        const Serve40_request *request, Serve40_reply *reply)
+{
+        int fd = cache_lookup(&srv->cache, payload, request->length, reply);
+        if (fd >= 0) {
+                return fd;
+        }
+
+        unsigned width, height;
+        size_t cap;
+        reply->status = Codec40_image_size(payload, request->length, &width,
+                                                                &height);
+        if (reply->status != CODEC40_OK) {
+                return -1;
+        }
+        Codec40_decompressed_size(payload, request->length, &cap);
+
+        unsigned char *map;
+        fd = new_result_fd(cap, &map);
+        if (fd < 0) {
+                reply->status = SERVE40_ESYSTEM;
+                return -1;
+        }
+
+        size_t length;
+        reply->status = Codec40_decompress(payload, request->length, map, cap,
+                                                                &length);
+        if (reply->status != CODEC40_OK ||
+                                seal_result_fd(fd, map, cap, length) < 0) {
+                if (reply->status == CODEC40_OK) {
+                        reply->status = SERVE40_ESYSTEM;
+                } else {
+                        munmap(map, cap);
+                }
+                close(fd);
+                return -1;
+        }
+        reply->width = width;
+        reply->height = height;
+        reply->length = length;
+
+        cache_insert(&srv->cache, payload, request->length, fd, reply);
+        return fd;
+}
+
+/*
+ * Name: new_result_fd
+ * Purpose: make a memfd big enough for a result and map it
+ * Parameters: the size of the result in bytes, where to store the mapping
+ * Returns: the memfd, or -1 on failure
+ * Notes: the memfd allows sealing, see seal_result_fd
+ */
+int new_result_fd(size_t length, unsigned char **map)
+{
+        int fd = memfd_create("comp40", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (fd < 0) {
+                return -1;
+        }
+        if (ftruncate(fd, length) < 0) {
+                close(fd);
+                return -1;
+        }
+        *map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (*map == MAP_FAILED) {
+                close(fd);
+                return -1;
+        }
+        return fd;
+}
+
+/*
+ * Name: seal_result_fd
+ * Purpose: unmap a finished result, trim it to its length and make it read
+ *          only for good, so it can be handed to any number of clients
+ * Parameters: the memfd, its mapping and the mapping's length, the length of
+ *             the result
+ * Returns: 0 on success, -1 on failure
+ * Notes: always unmaps map
+ */
+int seal_result_fd(int fd, unsigned char *map, size_t map_length,
+                                                        size_t length)
+{
+        munmap(map, map_length);
+        if (ftruncate(fd, length) < 0 || fcntl(fd, F_ADD_SEALS, SEALS) < 0) {
+                return -1;
+        }
+        return 0;
+}
+
+/*
+ * Name: queue_push
+ * Purpose: hand a connection with a complete request to the workers
+ * Parameters: the queue, the connection
+ * Returns: none
+ * Notes: wakes one waiting worker
+ */
+void queue_push(job_queue *queue, connection *conn)
+{
+        pthread_mutex_lock(&queue->lock);
+        Seq_addhi(queue->jobs, conn);
+        pthread_cond_signal(&queue->nonempty);
+        pthread_mutex_unlock(&queue->lock);
+}
+
+/*
+ * Name: queue_pop
+ * Purpose: take the oldest waiting request
+ * Parameters: the queue
+ * Returns: the connection it came on
+ * Notes: blocks until there is one
+ */
+connection *queue_pop(job_queue *queue)
+{
+        pthread_mutex_lock(&queue->lock);
+        while (Seq_length(queue->jobs) == 0) {
+                pthread_cond_wait(&queue->nonempty, &queue->lock);
+        }
+        connection *conn = Seq_remlo(queue->jobs);
+        pthread_mutex_unlock(&queue->lock);
+        return conn;
+}
+
+/*
+ * Name: hash_bytes
+ * Purpose: hash a compressed image for the cache (64-bit FNV-1a)
+ * Parameters: the bytes and how many there are
+ * Returns: the hash
+ * Notes: only used to skip most memcmps, equal hashes are still compared
+ */
+uint64_t hash_bytes(const unsigned char *bytes, size_t length)
+{
+        uint64_t hash = 14695981039346656037ULL;
+        for (size_t i = 0; i < length; i++) {
+                hash = (hash ^ bytes[i]) * 1099511628211ULL;
+        }
+        return hash;
+}
+
+/*
+ * Name: cache_lookup
+ * Purpose: find a decoded image in the cache and mark it most recently used
+ * Parameters: the cache, the compressed image, where to store the reply
+ * Returns: a dup of the cached memfd, or -1 on a miss
+ * Notes: does nothing when the cache is off
+ */
+int cache_lookup(lru_cache *cache, const unsigned char *key, size_t key_len,
+                                                        Serve40_reply *reply)
+{
+        if (cache->capacity == 0) {
+                return -1;
+        }
+
+        uint64_t hash = hash_bytes(key, key_len);
+        int fd = -1;
+        pthread_mutex_lock(&cache->lock);
+        for (cache_entry *entry = cache->head; entry != NULL;
+                                                entry = entry->next) {
+                if (entry->hash == hash && entry->key_len == key_len &&
+                                memcmp(entry->key, key, key_len) == 0) {
+                        fd = fcntl(entry->fd, F_DUPFD_CLOEXEC, 0);
+                        if (fd >= 0) {
+                                *reply = entry->reply;
+                                cache_unlink(cache, entry);
+                                cache_push_front(cache, entry);
+                        }
+                        break;
+                }
+        }
+        pthread_mutex_unlock(&cache->lock);
+        return fd;
+}
+
+/*
+ * Name: cache_insert
+ * Purpose: add a decoded image to the cache, evicting the least recently used
+ *          one if the cache is full
+ * Parameters: the cache, the compressed image, the sealed result fd, and the
+ *             reply that goes with it
+ * Returns: none
+ * Notes: the cache keeps its own dup of fd. Does nothing when the cache is off
+ */
+void cache_insert(lru_cache *cache, const unsigned char *key, size_t key_len,
+                                        int fd, const Serve40_reply *reply)
+{
+        if (cache->capacity == 0) {
+                return;
+        }
+        int own_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (own_fd < 0) {
+                return;
+        }
+
+        cache_entry *entry;
+        NEW(entry);
+        entry->hash = hash_bytes(key, key_len);
+        entry->key = ALLOC(key_len);
+        memcpy(entry->key, key, key_len);
+        entry->key_len = key_len;
+        entry->fd = own_fd;
+        entry->reply = *reply;
+
+        pthread_mutex_lock(&cache->lock);
+        cache_push_front(cache, entry);
+        cache_entry *evicted = NULL;
+        if (cache->length > cache->capacity) {
+                evicted = cache->tail;
+                cache_unlink(cache, evicted);
+        }
+        pthread_mutex_unlock(&cache->lock);
+
+        if (evicted != NULL) {
+                close(evicted->fd);
+                FREE(evicted->key);
+                FREE(evicted);
+        }
+}
+
+/*
+ * Name: cache_unlink
+ * Purpose: take an entry out of the recently used list
+ * Parameters: the cache, the entry
+ * Returns: none
+ * Notes: the cache lock must be held
+ */
+void cache_unlink(lru_cache *cache, cache_entry *entry)
+{
+        if (entry->prev != NULL) {
+                entry->prev->next = entry->next;
+        } else {
+                cache->head = entry->next;
+        }
+        if (entry->next != NULL) {
+                entry->next->prev = entry->prev;
+        } else {
+                cache->tail = entry->prev;
+        }
+        cache->length--;
+}
+
+/*
+ * Name: cache_push_front
+ * Purpose: put an entry at the most recently used end of the list
+ * Parameters: the cache, the entry
+ * Returns: none
+ * Notes: the cache lock must be held
+ */
+void cache_push_front(lru_cache *cache, cache_entry *entry)
+{
+        entry->prev = NULL;
+        entry->next = cache->head;
+        if (cache->head != NULL) {
+                cache->head->prev = entry;
+        } else {
+                cache->tail = entry;
+        }
+        cache->head = entry;
+        cache->length++;
+}
+
+/*
+ * Name: Serve40_connect
+ * Purpose: connect to a running codec daemon
+ * Parameters: the path of its socket
+ * Returns: the connected socket, or -1 on failure (errno is set)
+ * Notes: the same socket can be used for any number of jobs
+ */
+int Serve40_connect(const char *socket_path)
+{
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (socket_path == NULL ||
+                        strlen(socket_path) >= sizeof(addr.sun_path)) {
+                errno = EINVAL;
+                return -1;
+        }
+        strcpy(addr.sun_path, socket_path);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+                return -1;
+        }
+        if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+                close(fd);
+                return -1;
+        }
+        return fd;
+}
+
+/*
+ * Name: Serve40_submit
+ * Purpose: send one job to the daemon and wait for its reply
+ * Parameters: the connected socket, the request, a memfd holding
+ *             request->length bytes of payload and sealed with F_SEAL_SHRINK,
+ *             F_SEAL_GROW and F_SEAL_WRITE, where to store the reply and the
+ *             result fd
+ * Returns: 0 if a reply came back (check reply->status), -1 if the socket
+ *          failed
+ * Notes: *result_fd is -1 unless reply->status is CODEC40_OK, in which case
+ *        the caller must close it
+ */
+int Serve40_submit(int sock, const Serve40_request *request, int payload_fd,
+                                        Serve40_reply *reply, int *result_fd)
+{
+        assert(request != NULL && reply != NULL && result_fd != NULL);
+        *result_fd = -1;
+
+        if (send_with_fd(sock, request, sizeof(*request), payload_fd, 0) < 0) {
+                return -1;
+        }
+        return recv_with_fd(sock, reply, sizeof(*reply), result_fd) > 0 ? 0
+                                                                        : -1;
+}
+
+#undef LISTEN_BACKLOG
+#undef MAX_EVENTS
+#undef SEALS
+#undef PAYLOAD_SEALS
@@ -0,0 +1,67 @@
+/**************************************************************
+ *
+ *                     serve40.h
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  Interface for the long running codec daemon
+ *               (40image --serve) and for clients talking to it.
+ *
+ *               Protocol: a client connects to the Unix domain
+ *               socket and sends any number of jobs, one at a
+ *               time. A job is one Serve40_request struct, sent
+ *               together with a memfd (SCM_RIGHTS) holding the
+ *               payload. The payload is never copied through the
+ *               socket, so the memfd must be sealed with
+ *               F_SEAL_SHRINK, F_SEAL_GROW and F_SEAL_WRITE, or the
+ *               job fails with CODEC40_EINVAL. Jobs from all
+ *               clients share the daemon's workers, so an idle
+ *               connection holds none. Each job is answered with one
+ *               Serve40_reply, sent together with a sealed
+ *               (read only) memfd holding the result when the
+ *               status is CODEC40_OK.
+ *
+ *               Compress jobs carry 8-bit rgb triples and their
+ *               width and height, and return a compressed image.
+ *               Decompress jobs carry a compressed image and
+ *               return rgb triples plus the width and height.
+ *
+ **************************************************************/
+
+#ifndef SERVE40_INCLUDED
+#define SERVE40_INCLUDED
+
+#include <stdint.h>
+
+#define SERVE40_COMPRESS 1
+#define SERVE40_DECOMPRESS 2
+
+/* reply status for a failed system call; every other status is a
+ * Codec40_status */
+#define SERVE40_ESYSTEM -1
+
+typedef struct Serve40_request {
+        uint32_t op;            /* SERVE40_COMPRESS or SERVE40_DECOMPRESS */
+        uint32_t width;         /* compress only */
+        uint32_t height;        /* compress only */
+        uint64_t length;        /* payload bytes in the memfd */
+} Serve40_request;
+
+typedef struct Serve40_reply {
+        int32_t status;         /* Codec40_status or SERVE40_ESYSTEM */
+        uint32_t width;         /* decompress only */
+        uint32_t height;        /* decompress only */
+        uint64_t length;        /* result bytes in the memfd */
+} Serve40_reply;
+
+/* server side */
+int serve40(const char *socket_path, unsigned workers, unsigned cache_size);
+
+/* client side */
+int Serve40_connect(const char *socket_path);
+int Serve40_submit(int sock, const Serve40_request *request, int payload_fd,
+                                        Serve40_reply *reply, int *result_fd);
+
+#endif
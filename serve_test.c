@@ -0,0 +1,202 @@
+#define _GNU_SOURCE
+
+#include "serve40.h"
+#include "codec40.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "assert.h"
+
+#define WIDTH 16
+#define HEIGHT 12
+#define WORKERS 2
+#define CLIENTS 4
+#define JOBS 8
+#define TIMEOUT 5       /* seconds a client waits for a reply */
+
+static char socket_path[64];
+static unsigned char rgb[WIDTH * HEIGHT * 3];
+
+/* Helper functions */
+int connect_client(void);
+int new_payload(const unsigned char *bytes, size_t length, bool sealed);
+void compress_job(int sock, int payload, Serve40_reply *reply, int *result);
+void *busy_client(void *cl);
+
+/*
+ * A daemon with two workers and two idle clients (one connected and silent,
+ * one halfway through sending a request) must still answer a third client,
+ * and clients working at once must all be answered. An unsealed payload is
+ * refused, since the client could truncate it under the daemon's mapping.
+ */
+int main() {
+        snprintf(socket_path, sizeof(socket_path), "/tmp/serve_test.%d",
+                                                                (int) getpid());
+        for (size_t i = 0; i < sizeof(rgb); i++) {
+                rgb[i] = (i * 7) % 251;
+        }
+
+        pid_t daemon = fork();
+        assert(daemon >= 0);
+        if (daemon == 0) {
+                /* don't outlive a failed test */
+                prctl(PR_SET_PDEATHSIG, SIGKILL);
+                serve40(socket_path, WORKERS, 4);
+                _exit(EXIT_FAILURE);
+        }
+
+        int idle = connect_client();
+        int half = connect_client();
+        Serve40_request request = {.op = SERVE40_COMPRESS, .width = WIDTH,
+                                .height = HEIGHT, .length = sizeof(rgb)};
+        assert(send(half, &request, sizeof(request) / 2, 0) ==
+                                        (ssize_t) sizeof(request) / 2);
+
+        /* the third client, then its result decoded on the same connection */
+        int client = connect_client();
+        int payload = new_payload(rgb, sizeof(rgb), true);
+        Serve40_reply reply;
+        int compressed;
+        compress_job(client, payload, &reply, &compressed);
+        assert(reply.status == CODEC40_OK && compressed >= 0);
+        close(payload);
+
+        request = (Serve40_request) {.op = SERVE40_DECOMPRESS,
+                                                .length = reply.length};
+        int decoded;
+        assert(Serve40_submit(client, &request, compressed, &reply,
+                                                        &decoded) == 0);
+        assert(reply.status == CODEC40_OK && decoded >= 0);
+        assert(reply.width == WIDTH && reply.height == HEIGHT &&
+                                                reply.length == sizeof(rgb));
+        close(decoded);
+        close(compressed);
+
+        /* an unsealed payload */
+        payload = new_payload(rgb, sizeof(rgb), false);
+        int result;
+        compress_job(client, payload, &reply, &result);
+        assert(reply.status == CODEC40_EINVAL && result == -1);
+        close(payload);
+
+        /* clients at once, more of them than workers */
+        pthread_t threads[CLIENTS];
+        for (int i = 0; i < CLIENTS; i++) {
+                assert(pthread_create(&threads[i], NULL, busy_client,
+                                                                NULL) == 0);
+        }
+        for (int i = 0; i < CLIENTS; i++) {
+                pthread_join(threads[i], NULL);
+        }
+
+        close(client);
+        close(half);
+        close(idle);
+        kill(daemon, SIGTERM);
+        waitpid(daemon, NULL, 0);
+        unlink(socket_path);
+        printf("serve_test: ok\n");
+        return 0;
+}
+
+/*
+ * Name: connect_client
+ * Purpose: connect to the daemon, waiting for it to start listening
+ * Parameters: none
+ * Returns: the connected socket, which gives up on a reply after TIMEOUT
+ *          seconds
+ * Notes: fails the test if the daemon isn't listening within a few seconds
+ */
+int connect_client(void)
+{
+        int sock = -1;
+        for (int tries = 0; sock < 0 && tries < 500; tries++) {
+                sock = Serve40_connect(socket_path);
+                if (sock < 0) {
+                        usleep(10000);
+                }
+        }
+        assert(sock >= 0);
+
+        struct timeval timeout = {.tv_sec = TIMEOUT};
+        assert(setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                                                sizeof(timeout)) == 0);
+        return sock;
+}
+
+/*
+ * Name: new_payload
+ * Purpose: put bytes in a memfd to send to the daemon
+ * Parameters: the bytes and how many there are, whether to seal the memfd
+ *             against writing, shrinking and growing
+ * Returns: the memfd
+ * Notes: none
+ */
+int new_payload(const unsigned char *bytes, size_t length, bool sealed)
+{
+        int fd = memfd_create("serve_test", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        assert(fd >= 0);
+        assert(write(fd, bytes, length) == (ssize_t) length);
+        if (sealed) {
+                assert(fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+                                                        F_SEAL_WRITE) == 0);
+        }
+        return fd;
+}
+
+/*
+ * Name: compress_job
+ * Purpose: have the daemon compress the test image
+ * Parameters: the connected socket, a memfd holding the image's rgb triples,
+ *             where to store the reply and the result fd
+ * Returns: none
+ * Notes: fails the test if no reply comes back in time
+ */
+void compress_job(int sock, int payload, Serve40_reply *reply, int *result)
+{
+        Serve40_request request = {.op = SERVE40_COMPRESS, .width = WIDTH,
+                                .height = HEIGHT, .length = sizeof(rgb)};
+        assert(Serve40_submit(sock, &request, payload, reply, result) == 0);
+}
+
+/*
+ * Name: busy_client
+ * Purpose: compress the test image JOBS times on a connection of its own
+ * Parameters: unused
+ * Returns: NULL
+ * Notes: run by several threads at once
+ */
+void *busy_client(void *cl)
+{
+        (void) cl;
+        int sock = connect_client();
+        int payload = new_payload(rgb, sizeof(rgb), true);
+        for (int i = 0; i < JOBS; i++) {
+                Serve40_reply reply;
+                int result;
+                compress_job(sock, payload, &reply, &result);
+                assert(reply.status == CODEC40_OK && result >= 0);
+                close(result);
+        }
+        close(payload);
+        close(sock);
+        return NULL;
+}
+
+#undef WIDTH
+#undef HEIGHT
+#undef WORKERS
+#undef CLIENTS
+#undef JOBS
+#undef TIMEOUT
@@ -0,0 +1,126 @@
+#include "container40.h"
+#include "compress.h"
+#include "codec40.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "assert.h"
+
+/* Helper functions */
+void check_clean_failure(const char *image40, const char *header);
+
+/*
+ * Size math on images far past 2^32 pixels. Nothing here allocates pixels: a
+ * whole-slide sized image is just a header, and for format 3 its tile index,
+ * which is all the size functions look at. Then "size_test [40image]" (by
+ * default ./40image-6) decodes files whose headers claim huge images but hold
+ * a few bytes, which must fail cleanly rather than trying to allocate what
+ * the header says.
+ */
+int main(int argc, char *argv[]) {
+        /* 100000 x 50000, 5 gigapixels, in 1024 pixel tiles */
+        comp40_header big = {.version = COMP40_TILED, .width = 100000,
+                .height = 50000, .tile_size = 1024, .block_size = 2};
+        assert(comp40_tiles_across(&big) == 98);
+        assert(comp40_tiles_down(&big) == 49);
+        assert(comp40_index_size(&big) == (size_t) 98 * 49 *
+                                                COMP40_TILE_ENTRY_SIZE);
+
+        unsigned first_col, first_row, cols, rows;
+        comp40_tile_blocks(&big, 97, 48, &first_col, &first_row, &cols, &rows);
+        assert(first_col == 97 * 512 && cols == 50000 - 97 * 512);
+        assert(first_row == 48 * 512 && rows == 25000 - 48 * 512);
+
+        /* 2.5 G codewords of 4 bytes, more than 32 bits can count */
+        size_t header_size = write_comp40_header(NULL, 0, &(comp40_header) {
+                .version = COMP40_FLAT, .width = 100000, .height = 50000,
+                .block_size = 2});
+        assert(compressed_size(100000, 50000) ==
+                                header_size + (size_t) 50000 * 25000 * 4);
+        assert(compressed_size(INT_MAX, INT_MAX) > (size_t) UINT32_MAX * 4);
+
+        /* the header and index of a 5 gigapixel image are enough to size it */
+        char text[COMP40_MAX_HEADER_LENGTH];
+        int length = write_comp40_header(text, sizeof(text), &big);
+        size_t in_len = length + comp40_index_size(&big);
+        unsigned char *in = calloc(in_len, 1);
+        assert(in != NULL);
+        memcpy(in, text, length);
+        size_t rgb_size;
+        assert(Codec40_decompressed_size(in, in_len, &rgb_size) == CODEC40_OK);
+        assert(rgb_size == (size_t) 100000 * 50000 * 3);
+        free(in);
+
+        /* sizes the arrays can't index, and indexes too big to size */
+        comp40_header parsed;
+        const char *too_wide = "COMP40 Compressed image format 2\n"
+                                                "2147483648 2\n";
+        assert(parse_comp40_header((const unsigned char *) too_wide,
+                strlen(too_wide), &parsed) == CODEC40_EFORMAT);
+        const char *widest = "COMP40 Compressed image format 3\n"
+                                "2147483647 2147483647\ntile=1024\n";
+        assert(parse_comp40_header((const unsigned char *) widest,
+                strlen(widest), &parsed) == CODEC40_OK);
+        assert(comp40_tiles_across(&parsed) == 2097152);
+        const char *tiny_tiles = "COMP40 Compressed image format 3\n"
+                                "2147483647 2147483647\ntile=2\n";
+        assert(parse_comp40_header((const unsigned char *) tiny_tiles,
+                strlen(tiny_tiles), &parsed) == CODEC40_EFORMAT);
+
+        /* tiles whose raw length would overflow an index entry's 32 bits */
+        const char *largest_tiles = "COMP40 Compressed image format 3\n"
+                                "65536 65536\ntile=32768 profile=1\n";
+        assert(parse_comp40_header((const unsigned char *) largest_tiles,
+                strlen(largest_tiles), &parsed) == CODEC40_OK);
+        const char *huge_tiles = "COMP40 Compressed image format 3\n"
+                                "65536 65536\ntile=32770\n";
+        assert(parse_comp40_header((const unsigned char *) huge_tiles,
+                strlen(huge_tiles), &parsed) == CODEC40_EFORMAT);
+
+        const char *image40 = argc > 1 ? argv[1] : "./40image-6";
+        check_clean_failure(image40, "COMP40 Compressed image format 2\n"
+                                                "2000000000 2000000000\n");
+        check_clean_failure(image40, "COMP40 Compressed image format 3\n"
+                                        "2000000000 2000000000\ntile=256\n");
+
+        printf("size_test: ok\n");
+        return 0;
+}
+
+/*
+ * Name: check_clean_failure
+ * Purpose: run "40image -d" on a header followed by a few bytes, from a file
+ *          and from a pipe, and check that it exits with EXIT_FAILURE (not a
+ *          signal, as it would after an uncaught exception)
+ * Parameters: the 40image program, the header
+ * Returns: none
+ * Notes: fails the test if 40image can't be run
+ */
+void check_clean_failure(const char *image40, const char *header)
+{
+        char path[] = "/tmp/size_test.XXXXXX";
+        int fd = mkstemp(path);
+        assert(fd >= 0);
+        FILE *file = fdopen(fd, "wb");
+        assert(file != NULL);
+        fprintf(file, "%sxyz", header);
+        fclose(file);
+
+        /* a pipe can't be measured, so it takes a different path */
+        char commands[2][256];
+        snprintf(commands[0], sizeof(commands[0]), "%s -d %s >/dev/null 2>&1",
+                                                                image40, path);
+        snprintf(commands[1], sizeof(commands[1]),
+                        "cat %s | %s -d >/dev/null 2>&1", path, image40);
+        for (int i = 0; i < 2; i++) {
+                int status = system(commands[i]);
+                assert(status != -1 && WIFEXITED(status));
+                assert(WEXITSTATUS(status) == EXIT_FAILURE);
+        }
+        unlink(path);
+}
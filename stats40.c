@@ -0,0 +1,169 @@
+/**************************************************************
+ *
+ *                     stats40.c
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  Implementation of pipeline stage timing and the
+ *               allocation counters the Mem wrappers add to.
+ *
+ **************************************************************/
+
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <assert.h>
+#include "stats40.h"
+
+/* ru_maxrss is in kilobytes on Linux */
+#define RSS_UNIT 1024
+
+/* Allocation counters, shared by every thread */
+static uint64_t allocations = 0;
+static uint64_t frees = 0;
+static uint64_t bytes_allocated = 0;
+
+/* Helper functions */
+static void read_counters(Codec40_stage_stats *now);
+static double seconds(clockid_t clock);
+static void add_stage(Codec40_stage_stats *sum,
+                        const Codec40_stage_stats *now,
+                        const Codec40_stage_stats *mark);
+
+/*
+ * Name: stats40_start
+ * Purpose: start timing a run
+ * Parameters: the run (NULL for none)
+ * Returns: none
+ * Notes: any stats already in the run are cleared
+ */
+void stats40_start(Codec40_run_stats *run)
+{
+        if (run == NULL) {
+                return;
+        }
+        memset(run, 0, sizeof(*run));
+        run->total.name = "total";
+        read_counters(&run->mark);
+}
+
+/*
+ * Name: stats40_stage
+ * Purpose: finish timing a stage of a run
+ * Parameters: the run (NULL for none), the name of the stage that just ran
+ * Returns: none
+ * Notes: everything since stats40_start or the last stats40_stage is charged
+ *        to the stage, and the next stage starts now. A name that was used
+ *        before adds to that stage, so at most CODEC40_MAX_STAGES names can
+ *        be used in one run
+ */
+void stats40_stage(Codec40_run_stats *run, const char *name)
+{
+        if (run == NULL) {
+                return;
+        }
+        Codec40_stage_stats now;
+        read_counters(&now);
+
+        unsigned i = 0;
+        while (i < run->stages && strcmp(run->stage[i].name, name) != 0) {
+                i++;
+        }
+        if (i == run->stages) {
+                assert(run->stages < CODEC40_MAX_STAGES);
+                run->stage[run->stages++].name = name;
+        }
+        add_stage(&run->stage[i], &now, &run->mark);
+        add_stage(&run->total, &now, &run->mark);
+        run->mark = now;
+}
+
+/*
+ * Name: stats40_count_alloc
+ * Purpose: count one allocation
+ * Parameters: the number of bytes asked for
+ * Returns: none
+ * Notes: called by the Mem wrappers, from any thread
+ */
+void stats40_count_alloc(long nbytes)
+{
+        __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&bytes_allocated, nbytes > 0 ? nbytes : 0,
+                                                        __ATOMIC_RELAXED);
+}
+
+/*
+ * Name: stats40_count_free
+ * Purpose: count one free
+ * Parameters: none
+ * Returns: none
+ * Notes: called by the Mem wrappers, from any thread
+ */
+void stats40_count_free(void)
+{
+        __atomic_add_fetch(&frees, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Name: read_counters
+ * Purpose: read the clocks, the allocation counters and the peak RSS
+ * Parameters: where to store them (in the fields of a stage, but as totals
+ *             since an arbitrary start rather than what a stage cost)
+ * Returns: none
+ * Notes: none
+ */
+static void read_counters(Codec40_stage_stats *now)
+{
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        *now = (Codec40_stage_stats) {
+                .name = NULL,
+                .wall_seconds = seconds(CLOCK_MONOTONIC),
+                .cpu_seconds = seconds(CLOCK_PROCESS_CPUTIME_ID),
+                .allocations = __atomic_load_n(&allocations,
+                                                        __ATOMIC_RELAXED),
+                .frees = __atomic_load_n(&frees, __ATOMIC_RELAXED),
+                .bytes_allocated = __atomic_load_n(&bytes_allocated,
+                                                        __ATOMIC_RELAXED),
+                .peak_rss_bytes = (uint64_t) usage.ru_maxrss * RSS_UNIT
+        };
+}
+
+/*
+ * Name: seconds
+ * Purpose: read a clock
+ * Parameters: the clock
+ * Returns: its time in seconds
+ * Notes: none
+ */
+static double seconds(clockid_t clock)
+{
+        struct timespec time;
+        clock_gettime(clock, &time);
+        return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/*
+ * Name: add_stage
+ * Purpose: add what was done between two readings to a stage
+ * Parameters: the stage, the reading now and the reading it started at
+ * Returns: none
+ * Notes: the peak RSS is a high water mark, so it is kept, not added
+ */
+static void add_stage(Codec40_stage_stats *sum,
+                        const Codec40_stage_stats *now,
+                        const Codec40_stage_stats *mark)
+{
+        sum->wall_seconds += now->wall_seconds - mark->wall_seconds;
+        sum->cpu_seconds += now->cpu_seconds - mark->cpu_seconds;
+        sum->allocations += now->allocations - mark->allocations;
+        sum->frees += now->frees - mark->frees;
+        sum->bytes_allocated += now->bytes_allocated - mark->bytes_allocated;
+        if (now->peak_rss_bytes > sum->peak_rss_bytes) {
+                sum->peak_rss_bytes = now->peak_rss_bytes;
+        }
+}
+
+#undef RSS_UNIT
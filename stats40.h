@@ -0,0 +1,36 @@
+/**************************************************************
+ *
+ *                     stats40.h
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  Interface for timing the stages of a pipeline.
+ *               A run is started once, and then marked after
+ *               each stage with the stage's name. The wall and
+ *               CPU time, the allocations and the peak resident
+ *               set size since the last mark are added to that
+ *               stage and to the run's total. A NULL run makes
+ *               every call do nothing, so the stages can always
+ *               be marked.
+ *
+ *               Allocations are counted by alloc40.c, which wraps
+ *               the Mem interface. It is only linked in when the
+ *               program is linked with ALLOC40_WRAP (see the
+ *               Makefile); otherwise the counts stay at 0.
+ *
+ **************************************************************/
+
+#ifndef STATS40_INCLUDED
+#define STATS40_INCLUDED
+
+#include "codec40.h"
+
+void stats40_start(Codec40_run_stats *run);
+void stats40_stage(Codec40_run_stats *run, const char *name);
+
+void stats40_count_alloc(long nbytes);
+void stats40_count_free(void);
+
+#endif
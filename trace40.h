@@ -0,0 +1,77 @@
+/**************************************************************
+ *
+ *                     trace40.h
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  Static tracepoints (USDT probes) in the codec,
+ *               for perf, bpftrace or SystemTap to attach to in a
+ *               running 40image, libcodec40 user or daemon. All
+ *               of them are in the codec40 provider:
+ *
+ *                 stage__entry(stage, width, height)
+ *                 stage__exit(stage, width, height, bytes)
+ *                 block__row(stage, row, rows)
+ *                 flush(stage, bytes)
+ *
+ *               stage is the name of the compress.c or
+ *               decompress.c function (a string). width and
+ *               height are the size of the array the stage reads,
+ *               in pixels or, for stages that work on codewords,
+ *               blocks. bytes is the size of what the stage made:
+ *               the array it returns, or the bytes it wrote. A
+ *               block row fires when row (of rows) of blocks is
+ *               done (by a tiled stage, once per row of tiles,
+ *               with the last block row the tiles cover), and a
+ *               flush when a buffer of bytes is handed to stdio
+ *               or the caller.
+ *
+ *               With <sys/sdt.h> (systemtap-sdt-dev) each probe is
+ *               a single nop plus a note in the ELF file, so they
+ *               cost nothing until a tracer attaches. Without it,
+ *               or built with -DTRACE40_DISABLE, they compile to
+ *               nothing at all.
+ *
+ **************************************************************/
+
+#ifndef TRACE40_INCLUDED
+#define TRACE40_INCLUDED
+
+#if !defined(TRACE40_DISABLE) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TRACE40_ENABLED 1
+#endif
+#endif
+
+#ifdef TRACE40_ENABLED
+
+#define TRACE40_STAGE_ENTRY(stage, width, height) \
+        DTRACE_PROBE3(codec40, stage__entry, stage, width, height)
+#define TRACE40_STAGE_EXIT(stage, width, height, bytes) \
+        DTRACE_PROBE4(codec40, stage__exit, stage, width, height, bytes)
+#define TRACE40_BLOCK_ROW(stage, row, rows) \
+        DTRACE_PROBE3(codec40, block__row, stage, row, rows)
+#define TRACE40_FLUSH(stage, bytes) \
+        DTRACE_PROBE2(codec40, flush, stage, bytes)
+
+#else
+
+/* sizeof keeps the arguments "used" without evaluating them */
+#define TRACE40_STAGE_ENTRY(stage, width, height) \
+        do { (void) sizeof(stage); (void) sizeof(width); \
+             (void) sizeof(height); } while (0)
+#define TRACE40_STAGE_EXIT(stage, width, height, bytes) \
+        do { (void) sizeof(stage); (void) sizeof(width); \
+             (void) sizeof(height); (void) sizeof(bytes); } while (0)
+#define TRACE40_BLOCK_ROW(stage, row, rows) \
+        do { (void) sizeof(stage); (void) sizeof(row); \
+             (void) sizeof(rows); } while (0)
+#define TRACE40_FLUSH(stage, bytes) \
+        do { (void) sizeof(stage); (void) sizeof(bytes); } while (0)
+
+#endif
+
+#endif
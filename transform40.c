@@ -0,0 +1,213 @@
+/**************************************************************
+ *
+ *                     transform40.c
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  Implementation of the forward and inverse block
+ *               transforms for 2x2, 4x4 and 8x8 blocks.
+ *
+ **************************************************************/
+
+#include <stddef.h>
+#include <assert.h>
+#include "transform40.h"
+
+/*
+ * Lowest frequency DCT-II basis vector for each block size, -sqrt(2) *
+ * cos((2x + 1) * pi / 2n), so that its squares add up to n. Negated so that,
+ * like the Haar transform, a positive coefficient means brighter to the right
+ * (or bottom)
+ */
+static const float basis_4[4] = {
+        -1.3065630, -0.5411961, 0.5411961, 1.3065630
+};
+static const float basis_8[8] = {
+        -1.3870398, -1.1758756, -0.7856950, -0.2758994,
+        0.2758994, 0.7856950, 1.1758756, 1.3870398
+};
+
+/* Helper functions */
+void forward_2(const float *luma, comp_avg_floats *coeffs);
+void inverse_2(const comp_avg_floats *coeffs, float *luma);
+void forward_4(const float *luma, comp_avg_floats *coeffs);
+void inverse_4(const comp_avg_floats *coeffs, float *luma);
+void forward_8(const float *luma, comp_avg_floats *coeffs);
+void inverse_8(const comp_avg_floats *coeffs, float *luma);
+static inline void forward_n(const float *luma, unsigned n,
+                                const float *basis, comp_avg_floats *coeffs);
+static inline void inverse_n(const comp_avg_floats *coeffs, unsigned n,
+                                const float *basis, float *luma);
+
+/*
+ * Name: transform40_forward
+ * Purpose: find the a, b, c and d of one block
+ * Parameters: the block's luma, row major, its width (and height) in pixels,
+ *             and where to store the coefficients
+ * Returns: none
+ * Notes: luma and coeffs must not be NULL, block_size must be 2, 4 or 8. Only
+ *        a, b, c and d of coeffs are set, and they are not clamped
+ */
+void transform40_forward(const float *luma, unsigned block_size,
+                                                comp_avg_floats *coeffs)
+{
+        assert(luma != NULL && coeffs != NULL);
+        switch (block_size) {
+        case 2:
+                forward_2(luma, coeffs);
+                break;
+        case 4:
+                forward_4(luma, coeffs);
+                break;
+        case 8:
+                forward_8(luma, coeffs);
+                break;
+        default:
+                assert(0);
+        }
+}
+
+/*
+ * Name: transform40_inverse
+ * Purpose: rebuild the luma of one block from its a, b, c and d
+ * Parameters: the coefficients, the block's width (and height) in pixels, and
+ *             where to store its luma, row major
+ * Returns: none
+ * Notes: coeffs and luma must not be NULL, block_size must be 2, 4 or 8. The
+ *        luma is not clamped
+ */
+void transform40_inverse(const comp_avg_floats *coeffs, unsigned block_size,
+                                                                float *luma)
+{
+        assert(coeffs != NULL && luma != NULL);
+        switch (block_size) {
+        case 2:
+                inverse_2(coeffs, luma);
+                break;
+        case 4:
+                inverse_4(coeffs, luma);
+                break;
+        case 8:
+                inverse_8(coeffs, luma);
+                break;
+        default:
+                assert(0);
+        }
+}
+
+/*
+ * Name: forward_2
+ * Purpose: the 2x2 kernel - the Haar transform of the original format
+ * Parameters: the block's 4 luma values, where to store the coefficients
+ * Returns: none
+ * Notes: written out by hand, in the same order of operations as it always
+ *        was, so 2x2 files come out bit for bit the same
+ */
+void forward_2(const float *luma, comp_avg_floats *coeffs)
+{
+        float y1 = luma[0], y2 = luma[1], y3 = luma[2], y4 = luma[3];
+        coeffs->a = (y4 + y3 + y2 + y1) / 4;
+        coeffs->b = (y4 + y3 - y2 - y1) / 4;
+        coeffs->c = (y4 - y3 + y2 - y1) / 4;
+        coeffs->d = (y4 - y3 - y2 + y1) / 4;
+}
+
+/*
+ * Name: inverse_2
+ * Purpose: the inverse 2x2 kernel
+ * Parameters: the coefficients, where to store the block's 4 luma values
+ * Returns: none
+ * Notes: none
+ */
+void inverse_2(const comp_avg_floats *coeffs, float *luma)
+{
+        float a = coeffs->a, b = coeffs->b, c = coeffs->c, d = coeffs->d;
+        luma[0] = a - b - c + d;
+        luma[1] = a - b + c - d;
+        luma[2] = a + b - c - d;
+        luma[3] = a + b + c + d;
+}
+
+/*
+ * Name: forward_4, inverse_4, forward_8, inverse_8
+ * Purpose: the 4x4 and 8x8 kernels
+ * Parameters: as for forward_2 and inverse_2, with 16 or 64 luma values
+ * Returns: none
+ * Notes: each passes a constant size and basis to the inlined general kernel,
+ *        so the compiler can unroll its loops for that size
+ */
+void forward_4(const float *luma, comp_avg_floats *coeffs)
+{
+        forward_n(luma, 4, basis_4, coeffs);
+}
+
+void inverse_4(const comp_avg_floats *coeffs, float *luma)
+{
+        inverse_n(coeffs, 4, basis_4, luma);
+}
+
+void forward_8(const float *luma, comp_avg_floats *coeffs)
+{
+        forward_n(luma, 8, basis_8, coeffs);
+}
+
+void inverse_8(const comp_avg_floats *coeffs, float *luma)
+{
+        inverse_n(coeffs, 8, basis_8, luma);
+}
+
+/*
+ * Name: forward_n
+ * Purpose: find the DC and the three lowest frequency DCT coefficients of an
+ *          n x n block
+ * Parameters: the block's luma, its size, the basis vector for that size, and
+ *             where to store the coefficients
+ * Returns: none
+ * Notes: the transform is separable, so each row is summed plain and weighted
+ *        by the basis once, and those sums are then combined down the rows
+ */
+static inline void forward_n(const float *luma, unsigned n,
+                                const float *basis, comp_avg_floats *coeffs)
+{
+        float a = 0, b = 0, c = 0, d = 0;
+        for (unsigned y = 0; y < n; y++) {
+                float row_sum = 0;
+                float row_weighted = 0;
+                for (unsigned x = 0; x < n; x++) {
+                        row_sum += luma[y * n + x];
+                        row_weighted += luma[y * n + x] * basis[x];
+                }
+                a += row_sum;
+                b += row_sum * basis[y];
+                c += row_weighted;
+                d += row_weighted * basis[y];
+        }
+        coeffs->a = a / (n * n);
+        coeffs->b = b / (n * n);
+        coeffs->c = c / (n * n);
+        coeffs->d = d / (n * n);
+}
+
+/*
+ * Name: inverse_n
+ * Purpose: rebuild an n x n block from its DC and three lowest frequency DCT
+ *          coefficients
+ * Parameters: the coefficients, the block size, the basis vector for that
+ *             size, and where to store the block's luma
+ * Returns: none
+ * Notes: each row is a straight line in the basis, a + b * v(y) plus
+ *        (c + d * v(y)) times the basis
+ */
+static inline void inverse_n(const comp_avg_floats *coeffs, unsigned n,
+                                const float *basis, float *luma)
+{
+        for (unsigned y = 0; y < n; y++) {
+                float base = coeffs->a + coeffs->b * basis[y];
+                float slope = coeffs->c + coeffs->d * basis[y];
+                for (unsigned x = 0; x < n; x++) {
+                        luma[y * n + x] = base + slope * basis[x];
+                }
+        }
+}
@@ -0,0 +1,35 @@
+/**************************************************************
+ *
+ *                     transform40.h
+ *
+ *     Assignment: arith
+ *     Authors:  Adam Weiss and Auriel Wish
+ *     Date:     3/7/2023
+ *
+ *     Purpose:  Interface for the block transform: turning the
+ *               luma of one square block into the a, b, c and d
+ *               a codeword holds, and back. For a block of n x n
+ *               pixels they are the DC and the three lowest
+ *               frequency coefficients of its DCT (horizontal,
+ *               vertical and both), scaled so that a is the
+ *               average luma. With n = 2 that is exactly the
+ *               Haar transform of the original format, and each
+ *               block size has its own kernel.
+ *
+ **************************************************************/
+
+#ifndef TRANSFORM40_INCLUDED
+#define TRANSFORM40_INCLUDED
+
+#include <stdint.h>
+#include "pixel_structs.h"
+
+/* pixels in the largest block (8x8) */
+#define TRANSFORM40_MAX_PIXELS 64
+
+void transform40_forward(const float *luma, unsigned block_size,
+                                                comp_avg_floats *coeffs);
+void transform40_inverse(const comp_avg_floats *coeffs, unsigned block_size,
+                                                                float *luma);
+
+#endif
@@ -5,6 +5,7 @@
 #include "mem.h"
 #include "uarray.h"
 #include "uarray2.h"
+#include "foreach40.h"
 
 #define T UArray2_T
 
@@ -95,11 +96,14 @@ void UArray2_map_row_major(T array2,
         assert(array2!= NULL);
         int h = array2->height;  /* keeping height and width in registers */
         int w = array2->width;   /* avoids extra memory traffic           */
+        int size = array2->size;
+        if (w == 0)
+                return;
         for (int j = 0; j < h; j++) {
                 /* don't want row/UArray_at in inner loop */
-                UArray_T thisrow = row(array2, j); 
+                char *thisrow = UArray_at(row(array2, j), 0);
                 for (int i = 0; i < w; i++)
-                        apply(i, j, array2, UArray_at(thisrow, i), cl);
+                        apply(i, j, array2, thisrow + (size_t) i * size, cl);
         }
 }
 #line 211 "www/solutions/uarray2.nw"
@@ -114,4 +118,20 @@ void UArray2_map_col_major(T array2,
         for (int i = 0; i < w; i++)
                 for (int j = 0; j < h; j++)
                         apply(i, j, array2, UArray_at(row(array2, j), i), cl);
-}
\ No newline at end of file
+}
+
+/*
+ * Name: UArray2_row
+ * Purpose: get the elements of one row of a UArray2, for foreach40.h
+ * Parameters: the UArray2, the row
+ * Returns: a pointer to the element in column 0 of the row; the width
+ *          elements of the row follow it contiguously
+ * Notes: the row must be in bounds and the width must not be 0. Rows are
+ *        allocated one by one, so the next row is not after the last
+ *        element of this one
+ */
+void *UArray2_row(T array2, int j)
+{
+        assert(array2 != NULL);
+        return UArray_at(row(array2, j), 0);
+}
@@ -12,9 +12,11 @@
  *
  **************************************************************/
 #include <stdlib.h>
+#include <stdint.h>
 #include <math.h>
 #include "uarray2b.h"
 #include "uarray2.h"
+#include "foreach40.h"
 #include "uarray.h"
 #include "assert.h"
 #include "mem.h"
@@ -271,6 +273,21 @@ extern void UArray2b_map(T array2b, void apply(int col, int row, T array2b,
         }
 }
 
+/*
+ * Name: UArray2b_block
+ * Purpose: get the elements of one block of a UArray2b, for foreach40.h
+ * Parameters: UArray2b, column and row of the block (in blocks)
+ * Returns: a pointer to the block's top left element; the blocksize *
+ *          blocksize elements of the block follow it contiguously, a row of
+ *          the block at a time
+ * Notes: array2b must not be NULL and the block must be in bounds
+ */
+extern void *UArray2b_block(T array2b, int block_col, int block_row) {
+        assert(array2b != NULL);
+        UArray_T *uarray = UArray2_at(array2b->blocks, block_col, block_row);
+        return UArray_at(*uarray, 0);
+}
+
 /*
  * Name: traverse_block
  * Purpose: go through each element in the current uarray and call the apply
@@ -280,24 +297,34 @@ extern void UArray2b_map(T array2b, void apply(int col, int row, T array2b,
  * Returns: nothing, but applies the user defined apply function to each element
  *          within a block and traverses the entirety of the block
  * Notes: some blocks may have indices which are undefined but we avoid calling
- *        apply on these garbage value slots
+ *        apply on these garbage value slots, by only walking the rows and
+ *        columns of the block that are inside array2b
  */
 void traverse_block(int block_col, int block_row, T array2b, 
 void apply(int col, int row, T array2b, void *elem, void *cl), void *cl) {
-        int blocksize = UArray2b_blocksize(array2b);
-        UArray_T *curr_uarray = UArray2_at(array2b->blocks, block_col,
-                                                                block_row);
-        /* go through current block element by element and call apply func */
-        for (int i = 0; i < UArray_length(*curr_uarray); i++) {
-                /* Row and col of element in within a block in array2b */
-                int col = block_col * blocksize + i % blocksize;
-                int row = block_row * blocksize + i / blocksize;
-                
-                /* Make sure we're accessing a valid index of the array2b */
-                if (row < array2b->height && col < array2b->width) {
-                        apply(col, row, array2b, 
-                                UArray_at(*curr_uarray, i), cl);
-                }    
+        int blocksize = array2b->blocksize;
+        int size = array2b->size;
+        char *block = UArray2b_block(array2b, block_col, block_row);
+
+        /*
+         * First row and col of the block. The last block can reach past
+         * INT_MAX when the width or height is close to it, so how much of
+         * it is inside array2b is worked out in 64 bits
+         */
+        int64_t top = (int64_t) block_row * blocksize;
+        int64_t left = (int64_t) block_col * blocksize;
+        int rows = array2b->height - top < blocksize ?
+                                array2b->height - top : blocksize;
+        int cols = array2b->width - left < blocksize ?
+                                array2b->width - left : blocksize;
+
+        /* go through the block element by element and call apply func */
+        for (int j = 0; j < rows; j++) {
+                char *span = block + (size_t) j * blocksize * size;
+                for (int i = 0; i < cols; i++) {
+                        apply(left + i, top + j, array2b,
+                                span + (size_t) i * size, cl);
+                }
         }
 }
 